@@ -0,0 +1,378 @@
+#include "emu/i8086.h"
+#include "emu/i8086_jit.h"
+#include "emu/ibm5160.h"
+#include "emu/vga_palette.h"
+#include "gui/machine_runner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/*
+ * Runs small synthetic guest programs headless and reports how fast the
+ * CPU gets through them, to catch regressions per kind of workload.
+ * Each program is an endless loop loaded at 1000:0100 with DS and ES at
+ * 2000 filled with a pattern, SS:SP at 3000:FFFE and INT 60h pointing
+ * to handler_ip. They're run through the machine runner like the GUI
+ * does, so the PIT interrupt and the other devices are part of the cost.
+ *
+ * With --palette it times the VGA palette conversion kernels on a mode
+ * 13h frame instead.
+ */
+
+#define BENCH_CODE_SEG  0x1000
+#define BENCH_DATA_SEG  0x2000
+#define BENCH_STACK_SEG 0x3000
+
+#define BENCH_DEFAULT_INSTRUCTIONS 20000000
+#define BENCH_DEFAULT_REPEAT       3
+
+#define BENCH_PALETTE_FRAMES 2000
+#define BENCH_PALETTE_PIXELS (320 * 200)
+
+static const byte bench_alu[] = {
+	0xb8, 0x34, 0x12,               // 0100: mov ax,0x1234
+	0xbb, 0x78, 0x56,               // 0103: mov bx,0x5678
+	0x31, 0xc9,                     // 0106: xor cx,cx
+	0x01, 0xd8,                     // 0108: add ax,bx
+	0x83, 0xd2, 0x03,               // 010a: adc dx,0x3
+	0x29, 0xcb,                     // 010d: sub bx,cx
+	0x31, 0xc6,                     // 010f: xor si,ax
+	0x81, 0xe7, 0xff, 0x7f,         // 0111: and di,0x7fff
+	0x09, 0xf7,                     // 0115: or di,si
+	0xd1, 0xe0,                     // 0117: shl ax,1
+	0xd1, 0xdb,                     // 0119: rcr bx,1
+	0x41,                           // 011b: inc cx
+	0x4d,                           // 011c: dec bp
+	0xf7, 0xda,                     // 011d: neg dx
+	0xf7, 0xd6,                     // 011f: not si
+	0x39, 0xc3,                     // 0121: cmp bx,ax
+	0xeb, 0xe3,                     // 0123: jmp 108
+};
+
+static const byte bench_modrm[] = {
+	0x31, 0xdb,                     // 0100: xor bx,bx
+	0x31, 0xf6,                     // 0102: xor si,si
+	0x31, 0xff,                     // 0104: xor di,di
+	0xbd, 0x00, 0x01,               // 0106: mov bp,0x100
+	0x8b, 0x00,                     // 0109: mov ax,word [bx+si]
+	0x01, 0x41, 0x10,               // 010b: add word [bx+di+0x10],ax
+	0x8b, 0x52, 0x20,               // 010e: mov dx,word [bp+si+0x20]
+	0x31, 0x16, 0x34, 0x12,         // 0111: xor word ds:0x1234,dx
+	0x89, 0x04,                     // 0115: mov word [si],ax
+	0x13, 0x4f, 0x40,               // 0117: adc cx,word [bx+0x40]
+	0x89, 0x8d, 0x00, 0x20,         // 011a: mov word [di+0x2000],cx
+	0x83, 0xc6, 0x02,               // 011e: add si,0x2
+	0x81, 0xe6, 0xfe, 0x3f,         // 0121: and si,0x3ffe
+	0x43,                           // 0125: inc bx
+	0x81, 0xe3, 0xff, 0x00,         // 0126: and bx,0xff
+	0x83, 0xc7, 0x06,               // 012a: add di,0x6
+	0x81, 0xe7, 0xfe, 0x1f,         // 012d: and di,0x1ffe
+	0xeb, 0xd6,                     // 0131: jmp 109
+};
+
+static const byte bench_string[] = {
+	0xfc,                           // 0100: cld
+	0x31, 0xf6,                     // 0101: xor si,si
+	0xbf, 0x00, 0x80,               // 0103: mov di,0x8000
+	0xb9, 0x00, 0x01,               // 0106: mov cx,0x100
+	0xf3, 0xa5,                     // 0109: rep movs word es:[di],word ds:[si]
+	0x31, 0xff,                     // 010b: xor di,di
+	0xb0, 0x55,                     // 010d: mov al,0x55
+	0xb9, 0x00, 0x01,               // 010f: mov cx,0x100
+	0xf3, 0xaa,                     // 0112: rep stos byte es:[di],al
+	0x31, 0xf6,                     // 0114: xor si,si
+	0xbf, 0x00, 0x40,               // 0116: mov di,0x4000
+	0xb9, 0x40, 0x00,               // 0119: mov cx,0x40
+	0xf3, 0xa6,                     // 011c: repz cmps byte ds:[si],byte es:[di]
+	0x31, 0xf6,                     // 011e: xor si,si
+	0xbf, 0x00, 0x60,               // 0120: mov di,0x6000
+	0xb9, 0x20, 0x00,               // 0123: mov cx,0x20
+	0xad,                           // 0126: lods ax,word ds:[si]
+	0xab,                           // 0127: stos word es:[di],ax
+	0xe2, 0xfc,                     // 0128: loop 126
+	0xeb, 0xd5,                     // 012a: jmp 101
+};
+
+static const byte bench_call[] = {
+	0xeb, 0x07,                     // 0100: jmp 109
+	// INT 60h handler
+	0x42,                           // 0102: inc dx
+	0xcf,                           // 0103: iret
+	// Far function
+	0x40,                           // 0104: inc ax
+	0xcb,                           // 0105: retf
+	// Near function
+	0x53,                           // 0106: push bx
+	0x5b,                           // 0107: pop bx
+	0xc3,                           // 0108: ret
+	// Loop
+	0x9a, 0x04, 0x01, 0x00, 0x10,   // 0109: call 0x1000:0x104
+	0xcd, 0x60,                     // 010e: int 0x60
+	0xe8, 0xf3, 0xff,               // 0110: call 106
+	0x9c,                           // 0113: pushf
+	0x9d,                           // 0114: popf
+	0xeb, 0xf2,                     // 0115: jmp 109
+};
+
+static const byte bench_io[] = {
+	0x31, 0xc9,                     // 0100: xor cx,cx
+	0xba, 0xc8, 0x03,               // 0102: mov dx,0x3c8
+	0x88, 0xc8,                     // 0105: mov al,cl
+	0xee,                           // 0107: out dx,al
+	0x42,                           // 0108: inc dx
+	0xee,                           // 0109: out dx,al
+	0xee,                           // 010a: out dx,al
+	0xee,                           // 010b: out dx,al
+	0xe4, 0x40,                     // 010c: in al,0x40
+	0xba, 0xc7, 0x03,               // 010e: mov dx,0x3c7
+	0xee,                           // 0111: out dx,al
+	0xba, 0xc9, 0x03,               // 0112: mov dx,0x3c9
+	0xec,                           // 0115: in al,dx
+	0x41,                           // 0116: inc cx
+	0xeb, 0xe9,                     // 0117: jmp 102
+};
+
+static const byte bench_branch[] = {
+	0x31, 0xc0,                     // 0100: xor ax,ax
+	0x31, 0xdb,                     // 0102: xor bx,bx
+	0xb9, 0x64, 0x00,               // 0104: mov cx,0x64
+	0x40,                           // 0107: inc ax
+	0xa8, 0x01,                     // 0108: test al,0x1
+	0x74, 0x03,                     // 010a: je 10f
+	0x83, 0xc3, 0x03,               // 010c: add bx,0x3
+	0x81, 0xfb, 0x00, 0x80,         // 010f: cmp bx,0x8000
+	0x72, 0x04,                     // 0113: jb 119
+	0x81, 0xeb, 0x00, 0x70,         // 0115: sub bx,0x7000
+	0xa8, 0x04,                     // 0119: test al,0x4
+	0x75, 0x02,                     // 011b: jne 11f
+	0x31, 0xda,                     // 011d: xor dx,bx
+	0x39, 0xd0,                     // 011f: cmp ax,dx
+	0x7f, 0x02,                     // 0121: jg 125
+	0x7c, 0x01,                     // 0123: jl 126
+	0x46,                           // 0125: inc si
+	0xf6, 0xc3, 0x10,               // 0126: test bl,0x10
+	0x7b, 0x01,                     // 0129: jnp 12c
+	0x4e,                           // 012b: dec si
+	0xe2, 0xd9,                     // 012c: loop 107
+	0xb9, 0x64, 0x00,               // 012e: mov cx,0x64
+	0xe3, 0xd4,                     // 0131: jcxz 107
+	0xeb, 0xd2,                     // 0133: jmp 107
+};
+
+struct bench_workload_t {
+	const char *name;
+	const char *description;
+	const byte *code;
+	size_t      size;
+	uint16_t    handler_ip;
+};
+
+static const bench_workload_t workloads[] = {
+	{ "alu",     "Register ALU ops, shifts and a jump", bench_alu, sizeof(bench_alu), 0 },
+	{ "modrm",   "Loads and read-modify-writes through ModRM addressing modes", bench_modrm, sizeof(bench_modrm), 0 },
+	{ "string",  "REP MOVSW/STOSB/CMPSB and a LODSW/STOSW loop", bench_string, sizeof(bench_string), 0 },
+	{ "call",    "Far and near calls, INT/IRET and PUSHF/POPF", bench_call, sizeof(bench_call), 0x0102 },
+	{ "io",      "VGA DAC and PIT port reads and writes", bench_io, sizeof(bench_io), 0 },
+	{ "branch",  "Taken and not taken Jcc, LOOP and JCXZ", bench_branch, sizeof(bench_branch), 0 },
+};
+
+struct bench_result_t {
+	uint64_t instructions;
+	uint64_t cycles;
+	double   seconds;
+};
+
+static bench_result_t run_workload(const bench_workload_t &w, bool use_jit, uint64_t instructions) {
+	ibm5160_t *machine = new ibm5160_t;
+	i8086_t   *cpu = (i8086_t *)machine->cpu;
+	cpu->jit->enabled = use_jit;
+
+	memcpy(&machine->memory[BENCH_CODE_SEG * 16 + 0x100], w.code, w.size);
+	for (uint32_t i = 0; i != 0x10000; ++i) {
+		machine->memory[BENCH_DATA_SEG * 16 + i] = byte(i * 7 + (i >> 8));
+	}
+	if (w.handler_ip) {
+		writele16(&machine->memory[4 * 0x60 + 0], w.handler_ip);
+		writele16(&machine->memory[4 * 0x60 + 2], BENCH_CODE_SEG);
+	}
+	machine->memory_written(0, MEM_ADDR_SIZE);
+
+	cpu->cs = BENCH_CODE_SEG;
+	cpu->ip = 0x100;
+	cpu->ds = BENCH_DATA_SEG;
+	cpu->es = BENCH_DATA_SEG;
+	cpu->ss = BENCH_STACK_SEG;
+	cpu->sp = 0xfffe;
+
+	machine_runner_t *machine_runner = new machine_runner_t(machine);
+	machine_runner->set_throttle(false);
+
+	uint64_t start_instr_count = cpu->get_instr_count();
+	uint64_t start_cycles = cpu->get_cycles();
+	auto     start = std::chrono::steady_clock::now();
+
+	while (cpu->get_instr_count() - start_instr_count < instructions) {
+		machine_runner->run_until_next_event();
+	}
+
+	bench_result_t r;
+	r.seconds      = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	r.instructions = cpu->get_instr_count() - start_instr_count;
+	r.cycles       = cpu->get_cycles() - start_cycles;
+
+	delete machine_runner;
+	delete machine;
+	return r;
+}
+
+// How read_rgba() converted pixels before the palette was cached, for comparison.
+static void indexed_to_rgba_dac(byte *p, const byte *src, size_t count, const byte *dac_ram) {
+	for (size_t i = 0; i != count; ++i) {
+		byte c = src[i];
+		byte r = dac_ram[3*c+0];
+		byte g = dac_ram[3*c+1];
+		byte b = dac_ram[3*c+2];
+		p[4 * i + 0] = (r << 2) | (r >> 4);
+		p[4 * i + 1] = (g << 2) | (g >> 4);
+		p[4 * i + 2] = (b << 2) | (b >> 4);
+		p[4 * i + 3] = 255;
+	}
+}
+
+static void run_palette_bench(bool json, int repeat) {
+	std::vector<byte> pixels(BENCH_PALETTE_PIXELS);
+	std::vector<byte> expected(4 * BENCH_PALETTE_PIXELS);
+	std::vector<byte> rgba(4 * BENCH_PALETTE_PIXELS);
+	byte              dac_ram[0x300];
+	uint32_t          palette[256];
+
+	for (size_t i = 0; i != pixels.size(); ++i) {
+		pixels[i] = byte(i * 37 + (i >> 7));
+	}
+	for (int i = 0; i != 0x300; ++i) {
+		dac_ram[i] = byte(i * 5) & 0b111111;
+	}
+	for (int c = 0; c != 256; ++c) {
+		palette[c] = vga_dac_to_rgba(&dac_ram[3 * c]);
+	}
+	indexed_to_rgba_dac(expected.data(), pixels.data(), pixels.size(), dac_ram);
+
+	if (!json) {
+		printf("%-8s %14s %14s %10s\n", "kernel", "frames", "ns/frame", "Mpixels/s");
+	}
+
+	// The first row is the uncached conversion, then each kernel the host runs.
+	for (int k = -1; k != VGA_KERNEL_COUNT; ++k) {
+		vga_kernel_t kernel = vga_kernel_t(k);
+		if (k >= 0 && !vga_kernel_supported(kernel)) {
+			continue;
+		}
+
+		double best = 0;
+		for (int i = 0; i != repeat; ++i) {
+			auto start = std::chrono::steady_clock::now();
+			for (int frame = 0; frame != BENCH_PALETTE_FRAMES; ++frame) {
+				if (k < 0) {
+					indexed_to_rgba_dac(rgba.data(), pixels.data(), pixels.size(), dac_ram);
+				} else {
+					vga_indexed_to_rgba(kernel, rgba.data(), pixels.data(), pixels.size(), palette);
+				}
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (i == 0 || seconds < best) {
+				best = seconds;
+			}
+		}
+
+		const char *name = k < 0 ? "dac" : vga_kernel_name(kernel);
+		if (rgba != expected) {
+			printf("%s: output differs from the DAC conversion\n", name);
+		}
+
+		double ns_per_frame = best / BENCH_PALETTE_FRAMES * 1e9;
+		double mpixels      = BENCH_PALETTE_PIXELS / ns_per_frame * 1e3;
+		if (json) {
+			printf("{\"kernel\":\"%s\",\"frames\":%d,\"ns_per_frame\":%.0f,\"mpixels_per_second\":%.1f}\n",
+				name, BENCH_PALETTE_FRAMES, ns_per_frame, mpixels);
+		} else {
+			printf("%-8s %14d %14.0f %10.1f\n", name, BENCH_PALETTE_FRAMES, ns_per_frame, mpixels);
+		}
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char **argv) {
+	bool     use_jit = false;
+	bool     json = false;
+	bool     palette = false;
+	uint64_t instructions = BENCH_DEFAULT_INSTRUCTIONS;
+	int      repeat = BENCH_DEFAULT_REPEAT;
+
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "--jit")) {
+			use_jit = true;
+		} else if (!strcmp(argv[arg], "--json")) {
+			json = true;
+		} else if (!strcmp(argv[arg], "--palette")) {
+			palette = true;
+		} else if (!strcmp(argv[arg], "--instructions") && arg + 1 < argc) {
+			instructions = strtoull(argv[++arg], nullptr, 0);
+		} else if (!strcmp(argv[arg], "--repeat") && arg + 1 < argc) {
+			repeat = std::max(1, atoi(argv[++arg]));
+		} else {
+			printf("Usage: %s [--jit] [--json] [--instructions N] [--repeat N] [workload...]\n", argv[0]);
+			printf("       %s [--json] [--repeat N] --palette\n\n", argv[0]);
+			for (const auto &w : workloads) {
+				printf("  %-8s %s\n", w.name, w.description);
+			}
+			exit(1);
+		}
+	}
+
+	if (palette) {
+		run_palette_bench(json, repeat);
+		return 0;
+	}
+
+	if (!json) {
+		printf("%-8s %14s %14s %10s %10s %14s\n", "workload", "instructions", "cycles", "seconds", "MIPS", "cycles/s");
+	}
+
+	for (const auto &w : workloads) {
+		bool selected = arg == argc;
+		for (int i = arg; i < argc; ++i) {
+			selected |= !strcmp(argv[i], w.name);
+		}
+		if (!selected) {
+			continue;
+		}
+
+		// The fastest run is the one least disturbed by the host.
+		bench_result_t best = {};
+		for (int i = 0; i != repeat; ++i) {
+			bench_result_t r = run_workload(w, use_jit, instructions);
+			if (i == 0 || r.instructions / r.seconds > best.instructions / best.seconds) {
+				best = r;
+			}
+		}
+
+		double mips = best.instructions / best.seconds / 1e6;
+		double cps  = best.cycles / best.seconds;
+		if (json) {
+			printf("{\"workload\":\"%s\",\"jit\":%s,\"instructions\":%llu,\"cycles\":%llu,\"seconds\":%.6f,\"mips\":%.3f,\"cycles_per_second\":%.0f}\n",
+				w.name, use_jit ? "true" : "false",
+				(unsigned long long)best.instructions, (unsigned long long)best.cycles, best.seconds, mips, cps);
+		} else {
+			printf("%-8s %14llu %14llu %10.3f %10.2f %14.0f\n",
+				w.name, (unsigned long long)best.instructions, (unsigned long long)best.cycles, best.seconds, mips, cps);
+		}
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -1,7 +1,13 @@
 #include "dos/dos.h"
 #include "emu/i8086.h"
+#include "emu/i8086_hle.h"
+#include "emu/i8086_jit.h"
+#include "emu/i8086_trace.h"
+#include "emu/trace_diff.h"
 #include "emu/i8254_pit.h"
 #include "emu/ibm5160.h"
+#include "emu/input_journal.h"
+#include "emu/time_travel.h"
 #include "emu/vga.h"
 #include "gui/machine_runner.h"
 #include "gui/main_window.h"
@@ -9,19 +15,116 @@
 #include "support/mem_writer.h"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <mutex>
 #include <thread>
 
+// Prints a recorded trace in the log_state() text format.
+static int trace_to_text(const char *path) {
+	i8086_trace_reader_t reader;
+	if (!reader.open(path)) {
+		return -1;
+	}
+
+	trace_record_t r;
+	while (reader.next(r)) {
+		trace_print_log_line(stdout, r);
+	}
+	return 0;
+}
+
+// Compares a reference log with a recorded trace, or with the program run live if trace_path is null.
+static int diff_traces(const char *ref_path, const char *trace_path, ibm5160_t *machine, uint64_t resync_window) {
+	trace_log_reader_t ref;
+	if (!ref.open(ref_path)) {
+		return -1;
+	}
+
+	trace_diff_t diff;
+	diff.resync_window = resync_window;
+
+	bool same;
+	if (trace_path) {
+		i8086_trace_reader_t own;
+		if (!own.open(trace_path)) {
+			return -1;
+		}
+		same = diff.run(ref, own);
+	} else {
+		i8086_live_trace_t own((i8086_t *)machine->cpu);
+		same = diff.run(ref, own);
+	}
+
+	printf("trace_diff: %llu instructions compared, %llu resyncs\n",
+		(unsigned long long)diff.compared, (unsigned long long)diff.resyncs);
+	return same ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
-	if (argc < 2) {
-		printf("Usage: %s file\n", argv[0]);
+	bool use_jit = false;
+	const char *trace_path = nullptr;
+	const char *snapshot_path = nullptr;
+	const char *record_path = nullptr;
+	const char *replay_path = nullptr;
+	size_t      time_travel_budget = 0;
+	const char *diff_ref_path = nullptr;
+	uint64_t    diff_resync_window = 0;
+	hle_mode_t  hle_mode = HLE_MODE_ON;
+
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "--jit")) {
+			use_jit = true;
+		} else if (!strcmp(argv[arg], "--time-travel") && arg + 1 < argc) {
+			time_travel_budget = size_t(strtoull(argv[++arg], nullptr, 0)) << 20;
+		} else if (!strcmp(argv[arg], "--snapshot") && arg + 1 < argc) {
+			snapshot_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--record") && arg + 1 < argc) {
+			record_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--replay") && arg + 1 < argc) {
+			replay_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--trace") && arg + 1 < argc) {
+			trace_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--trace-to-text") && arg + 1 < argc) {
+			return trace_to_text(argv[++arg]);
+		} else if (!strcmp(argv[arg], "--diff-trace") && arg + 2 < argc) {
+			const char *ref = argv[++arg];
+			const char *trace = argv[++arg];
+			return diff_traces(ref, trace, nullptr, diff_resync_window);
+		} else if (!strcmp(argv[arg], "--diff-live") && arg + 1 < argc) {
+			diff_ref_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--diff-resync") && arg + 1 < argc) {
+			diff_resync_window = strtoull(argv[++arg], nullptr, 0);
+		} else if (!strcmp(argv[arg], "--hle") && arg + 1 < argc) {
+			const char *mode = argv[++arg];
+			if (!strcmp(mode, "off")) {
+				hle_mode = HLE_MODE_OFF;
+			} else if (!strcmp(mode, "verify")) {
+				hle_mode = HLE_MODE_VERIFY;
+			} else {
+				hle_mode = HLE_MODE_ON;
+			}
+		} else {
+			break;
+		}
+	}
+
+	if (arg >= argc) {
+		printf("Usage: %s [--jit] [--time-travel MiB] [--snapshot in.snap] [--record out.input | --replay in.input] [--trace out.trace] [--hle on|off|verify] file\n", argv[0]);
+		printf("       %s --trace-to-text in.trace\n", argv[0]);
+		printf("       %s [--diff-resync lines] --diff-trace reference.log in.trace\n", argv[0]);
+		printf("       %s [--diff-resync lines] --diff-live reference.log file\n", argv[0]);
 		exit(1);
 	}
 
 	auto machine = std::make_unique<ibm5160_t>();
+	i8086_t *cpu = (i8086_t *)machine->cpu;
+	cpu->jit->enabled = use_jit;
+	machine->hle->mode = hle_mode;
 
-	const char *filename = argv[1];
+	const char *filename = argv[arg];
 	file_reader_t exe(filename);
 	if (exe.eof()) {
 		printf("Unable to open file '%s'\n", filename);
@@ -29,7 +132,45 @@ int main(int argc, char **argv) {
 	}
 	machine->dos->exec(exe);
 
-	machine_runner_t *machine_runner = new machine_runner_t(&*machine);
+	// Resume a session saved from the same program.
+	if (snapshot_path && !machine->load_snapshot(snapshot_path)) {
+		return -1;
+	}
+
+	if (trace_path && !cpu->trace->open(trace_path)) {
+		return -1;
+	}
+
+	// Runs the CPU alone without the GUI and the other devices.
+	if (diff_ref_path) {
+		return diff_traces(diff_ref_path, nullptr, &*machine, diff_resync_window);
+	}
+
+	// Records from here on, the JIT isn't used while time travel is on.
+	time_travel_t *time_travel = nullptr;
+	if (time_travel_budget) {
+		time_travel = new time_travel_t(&*machine);
+		time_travel->ram_budget = time_travel_budget;
+	}
+
+	// Time travel keeps its own input log.
+	input_journal_t *input_journal = nullptr;
+	if (record_path || replay_path) {
+		if (time_travel || (record_path && replay_path)) {
+			printf("--record, --replay and --time-travel can't be combined\n");
+			return -1;
+		}
+		input_journal = new input_journal_t(&*machine);
+		if (record_path && !input_journal->open_record(record_path)) {
+			return -1;
+		}
+		if (replay_path && !input_journal->open_replay(replay_path)) {
+			return -1;
+		}
+	}
+
+	machine_runner_t *machine_runner = new machine_runner_t(&*machine, time_travel, input_journal);
+	machine_runner->start();
 
 	auto main_window = new main_window_t(machine_runner);
 
@@ -41,5 +182,10 @@ int main(int argc, char **argv) {
 	main_window->uninitialize_imgui();
 	main_window->uninitialize_glfw();
 
+	cpu->trace->close();
+	if (input_journal) {
+		input_journal->close();
+	}
+
 	return 0;
 }
@@ -3,6 +3,7 @@
 #include "dos/dos_environment.h"
 #include "emu/i8086.h"
 #include "emu/ibm5160.h"
+#include "emu/snapshot.h"
 
 #include <cstring>
 
@@ -36,6 +37,106 @@ void dos_t::install() {
 	}
 }
 
+static FILE *reopen_file(const std::filesystem::path &path, bool writable) {
+	// Files created by DOS are reopened without truncating them.
+#ifdef _MSC_VER
+	return _wfopen(path.c_str(), writable ? L"r+b" : L"rb");
+#else
+	return fopen(path.c_str(), writable ? "r+b" : "rb");
+#endif
+}
+
+void dos_t::save_state(snapshot_writer_t &w) {
+	w.put(in_dos);
+	w.put(ctrl_break);
+	w.put(initial_mcb_seg);
+	w.put(allocation_strategy);
+	w.put(mouse_x);
+	w.put(mouse_y);
+	w.put(mouse_buttons);
+	w.put(current_psp);
+	w.put(user_dta_ofs);
+	w.put(user_dta_seg);
+	w.put(user_regs);
+
+	w.put(uint32_t(open_files.size()));
+	for (const auto &file : open_files) {
+		int64_t pos = file.f ? ftell(file.f) : -1;
+		w.put_string(file.path.string());
+		w.put(file.writable);
+		w.put(pos);
+	}
+}
+
+bool dos_t::load_state(snapshot_reader_t &r) {
+	r.get(in_dos);
+	r.get(ctrl_break);
+	r.get(initial_mcb_seg);
+	r.get(allocation_strategy);
+	r.get(mouse_x);
+	r.get(mouse_y);
+	r.get(mouse_buttons);
+	r.get(current_psp);
+	r.get(user_dta_ofs);
+	r.get(user_dta_seg);
+	r.get(user_regs);
+
+	uint32_t count;
+	if (!r.get(count)) {
+		return false;
+	}
+
+	std::vector<open_file_t> files;
+	for (uint32_t i = 0; i != count; ++i) {
+		std::string path;
+		bool        writable;
+		int64_t     pos;
+
+		r.get_string(path);
+		r.get(writable);
+		if (!r.get(pos)) {
+			break;
+		}
+
+		open_file_t file = { nullptr, path, writable };
+		if (pos >= 0) {
+			// Keep the handle if it's still open on the same file.
+			if (i < open_files.size() && open_files[i].f && open_files[i].path == file.path
+			 && open_files[i].writable == writable)
+			{
+				std::swap(file.f, open_files[i].f);
+			} else {
+				file.f = reopen_file(file.path, writable);
+			}
+
+			if (!file.f) {
+				printf("dos: unable to reopen '%s'\n", path.c_str());
+			} else {
+				fseek(file.f, pos, SEEK_SET);
+			}
+		}
+		files.push_back(file);
+	}
+
+	if (!r.good()) {
+		for (auto &file : files) {
+			if (file.f) {
+				fclose(file.f);
+			}
+		}
+		return false;
+	}
+
+	for (auto &file : open_files) {
+		if (file.f) {
+			fclose(file.f);
+		}
+	}
+	open_files = files;
+
+	return true;
+}
+
 bool dos_t::set_in_env(uint16_t env_seg, const char *s) {
 	mcb_t env_mcb(machine, env_seg - 1);
 	assert(env_mcb.has_valid_signature());
@@ -91,7 +192,7 @@ void dos_t::save_user_state() {
 	user_regs.bp    = cpu->bp;
 	user_regs.ds    = cpu->ds;
 	user_regs.es    = cpu->es;
-	user_regs.flags = cpu->flags;
+	user_regs.flags = cpu->get_flags();
 }
 
 void dos_t::restore_user_state() {
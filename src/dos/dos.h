@@ -2,6 +2,7 @@
 #define DOS_DOS_H
 
 #include <cstdio>
+#include <filesystem>
 #include <vector>
 
 #include "dos/dos_alloc.h"
@@ -11,6 +12,8 @@
 class file_reader_t;
 class ibm5160_t;
 class i8086_t;
+class snapshot_reader_t;
+class snapshot_writer_t;
 
 #define return_syscall_ok()       do { syscall_ok();       return; } while(0)
 #define return_syscall_error(err) do { syscall_error(err); return; } while(0)
@@ -23,7 +26,14 @@ public:
 	int in_dos = 0;
 	bool ctrl_break = true;
 
-	std::vector<FILE *> open_files;
+	// The host path and mode are kept to reopen the file when a snapshot is restored.
+	struct open_file_t {
+		FILE                  *f;   // nullptr once closed
+		std::filesystem::path  path;
+		bool                   writable;
+	};
+
+	std::vector<open_file_t> open_files;
 	const int first_fd = 3;
 
 	uint16_t initial_mcb_seg     = 0x0158;
@@ -33,10 +43,10 @@ public:
 	uint16_t mouse_y = 0;
 	uint16_t mouse_buttons = 0;
 
-	uint16_t current_psp;
+	uint16_t current_psp = 0;
 
-	uint16_t user_dta_ofs;
-	uint16_t user_dta_seg;
+	uint16_t user_dta_ofs = 0;
+	uint16_t user_dta_seg = 0;
 
 	struct {
 		uint16_t ax;
@@ -49,7 +59,7 @@ public:
 		uint16_t ds;
 		uint16_t es;
 		uint16_t flags;
-	} user_regs;
+	} user_regs = {};
 
 	enum {
 		error_invalid_function    =  1,
@@ -77,6 +87,10 @@ public:
 
 	void install();
 
+	// Files are reopened at their saved positions, their contents aren't part of the state.
+	void save_state(snapshot_writer_t &w);
+	bool load_state(snapshot_reader_t &r);
+
 	void build_psp(uint16_t psp_segment, uint16_t psp_size_paras);
 	bool exec(file_reader_t &rd);
 
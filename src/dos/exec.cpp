@@ -25,6 +25,8 @@ void dos_t::build_psp(uint16_t psp_segment, uint16_t psp_size_paras) {
 	psp.seek_set(0x80);
 	psp.writebyte(0x00);
 	psp.writebyte(0x0d);
+
+	machine->memory_written(0x10 * psp_segment, 0x10 * psp_size_paras);
 }
 
 bool dos_t::exec(file_reader_t &rd) {
@@ -96,6 +98,7 @@ bool dos_t::exec(file_reader_t &rd) {
 		image_size = image_size - 512 + head.e_cblp;
 	}
 	rd.read(image, image_size);
+	machine->memory_written(0x10 * exe_seg, image_size);
 
 	uint16_t psp_segment = load_seg;
 	build_psp(psp_segment, psp_size_paras);
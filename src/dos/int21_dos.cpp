@@ -442,7 +442,7 @@ void dos_t::int21_3c_create_or_truncate_file() {
 	assert(f);
 
 	int fd = open_files.size() + first_fd;
-	open_files.push_back(f);
+	open_files.push_back({ f, filepath, true });
 
 	user_regs.ax = fd;
 	return_syscall_ok();
@@ -517,7 +517,7 @@ void dos_t::int21_3d_open_file() {
 	printf("Found file '%s'.\n", filepath);
 
 	int fd = open_files.size() + first_fd;
-	open_files.push_back(f);
+	open_files.push_back({ f, path, false });
 
 	user_regs.ax = fd;
 	return_syscall_ok();
@@ -525,11 +525,12 @@ void dos_t::int21_3d_open_file() {
 
 void dos_t::int21_3e_close_file() {
 	log_int(__FUNCTION__);
-	FILE *f = open_files.at(cpu->bx - first_fd);
+	FILE *f = open_files.at(cpu->bx - first_fd).f;
 
 	assert(f);
 
 	int r = fclose(f);
+	open_files.at(cpu->bx - first_fd).f = nullptr;
 	if (r != 0) {
 		return_syscall_error(error_invalid_handle);
 	}
@@ -539,12 +540,13 @@ void dos_t::int21_3e_close_file() {
 
 void dos_t::int21_3f_read_file_or_device() {
 	// log_int(__FUNCTION__);
-	FILE     *f     = open_files.at(cpu->bx - first_fd);
+	FILE     *f     = open_files.at(cpu->bx - first_fd).f;
 	uint16_t  count = cpu->cx;
 	byte     *buf   = machine->memory + (0x10 * cpu->ds + cpu->dx);
 
 	assert(f);
 	size_t r = fread(buf, 1, count, f);
+	machine->memory_written(0x10 * cpu->ds + cpu->dx, r);
 
 	user_regs.ax = r;
 	return_syscall_ok();
@@ -552,7 +554,7 @@ void dos_t::int21_3f_read_file_or_device() {
 
 void dos_t::int21_40_write_file_or_device() {
 	log_int(__FUNCTION__);
-	FILE     *f = open_files.at(cpu->bx - first_fd);
+	FILE     *f = open_files.at(cpu->bx - first_fd).f;
 	uint16_t  count = cpu->cx;
 	byte     *buf   = machine->memory + (0x10 * cpu->ds + cpu->dx);
 
@@ -569,7 +571,7 @@ void dos_t::int21_41_delete_file() {
 
 void dos_t::int21_42_move_file_pointer() {
 	// log_int(__FUNCTION__);
-	FILE *f = open_files.at(cpu->bx - first_fd);
+	FILE *f = open_files.at(cpu->bx - first_fd).f;
 	size_t offset = (((uint32_t)cpu->cx) << 16) + cpu->dx;
 
 	assert(f);
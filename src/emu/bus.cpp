@@ -0,0 +1,151 @@
+#include "emu/bus.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+bus_t::bus_t() {
+	memset(pages, 0, sizeof(pages));
+	memset(io_devices, 0, sizeof(io_devices));
+	memset(io_watch, 0, sizeof(io_watch));
+	memset(dirty, 0, sizeof(dirty));
+}
+
+// Keeps the page's watch flags.
+void bus_t::map_page(uint32_t page, byte *ram, bool ram_writable, device_t *device) {
+	pages[page].ram          = ram;
+	pages[page].ram_writable = ram_writable;
+	pages[page].device       = device;
+	update_page(pages[page]);
+}
+
+// Only unwatched RAM and ROM take the fast path, a read watch takes writes off it too.
+void bus_t::update_page(page_t &page) {
+	page.host     = (page.watch & WATCH_READ) ? nullptr : page.ram;
+	page.writable = page.host && page.ram_writable && !(page.watch & WATCH_WRITE);
+}
+
+void bus_t::map_ram(uint32_t addr, uint32_t len, byte *host) {
+	assert(addr % MEM_PAGE_SIZE == 0 && len % MEM_PAGE_SIZE == 0);
+	assert(addr + len <= MEM_ADDR_SIZE);
+
+	for (uint32_t ofs = 0; ofs != len; ofs += MEM_PAGE_SIZE) {
+		map_page((addr + ofs) / MEM_PAGE_SIZE, host + ofs, true, nullptr);
+	}
+}
+
+void bus_t::map_rom(uint32_t addr, uint32_t len, byte *host) {
+	assert(addr % MEM_PAGE_SIZE == 0 && len % MEM_PAGE_SIZE == 0);
+	assert(addr + len <= MEM_ADDR_SIZE);
+
+	for (uint32_t ofs = 0; ofs != len; ofs += MEM_PAGE_SIZE) {
+		map_page((addr + ofs) / MEM_PAGE_SIZE, host + ofs, false, nullptr);
+	}
+}
+
+void bus_t::map_mmio(uint32_t addr, uint32_t len, device_t *device) {
+	assert(addr % MEM_PAGE_SIZE == 0 && len % MEM_PAGE_SIZE == 0);
+	assert(addr + len <= MEM_ADDR_SIZE);
+
+	for (uint32_t ofs = 0; ofs != len; ofs += MEM_PAGE_SIZE) {
+		map_page((addr + ofs) / MEM_PAGE_SIZE, nullptr, false, device);
+	}
+}
+
+void bus_t::unmap(uint32_t addr, uint32_t len) {
+	map_mmio(addr, len, nullptr);
+}
+
+void bus_t::map_io(uint16_t first, uint16_t last, device_t *device) {
+	assert(first <= last);
+
+	for (uint32_t port = first; port <= last; ++port) {
+		if (io_devices[port]) {
+			printf("bus: port %04x is already mapped\n", port);
+		}
+		io_devices[port] = device;
+	}
+}
+
+void bus_t::set_page_watch(uint32_t page, byte flags) {
+	pages[page].watch = flags & (WATCH_READ | WATCH_WRITE);
+	update_page(pages[page]);
+}
+
+void bus_t::set_io_watch(uint16_t port, byte flags) {
+	io_watch[port] = flags & (WATCH_READ | WATCH_WRITE);
+}
+
+byte bus_t::peek8(uint32_t addr) {
+	addr &= MEM_ADDR_MASK;
+	const page_t &page = pages[addr / MEM_PAGE_SIZE];
+	if (page.ram) {
+		return page.ram[addr % MEM_PAGE_SIZE];
+	}
+	return page.device ? page.device->mmio_read(addr) : 0;
+}
+
+byte *bus_t::host_range(uint32_t addr, uint32_t len, bool write) {
+	addr &= MEM_ADDR_MASK;
+	if (len == 0 || addr + len > MEM_ADDR_SIZE) {
+		return nullptr;
+	}
+
+	uint32_t first_page = addr / MEM_PAGE_SIZE;
+	uint32_t last_page  = (addr + len - 1) / MEM_PAGE_SIZE;
+	byte    *base       = pages[first_page].host;
+
+	for (uint32_t page = first_page; page <= last_page; ++page) {
+		const page_t &p = pages[page];
+		if (!p.host || (write && !p.writable) || p.host != base + (page - first_page) * MEM_PAGE_SIZE) {
+			return nullptr;
+		}
+	}
+
+	return base + addr % MEM_PAGE_SIZE;
+}
+
+void bus_t::mark_dirty(uint32_t addr, uint32_t len) {
+	if (len == 0) {
+		return;
+	}
+
+	uint32_t first_page = (addr & MEM_ADDR_MASK) / MEM_PAGE_SIZE;
+	uint32_t last_page  = ((addr + len - 1) & MEM_ADDR_MASK) / MEM_PAGE_SIZE;
+	for (uint32_t page = first_page; page != last_page; page = (page + 1) % MEM_PAGE_COUNT) {
+		dirty[page] = true;
+	}
+	dirty[last_page] = true;
+}
+
+void bus_t::clear_dirty() {
+	memset(dirty, 0, sizeof(dirty));
+}
+
+// The slow path, for device pages, ROM writes and watched pages.
+byte bus_t::mmio_read8(uint32_t addr) {
+	const page_t &page = pages[addr / MEM_PAGE_SIZE];
+
+	byte v = peek8(addr);
+	if (page.watch & WATCH_READ) {
+		watch_handler(addr, v, WATCH_READ);
+	}
+	return v;
+}
+
+void bus_t::mmio_write8(uint32_t addr, byte v) {
+	const page_t &page = pages[addr / MEM_PAGE_SIZE];
+
+	if (page.watch & WATCH_WRITE) {
+		watch_handler(addr, v, WATCH_WRITE);
+	}
+
+	if (page.ram) {
+		if (page.ram_writable) {
+			page.ram[addr % MEM_PAGE_SIZE] = v;
+			dirty[addr / MEM_PAGE_SIZE] = true;
+		}
+	} else if (page.device) {
+		page.device->mmio_write(addr, v);
+	}
+}
@@ -0,0 +1,182 @@
+#ifndef EMU_BUS_H
+#define EMU_BUS_H
+
+#include "emu/device.h"
+#include "emu/scheduler.h"
+#include "support/types.h"
+
+#include <functional>
+
+// The 8086 addresses 1 MiB of memory and 64 KiB of I/O ports.
+#define MEM_ADDR_SIZE   0x100000
+#define MEM_ADDR_MASK   (MEM_ADDR_SIZE - 1)
+#define MEM_PAGE_SIZE   4096
+#define MEM_PAGE_COUNT  (MEM_ADDR_SIZE / MEM_PAGE_SIZE)
+#define IO_PORT_COUNT   0x10000
+
+// Watch flags, passed to the watch handler with WATCH_IO added for ports.
+#define WATCH_READ   0x01
+#define WATCH_WRITE  0x02
+#define WATCH_IO     0x04
+
+/*
+ * Memory is mapped in 4 KiB pages. RAM and ROM pages point straight at
+ * host memory so accesses inline to a load or store, anything else goes
+ * to the device mapped on the page. I/O ports are dispatched through a
+ * table of devices indexed by port number.
+ *
+ * Watched pages drop out of the fast path, their accesses go the slow
+ * way and are reported to the watch handler. Unwatched pages cost nothing.
+ */
+class bus_t {
+	struct page_t {
+		byte     *host;       // Host memory for the fast path, nullptr when it's not RAM or ROM or watched
+		bool      writable;   // Writes can take the fast path
+		byte     *ram;        // Host memory for RAM and ROM pages, even when watched
+		bool      ram_writable;
+		device_t *device;     // Handler for memory-mapped I/O pages
+		byte      watch;
+	};
+
+	page_t    pages[MEM_PAGE_COUNT];
+	device_t *io_devices[IO_PORT_COUNT];
+	byte      io_watch[IO_PORT_COUNT];
+	bool      dirty[MEM_PAGE_COUNT];   // RAM pages written since clear_dirty()
+
+	void map_page(uint32_t page, byte *ram, bool ram_writable, device_t *device);
+	void update_page(page_t &page);
+
+	byte mmio_read8(uint32_t addr);
+	void mmio_write8(uint32_t addr, byte v);
+
+public:
+	bus_t();
+
+	// Brings devices up to date around their port accesses.
+	scheduler_t *scheduler = nullptr;
+
+	// Called on accesses to watched pages and ports, before writes land.
+	std::function<void(uint32_t addr, byte v, byte flags)> watch_handler;
+
+	// Ranges are given in bytes and must be page aligned.
+	void map_ram(uint32_t addr, uint32_t len, byte *host);
+	void map_rom(uint32_t addr, uint32_t len, byte *host);
+	void map_mmio(uint32_t addr, uint32_t len, device_t *device);
+	void unmap(uint32_t addr, uint32_t len);
+
+	// Ports first to last inclusive.
+	void map_io(uint16_t first, uint16_t last, device_t *device);
+
+	// Replaces the watch flags of a page or port.
+	void set_page_watch(uint32_t page, byte flags);
+	void set_io_watch(uint16_t port, byte flags);
+
+	// Reads memory without triggering watches, for instruction decoding and tools.
+	byte peek8(uint32_t addr);
+
+	// Host memory backing addr, or nullptr if it isn't RAM or ROM.
+	byte *host_ptr(uint32_t addr) {
+		const page_t &page = pages[(addr & MEM_ADDR_MASK) / MEM_PAGE_SIZE];
+		return page.host ? page.host + addr % MEM_PAGE_SIZE : nullptr;
+	}
+
+	// Host memory backing all of [addr, addr + len) if it's contiguous RAM (or ROM when reading).
+	byte *host_range(uint32_t addr, uint32_t len, bool write);
+
+	// Writes through host memory returned above must be marked by hand.
+	void mark_dirty(uint32_t addr, uint32_t len);
+	void clear_dirty();
+
+	bool is_dirty(uint32_t page) {
+		return dirty[page];
+	}
+
+	byte read8(uint32_t addr) {
+		addr &= MEM_ADDR_MASK;
+		const page_t &page = pages[addr / MEM_PAGE_SIZE];
+		if (page.host) {
+			return page.host[addr % MEM_PAGE_SIZE];
+		}
+		return mmio_read8(addr);
+	}
+
+	uint16_t read16(uint32_t addr) {
+		addr &= MEM_ADDR_MASK;
+		const page_t &page = pages[addr / MEM_PAGE_SIZE];
+		if (page.host && addr % MEM_PAGE_SIZE != MEM_PAGE_SIZE - 1) {
+			return readle16(&page.host[addr % MEM_PAGE_SIZE]);
+		}
+		return read8(addr) | (read8(addr + 1) << 8);
+	}
+
+	void write8(uint32_t addr, byte v) {
+		addr &= MEM_ADDR_MASK;
+		const page_t &page = pages[addr / MEM_PAGE_SIZE];
+		if (page.writable) {
+			page.host[addr % MEM_PAGE_SIZE] = v;
+			dirty[addr / MEM_PAGE_SIZE] = true;
+		} else {
+			mmio_write8(addr, v);
+		}
+	}
+
+	void write16(uint32_t addr, uint16_t v) {
+		addr &= MEM_ADDR_MASK;
+		const page_t &page = pages[addr / MEM_PAGE_SIZE];
+		if (page.writable && addr % MEM_PAGE_SIZE != MEM_PAGE_SIZE - 1) {
+			writele16(&page.host[addr % MEM_PAGE_SIZE], v);
+			dirty[addr / MEM_PAGE_SIZE] = true;
+			return;
+		}
+		write8(addr, readlo(v));
+		write8(addr + 1, readhi(v));
+	}
+
+	byte io_read8(uint16_t port) {
+		device_t *device = io_devices[port];
+		byte v = 0;
+		if (device) {
+			if (scheduler) {
+				scheduler->sync(device);
+			}
+			v = device->io_read(port);
+			if (scheduler) {
+				scheduler->reschedule(device);
+			}
+		}
+		if (io_watch[port] & WATCH_READ) {
+			watch_handler(port, v, WATCH_IO | WATCH_READ);
+		}
+		return v;
+	}
+
+	// 16-bit port accesses are split into two byte accesses like on the 8088.
+	uint16_t io_read16(uint16_t port) {
+		byte lo = io_read8(port);
+		byte hi = io_read8(port + 1);
+		return lo | (hi << 8);
+	}
+
+	void io_write8(uint16_t port, byte v) {
+		if (io_watch[port] & WATCH_WRITE) {
+			watch_handler(port, v, WATCH_IO | WATCH_WRITE);
+		}
+		device_t *device = io_devices[port];
+		if (device) {
+			if (scheduler) {
+				scheduler->sync(device);
+			}
+			device->io_write(port, v);
+			if (scheduler) {
+				scheduler->reschedule(device);
+			}
+		}
+	}
+
+	void io_write16(uint16_t port, uint16_t v) {
+		io_write8(port, readlo(v));
+		io_write8(port + 1, readhi(v));
+	}
+};
+
+#endif
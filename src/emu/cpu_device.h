@@ -7,6 +7,9 @@ class cpu_device_t : public device_t {
 public:
 	virtual void raise_nmi()          = 0;
 	virtual void raise_intr(byte num) = 0;
+
+	// Cycles as run_cycles() counts them, the machine's time base.
+	virtual uint64_t get_clock_cycles() = 0;
 };
 
 #endif
@@ -3,20 +3,42 @@
 
 #include "support/types.h"
 
+class bus_t;
 class machine_t;
+class snapshot_reader_t;
+class snapshot_writer_t;
 
 class device_t {
 protected:
 	machine_t *machine;
 
 public:
+	virtual ~device_t() {}
+
 	void set_machine(machine_t *a_machine) {
 		machine = a_machine;
 	}
 
 	virtual double   frequency_in_mhz() = 0;
+
+	// Cycles until the next event something else sees, like an interrupt,
+	// UINT64_MAX if there's none. The scheduler brings devices up to date
+	// before their ports are accessed, run_cycles() must catch up in one
+	// call rather than cycle by cycle.
 	virtual uint64_t next_cycles() = 0;
 	virtual uint64_t run_cycles(uint64_t cycles) = 0;
+
+	// Register the device's I/O ports and memory-mapped ranges.
+	virtual void map(bus_t *bus) { (void)bus; }
+
+	virtual byte io_read(uint16_t port)             { (void)port; return 0; }
+	virtual void io_write(uint16_t port, byte v)    { (void)port; (void)v; }
+	virtual byte mmio_read(uint32_t addr)           { (void)addr; return 0; }
+	virtual void mmio_write(uint32_t addr, byte v)  { (void)addr; (void)v; }
+
+	// Save and restore the device's state in snapshots, load_state() returns false on a short read.
+	virtual void save_state(snapshot_writer_t &w) = 0;
+	virtual bool load_state(snapshot_reader_t &r) = 0;
 };
 
 #endif
@@ -1,9 +1,19 @@
 #include "i8086.h"
 
 #include "ibm5160.h"
+#include "emu/bus.h"
+#include "i8086_block_cache.h"
+#include "i8086_breakpoints.h"
+#include "i8086_func_profiler.h"
+#include "i8086_hle.h"
+#include "i8086_jit.h"
+#include "i8086_profiler.h"
+#include "i8086_trace.h"
+#include "emu/snapshot.h"
 #include "disasm/disasm_i8086.h"
 #include "disasm/names.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cstdio>
@@ -12,40 +22,42 @@
 #include <utility>
 #include <vector>
 
-struct call_stack_entry_t {
-	i8086_addr_t from;
-	i8086_addr_t to;
-	bool         is_int;
-};
-
-std::vector<call_stack_entry_t> call_stack;
-
-void dump_call_stack() {
-	printf("Callstack:\n");
-	for (size_t i = 0; i < call_stack.size(); i++) {
-		printf("\t%3zu: %04x:%04x -> %04x:%04x%s\n", i,
-			call_stack[i].from.seg, call_stack[i].from.ofs,
-			call_stack[i].to.seg, call_stack[i].to.ofs,
-			call_stack[i].is_int ? " - interrupt" : ""
-		);
-	}
-	printf("\n");
-}
-
 i8086_t::i8086_t() {
+	block_cache = new i8086_block_cache_t(this);
+	jit = new i8086_jit_t(this);
+	trace = new i8086_trace_t(this);
+	breakpoints = new i8086_breakpoints_t(this);
+	profiler = new i8086_profiler_t(this);
+	func_profiler = new i8086_func_profiler_t(this);
 	reset();
 }
 
+i8086_t::~i8086_t() {
+	delete func_profiler;
+	delete profiler;
+	delete breakpoints;
+	delete trace;
+	delete jit;
+	delete block_cache;
+}
+
 void i8086_t::reset() {
 	is_prefix = false;
 	sreg_ovr = 0;
 	repmode = REP_NONE;
+	rep_resume = false;
 
 	int_delay = false;
 	int_nmi = false;
 	int_intr = false;
+	int_number = 0;
+
+	log_cs = 0;
+	log_ip = 0;
 
-	flags = 0x0002;
+	call_stack.clear();
+
+	load_flags(0x0002);
 
 	ip = 0xfff0;
 	cs = 0xf000;
@@ -70,12 +82,93 @@ uint64_t i8086_t::next_cycles() {
 
 uint64_t i8086_t::run_cycles(uint64_t cycles) {
 	uint64_t actual_cycles = 0;
-	while (actual_cycles < cycles) {
-		actual_cycles += step();
+	if (jit->enabled && block_cache->enabled && !trace->is_open() && !breakpoints->active() && !profiler->enabled) {
+		while (actual_cycles < cycles) {
+			actual_cycles += run_block();
+		}
+	} else {
+		// Stops early when a breakpoint or watchpoint hits.
+		while (actual_cycles < cycles && !breakpoints->stop) {
+			if (breakpoints->check(cs, ip)) {
+				break;
+			}
+			actual_cycles += step();
+		}
 	}
 	return actual_cycles;
 }
 
+void i8086_t::save_state(snapshot_writer_t &w) {
+	w.put(instr_count);
+	w.put(cycles);
+	w.put(clock_cycles);
+
+	w.put(ip);
+	w.put(es);
+	w.put(cs);
+	w.put(ss);
+	w.put(ds);
+	w.put(ax);
+	w.put(cx);
+	w.put(dx);
+	w.put(bx);
+	w.put(sp);
+	w.put(bp);
+	w.put(di);
+	w.put(si);
+	w.put(get_flags());
+
+	w.put(int_delay);
+	w.put(int_nmi);
+	w.put(int_intr);
+	w.put(int_number);
+	w.put(rep_resume);
+
+	w.put(log_cs);
+	w.put(log_ip);
+}
+
+bool i8086_t::load_state(snapshot_reader_t &r) {
+	uint16_t new_flags;
+
+	r.get(instr_count);
+	r.get(cycles);
+	r.get(clock_cycles);
+
+	r.get(ip);
+	r.get(es);
+	r.get(cs);
+	r.get(ss);
+	r.get(ds);
+	r.get(ax);
+	r.get(cx);
+	r.get(dx);
+	r.get(bx);
+	r.get(sp);
+	r.get(bp);
+	r.get(di);
+	r.get(si);
+	r.get(new_flags);
+	load_flags(new_flags);
+
+	r.get(int_delay);
+	r.get(int_nmi);
+	r.get(int_intr);
+	r.get(int_number);
+	r.get(rep_resume);
+
+	r.get(log_cs);
+	r.get(log_ip);
+
+	// The blocks run last may no longer be what's in memory, and frames don't carry over.
+	block = nullptr;
+	block_index = 0;
+	jit_prev = nullptr;
+	call_stack.clear();
+
+	return r.good();
+}
+
 void i8086_t::dump_state() {
 	printf("\n\t");
 	printf("ax=%04x\t", ax);
@@ -111,27 +204,27 @@ void i8086_t::dump_state() {
 	printf("\n");
 }
 
-void i8086_t::log_state() {
-	printf("%10d: ", instr_count);
-	printf("%04X:%04X  ", log_cs, log_ip);
-	printf(" EAX:%08X", ax);
-	printf(" EBX:%08X", bx);
-	printf(" ECX:%08X", cx);
-	printf(" EDX:%08X", dx);
-	printf(" ESI:%08X", si);
-	printf(" EDI:%08X", di);
-	printf(" EBP:%08X", bp);
-	printf(" ESP:%08X", sp);
-	printf(" DS:%04X", ds);
-	printf(" ES:%04X", es);
-	printf(" SS:%04X", ss);
-	printf(" C%d", get_cf());
-	printf(" Z%d", get_zf());
-	printf(" S%d", get_sf());
-	printf(" O%d", get_of());
-	printf(" I%d", get_if());
-	printf(" F%04X", get_log_flags());
-	printf("\n");
+void i8086_t::log_state(uint16_t at_cs, uint16_t at_ip) {
+	trace_record_t r = {};
+	uint16_t *v = r.field;
+
+	r.instr_count  = instr_count;
+	v[TRACE_CS]    = at_cs;
+	v[TRACE_IP]    = at_ip;
+	v[TRACE_AX]    = ax;
+	v[TRACE_BX]    = bx;
+	v[TRACE_CX]    = cx;
+	v[TRACE_DX]    = dx;
+	v[TRACE_SI]    = si;
+	v[TRACE_DI]    = di;
+	v[TRACE_BP]    = bp;
+	v[TRACE_SP]    = sp;
+	v[TRACE_DS]    = ds;
+	v[TRACE_ES]    = es;
+	v[TRACE_SS]    = ss;
+	v[TRACE_FLAGS] = get_flags();
+
+	trace_print_log_line(stdout, r);
 }
 
 void i8086_t::set_callback_base(uint16_t callback_base_seg) {
@@ -174,13 +267,16 @@ uint32_t i8086_t::step() {
 	}
 
 	if (!int_delay) {
+		// An interrupted REP instruction pays for its setup again when it resumes.
 		if (int_nmi) {
 			int_nmi = false;
+			rep_resume = false;
 			call_int(2);
 			return cycles;
 		}
 		if (int_intr) {
 			int_intr = false;
+			rep_resume = false;
 			call_int(int_number);
 			return cycles;
 		}
@@ -188,281 +284,429 @@ uint32_t i8086_t::step() {
 	int_delay = false;
 
 	op_ip = ip;
+	insn = next_insn();
+
+	// After the lookup, decoding a block can bind a hook to it. A verified
+	// hook takes as long as the guest routine did.
+	uint64_t hle_start = clock_cycles;
+	if (hle && hle->check(cs, ip)) {
+		insn = nullptr;
+		return clock_cycles - hle_start;
+	}
+
+	if (trace->is_open() && cs < 0xf000) {
+		trace->record();
+	}
+
+	insn_pos = 0;
+	uint16_t op_cs = cs;
+	uint64_t op_cycles = this->cycles;
 	do {
 		op = fetch8();
 		is_prefix = false;
 		cycles += dispatch();
 	} while (is_prefix);
+	insn = nullptr;
+
+	if (profiler->enabled) {
+		profiler->record(0x10 * op_cs + op_ip, op_cs, this->cycles - op_cycles);
+	}
+
+#if LAZY_FLAGS_CHECK
+	check_lazy_flags();
+#endif
 
 	if (cs < 0xf000) {
 		instr_count++;
 	}
 
+	clock_cycles += cycles;
 	return cycles;
 }
 
-uint32_t i8086_t::dispatch() {
-#define OPCODE(x, func) case x: op_##func(); break
-
-	switch (op) {
-		OPCODE(0x00, alu_r_rm);
-		OPCODE(0x01, alu_r_rm);
-		OPCODE(0x02, alu_r_rm);
-		OPCODE(0x03, alu_r_rm);
-		OPCODE(0x04, alu_a_imm);
-		OPCODE(0x05, alu_a_imm);
-		OPCODE(0x06, push_sreg);
-		OPCODE(0x07, pop_sreg);
-		OPCODE(0x08, alu_r_rm);
-		OPCODE(0x09, alu_r_rm);
-		OPCODE(0x0a, alu_r_rm);
-		OPCODE(0x0b, alu_r_rm);
-		OPCODE(0x0c, alu_a_imm);
-		OPCODE(0x0d, alu_a_imm);
-		OPCODE(0x0e, push_sreg);
-		OPCODE(0x0f, pop_sreg);
-		OPCODE(0x10, alu_r_rm);
-		OPCODE(0x11, alu_r_rm);
-		OPCODE(0x12, alu_r_rm);
-		OPCODE(0x13, alu_r_rm);
-		OPCODE(0x14, alu_a_imm);
-		OPCODE(0x15, alu_a_imm);
-		OPCODE(0x16, push_sreg);
-		OPCODE(0x17, pop_sreg);
-		OPCODE(0x18, alu_r_rm);
-		OPCODE(0x19, alu_r_rm);
-		OPCODE(0x1a, alu_r_rm);
-		OPCODE(0x1b, alu_r_rm);
-		OPCODE(0x1c, alu_a_imm);
-		OPCODE(0x1d, alu_a_imm);
-		OPCODE(0x1e, push_sreg);
-		OPCODE(0x1f, pop_sreg);
-		OPCODE(0x20, alu_r_rm);
-		OPCODE(0x21, alu_r_rm);
-		OPCODE(0x22, alu_r_rm);
-		OPCODE(0x23, alu_r_rm);
-		OPCODE(0x24, alu_a_imm);
-		OPCODE(0x25, alu_a_imm);
-		OPCODE(0x26, seg_ovr_es);
-		OPCODE(0x27, daa);
-		OPCODE(0x28, alu_r_rm);
-		OPCODE(0x29, alu_r_rm);
-		OPCODE(0x2a, alu_r_rm);
-		OPCODE(0x2b, alu_r_rm);
-		OPCODE(0x2c, alu_a_imm);
-		OPCODE(0x2d, alu_a_imm);
-		OPCODE(0x2e, seg_ovr_cs);
-		OPCODE(0x2f, das);
-		OPCODE(0x30, alu_r_rm);
-		OPCODE(0x31, alu_r_rm);
-		OPCODE(0x32, alu_r_rm);
-		OPCODE(0x33, alu_r_rm);
-		OPCODE(0x34, alu_a_imm);
-		OPCODE(0x35, alu_a_imm);
-		OPCODE(0x36, seg_ovr_ss);
-		OPCODE(0x37, aaa);
-		OPCODE(0x38, alu_r_rm);
-		OPCODE(0x39, alu_r_rm);
-		OPCODE(0x3a, alu_r_rm);
-		OPCODE(0x3b, alu_r_rm);
-		OPCODE(0x3c, alu_a_imm);
-		OPCODE(0x3d, alu_a_imm);
-		OPCODE(0x3e, seg_ovr_ds);
-		OPCODE(0x3f, aas);
-		OPCODE(0x40, inc_reg);
-		OPCODE(0x41, inc_reg);
-		OPCODE(0x42, inc_reg);
-		OPCODE(0x43, inc_reg);
-		OPCODE(0x44, inc_reg);
-		OPCODE(0x45, inc_reg);
-		OPCODE(0x46, inc_reg);
-		OPCODE(0x47, inc_reg);
-		OPCODE(0x48, dec_reg);
-		OPCODE(0x49, dec_reg);
-		OPCODE(0x4a, dec_reg);
-		OPCODE(0x4b, dec_reg);
-		OPCODE(0x4c, dec_reg);
-		OPCODE(0x4d, dec_reg);
-		OPCODE(0x4e, dec_reg);
-		OPCODE(0x4f, dec_reg);
-		OPCODE(0x50, push_reg);
-		OPCODE(0x51, push_reg);
-		OPCODE(0x52, push_reg);
-		OPCODE(0x53, push_reg);
-		OPCODE(0x54, push_reg);
-		OPCODE(0x55, push_reg);
-		OPCODE(0x56, push_reg);
-		OPCODE(0x57, push_reg);
-		OPCODE(0x58, pop_reg);
-		OPCODE(0x59, pop_reg);
-		OPCODE(0x5a, pop_reg);
-		OPCODE(0x5b, pop_reg);
-		OPCODE(0x5c, pop_reg);
-		OPCODE(0x5d, pop_reg);
-		OPCODE(0x5e, pop_reg);
-		OPCODE(0x5f, pop_reg);
-		OPCODE(0x60, jcc); // Undocumented alias of 0x70
-		OPCODE(0x61, jcc); // Undocumented alias of 0x71
-		OPCODE(0x62, jcc); // Undocumented alias of 0x72
-		OPCODE(0x63, jcc); // Undocumented alias of 0x73
-		OPCODE(0x64, jcc); // Undocumented alias of 0x74
-		OPCODE(0x65, jcc); // Undocumented alias of 0x75
-		OPCODE(0x66, jcc); // Undocumented alias of 0x76
-		OPCODE(0x67, jcc); // Undocumented alias of 0x77
-		OPCODE(0x68, jcc); // Undocumented alias of 0x78
-		OPCODE(0x69, jcc); // Undocumented alias of 0x79
-		OPCODE(0x6a, jcc); // Undocumented alias of 0x7a
-		OPCODE(0x6b, jcc); // Undocumented alias of 0x7b
-		OPCODE(0x6c, jcc); // Undocumented alias of 0x7c
-		OPCODE(0x6d, jcc); // Undocumented alias of 0x7d
-		OPCODE(0x6e, jcc); // Undocumented alias of 0x7e
-		OPCODE(0x6f, jcc); // Undocumented alias of 0x7f
-		OPCODE(0x70, jcc);
-		OPCODE(0x71, jcc);
-		OPCODE(0x72, jcc);
-		OPCODE(0x73, jcc);
-		OPCODE(0x74, jcc);
-		OPCODE(0x75, jcc);
-		OPCODE(0x76, jcc);
-		OPCODE(0x77, jcc);
-		OPCODE(0x78, jcc);
-		OPCODE(0x79, jcc);
-		OPCODE(0x7a, jcc);
-		OPCODE(0x7b, jcc);
-		OPCODE(0x7c, jcc);
-		OPCODE(0x7d, jcc);
-		OPCODE(0x7e, jcc);
-		OPCODE(0x7f, jcc);
-		OPCODE(0x80, grp1_rmw_imm);
-		OPCODE(0x81, grp1_rmw_imm);
-		OPCODE(0x82, grp1_rmw_imm);
-		OPCODE(0x83, grp1_rmw_imm);
-		OPCODE(0x84, test_rm_r);
-		OPCODE(0x85, test_rm_r);
-		OPCODE(0x86, xchg_rm_r);
-		OPCODE(0x87, xchg_rm_r);
-		OPCODE(0x88, mov_rm_r);
-		OPCODE(0x89, mov_rm_r);
-		OPCODE(0x8a, mov_rm_r);
-		OPCODE(0x8b, mov_rm_r);
-		OPCODE(0x8c, mov_rm16_sreg);
-		OPCODE(0x8d, lea_r16_m16);
-		OPCODE(0x8e, mov_rm16_sreg);
-		OPCODE(0x8f, pop_rm16);
-		OPCODE(0x90, xchg_ax_r);
-		OPCODE(0x91, xchg_ax_r);
-		OPCODE(0x92, xchg_ax_r);
-		OPCODE(0x93, xchg_ax_r);
-		OPCODE(0x94, xchg_ax_r);
-		OPCODE(0x95, xchg_ax_r);
-		OPCODE(0x96, xchg_ax_r);
-		OPCODE(0x97, xchg_ax_r);
-		OPCODE(0x98, cbw);
-		OPCODE(0x99, cwd);
-		OPCODE(0x9a, call_far);
-		OPCODE(0x9b, wait);
-		OPCODE(0x9c, pushf);
-		OPCODE(0x9d, popf);
-		OPCODE(0x9e, sahf);
-		OPCODE(0x9f, lahf);
-		OPCODE(0xa0, mov_a_m);
-		OPCODE(0xa1, mov_a_m);
-		OPCODE(0xa2, mov_a_m);
-		OPCODE(0xa3, mov_a_m);
-		OPCODE(0xa4, movs);
-		OPCODE(0xa5, movs);
-		OPCODE(0xa6, cmps);
-		OPCODE(0xa7, cmps);
-		OPCODE(0xa8, test_a_imm);
-		OPCODE(0xa9, test_a_imm);
-		OPCODE(0xaa, stos);
-		OPCODE(0xab, stos);
-		OPCODE(0xac, lods);
-		OPCODE(0xad, lods);
-		OPCODE(0xae, scas);
-		OPCODE(0xaf, scas);
-		OPCODE(0xb0, mov_reg_imm);
-		OPCODE(0xb1, mov_reg_imm);
-		OPCODE(0xb2, mov_reg_imm);
-		OPCODE(0xb3, mov_reg_imm);
-		OPCODE(0xb4, mov_reg_imm);
-		OPCODE(0xb5, mov_reg_imm);
-		OPCODE(0xb6, mov_reg_imm);
-		OPCODE(0xb7, mov_reg_imm);
-		OPCODE(0xb8, mov_reg_imm);
-		OPCODE(0xb9, mov_reg_imm);
-		OPCODE(0xba, mov_reg_imm);
-		OPCODE(0xbb, mov_reg_imm);
-		OPCODE(0xbc, mov_reg_imm);
-		OPCODE(0xbd, mov_reg_imm);
-		OPCODE(0xbe, mov_reg_imm);
-		OPCODE(0xbf, mov_reg_imm);
-		OPCODE(0xc0, ret_imm16_intraseg); // Undocumented alias of 0xc2
-		OPCODE(0xc1, ret_intraseg);       // Undocumented alias of 0xc3
-		OPCODE(0xc2, ret_imm16_intraseg);
-		OPCODE(0xc3, ret_intraseg);
-		OPCODE(0xc4, les_r16_m16);
-		OPCODE(0xc5, lds_r16_m16);
-		OPCODE(0xc6, mov_m_imm);
-		OPCODE(0xc7, mov_m_imm);
-		OPCODE(0xc8, ret_imm16_interseg); // Undocumented alias of 0xca
-		OPCODE(0xc9, ret_interseg);       // Undocumented alias of 0xcb
-		OPCODE(0xca, ret_imm16_interseg);
-		OPCODE(0xcb, ret_interseg);
-		OPCODE(0xcc, int_3);
-		OPCODE(0xcd, int_imm8);
-		OPCODE(0xce, into);
-		OPCODE(0xcf, iret);
-		OPCODE(0xd0, grp2_rmw);
-		OPCODE(0xd1, grp2_rmw);
-		OPCODE(0xd2, grp2_rmw);
-		OPCODE(0xd3, grp2_rmw);
-		OPCODE(0xd4, aam);
-		OPCODE(0xd5, aad);
-		OPCODE(0xd6, salc); // Undocumented by Intel
-		OPCODE(0xd7, xlat);
-		OPCODE(0xd8, esc);
-		OPCODE(0xd9, esc);
-		OPCODE(0xda, esc);
-		OPCODE(0xdb, esc);
-		OPCODE(0xdc, esc);
-		OPCODE(0xdd, esc);
-		OPCODE(0xde, esc);
-		OPCODE(0xdf, esc);
-		OPCODE(0xe0, loopnz);
-		OPCODE(0xe1, loopz);
-		OPCODE(0xe2, loop);
-		OPCODE(0xe3, jcxz);
-		OPCODE(0xe4, in_al_imm8);
-		OPCODE(0xe5, in_ax_imm8);
-		OPCODE(0xe6, out_al_imm8);
-		OPCODE(0xe7, out_ax_imm8);
-		OPCODE(0xe8, call_near);
-		OPCODE(0xe9, jmp_near);
-		OPCODE(0xea, jmp_far);
-		OPCODE(0xeb, jmp_short);
-		OPCODE(0xec, in_al_dx);
-		OPCODE(0xed, in_ax_dx);
-		OPCODE(0xee, out_al_dx);
-		OPCODE(0xef, out_ax_dx);
-		OPCODE(0xf0, lock_prefix);
-		OPCODE(0xf1, unused);
-		OPCODE(0xf2, repne);
-		OPCODE(0xf3, rep);
-		OPCODE(0xf4, hlt);
-		OPCODE(0xf5, cmc);
-		OPCODE(0xf6, grp3_rmw);
-		OPCODE(0xf7, grp3_rmw);
-		OPCODE(0xf8, clc);
-		OPCODE(0xf9, stc);
-		OPCODE(0xfa, cli);
-		OPCODE(0xfb, sti);
-		OPCODE(0xfc, cld);
-		OPCODE(0xfd, std);
-		OPCODE(0xfe, grp4_rm8);
-		OPCODE(0xff, grp5);
+/*
+ * Runs the block at cs:ip, translated once it got hot. Blocks are chained
+ * to the block that followed them last time to skip the cache lookup.
+ */
+uint32_t i8086_t::run_block() {
+	if (int_delay || int_nmi || int_intr || (hle && hle->hooked(0x10 * cs + ip))) {
+		return step();
+	}
+
+	i8086_block_t *next = jit_prev ? jit_prev->link : nullptr;
+	if (!next || next->cs != cs || next->ip != ip || !block_cache->is_valid(next)) {
+		next = block_cache->lookup(cs, ip);
+		if (jit_prev) {
+			jit_prev->link = next;
+		}
+	}
+	jit_prev = next;
+
+	if (!next->count) {
+		jit_prev = nullptr;
+		return step();
+	}
+
+	if (!next->code && ++next->exec_count >= JIT_HOT_THRESHOLD) {
+		next->code = (void *)jit->translate(next);
+		if (!next->code) {
+			jit_prev = nullptr;
+			return step();
+		}
+	}
+
+	if (cs < 0xf000) {
+		log_cs = cs;
+		log_ip = ip;
+	}
+
+	// Translated code adds to clock_cycles itself, before each call into the interpreter.
+	block = next;
+	if (next->code) {
+		return ((jit_code_t)next->code)(this);
+	}
+
+	// Interpret the whole block while it's still cold.
+	block_index = 0;
+	uint32_t steps = 0;
+	do {
+		steps += step();
+	} while (block == next && block_index < next->count
+	      && cs == next->cs && ip == next->insns[block_index].ip);
+
+	return steps;
+}
+
+// Runs a single predecoded instruction for the JIT, returns false if execution left the block or an interrupt is due.
+bool i8086_t::exec_insn(i8086_insn_t *a_insn) {
+	i8086_block_t *current = block;
+
+	sreg_ovr = 0;
+	repmode = REP_NONE;
+	int_delay = false;
+
+	op_ip = ip;
+	insn = a_insn;
+	insn_pos = 0;
+	uint32_t steps = 0;
+	do {
+		op = fetch8();
+		is_prefix = false;
+		steps += dispatch();
+	} while (is_prefix);
+	insn = nullptr;
+
+#if LAZY_FLAGS_CHECK
+	check_lazy_flags();
+#endif
+
+	// Counted like step() does, by the segment the instruction left cs at.
+	if (cs < 0xf000) {
+		instr_count++;
+	}
+	clock_cycles += steps;
+
+	// A port access can raise an interrupt, step() takes it before the next instruction.
+	if (int_intr || int_nmi) {
+		return false;
+	}
+	return cs == current->cs && ip == uint16_t(a_insn->ip + a_insn->len) && block_cache->is_valid(current);
+}
+
+i8086_insn_t *i8086_t::next_insn() {
+	if (!block_cache->enabled) {
+		return nullptr;
+	}
+
+	// Continue in the current block if execution fell through to its next instruction.
+	if (!block || block->cs != cs || block_index >= block->count
+	 || block->insns[block_index].ip != ip || !block_cache->is_valid(block))
+	{
+		block = block_cache->lookup(cs, ip);
+		block_index = 0;
+	}
+
+	// Instructions the cache can't hold are fetched from memory.
+	if (block_index >= block->count) {
+		return nullptr;
 	}
 
+	return &block->insns[block_index++];
+}
+
+/*
+ * Opcode handlers that decode bits of the opcode byte (width, direction,
+ * ALU function, register) are templates on the opcode, so each table
+ * entry is a handler with those bits folded in at compile time.
+ */
+#define OPCODE(x, func)   &i8086_t::op_##func
+#define OPCODE_T(x, func) &i8086_t::op_##func<x>
+
+static constexpr i8086_t::op_handler_t op_table[256] = {
+	OPCODE_T(0x00, alu_r_rm),
+	OPCODE_T(0x01, alu_r_rm),
+	OPCODE_T(0x02, alu_r_rm),
+	OPCODE_T(0x03, alu_r_rm),
+	OPCODE_T(0x04, alu_a_imm),
+	OPCODE_T(0x05, alu_a_imm),
+	OPCODE_T(0x06, push_sreg),
+	OPCODE_T(0x07, pop_sreg),
+	OPCODE_T(0x08, alu_r_rm),
+	OPCODE_T(0x09, alu_r_rm),
+	OPCODE_T(0x0a, alu_r_rm),
+	OPCODE_T(0x0b, alu_r_rm),
+	OPCODE_T(0x0c, alu_a_imm),
+	OPCODE_T(0x0d, alu_a_imm),
+	OPCODE_T(0x0e, push_sreg),
+	OPCODE_T(0x0f, pop_sreg),
+	OPCODE_T(0x10, alu_r_rm),
+	OPCODE_T(0x11, alu_r_rm),
+	OPCODE_T(0x12, alu_r_rm),
+	OPCODE_T(0x13, alu_r_rm),
+	OPCODE_T(0x14, alu_a_imm),
+	OPCODE_T(0x15, alu_a_imm),
+	OPCODE_T(0x16, push_sreg),
+	OPCODE_T(0x17, pop_sreg),
+	OPCODE_T(0x18, alu_r_rm),
+	OPCODE_T(0x19, alu_r_rm),
+	OPCODE_T(0x1a, alu_r_rm),
+	OPCODE_T(0x1b, alu_r_rm),
+	OPCODE_T(0x1c, alu_a_imm),
+	OPCODE_T(0x1d, alu_a_imm),
+	OPCODE_T(0x1e, push_sreg),
+	OPCODE_T(0x1f, pop_sreg),
+	OPCODE_T(0x20, alu_r_rm),
+	OPCODE_T(0x21, alu_r_rm),
+	OPCODE_T(0x22, alu_r_rm),
+	OPCODE_T(0x23, alu_r_rm),
+	OPCODE_T(0x24, alu_a_imm),
+	OPCODE_T(0x25, alu_a_imm),
+	OPCODE(0x26, seg_ovr_es),
+	OPCODE(0x27, daa),
+	OPCODE_T(0x28, alu_r_rm),
+	OPCODE_T(0x29, alu_r_rm),
+	OPCODE_T(0x2a, alu_r_rm),
+	OPCODE_T(0x2b, alu_r_rm),
+	OPCODE_T(0x2c, alu_a_imm),
+	OPCODE_T(0x2d, alu_a_imm),
+	OPCODE(0x2e, seg_ovr_cs),
+	OPCODE(0x2f, das),
+	OPCODE_T(0x30, alu_r_rm),
+	OPCODE_T(0x31, alu_r_rm),
+	OPCODE_T(0x32, alu_r_rm),
+	OPCODE_T(0x33, alu_r_rm),
+	OPCODE_T(0x34, alu_a_imm),
+	OPCODE_T(0x35, alu_a_imm),
+	OPCODE(0x36, seg_ovr_ss),
+	OPCODE(0x37, aaa),
+	OPCODE_T(0x38, alu_r_rm),
+	OPCODE_T(0x39, alu_r_rm),
+	OPCODE_T(0x3a, alu_r_rm),
+	OPCODE_T(0x3b, alu_r_rm),
+	OPCODE_T(0x3c, alu_a_imm),
+	OPCODE_T(0x3d, alu_a_imm),
+	OPCODE(0x3e, seg_ovr_ds),
+	OPCODE(0x3f, aas),
+	OPCODE_T(0x40, inc_reg),
+	OPCODE_T(0x41, inc_reg),
+	OPCODE_T(0x42, inc_reg),
+	OPCODE_T(0x43, inc_reg),
+	OPCODE_T(0x44, inc_reg),
+	OPCODE_T(0x45, inc_reg),
+	OPCODE_T(0x46, inc_reg),
+	OPCODE_T(0x47, inc_reg),
+	OPCODE_T(0x48, dec_reg),
+	OPCODE_T(0x49, dec_reg),
+	OPCODE_T(0x4a, dec_reg),
+	OPCODE_T(0x4b, dec_reg),
+	OPCODE_T(0x4c, dec_reg),
+	OPCODE_T(0x4d, dec_reg),
+	OPCODE_T(0x4e, dec_reg),
+	OPCODE_T(0x4f, dec_reg),
+	OPCODE_T(0x50, push_reg),
+	OPCODE_T(0x51, push_reg),
+	OPCODE_T(0x52, push_reg),
+	OPCODE_T(0x53, push_reg),
+	OPCODE_T(0x54, push_reg),
+	OPCODE_T(0x55, push_reg),
+	OPCODE_T(0x56, push_reg),
+	OPCODE_T(0x57, push_reg),
+	OPCODE_T(0x58, pop_reg),
+	OPCODE_T(0x59, pop_reg),
+	OPCODE_T(0x5a, pop_reg),
+	OPCODE_T(0x5b, pop_reg),
+	OPCODE_T(0x5c, pop_reg),
+	OPCODE_T(0x5d, pop_reg),
+	OPCODE_T(0x5e, pop_reg),
+	OPCODE_T(0x5f, pop_reg),
+	OPCODE_T(0x60, jcc), // Undocumented alias of 0x70
+	OPCODE_T(0x61, jcc), // Undocumented alias of 0x71
+	OPCODE_T(0x62, jcc), // Undocumented alias of 0x72
+	OPCODE_T(0x63, jcc), // Undocumented alias of 0x73
+	OPCODE_T(0x64, jcc), // Undocumented alias of 0x74
+	OPCODE_T(0x65, jcc), // Undocumented alias of 0x75
+	OPCODE_T(0x66, jcc), // Undocumented alias of 0x76
+	OPCODE_T(0x67, jcc), // Undocumented alias of 0x77
+	OPCODE_T(0x68, jcc), // Undocumented alias of 0x78
+	OPCODE_T(0x69, jcc), // Undocumented alias of 0x79
+	OPCODE_T(0x6a, jcc), // Undocumented alias of 0x7a
+	OPCODE_T(0x6b, jcc), // Undocumented alias of 0x7b
+	OPCODE_T(0x6c, jcc), // Undocumented alias of 0x7c
+	OPCODE_T(0x6d, jcc), // Undocumented alias of 0x7d
+	OPCODE_T(0x6e, jcc), // Undocumented alias of 0x7e
+	OPCODE_T(0x6f, jcc), // Undocumented alias of 0x7f
+	OPCODE_T(0x70, jcc),
+	OPCODE_T(0x71, jcc),
+	OPCODE_T(0x72, jcc),
+	OPCODE_T(0x73, jcc),
+	OPCODE_T(0x74, jcc),
+	OPCODE_T(0x75, jcc),
+	OPCODE_T(0x76, jcc),
+	OPCODE_T(0x77, jcc),
+	OPCODE_T(0x78, jcc),
+	OPCODE_T(0x79, jcc),
+	OPCODE_T(0x7a, jcc),
+	OPCODE_T(0x7b, jcc),
+	OPCODE_T(0x7c, jcc),
+	OPCODE_T(0x7d, jcc),
+	OPCODE_T(0x7e, jcc),
+	OPCODE_T(0x7f, jcc),
+	OPCODE_T(0x80, grp1_rmw_imm),
+	OPCODE_T(0x81, grp1_rmw_imm),
+	OPCODE_T(0x82, grp1_rmw_imm),
+	OPCODE_T(0x83, grp1_rmw_imm),
+	OPCODE_T(0x84, test_rm_r),
+	OPCODE_T(0x85, test_rm_r),
+	OPCODE_T(0x86, xchg_rm_r),
+	OPCODE_T(0x87, xchg_rm_r),
+	OPCODE_T(0x88, mov_rm_r),
+	OPCODE_T(0x89, mov_rm_r),
+	OPCODE_T(0x8a, mov_rm_r),
+	OPCODE_T(0x8b, mov_rm_r),
+	OPCODE_T(0x8c, mov_rm16_sreg),
+	OPCODE(0x8d, lea_r16_m16),
+	OPCODE_T(0x8e, mov_rm16_sreg),
+	OPCODE(0x8f, pop_rm16),
+	OPCODE_T(0x90, xchg_ax_r),
+	OPCODE_T(0x91, xchg_ax_r),
+	OPCODE_T(0x92, xchg_ax_r),
+	OPCODE_T(0x93, xchg_ax_r),
+	OPCODE_T(0x94, xchg_ax_r),
+	OPCODE_T(0x95, xchg_ax_r),
+	OPCODE_T(0x96, xchg_ax_r),
+	OPCODE_T(0x97, xchg_ax_r),
+	OPCODE(0x98, cbw),
+	OPCODE(0x99, cwd),
+	OPCODE(0x9a, call_far),
+	OPCODE(0x9b, wait),
+	OPCODE(0x9c, pushf),
+	OPCODE(0x9d, popf),
+	OPCODE(0x9e, sahf),
+	OPCODE(0x9f, lahf),
+	OPCODE_T(0xa0, mov_a_m),
+	OPCODE_T(0xa1, mov_a_m),
+	OPCODE_T(0xa2, mov_a_m),
+	OPCODE_T(0xa3, mov_a_m),
+	OPCODE_T(0xa4, movs),
+	OPCODE_T(0xa5, movs),
+	OPCODE_T(0xa6, cmps),
+	OPCODE_T(0xa7, cmps),
+	OPCODE_T(0xa8, test_a_imm),
+	OPCODE_T(0xa9, test_a_imm),
+	OPCODE_T(0xaa, stos),
+	OPCODE_T(0xab, stos),
+	OPCODE_T(0xac, lods),
+	OPCODE_T(0xad, lods),
+	OPCODE_T(0xae, scas),
+	OPCODE_T(0xaf, scas),
+	OPCODE_T(0xb0, mov_reg_imm),
+	OPCODE_T(0xb1, mov_reg_imm),
+	OPCODE_T(0xb2, mov_reg_imm),
+	OPCODE_T(0xb3, mov_reg_imm),
+	OPCODE_T(0xb4, mov_reg_imm),
+	OPCODE_T(0xb5, mov_reg_imm),
+	OPCODE_T(0xb6, mov_reg_imm),
+	OPCODE_T(0xb7, mov_reg_imm),
+	OPCODE_T(0xb8, mov_reg_imm),
+	OPCODE_T(0xb9, mov_reg_imm),
+	OPCODE_T(0xba, mov_reg_imm),
+	OPCODE_T(0xbb, mov_reg_imm),
+	OPCODE_T(0xbc, mov_reg_imm),
+	OPCODE_T(0xbd, mov_reg_imm),
+	OPCODE_T(0xbe, mov_reg_imm),
+	OPCODE_T(0xbf, mov_reg_imm),
+	OPCODE(0xc0, ret_imm16_intraseg), // Undocumented alias of 0xc2
+	OPCODE(0xc1, ret_intraseg),       // Undocumented alias of 0xc3
+	OPCODE(0xc2, ret_imm16_intraseg),
+	OPCODE(0xc3, ret_intraseg),
+	OPCODE(0xc4, les_r16_m16),
+	OPCODE(0xc5, lds_r16_m16),
+	OPCODE_T(0xc6, mov_m_imm),
+	OPCODE_T(0xc7, mov_m_imm),
+	OPCODE(0xc8, ret_imm16_interseg), // Undocumented alias of 0xca
+	OPCODE(0xc9, ret_interseg),       // Undocumented alias of 0xcb
+	OPCODE(0xca, ret_imm16_interseg),
+	OPCODE(0xcb, ret_interseg),
+	OPCODE(0xcc, int_3),
+	OPCODE(0xcd, int_imm8),
+	OPCODE(0xce, into),
+	OPCODE(0xcf, iret),
+	OPCODE_T(0xd0, grp2_rmw),
+	OPCODE_T(0xd1, grp2_rmw),
+	OPCODE_T(0xd2, grp2_rmw),
+	OPCODE_T(0xd3, grp2_rmw),
+	OPCODE(0xd4, aam),
+	OPCODE(0xd5, aad),
+	OPCODE(0xd6, salc), // Undocumented by Intel
+	OPCODE(0xd7, xlat),
+	OPCODE(0xd8, esc),
+	OPCODE(0xd9, esc),
+	OPCODE(0xda, esc),
+	OPCODE(0xdb, esc),
+	OPCODE(0xdc, esc),
+	OPCODE(0xdd, esc),
+	OPCODE(0xde, esc),
+	OPCODE(0xdf, esc),
+	OPCODE(0xe0, loopnz),
+	OPCODE(0xe1, loopz),
+	OPCODE(0xe2, loop),
+	OPCODE(0xe3, jcxz),
+	OPCODE(0xe4, in_al_imm8),
+	OPCODE(0xe5, in_ax_imm8),
+	OPCODE(0xe6, out_al_imm8),
+	OPCODE(0xe7, out_ax_imm8),
+	OPCODE(0xe8, call_near),
+	OPCODE(0xe9, jmp_near),
+	OPCODE(0xea, jmp_far),
+	OPCODE(0xeb, jmp_short),
+	OPCODE(0xec, in_al_dx),
+	OPCODE(0xed, in_ax_dx),
+	OPCODE(0xee, out_al_dx),
+	OPCODE(0xef, out_ax_dx),
+	OPCODE(0xf0, lock_prefix),
+	OPCODE(0xf1, unused),
+	OPCODE(0xf2, repne),
+	OPCODE(0xf3, rep),
+	OPCODE(0xf4, hlt),
+	OPCODE(0xf5, cmc),
+	OPCODE_T(0xf6, grp3_rmw),
+	OPCODE_T(0xf7, grp3_rmw),
+	OPCODE(0xf8, clc),
+	OPCODE(0xf9, stc),
+	OPCODE(0xfa, cli),
+	OPCODE(0xfb, sti),
+	OPCODE(0xfc, cld),
+	OPCODE(0xfd, std),
+	OPCODE(0xfe, grp4_rm8),
+	OPCODE(0xff, grp5),
+};
+
+#undef OPCODE_T
+#undef OPCODE
+
+uint32_t i8086_t::dispatch() {
+	(this->*op_table[op])();
+
 	return 1;
 }
 
@@ -489,14 +733,14 @@ void i8086_t::call_int(byte num) {
 	uint16_t int_ip = mem_read16(0, 4 * num);
 	uint16_t int_cs = mem_read16(0, 4 * num + 2);
 
-	push(flags);
+	push(get_flags());
 	push(cs);
 	push(ip);
 
 	set_if(false);
 	set_tf(false);
 
-	call_stack.push_back({{cs, op_ip}, {int_cs, int_ip}, true});
+	call_stack.call({cs, op_ip}, {int_cs, int_ip}, ss, sp, true);
 
 	cs = int_cs;
 	ip = int_ip;
@@ -515,15 +759,13 @@ void i8086_t::call_int(byte num) {
 byte i8086_t::mem_read8(uint16_t seg, uint16_t ofs) {
 	uint32_t ea = 0x10 * seg + ofs;
 
-	byte v = read(MEM, ea, W8);
-
-	return v;
+	return bus->read8(ea);
 }
 
 uint16_t i8086_t::mem_read16(uint16_t seg, uint16_t ofs) {
 	uint32_t ea = 0x10 * seg + ofs;
 
-	uint16_t v = read(MEM, ea, W16);
+	uint16_t v = bus->read16(ea);
 
 	if (ofs & 1) {
 		cycles += 4;
@@ -535,13 +777,15 @@ uint16_t i8086_t::mem_read16(uint16_t seg, uint16_t ofs) {
 void i8086_t::mem_write8(uint16_t seg, uint16_t ofs, byte v) {
 	uint32_t ea = 0x10 * seg + ofs;
 
-	write(MEM, ea, W8, v);
+	bus->write8(ea, v);
+	block_cache->memory_written(ea, 1);
 }
 
 void i8086_t::mem_write16(uint16_t seg, uint16_t ofs, uint16_t v) {
 	uint32_t ea = 0x10 * seg + ofs;
 
-	write(MEM, ea, W16, v);
+	bus->write16(ea, v);
+	block_cache->memory_written(ea, 2);
 
 	if (ofs & 1) {
 		cycles += 4;
@@ -549,7 +793,15 @@ void i8086_t::mem_write16(uint16_t seg, uint16_t ofs, uint16_t v) {
 }
 
 byte i8086_t::fetch8() {
-	byte v = mem_read8(cs, ip);
+	byte v;
+
+	if (insn) {
+		assert(insn_pos < insn->len);
+		v = insn->bytes[insn_pos];
+		insn_pos += 1;
+	} else {
+		v = mem_read8(cs, ip);
+	}
 
 	ip += 1;
 
@@ -557,7 +809,18 @@ byte i8086_t::fetch8() {
 }
 
 uint16_t i8086_t::fetch16() {
-	uint16_t w = mem_read16(cs, ip);
+	uint16_t w;
+
+	if (insn) {
+		assert(insn_pos + 1 < insn->len);
+		w = readle16(&insn->bytes[insn_pos]);
+		insn_pos += 2;
+		if (ip & 1) {
+			cycles += 4;
+		}
+	} else {
+		w = mem_read16(cs, ip);
+	}
 
 	ip += 2;
 
@@ -580,6 +843,25 @@ uint32_t sext16(uint16_t v) {
 	return v;
 }
 
+uint16_t i8086_t::fetch_disp(byte mod, byte rm) {
+	if (insn) {
+		// Predecoded and sign-extended by the block cache.
+		if (insn->disp_len == 2 && (ip & 1)) {
+			cycles += 4;
+		}
+		ip       += insn->disp_len;
+		insn_pos += insn->disp_len;
+		return insn->disp;
+	}
+
+	switch (mod) {
+		case 0b00: return rm == 0b110 ? fetch16() : 0;
+		case 0b01: return sext(fetch8());
+		case 0b10: return fetch16();
+	}
+	return 0;
+}
+
 void i8086_t::push(uint16_t v) {
 	sp -= 2;
 	mem_write16(ss, sp, v);
@@ -717,13 +999,10 @@ i8086_t::modrm_t i8086_t::modrm_mem_sw(byte modrm, bool s, bool w) {
 			case 0b011: ofs = bp + di; break;
 			case 0b100: ofs = si;      break;
 			case 0b101: ofs = di;      break;
-			case 0b110: ofs = mod ? bp : fetch16(); break;
+			case 0b110: ofs = mod ? bp : 0; break;
 			case 0b111: ofs = bx;      break;
 		}
-		switch (mod) {
-			case 0b01: ofs += sext(fetch8()); break;
-			case 0b10: ofs += fetch16(); break;
-		}
+		ofs += fetch_disp(mod, rm);
 		res.ofs = ofs;
 	}
 
@@ -838,53 +1117,62 @@ const char *i8086_t::str_w(bool w) {
  * ##     ## ########  #######
  */
 
-uint16_t i8086_t::alu_w(byte func, uint16_t a, uint16_t b, bool w) {
+template<byte func, bool w>
+uint16_t i8086_t::alu(uint16_t a, uint16_t b) {
 	uint16_t res;
-	uint16_t c = !!(flags & FLAG_CF);
-
-	switch (func) {
-		case ALU_ADD: res = a + b; break;
-		case ALU_OR:  res = a | b; break;
-		case ALU_ADC: res = a + b + c; break;
-		case ALU_SBB: res = a - b - c; break;
-		case ALU_AND: res = a & b; break;
-		case ALU_SUB: res = a - b; break;
-		case ALU_XOR: res = a ^ b; break;
-		case ALU_CMP: res = a - b; break;
-		default: assert(0 && "invalid alu func");
-	}
-
-	if (!w) {
-		switch (func) {
-			case ALU_ADD: update_flags_add8(res, a, b); break;
-			case ALU_OR:  update_flags_bin8(res, a, b); break;
-			case ALU_ADC: update_flags_add8(res, a, b, c); break;
-			case ALU_SBB: update_flags_sub8(res, a, b, c); break;
-			case ALU_AND: update_flags_bin8(res, a, b); break;
-			case ALU_SUB: update_flags_sub8(res, a, b); break;
-			case ALU_XOR: update_flags_bin8(res, a, b); break;
-			case ALU_CMP: update_flags_sub8(res, a, b); break;
-		}
+	uint16_t c = get_cf();
+
+	if constexpr (func == ALU_ADD) {
+		res = a + b;
+		if constexpr (!w) update_flags_add8(res, a, b); else update_flags_add16(res, a, b);
+	} else if constexpr (func == ALU_OR) {
+		res = a | b;
+		if constexpr (!w) update_flags_bin8(res, a, b); else update_flags_bin16(res, a, b);
+	} else if constexpr (func == ALU_ADC) {
+		res = a + b + c;
+		if constexpr (!w) update_flags_add8(res, a, b, c); else update_flags_add16(res, a, b, c);
+	} else if constexpr (func == ALU_SBB) {
+		res = a - b - c;
+		if constexpr (!w) update_flags_sub8(res, a, b, c); else update_flags_sub16(res, a, b, c);
+	} else if constexpr (func == ALU_AND) {
+		res = a & b;
+		if constexpr (!w) update_flags_bin8(res, a, b); else update_flags_bin16(res, a, b);
+	} else if constexpr (func == ALU_SUB || func == ALU_CMP) {
+		res = a - b;
+		if constexpr (!w) update_flags_sub8(res, a, b); else update_flags_sub16(res, a, b);
+	} else if constexpr (func == ALU_XOR) {
+		res = a ^ b;
+		if constexpr (!w) update_flags_bin8(res, a, b); else update_flags_bin16(res, a, b);
 	} else {
-		switch (func) {
-			case ALU_ADD: update_flags_add16(res, a, b); break;
-			case ALU_OR:  update_flags_bin16(res, a, b); break;
-			case ALU_ADC: update_flags_add16(res, a, b, c); break;
-			case ALU_SBB: update_flags_sub16(res, a, b, c); break;
-			case ALU_AND: update_flags_bin16(res, a, b); break;
-			case ALU_SUB: update_flags_sub16(res, a, b); break;
-			case ALU_XOR: update_flags_bin16(res, a, b); break;
-			case ALU_CMP: update_flags_sub16(res, a, b); break;
-		}
+		static_assert(func <= ALU_CMP, "invalid alu func");
 	}
 
-	if (!w) {
+	if constexpr (!w) {
 		res &= 0x00ff;
 	}
 
 	return res;
 }
 
+uint16_t i8086_t::alu_w(byte func, uint16_t a, uint16_t b, bool w) {
+#define ALU_FUNC(f) case f: return !w ? alu<f, false>(a, b) : alu<f, true>(a, b)
+
+	switch (func) {
+		ALU_FUNC(ALU_ADD);
+		ALU_FUNC(ALU_OR);
+		ALU_FUNC(ALU_ADC);
+		ALU_FUNC(ALU_SBB);
+		ALU_FUNC(ALU_AND);
+		ALU_FUNC(ALU_SUB);
+		ALU_FUNC(ALU_XOR);
+		ALU_FUNC(ALU_CMP);
+		default: assert(0 && "invalid alu func");
+	}
+
+#undef ALU_FUNC
+	return 0;
+}
+
 /*
  * ######## ##          ###     ######    ######
  * ##       ##         ## ##   ##    ##  ##    ##
@@ -1033,41 +1321,150 @@ inline bool of_w_sub(uint16_t res, uint16_t dst, uint16_t src, bool w) {
 	return !w ? of8_sub(res, dst, src) : of16_sub(res, dst, src);
 }
 
+/*
+ * Lazy flags
+ */
+
+bool i8086_t::lazy_cf() {
+	switch (lazy.op) {
+		case LAZY_ADD: return cf_w_add(lazy.res, lazy.dst, lazy.src, lazy.cf, lazy.w);
+		case LAZY_SUB: return cf_w_sub(lazy.res, lazy.dst, lazy.src, lazy.cf, lazy.w);
+		case LAZY_BIN: return false;
+		case LAZY_SHF: return lazy.cf;
+		case LAZY_INC: return lazy.cf;
+		case LAZY_DEC: return lazy.cf;
+		default:       return !!(flags & FLAG_CF);
+	}
+}
+
+bool i8086_t::lazy_pf() {
+	return pf8(lazy.res);
+}
+
+bool i8086_t::lazy_af() {
+	switch (lazy.op) {
+		case LAZY_BIN: return false; // TODO: DOSBox does this
+		case LAZY_SHF: return !!(flags & FLAG_AF);
+		default:       return af8(lazy.res, lazy.dst, lazy.src);
+	}
+}
+
+bool i8086_t::lazy_zf() {
+	return !lazy.w ? zf8(lazy.res) : zf16(lazy.res);
+}
+
+bool i8086_t::lazy_sf() {
+	return !lazy.w ? sf8(lazy.res) : sf16(lazy.res);
+}
+
+bool i8086_t::lazy_of() {
+	switch (lazy.op) {
+		case LAZY_ADD: return of_w_add(lazy.res, lazy.dst, lazy.src, lazy.w);
+		case LAZY_SUB: return of_w_sub(lazy.res, lazy.dst, lazy.src, lazy.w);
+		case LAZY_BIN: return false;
+		case LAZY_SHF: return !lazy.w ? signbit8(lazy.res ^ lazy.src) : signbit16(lazy.res ^ lazy.src);
+		case LAZY_INC: return of_w_add(lazy.res, lazy.dst, lazy.src, lazy.w);
+		case LAZY_DEC: return of_w_sub(lazy.res, lazy.dst, lazy.src, lazy.w);
+		default:       return !!(flags & FLAG_OF);
+	}
+}
+
+void i8086_t::materialize_flags() {
+	uint16_t f = flags & ~FLAG_STATUS;
+
+	f |= lazy_cf() ? FLAG_CF : 0;
+	f |= lazy_pf() ? FLAG_PF : 0;
+	f |= lazy_af() ? FLAG_AF : 0;
+	f |= lazy_zf() ? FLAG_ZF : 0;
+	f |= lazy_sf() ? FLAG_SF : 0;
+	f |= lazy_of() ? FLAG_OF : 0;
+
+	flags = f;
+	lazy.op = LAZY_NONE;
+}
+
+#if LAZY_FLAGS_CHECK
+/*
+ * The eager flag computation, kept as a reference for the lazy flags.
+ */
+
+static void set_check(uint16_t &flags, uint16_t mask, bool cond) {
+	flags = cond ? (flags | mask) : (flags & ~mask);
+}
+
+void i8086_t::check_lazy_flags() {
+	lazy_flags_t last = lazy;
+
+	uint16_t lazy_flags = flags & ~FLAG_STATUS;
+	lazy_flags |= get_cf() ? FLAG_CF : 0;
+	lazy_flags |= get_pf() ? FLAG_PF : 0;
+	lazy_flags |= get_af() ? FLAG_AF : 0;
+	lazy_flags |= get_zf() ? FLAG_ZF : 0;
+	lazy_flags |= get_sf() ? FLAG_SF : 0;
+	lazy_flags |= get_of() ? FLAG_OF : 0;
+
+	uint16_t materialized = get_flags();
+
+	if (lazy_flags != check_flags || materialized != check_flags) {
+		printf("lazy flags mismatch at %04x:%04x op %02x: lazy %04x materialized %04x eager %04x\n",
+			cs, op_ip, op, lazy_flags, materialized, check_flags);
+		printf("last op %d w %d res %04x dst %04x src %04x cf %d\n",
+			last.op, last.w, last.res, last.dst, last.src, last.cf);
+		dump_state();
+		exit(1);
+	}
+}
+#endif
+
 void i8086_t::update_flags_add8(uint8_t res, uint8_t dst, uint8_t src, bool cf) {
-	set_cf(cf8_add(res, dst, src, cf));
-	set_pf(pf8(res));
-	set_af(af8(res, dst, src));
-	set_zf(zf8(res));
-	set_sf(sf8(res));
-	set_of(of8_add(res, dst, src));
+	set_lazy(LAZY_ADD, false, res, dst, src, cf);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, cf8_add(res, dst, src, cf));
+	set_check(check_flags, FLAG_PF, pf8(res));
+	set_check(check_flags, FLAG_AF, af8(res, dst, src));
+	set_check(check_flags, FLAG_ZF, zf8(res));
+	set_check(check_flags, FLAG_SF, sf8(res));
+	set_check(check_flags, FLAG_OF, of8_add(res, dst, src));
+#endif
 }
 
 void i8086_t::update_flags_sub8(uint8_t res, uint8_t dst, uint8_t src, bool cf) {
-	set_cf(cf8_sub(res, dst, src, cf));
-	set_pf(pf8(res));
-	set_af(af8(res, dst, src));
-	set_zf(zf8(res));
-	set_sf(sf8(res));
-	set_of(of8_sub(res, dst, src));
+	set_lazy(LAZY_SUB, false, res, dst, src, cf);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, cf8_sub(res, dst, src, cf));
+	set_check(check_flags, FLAG_PF, pf8(res));
+	set_check(check_flags, FLAG_AF, af8(res, dst, src));
+	set_check(check_flags, FLAG_ZF, zf8(res));
+	set_check(check_flags, FLAG_SF, sf8(res));
+	set_check(check_flags, FLAG_OF, of8_sub(res, dst, src));
+#endif
 }
 
 void i8086_t::update_flags_bin8(uint8_t res, uint8_t dst, uint8_t src) {
-	(void)dst;
-	(void)src;
-	set_cf(0);
-	set_pf(pf8(res));
-	set_zf(zf8(res));
-	set_sf(sf8(res));
-	set_af(0); // TODO: DOSBox does this
-	set_of(0);
+	set_lazy(LAZY_BIN, false, res, dst, src, 0);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, 0);
+	set_check(check_flags, FLAG_PF, pf8(res));
+	set_check(check_flags, FLAG_ZF, zf8(res));
+	set_check(check_flags, FLAG_SF, sf8(res));
+	set_check(check_flags, FLAG_AF, 0);
+	set_check(check_flags, FLAG_OF, 0);
+#endif
 }
 
 void i8086_t::update_flags_shf8(uint8_t res, uint8_t src, bool cf) {
-	set_cf(cf);
-	set_pf(pf8(res));
-	set_zf(zf8(res));
-	set_sf(sf8(res));
-	set_of((res & 0x80) != (src & 0x80));
+	// Shifts leave AF alone, so it has to be up to date.
+	if (lazy.op != LAZY_NONE) {
+		materialize_flags();
+	}
+	set_lazy(LAZY_SHF, false, res, 0, src, cf);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, cf);
+	set_check(check_flags, FLAG_PF, pf8(res));
+	set_check(check_flags, FLAG_ZF, zf8(res));
+	set_check(check_flags, FLAG_SF, sf8(res));
+	set_check(check_flags, FLAG_OF, (res & 0x80) != (src & 0x80));
+#endif
 }
 
 void i8086_t::update_flags_rot8(uint8_t res, uint8_t src, bool cf) {
@@ -1075,41 +1472,77 @@ void i8086_t::update_flags_rot8(uint8_t res, uint8_t src, bool cf) {
 	set_of((res & 0x80) != (src & 0x80));
 }
 
+void i8086_t::update_flags_inc8(uint8_t res, uint8_t dst) {
+	set_lazy(LAZY_INC, false, res, dst, 1, get_cf());
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_PF, pf8(res));
+	set_check(check_flags, FLAG_AF, af8(res, dst, 1));
+	set_check(check_flags, FLAG_ZF, zf8(res));
+	set_check(check_flags, FLAG_SF, sf8(res));
+	set_check(check_flags, FLAG_OF, of8_add(res, dst, 1));
+#endif
+}
+
+void i8086_t::update_flags_dec8(uint8_t res, uint8_t dst) {
+	set_lazy(LAZY_DEC, false, res, dst, 1, get_cf());
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_PF, pf8(res));
+	set_check(check_flags, FLAG_AF, af8(res, dst, 1));
+	set_check(check_flags, FLAG_ZF, zf8(res));
+	set_check(check_flags, FLAG_SF, sf8(res));
+	set_check(check_flags, FLAG_OF, of8_sub(res, dst, 1));
+#endif
+}
+
 void i8086_t::update_flags_add16(uint16_t res, uint16_t dst, uint16_t src, bool cf) {
-	set_cf(cf16_add(res, dst, src, cf));
-	set_pf(pf16(res));
-	set_af(af16(res, dst, src));
-	set_zf(zf16(res));
-	set_sf(sf16(res));
-	set_of(of16_add(res, dst, src));
+	set_lazy(LAZY_ADD, true, res, dst, src, cf);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, cf16_add(res, dst, src, cf));
+	set_check(check_flags, FLAG_PF, pf16(res));
+	set_check(check_flags, FLAG_AF, af16(res, dst, src));
+	set_check(check_flags, FLAG_ZF, zf16(res));
+	set_check(check_flags, FLAG_SF, sf16(res));
+	set_check(check_flags, FLAG_OF, of16_add(res, dst, src));
+#endif
 }
 
 void i8086_t::update_flags_sub16(uint16_t res, uint16_t dst, uint16_t src, bool cf) {
-	set_cf(cf16_sub(res, dst, src, cf));
-	set_pf(pf16(res));
-	set_af(af16(res, dst, src));
-	set_zf(zf16(res));
-	set_sf(sf16(res));
-	set_of(of16_sub(res, dst, src));
+	set_lazy(LAZY_SUB, true, res, dst, src, cf);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, cf16_sub(res, dst, src, cf));
+	set_check(check_flags, FLAG_PF, pf16(res));
+	set_check(check_flags, FLAG_AF, af16(res, dst, src));
+	set_check(check_flags, FLAG_ZF, zf16(res));
+	set_check(check_flags, FLAG_SF, sf16(res));
+	set_check(check_flags, FLAG_OF, of16_sub(res, dst, src));
+#endif
 }
 
 void i8086_t::update_flags_bin16(uint16_t res, uint16_t dst, uint16_t src) {
-	(void)dst;
-	(void)src;
-	set_cf(0);
-	set_pf(pf16(res));
-	set_zf(zf16(res));
-	set_sf(sf16(res));
-	set_af(0); // TODO: DOSBox does this
-	set_of(0);
+	set_lazy(LAZY_BIN, true, res, dst, src, 0);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, 0);
+	set_check(check_flags, FLAG_PF, pf16(res));
+	set_check(check_flags, FLAG_ZF, zf16(res));
+	set_check(check_flags, FLAG_SF, sf16(res));
+	set_check(check_flags, FLAG_AF, 0);
+	set_check(check_flags, FLAG_OF, 0);
+#endif
 }
 
 void i8086_t::update_flags_shf16(uint16_t res, uint16_t src, bool cf) {
-	set_cf(cf);
-	set_pf(pf16(res));
-	set_zf(zf16(res));
-	set_sf(sf16(res));
-	set_of((res & 0x8000) != (src & 0x8000));
+	// Shifts leave AF alone, so it has to be up to date.
+	if (lazy.op != LAZY_NONE) {
+		materialize_flags();
+	}
+	set_lazy(LAZY_SHF, true, res, 0, src, cf);
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_CF, cf);
+	set_check(check_flags, FLAG_PF, pf16(res));
+	set_check(check_flags, FLAG_ZF, zf16(res));
+	set_check(check_flags, FLAG_SF, sf16(res));
+	set_check(check_flags, FLAG_OF, (res & 0x8000) != (src & 0x8000));
+#endif
 }
 
 void i8086_t::update_flags_rot16(uint16_t res, uint16_t src, bool cf) {
@@ -1117,6 +1550,28 @@ void i8086_t::update_flags_rot16(uint16_t res, uint16_t src, bool cf) {
 	set_of((res & 0x8000) != (src & 0x8000));
 }
 
+void i8086_t::update_flags_inc16(uint16_t res, uint16_t dst) {
+	set_lazy(LAZY_INC, true, res, dst, 1, get_cf());
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_PF, pf16(res));
+	set_check(check_flags, FLAG_AF, af16(res, dst, 1));
+	set_check(check_flags, FLAG_ZF, zf16(res));
+	set_check(check_flags, FLAG_SF, sf16(res));
+	set_check(check_flags, FLAG_OF, of16_add(res, dst, 1));
+#endif
+}
+
+void i8086_t::update_flags_dec16(uint16_t res, uint16_t dst) {
+	set_lazy(LAZY_DEC, true, res, dst, 1, get_cf());
+#if LAZY_FLAGS_CHECK
+	set_check(check_flags, FLAG_PF, pf16(res));
+	set_check(check_flags, FLAG_AF, af16(res, dst, 1));
+	set_check(check_flags, FLAG_ZF, zf16(res));
+	set_check(check_flags, FLAG_SF, sf16(res));
+	set_check(check_flags, FLAG_OF, of16_sub(res, dst, 1));
+#endif
+}
+
 void i8086_t::unimplemented(const char *op_name, int line) {
 	printf("unimplemented! %s:%d [%02x]\n", op_name, line, op);
 	dump_state();
@@ -1137,23 +1592,25 @@ void i8086_t::op_unused() {
  *  #######  ##         ######   #######  ########  ########  ######
  */
 
+template<byte OP>
 void i8086_t::op_alu_r_rm() {
+	constexpr bool w    = !!(OP & 0b01);
+	constexpr bool d    = !!(OP & 0b10);
+	constexpr byte func = (OP >> 3) & 0b111;
+
 	byte modrm = fetch8();
-	bool w     = !!(op & 0b01);
-	bool d     = !!(op & 0b10);
-	byte func  = (op >> 3) & 0b111;
 
 	modrm_t mem = modrm_mem_sw(modrm, false, w);
 	modrm_t reg = modrm_reg_sw(modrm, false, w);
 
 	uint16_t a = read_modrm(reg);
 	uint16_t b = read_modrm(mem);
-	if (!d) {
+	if constexpr (!d) {
 		std::swap(a, b);
 	}
-	uint16_t r = alu_w(func, a, b, w);
+	uint16_t r = alu<func, w>(a, b);
 
-	if (func != ALU_CMP) {
+	if constexpr (func != ALU_CMP) {
 		write_modrm(!d ? mem : reg, r);
 	}
 
@@ -1163,28 +1620,30 @@ void i8086_t::op_alu_r_rm() {
 		cycles += 6;
 	}
 	// If writing to mem
-	if (!d && func != ALU_CMP) {
+	if constexpr (!d && func != ALU_CMP) {
 		cycles += 7;
 	}
 }
 
+template<byte OP>
 void i8086_t::op_alu_a_imm() {
-	bool w    = op & 1;
-	byte func = (op >> 3) & 0b111;
+	constexpr bool w    = OP & 1;
+	constexpr byte func = (OP >> 3) & 0b111;
 
 	uint16_t a = read_reg(REG_AX, w);
 	uint16_t b = fetch(w);
-	uint16_t r = alu_w(func, a, b, w);
+	uint16_t r = alu<func, w>(a, b);
 
-	if (func != ALU_CMP) {
+	if constexpr (func != ALU_CMP) {
 		write_reg(REG_AX, r, w);
 	}
 
 	cycles += 4;
 }
 
+template<byte OP>
 void i8086_t::op_push_sreg() {
-	byte sreg = (op >> 3) & 0b111;
+	constexpr byte sreg = (OP >> 3) & 0b111;
 
 	uint16_t v = read_sreg(sreg);
 	push(v);
@@ -1192,8 +1651,9 @@ void i8086_t::op_push_sreg() {
 	cycles += 10;
 }
 
+template<byte OP>
 void i8086_t::op_pop_sreg() {
-	byte sreg = (op >> 3) & 0b111;
+	constexpr byte sreg = (OP >> 3) & 0b111;
 
 	uint16_t v = pop();
 	write_sreg(sreg, v);
@@ -1212,8 +1672,8 @@ void i8086_t::op_seg_ovr_es() {
 
 void i8086_t::op_daa() {
 	uint8_t al = readlo(ax);
-	bool    af = !!(flags & FLAG_AF);
-	bool    cf = !!(flags & FLAG_CF);
+	bool    af = get_af();
+	bool    cf = get_cf();
 	uint8_t old_al = al;
 
 	if ((al & 0x0f) > 9 || af) {
@@ -1257,10 +1717,10 @@ void i8086_t::op_das() {
 
 	if ((al & 0x0f) > 9 || get_af()) {
 		new_al = al - 6;
-		new_cf = flags & FLAG_CF || (new_al > al);
+		new_cf = get_cf() || (new_al > al);
 		new_af = 1;
 	}
-	if ((al > 0x99) || flags & FLAG_CF) {
+	if ((al > 0x99) || get_cf()) {
 		new_al -= 0x60;
 		new_cf = 1;
 	}
@@ -1341,42 +1801,35 @@ void i8086_t::op_aas() {
 	cycles += 4;
 }
 
+template<byte OP>
 void i8086_t::op_inc_reg() {
-	byte reg = op & 0b111;
+	constexpr byte reg = OP & 0b111;
 
 	uint16_t dst = read_reg(reg, true);
-	uint16_t src = 1;
 	uint16_t res = dst + 1;
 	write_reg(reg, res, true);
 
-	set_pf(pf16(res));
-	set_af(af16(res, dst, src));
-	set_zf(zf16(res));
-	set_sf(sf16(res));
-	set_of(of16_add(res, dst, src));
+	update_flags_inc16(res, dst);
 
 	cycles += 2;
 }
 
+template<byte OP>
 void i8086_t::op_dec_reg() {
-	byte reg = op & 0b111;
+	constexpr byte reg = OP & 0b111;
 
 	uint16_t dst = read_reg(reg, true);
-	uint16_t src = 1;
 	uint16_t res = dst - 1;
 	write_reg(reg, res, true);
 
-	set_pf(pf16(res));
-	set_af(af16(res, dst, src));
-	set_zf(zf16(res));
-	set_sf(sf16(res));
-	set_of(of16_sub(res, dst, src));
+	update_flags_dec16(res, dst);
 
 	cycles += 2;
 }
 
+template<byte OP>
 void i8086_t::op_push_reg() {
-	byte reg = op & 0b111;
+	constexpr byte reg = OP & 0b111;
 
 	// On 8086 'push ss' pushes the updated value of ss
 	// so we can't use ::push(v)
@@ -1387,8 +1840,9 @@ void i8086_t::op_push_reg() {
 	cycles += 11;
 }
 
+template<byte OP>
 void i8086_t::op_pop_reg() {
-	byte reg = op & 0b111;
+	constexpr byte reg = OP & 0b111;
 
 	uint16_t v = pop();
 	write_reg(reg, v, true);
@@ -1396,9 +1850,10 @@ void i8086_t::op_pop_reg() {
 	cycles += 8;
 }
 
+template<byte OP>
 void i8086_t::op_jcc() {
-	byte cond = (op >> 1) & 0b111;
-	bool neg = op & 1;
+	constexpr byte cond = (OP >> 1) & 0b111;
+	constexpr bool neg  = OP & 1;
 	bool r;
 
 	int8_t inc = (int8_t)fetch8();
@@ -1415,7 +1870,7 @@ void i8086_t::op_jcc() {
 		default:
 			assert(0 && "unreachable");
 	}
-	if (neg) {
+	if constexpr (neg) {
 		r = !r;
 	}
 
@@ -1429,20 +1884,20 @@ void i8086_t::op_jcc() {
 	}
 }
 
+template<byte OP>
 void i8086_t::op_grp1_rmw_imm() {
-	bool w      = !!(op & 1);
+	constexpr bool w = !!(OP & 1);
 	byte modrm  = fetch8();
 	byte func   = (modrm >> 3) & 0b111;
 	modrm_t mem = modrm_mem_sw(modrm, false, w);
 	uint16_t imm;
 
-	switch (op & 3) { // s:w
-		case 0b00: imm = fetch8(); break;
-		case 0b01: imm = fetch16(); break;
-		case 0b10:
-		case 0b11: imm = sext(fetch8()); break;
-		default:
-			assert(0 && "unreachable");
+	if constexpr ((OP & 3) == 0b00) { // s:w
+		imm = fetch8();
+	} else if constexpr ((OP & 3) == 0b01) {
+		imm = fetch16();
+	} else {
+		imm = sext(fetch8());
 	}
 
 	uint16_t a = read_modrm(mem);
@@ -1464,8 +1919,9 @@ void i8086_t::op_grp1_rmw_imm() {
 	}
 }
 
+template<byte OP>
 void i8086_t::op_test_rm_r() {
-	bool w     = !!(op & 0b01);
+	constexpr bool w = !!(OP & 0b01);
 	byte modrm = fetch8();
 
 	modrm_t mem = modrm_mem_sw(modrm, false, w);
@@ -1474,11 +1930,12 @@ void i8086_t::op_test_rm_r() {
 	uint16_t a = read_modrm(mem);
 	uint16_t b = read_modrm(reg);
 
-	(void)alu_w(ALU_AND, a, b, w);
+	(void)alu<ALU_AND, w>(a, b);
 }
 
+template<byte OP>
 void i8086_t::op_xchg_rm_r() {
-	bool w     = !!(op & 0b01);
+	constexpr bool w = !!(OP & 0b01);
 	byte modrm = fetch8();
 
 	modrm_t mem = modrm_mem_sw(modrm, false, w);
@@ -1491,15 +1948,16 @@ void i8086_t::op_xchg_rm_r() {
 	write_modrm(mem, b);
 }
 
+template<byte OP>
 void i8086_t::op_mov_rm_r() {
-	bool w     = !!(op & 0b01);
-	bool d     = !!(op & 0b10);
+	constexpr bool w = !!(OP & 0b01);
+	constexpr bool d = !!(OP & 0b10);
 	byte modrm = fetch8();
 
 	modrm_t mem = modrm_mem_sw(modrm, false, w);
 	modrm_t reg = modrm_reg_sw(modrm, false, w);
 
-	if (!d) {
+	if constexpr (!d) {
 		write_modrm(mem, read_modrm(reg));
 	} else {
 		write_modrm(reg, read_modrm(mem));
@@ -1509,20 +1967,21 @@ void i8086_t::op_mov_rm_r() {
 	if (mem.is_mem) {
 		// If one argument is mem
 		cycles += 6;
-		if (!d) {
+		if constexpr (!d) {
 			// If destination is mem
 			cycles += 1;
 		}
 	}
 }
 
+template<byte OP>
 void i8086_t::op_mov_rm16_sreg() {
-	bool d = !!(op & 2);
+	constexpr bool d = !!(OP & 2);
 
 	byte modrm = fetch8();
 	byte sreg = (modrm >> 3) & 0b111;
 
-	if (!d) {
+	if constexpr (!d) {
 		modrm_t dst = modrm_mem_sw(modrm, false, true);
 		write_modrm(dst, read_sreg(sreg));
 
@@ -1563,8 +2022,9 @@ void i8086_t::op_pop_rm16() {
 	}
 }
 
+template<byte OP>
 void i8086_t::op_xchg_ax_r() {
-	byte reg = op & 0b111;
+	constexpr byte reg = OP & 0b111;
 
 	cycles += 3;
 
@@ -1592,11 +2052,7 @@ void i8086_t::op_call_far() {
 	push(cs);
 	push(ip);
 
-	call_stack.push_back({
-		{cs, op_ip},
-		{seg, ofs},
-		false
-	});
+	call_stack.call({cs, op_ip}, {seg, ofs}, ss, sp, false);
 
 	cs = seg;
 	ip = ofs;
@@ -1609,35 +2065,36 @@ void i8086_t::op_wait() {
 }
 
 void i8086_t::op_pushf() {
-	push(flags);
+	push(get_flags());
 }
 
 void i8086_t::op_popf() {
-	flags = pop();
+	load_flags(pop());
 
 	cycles += 8;
 }
 
 void i8086_t::op_sahf() {
-	flags = readhi(ax);
+	load_flags(readhi(ax));
 
 	cycles += 4;
 }
 
 void i8086_t::op_lahf() {
-	writehi(ax, flags);
+	writehi(ax, get_flags());
 
 	cycles += 4;
 }
 
+template<byte OP>
 void i8086_t::op_mov_a_m() {
-	bool w = !!(op & 1);
-	bool d = !!(op & 2);
+	constexpr bool w = !!(OP & 1);
+	constexpr bool d = !!(OP & 2);
 	uint16_t seg = read_sreg_ovr(SEG_DS);
 	uint16_t ofs = fetch16();
 	uint16_t v;
 
-	if (!d) {
+	if constexpr (!d) {
 		v = mem_read(seg, ofs, w);
 		write_reg(REG_AX, v, w);
 	} else {
@@ -1648,24 +2105,272 @@ void i8086_t::op_mov_a_m() {
 	cycles += 10;
 }
 
+/*
+ * REP string instructions run at most REP_CHUNK_LEN elements per step.
+ * When the chunk runs out the instruction rewinds ip to op_ip, prefixes
+ * included, so pending interrupts are taken before it carries on with
+ * the registers it left behind, the same way an 8086 resumes it.
+ */
+void i8086_t::rep_suspend() {
+	ip = op_ip;
+	int_delay = false;
+	rep_resume = true;
+}
+
+// Returns false when picking up an instruction that yielded and already paid for its setup.
+bool i8086_t::rep_start() {
+	bool fresh = !rep_resume;
+	rep_resume = false;
+	return fresh;
+}
+
+/*
+ * Bulk paths for REP string instructions. They run the elements up to the
+ * next offset wraparound or the end of the chunk at once when the memory
+ * is plain RAM, and update cx, si, di, flags and cycles exactly like the
+ * element-wise loop. They return false when the element-wise loop has to
+ * run the next element.
+ */
+
+// Number of elements from ofs on before the offset wraps around.
+static inline uint32_t str_run_length(uint16_t ofs, int delta) {
+	if (delta > 0) {
+		return (0xffff - ofs) / delta + 1;
+	}
+	return ofs / -delta + 1;
+}
+
+// Host memory of the lowest element in a run of n elements starting at ofs.
+byte *i8086_t::str_run_ptr(uint16_t seg, uint16_t ofs, int delta, uint32_t n, bool write) {
+	if (n == 0) {
+		return nullptr;
+	}
+
+	uint32_t size = delta > 0 ? delta : -delta;
+	uint16_t lo   = delta > 0 ? ofs : ofs - (n - 1) * size;
+
+	return bus->host_range(0x10 * seg + lo, n * size, write);
+}
+
+// Index of the first element where a and b differ, or n.
+static uint32_t str_first_mismatch(const byte *a, const byte *b, uint32_t n, uint32_t size) {
+	uint32_t len = n * size;
+	uint32_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t va, vb;
+		memcpy(&va, a + i, 8);
+		memcpy(&vb, b + i, 8);
+		if (va != vb) {
+			break;
+		}
+	}
+	for (; i < len && a[i] == b[i]; ++i) {
+	}
+	return i / size;
+}
+
+template<bool w>
+bool i8086_t::rep_movs_bulk(uint16_t src_seg, int delta, uint32_t &budget) {
+	constexpr uint32_t size = w ? 2 : 1;
+
+	uint32_t n = std::min({ uint32_t(cx), budget, str_run_length(si, delta), str_run_length(di, delta) });
+	byte *src = str_run_ptr(src_seg, si, delta, n, false);
+	byte *dst = str_run_ptr(es, di, delta, n, true);
+	if (!src || !dst) {
+		return false;
+	}
+
+	uint32_t len = n * size;
+	if (src + len <= dst || dst + len <= src) {
+		memcpy(dst, src, len);
+	} else {
+		// Overlapping copies repeat data like the element-wise loop does.
+		byte *s = delta > 0 ? src : src + len - size;
+		byte *d = delta > 0 ? dst : dst + len - size;
+		for (uint32_t i = 0; i != n; ++i, s += delta, d += delta) {
+			if constexpr (w) {
+				writele16(d, readle16(s));
+			} else {
+				*d = *s;
+			}
+		}
+	}
+
+	uint16_t dst_lo = delta > 0 ? di : di - (n - 1) * size;
+	bus->mark_dirty(0x10 * es + dst_lo, len);
+	block_cache->memory_written(0x10 * es + dst_lo, len);
+
+	cycles += n * (17 + (w ? 4 * (si & 1) + 4 * (di & 1) : 0));
+	cx -= n;
+	budget -= n;
+	si += n * delta;
+	di += n * delta;
+
+	return true;
+}
+
+template<bool w>
+bool i8086_t::rep_cmps_bulk(uint16_t si_seg, uint16_t di_seg, int delta, uint32_t &budget) {
+	constexpr uint32_t size = w ? 2 : 1;
+
+	uint32_t n = std::min({ uint32_t(cx), budget, str_run_length(si, delta), str_run_length(di, delta) });
+	byte *src = str_run_ptr(si_seg, si, delta, n, false);
+	byte *dst = str_run_ptr(di_seg, di, delta, n, false);
+	if (!src || !dst) {
+		return false;
+	}
+
+	// Find the element that ends the loop, or run them all.
+	uint32_t done;
+	if (repmode == REP_REP && delta > 0) {
+		done = std::min(str_first_mismatch(src, dst, n, size) + 1, n);
+	} else {
+		byte *s = delta > 0 ? src : src + (n - 1) * size;
+		byte *d = delta > 0 ? dst : dst + (n - 1) * size;
+		for (done = 0; done != n; ) {
+			bool equal = w ? readle16(s) == readle16(d) : *s == *d;
+			done++;
+			if (equal != (repmode == REP_REP)) {
+				break;
+			}
+			s += delta;
+			d += delta;
+		}
+	}
+
+	// The flags come from the last comparison.
+	byte *s = src + (delta > 0 ? 0 : (n - 1) * size) + int(done - 1) * delta;
+	byte *d = dst + (delta > 0 ? 0 : (n - 1) * size) + int(done - 1) * delta;
+	alu<ALU_CMP, w>(w ? readle16(s) : *s, w ? readle16(d) : *d);
+
+	cycles += done * (22 + (w ? 4 * (si & 1) + 4 * (di & 1) : 0));
+	cx -= done;
+	budget -= done;
+	si += done * delta;
+	di += done * delta;
+
+	return true;
+}
+
+template<bool w>
+bool i8086_t::rep_stos_bulk(uint16_t v, int delta, uint32_t &budget) {
+	constexpr uint32_t size = w ? 2 : 1;
+
+	uint32_t n = std::min({ uint32_t(cx), budget, str_run_length(di, delta) });
+	byte *dst = str_run_ptr(es, di, delta, n, true);
+	if (!dst) {
+		return false;
+	}
+
+	uint32_t len = n * size;
+	if (!w || readlo(v) == readhi(v)) {
+		memset(dst, readlo(v), len);
+	} else {
+		for (uint32_t i = 0; i != len; i += 2) {
+			writele16(dst + i, v);
+		}
+	}
+
+	uint16_t dst_lo = delta > 0 ? di : di - (n - 1) * size;
+	bus->mark_dirty(0x10 * es + dst_lo, len);
+	block_cache->memory_written(0x10 * es + dst_lo, len);
+
+	cycles += n * (10 + (w ? 4 * (di & 1) : 0));
+	cx -= n;
+	budget -= n;
+	di += n * delta;
+
+	return true;
+}
+
+template<bool w>
+bool i8086_t::rep_lods_bulk(uint16_t seg, int delta, uint32_t &budget) {
+	constexpr uint32_t size = w ? 2 : 1;
+
+	uint32_t n = std::min({ uint32_t(cx), budget, str_run_length(si, delta) });
+	byte *src = str_run_ptr(seg, si, delta, n, false);
+	if (!src) {
+		return false;
+	}
+
+	// Only the last element loaded is left in the accumulator.
+	byte *last = delta > 0 ? src + (n - 1) * size : src;
+	write_reg(REG_AX, w ? readle16(last) : *last, w);
+
+	cycles += n * (13 + (w ? 4 * (si & 1) : 0));
+	cx -= n;
+	budget -= n;
+	si += n * delta;
+
+	return true;
+}
+
+template<bool w>
+bool i8086_t::rep_scas_bulk(uint16_t di_seg, uint16_t a, int delta, uint32_t &budget) {
+	constexpr uint32_t size = w ? 2 : 1;
+
+	uint32_t n = std::min({ uint32_t(cx), budget, str_run_length(di, delta) });
+	byte *dst = str_run_ptr(di_seg, di, delta, n, false);
+	if (!dst) {
+		return false;
+	}
+
+	// Find the element that ends the loop, or run them all.
+	uint32_t done;
+	if (!w && repmode == REP_REPNE && delta > 0) {
+		byte *found = (byte *)memchr(dst, a, n);
+		done = found ? found - dst + 1 : n;
+	} else {
+		byte *d = delta > 0 ? dst : dst + (n - 1) * size;
+		for (done = 0; done != n; d += delta) {
+			bool equal = w ? readle16(d) == a : *d == readlo(a);
+			done++;
+			if (equal != (repmode == REP_REP)) {
+				break;
+			}
+		}
+	}
+
+	// The flags come from the last comparison.
+	byte *d = dst + (delta > 0 ? 0 : (n - 1) * size) + int(done - 1) * delta;
+	alu<ALU_CMP, w>(a, w ? readle16(d) : *d);
+
+	cycles += done * (15 + (w ? 4 * (di & 1) : 0));
+	cx -= done;
+	budget -= done;
+	di += done * delta;
+
+	return true;
+}
+
+template<byte OP>
 void i8086_t::op_movs() {
-	bool     w        = !!(op & 1);
+	constexpr bool w  = !!(OP & 1);
 	int      delta    = strop_delta(w);
 	byte     src_sreg = get_sreg_ovr(SEG_DS);
 	uint16_t src_seg  = read_sreg(src_sreg);
-
-	cycles += 1;
+	uint32_t budget   = REP_CHUNK_LEN;
 
 	if (repmode == REP_NONE) {
-		cycles += 8;
+		cycles += 9;
 		goto inst;
 	}
+	if (rep_start()) {
+		cycles += 1;
+	}
 repeat:
 	if (cx == 0) {
 		return;
 	}
+	if (rep_movs_bulk<w>(src_seg, delta, budget)) {
+		goto repeat;
+	}
+	if (budget == 0) {
+		rep_suspend();
+		return;
+	}
 
-	// TODO: Service interrupts
+	--budget;
 	--cx;
 inst:
 	mem_write(es, di, mem_read(src_seg, si, w), w);
@@ -1680,35 +2385,45 @@ inst:
 	}
 }
 
+template<byte OP>
 void i8086_t::op_cmps() {
-	bool     w      = !!(op & 1);
+	constexpr bool w = !!(OP & 1);
 	int      delta  = strop_delta(w);
 	uint16_t si_seg = read_sreg_ovr(SEG_DS);
 	uint16_t di_seg = read_sreg(SEG_ES);
+	uint32_t budget = REP_CHUNK_LEN;
+	uint16_t a, b;
 
 	if (repmode == REP_NONE) {
 		cycles += 9;
-	}
-
-	if (repmode == REP_NONE) {
 		goto inst;
 	}
+	rep_start();
 repeat:
 	if (cx == 0) {
 		return;
 	}
-	// TODO: Service interrupts
+	if (rep_cmps_bulk<w>(si_seg, di_seg, delta, budget)) {
+		goto check;
+	}
+	if (budget == 0) {
+		rep_suspend();
+		return;
+	}
+
+	--budget;
 	--cx;
 inst:
-	uint16_t a = mem_read(di_seg, di, w);
-	uint16_t b = mem_read(si_seg, si, w);
+	a = mem_read(di_seg, di, w);
+	b = mem_read(si_seg, si, w);
 	si += delta;
 	di += delta;
 
-	alu_w(ALU_CMP, b, a, w);
+	alu<ALU_CMP, w>(b, a);
 
 	cycles += 22;
 
+check:
 	if (repmode == REP_REP && get_zf()) {
 		goto repeat;
 	}
@@ -1717,32 +2432,42 @@ inst:
 	}
 }
 
+template<byte OP>
 void i8086_t::op_test_a_imm() {
-	bool w = op & 1;
+	constexpr bool w = OP & 1;
 	uint16_t imm = fetch(w);
 
 	uint16_t a = read_reg(REG_AX, w);
-	alu_w(ALU_AND, a, imm, w);
+	alu<ALU_AND, w>(a, imm);
 }
 
+template<byte OP>
 void i8086_t::op_stos() {
-	bool     w     = op & 1;
+	constexpr bool w = OP & 1;
 	uint16_t v     = read_reg(REG_AX, w);
 	int      delta = strop_delta(w);
-
-	cycles += 1;
-	if (repmode != REP_NONE) {
-		cycles += 9;
-	}
+	uint32_t budget = REP_CHUNK_LEN;
 
 	if (repmode == REP_NONE) {
+		cycles += 1;
 		goto inst;
 	}
+	if (rep_start()) {
+		cycles += 10;
+	}
 repeat:
 	if (cx == 0) {
 		return;
 	}
-	// TODO: Service interrupts
+	if (rep_stos_bulk<w>(v, delta, budget)) {
+		goto repeat;
+	}
+	if (budget == 0) {
+		rep_suspend();
+		return;
+	}
+
+	--budget;
 	--cx;
 inst:
 	mem_write(read_sreg(SEG_ES), di, v, w);
@@ -1755,26 +2480,34 @@ inst:
 	}
 }
 
+template<byte OP>
 void i8086_t::op_lods() {
-	bool     w     = op & 1;
+	constexpr bool w = OP & 1;
 	uint16_t seg   = read_sreg_ovr(SEG_DS);
 	int      delta = strop_delta(w);
+	uint32_t budget = REP_CHUNK_LEN;
 	uint16_t v;
 
-	if (repmode != REP_NONE) {
-		cycles += 9;
-	}
-
 	if (repmode == REP_NONE) {
 		goto inst;
 	}
+	if (rep_start()) {
+		cycles += 9;
+	}
 repeat:
 	if (cx == 0) {
 		return;
 	}
+	if (rep_lods_bulk<w>(seg, delta, budget)) {
+		goto repeat;
+	}
+	if (budget == 0) {
+		rep_suspend();
+		return;
+	}
 	cycles += 1;
 
-	// TODO: Service interrupts
+	--budget;
 	--cx;
 inst:
 	v = mem_read(seg, si, w);
@@ -1788,36 +2521,47 @@ inst:
 	}
 }
 
+template<byte OP>
 void i8086_t::op_scas() {
-	bool     w      = !!(op & 1);
+	constexpr bool w = !!(OP & 1);
 	int      delta  = strop_delta(w);
 	uint16_t di_seg = read_sreg_ovr(SEG_ES);
 
+	uint32_t budget = REP_CHUNK_LEN;
+
 	uint16_t a = read_reg(REG_AX, w);
 	uint16_t b;
 
-	if (repmode != REP_NONE) {
-		cycles += 9;
-	}
-
 	if (repmode == REP_NONE) {
 		goto inst;
 	}
+	if (rep_start()) {
+		cycles += 9;
+	}
 repeat:
 	if (cx == 0) {
 		return;
 	}
-	// TODO: Service interrupts
+	if (rep_scas_bulk<w>(di_seg, a, delta, budget)) {
+		goto check;
+	}
+	if (budget == 0) {
+		rep_suspend();
+		return;
+	}
+
+	--budget;
 	--cx;
 
 inst:
 	b = mem_read(di_seg, di, w);
 	di += delta;
 
-	alu_w(ALU_CMP, a, b, w);
+	alu<ALU_CMP, w>(a, b);
 
 	cycles += 15;
 
+check:
 	if (repmode == REP_REP && get_zf()) {
 		goto repeat;
 	}
@@ -1826,9 +2570,10 @@ inst:
 	}
 }
 
+template<byte OP>
 void i8086_t::op_mov_reg_imm() {
-	byte reg = op & 0b111;
-	bool w   = (op >> 3) & 1;
+	constexpr byte reg = OP & 0b111;
+	constexpr bool w   = (OP >> 3) & 1;
 	uint16_t imm = !w ? fetch8() : fetch16();
 	write_reg(reg, imm, w);
 
@@ -1836,20 +2581,16 @@ void i8086_t::op_mov_reg_imm() {
 }
 
 void i8086_t::op_ret_imm16_intraseg() {
-	ip = pop();
-	sp += fetch16();
+	uint16_t imm = fetch16();
 
-	if (!call_stack.empty()) {
-		call_stack.pop_back();
-	}
+	call_stack.ret(ss, sp);
+	ip = pop();
+	sp += imm;
 }
 
 void i8086_t::op_ret_intraseg() {
+	call_stack.ret(ss, sp);
 	ip = pop();
-
-	if (!call_stack.empty()) {
-		call_stack.pop_back();
-	}
 }
 
 void i8086_t::op_les_r16_m16() {
@@ -1884,8 +2625,9 @@ void i8086_t::op_lds_r16_m16() {
 	cycles += 16;
 }
 
+template<byte OP>
 void i8086_t::op_mov_m_imm() {
-	bool w = op & 1;
+	constexpr bool w = OP & 1;
 	byte modrm = fetch8();
 	modrm_t dst = modrm_mem_sw(modrm, false, w);
 	uint16_t imm = fetch(w);
@@ -1896,19 +2638,19 @@ void i8086_t::op_mov_m_imm() {
 }
 
 void i8086_t::op_ret_imm16_interseg() {
+	uint16_t imm = fetch16();
+
+	call_stack.ret(ss, sp);
 	ip = pop();
 	cs = pop();
 
-	sp += fetch16();
-
-	if (!call_stack.empty()) call_stack.pop_back();
+	sp += imm;
 }
 
 void i8086_t::op_ret_interseg() {
+	call_stack.ret(ss, sp);
 	ip = pop();
 	cs = pop();
-
-	if (!call_stack.empty()) call_stack.pop_back();
 }
 
 void i8086_t::op_int_3() {
@@ -1933,14 +2675,13 @@ void i8086_t::op_into() {
 }
 
 void i8086_t::op_iret() {
+	call_stack.ret(ss, sp);
 	ip = pop();
 	cs = pop();
-	flags = pop();
+	load_flags(pop());
 	int_delay = true;
 
 	cycles += 24;
-
-	call_stack.pop_back();
 }
 
 // TODO: Rotates also need to update OF
@@ -2064,9 +2805,10 @@ inline void sarw(uint16_t &v, bool &cf, byte n = 1) {
 	}
 }
 
+template<byte OP>
 void i8086_t::op_grp2_rmw() {
-	bool v = !!(op & 2);
-	bool w = !!(op & 1);
+	constexpr bool v = !!(OP & 2);
+	constexpr bool w = !!(OP & 1);
 	byte modrm  = fetch8();
 	byte func   = (modrm >> 3) & 0b111;
 	modrm_t dst = modrm_mem_sw(modrm, false, w);
@@ -2092,8 +2834,8 @@ void i8086_t::op_grp2_rmw() {
 
 	uint16_t src = read_modrm(dst);
 	uint16_t res = src;
-	bool cf = flags & FLAG_CF;
-	if (!w) {
+	bool cf = get_cf();
+	if constexpr (!w) {
 		switch (func) {
 			case 0: rolb(res, cf, n); break;
 			case 1: rorb(res, cf, n); break;
@@ -2234,7 +2976,7 @@ void i8086_t::op_in_al_imm8() {
 	byte port = fetch8();
 	byte v;
 
-	v = read(IO, port, W8);
+	v = bus->io_read8(port);
 	writelo(ax, v);
 
 	cycles += 10;
@@ -2243,7 +2985,7 @@ void i8086_t::op_in_al_imm8() {
 void i8086_t::op_in_ax_imm8() {
 	byte port = fetch8();
 
-	uint16_t v = read(IO, port, W16);
+	uint16_t v = bus->io_read16(port);
 	ax = v;
 
 	cycles += 10;
@@ -2252,15 +2994,15 @@ void i8086_t::op_in_ax_imm8() {
 void i8086_t::op_out_al_imm8() {
 	byte port = fetch8();
 
-	write(IO, port, W8, readlo(ax));
+	bus->io_write8(port, readlo(ax));
 
 	cycles += 10;
 }
 
 void i8086_t::op_out_ax_imm8() {
-	uint16_t imm = fetch16();
+	byte port = fetch8();
 
-	write(IO, imm, W16, ax);
+	bus->io_write16(port, ax);
 
 	cycles += 8;
 }
@@ -2271,11 +3013,7 @@ void i8086_t::op_call_near() {
 	sp -= 2;
 	mem_write16(ss, sp, ip);
 
-	call_stack.push_back({
-		{cs, op_ip},
-		{cs, uint16_t(ip + inc)},
-		false
-	});
+	call_stack.call({cs, op_ip}, {cs, uint16_t(ip + inc)}, ss, sp, false);
 
 	ip += inc;
 
@@ -2306,7 +3044,7 @@ void i8086_t::op_in_al_dx() {
 	uint16_t port = dx;
 	uint16_t v;
 
-	v = read(IO, port, W8);
+	v = bus->io_read8(port);
 	writelo(ax, v);
 
 	cycles += 8;
@@ -2314,7 +3052,7 @@ void i8086_t::op_in_al_dx() {
 
 void i8086_t::op_in_ax_dx() {
 	uint16_t port = dx;
-	uint16_t v = read(IO, port, W16);
+	uint16_t v = bus->io_read16(port);
 	ax = v;
 
 	cycles += 8;
@@ -2323,13 +3061,13 @@ void i8086_t::op_in_ax_dx() {
 void i8086_t::op_out_al_dx() {
 	uint16_t port = dx;
 
-	write(IO, port, W8, readlo(ax));
+	bus->io_write8(port, readlo(ax));
 }
 
 void i8086_t::op_out_ax_dx() {
 	uint16_t port = dx;
 
-	write(IO, port, W16, ax);
+	bus->io_write16(port, ax);
 }
 
 void i8086_t::op_lock_prefix() {
@@ -2385,8 +3123,9 @@ int32_t utos32(uint32_t v) {
 	return static_cast<int32_t>(v - INT32_MIN) + INT32_MIN;
 }
 
+template<byte OP>
 void i8086_t::op_grp3_rmw() {
-	bool w = !!(op & 1);
+	constexpr bool w = !!(OP & 1);
 	byte modrm  = fetch8();
 	byte func   = (modrm >> 3) & 0b111;
 	modrm_t mem = modrm_mem_sw(modrm, false, w);
@@ -2597,11 +3336,7 @@ void i8086_t::op_grp4_rm8() {
 			res = dst + src;
 			write_modrm(mem, res);
 
-			set_pf(pf8(res));
-			set_af(af8(res, dst, src));
-			set_zf(zf8(res));
-			set_sf(sf8(res));
-			set_of(of8_add(res, dst, src));
+			update_flags_inc8(res, dst);
 
 			cycles += 3;
 			if (mem.is_mem) {
@@ -2615,11 +3350,7 @@ void i8086_t::op_grp4_rm8() {
 			res = dst - src;
 			write_modrm(mem, res);
 
-			set_pf(pf8(res));
-			set_af(af8(res, dst, src));
-			set_zf(zf8(res));
-			set_sf(sf8(res));
-			set_of(of8_sub(res, dst, src));
+			update_flags_dec8(res, dst);
 
 			cycles += 3;
 			if (mem.is_mem) {
@@ -2671,11 +3402,7 @@ void i8086_t::op_call_rm16(byte modrm) {
 		cycles += 5;
 	}
 
-	call_stack.push_back({
-		{cs, op_ip},
-		{cs, ofs},
-		false
-	});
+	call_stack.call({cs, op_ip}, {cs, ofs}, ss, sp, false);
 }
 
 void i8086_t::op_call_far(byte modrm) {
@@ -2689,11 +3416,7 @@ void i8086_t::op_call_far(byte modrm) {
 
 	cycles += 37;
 
-	call_stack.push_back({
-		{cs, op_ip},
-		{seg, ofs},
-		false
-	});
+	call_stack.call({cs, op_ip}, {seg, ofs}, ss, sp, false);
 
 	cs = seg;
 	ip = ofs;
@@ -4,31 +4,79 @@
 #include "emu/emu.h"
 #include "emu/cpu_device.h"
 #include "emu/i8086_addr.h"
+#include "emu/i8086_call_stack.h"
 #include "support/types.h"
 
+#include <cassert>
 #include <functional>
 #include <vector>
 
+// Compute flags eagerly alongside the lazy flags and compare after every instruction.
+#ifndef LAZY_FLAGS_CHECK
+#define LAZY_FLAGS_CHECK 0
+#endif
+
+// Elements a REP string instruction runs per step before it restarts itself.
+#define REP_CHUNK_LEN 256
+
+class bus_t;
 class disasm_i8086_t;
+class i8086_breakpoints_t;
+class i8086_func_profiler_t;
+class i8086_hle_t;
+class i8086_profiler_t;
 class ibm5160_t;
 class names_t;
+class i8086_block_cache_t;
+class i8086_jit_t;
+class i8086_trace_t;
+struct i8086_block_t;
+struct i8086_insn_t;
 
 class i8086_t : public cpu_device_t {
-	int instr_count = 0;
+	uint64_t instr_count = 0;
 	uint64_t cycles = 0;
+	uint64_t clock_cycles = 0;   // What step() and run_block() returned
 
 	std::vector<callback_t> callbacks;
 	i8086_addr_t            callback_base_addr;
 	i8086_addr_t            callback_next_addr;
 
 	disasm_i8086_t         *disassembler = nullptr;
-	names_t                *names;
+	names_t                *names = nullptr;
+
+	// Predecoded instruction being executed, fetches are served from it.
+	i8086_block_t          *block = nullptr;
+	int                     block_index = 0;
+	i8086_insn_t           *insn = nullptr;
+	byte                    insn_pos = 0;
+
+	i8086_insn_t *next_insn();
+
+	// Last block run by run_block(), to chain to its successor.
+	i8086_block_t          *jit_prev = nullptr;
+
+	bool     exec_insn(i8086_insn_t *insn);
+	uint32_t run_block();
+
+	friend class i8086_hle_t;
+	friend class i8086_jit_t;
+	friend class i8086_live_trace_t;
 
 public:
-	read_cb_t  read;
-	write_cb_t write;
+	bus_t     *bus = nullptr;
+
+	i8086_block_cache_t   *block_cache;
+	i8086_jit_t           *jit;
+	i8086_call_stack_t     call_stack;
+	i8086_trace_t         *trace;
+	i8086_breakpoints_t   *breakpoints;
+	i8086_profiler_t      *profiler;
+	i8086_func_profiler_t *func_profiler;
+	i8086_hle_t           *hle = nullptr;   // Set by the machine
 
 	i8086_t();
+	~i8086_t();
 
 	double frequency_in_mhz() {
 		return 5.0;
@@ -39,12 +87,18 @@ public:
 	uint64_t next_cycles();
 	uint64_t run_cycles(uint64_t cycles);
 
+	void save_state(snapshot_writer_t &w);
+	bool load_state(snapshot_reader_t &r);
+
 	void dump_state();
-	void log_state();
+	void log_state() { log_state(log_cs, log_ip); }
+	void log_state(uint16_t at_cs, uint16_t at_ip);
 
 	void         set_callback_base(uint16_t callback_base_seg);
 	i8086_addr_t install_callback(uint16_t seg, uint16_t ofs, callback_t callback);
 
+	typedef void (i8086_t::*op_handler_t)();
+
 	uint32_t step();
 	uint32_t dispatch();
 
@@ -57,7 +111,8 @@ public:
 	void raise_intr(byte num);
 	void call_int(byte num);
 
-	void set_names(names_t *);
+	void     set_names(names_t *);
+	names_t *get_names() { return names; }
 
 	/* Registers */
 	enum {
@@ -95,6 +150,7 @@ public:
 		REP_REPNE,
 		REP_REP,
 	} repmode;
+	bool rep_resume;   // Restarting a REP string instruction that yielded mid-run
 
 	uint16_t log_cs;
 	uint16_t log_ip;
@@ -118,6 +174,8 @@ public:
 	uint16_t di;
 	uint16_t si;
 
+	// The status flags are only up to date when no lazy operation is pending,
+	// use get_flags() and load_flags() to access the whole register.
 	uint16_t flags;
 
 	enum {
@@ -130,23 +188,86 @@ public:
 		FLAG_IF = (1 <<  9),
 		FLAG_DF = (1 << 10),
 		FLAG_OF = (1 << 11),
+
+		FLAG_STATUS = FLAG_CF | FLAG_PF | FLAG_AF | FLAG_ZF | FLAG_SF | FLAG_OF,
 	};
 
+	/*
+	 * The last flag-setting operation, its status flags are computed
+	 * from the operands and result when they're read.
+	 */
+	enum lazy_op_t : byte {
+		LAZY_NONE,
+		LAZY_ADD,
+		LAZY_SUB,
+		LAZY_BIN,
+		LAZY_SHF,
+		LAZY_INC,
+		LAZY_DEC,
+	};
+
+	struct lazy_flags_t {
+		lazy_op_t op;
+		bool      w;
+		bool      cf; // Carry in for add/sub, carry out for shifts, kept carry for inc/dec
+		uint16_t  res;
+		uint16_t  dst;
+		uint16_t  src;
+	} lazy = {};
+
+#if LAZY_FLAGS_CHECK
+	uint16_t check_flags;
+	void check_lazy_flags();
+#endif
+
+	bool lazy_cf();
+	bool lazy_pf();
+	bool lazy_af();
+	bool lazy_zf();
+	bool lazy_sf();
+	bool lazy_of();
+	void materialize_flags();
+
+	void set_lazy(lazy_op_t op, bool w, uint16_t res, uint16_t dst, uint16_t src, bool cf) {
+		lazy = { op, w, cf, res, dst, src };
+	}
+
+	uint16_t get_flags() {
+		if (lazy.op != LAZY_NONE) {
+			materialize_flags();
+		}
+		return flags;
+	}
+
+	void load_flags(uint16_t v) {
+		lazy.op = LAZY_NONE;
+		flags = v;
+#if LAZY_FLAGS_CHECK
+		check_flags = v;
+#endif
+	}
+
 	void set_flags(uint16_t mask, bool cond) {
+		if ((mask & FLAG_STATUS) && lazy.op != LAZY_NONE) {
+			materialize_flags();
+		}
 		flags = cond ? (flags | mask) : (flags & ~mask);
+#if LAZY_FLAGS_CHECK
+		check_flags = cond ? (check_flags | mask) : (check_flags & ~mask);
+#endif
 	}
 
-	int get_log_flags() { return flags & (FLAG_CF | FLAG_PF | FLAG_ZF | FLAG_SF | FLAG_TF | FLAG_IF | FLAG_DF | FLAG_OF); }
+	int get_log_flags() { return get_flags() & (FLAG_CF | FLAG_PF | FLAG_ZF | FLAG_SF | FLAG_TF | FLAG_IF | FLAG_DF | FLAG_OF); }
 
-	bool get_cf() { return !!(flags & FLAG_CF); }
-	bool get_pf() { return !!(flags & FLAG_PF); }
-	bool get_af() { return !!(flags & FLAG_AF); }
-	bool get_zf() { return !!(flags & FLAG_ZF); }
-	bool get_sf() { return !!(flags & FLAG_SF); }
+	bool get_cf() { return lazy.op != LAZY_NONE ? lazy_cf() : !!(flags & FLAG_CF); }
+	bool get_pf() { return lazy.op != LAZY_NONE ? lazy_pf() : !!(flags & FLAG_PF); }
+	bool get_af() { return lazy.op != LAZY_NONE ? lazy_af() : !!(flags & FLAG_AF); }
+	bool get_zf() { return lazy.op != LAZY_NONE ? lazy_zf() : !!(flags & FLAG_ZF); }
+	bool get_sf() { return lazy.op != LAZY_NONE ? lazy_sf() : !!(flags & FLAG_SF); }
 	bool get_tf() { return !!(flags & FLAG_TF); }
 	bool get_if() { return !!(flags & FLAG_IF); }
 	bool get_df() { return !!(flags & FLAG_DF); }
-	bool get_of() { return !!(flags & FLAG_OF); }
+	bool get_of() { return lazy.op != LAZY_NONE ? lazy_of() : !!(flags & FLAG_OF); }
 
 	void set_cf(bool cond) { set_flags(FLAG_CF, cond); }
 	void set_pf(bool cond) { set_flags(FLAG_PF, cond); }
@@ -158,7 +279,9 @@ public:
 	void set_df(bool cond) { set_flags(FLAG_DF, cond); }
 	void set_of(bool cond) { set_flags(FLAG_OF, cond); }
 
-	int get_instr_count() { return instr_count; }
+	uint64_t get_instr_count()  { return instr_count; }
+	uint64_t get_cycles()       { return cycles; }
+	uint64_t get_clock_cycles() { return clock_cycles; }
 
 	struct modrm_t {
 		byte     v;
@@ -215,6 +338,7 @@ public:
 	uint16_t fetch(bool w) {
 		return !w ? fetch8() : fetch16();
 	}
+	uint16_t fetch_disp(byte mod, byte rm);
 
 	void     push(uint16_t v);
 	uint16_t pop();
@@ -246,6 +370,18 @@ public:
 		}
 	}
 
+	void rep_suspend();
+	bool rep_start();
+
+	byte *str_run_ptr(uint16_t seg, uint16_t ofs, int delta, uint32_t n, bool write);
+	template<bool w> bool rep_movs_bulk(uint16_t src_seg, int delta, uint32_t &budget);
+	template<bool w> bool rep_cmps_bulk(uint16_t si_seg, uint16_t di_seg, int delta, uint32_t &budget);
+	template<bool w> bool rep_stos_bulk(uint16_t v, int delta, uint32_t &budget);
+	template<bool w> bool rep_lods_bulk(uint16_t seg, int delta, uint32_t &budget);
+	template<bool w> bool rep_scas_bulk(uint16_t di_seg, uint16_t a, int delta, uint32_t &budget);
+
+	template<byte func, bool w>
+	uint16_t alu(uint16_t a, uint16_t b);
 	uint16_t alu_w(byte func, uint16_t a, uint16_t b, bool w);
 
 	void update_flags_add8(uint8_t res, uint8_t dst, uint8_t src, bool cf = 0);
@@ -253,19 +389,23 @@ public:
 	void update_flags_bin8(uint8_t res, uint8_t dst, uint8_t src);
 	void update_flags_shf8(uint8_t res, uint8_t src, bool cf);
 	void update_flags_rot8(uint8_t res, uint8_t src, bool cf);
+	void update_flags_inc8(uint8_t res, uint8_t dst);
+	void update_flags_dec8(uint8_t res, uint8_t dst);
 	void update_flags_add16(uint16_t res, uint16_t dst, uint16_t src, bool cf = 0);
 	void update_flags_sub16(uint16_t res, uint16_t dst, uint16_t src, bool cf = 0);
 	void update_flags_bin16(uint16_t res, uint16_t dst, uint16_t src);
 	void update_flags_shf16(uint16_t res, uint16_t src, bool cf);
 	void update_flags_rot16(uint16_t res, uint16_t src, bool cf);
+	void update_flags_inc16(uint16_t res, uint16_t dst);
+	void update_flags_dec16(uint16_t res, uint16_t dst);
 
 	void unimplemented(const char *op_name, int line);
 	void op_unused();
 
-	void op_alu_r_rm();
-	void op_alu_a_imm();
-	void op_push_sreg();
-	void op_pop_sreg();
+	template<byte OP> void op_alu_r_rm();
+	template<byte OP> void op_alu_a_imm();
+	template<byte OP> void op_push_sreg();
+	template<byte OP> void op_pop_sreg();
 	void op_seg_ovr_es();
 	void op_daa();
 	void op_seg_ovr_cs();
@@ -274,19 +414,19 @@ public:
 	void op_aaa();
 	void op_seg_ovr_ds();
 	void op_aas();
-	void op_inc_reg();
-	void op_dec_reg();
-	void op_push_reg();
-	void op_pop_reg();
-	void op_jcc();
-	void op_grp1_rmw_imm();
-	void op_test_rm_r();
-	void op_xchg_rm_r();
-	void op_mov_rm_r();
-	void op_mov_rm16_sreg();
+	template<byte OP> void op_inc_reg();
+	template<byte OP> void op_dec_reg();
+	template<byte OP> void op_push_reg();
+	template<byte OP> void op_pop_reg();
+	template<byte OP> void op_jcc();
+	template<byte OP> void op_grp1_rmw_imm();
+	template<byte OP> void op_test_rm_r();
+	template<byte OP> void op_xchg_rm_r();
+	template<byte OP> void op_mov_rm_r();
+	template<byte OP> void op_mov_rm16_sreg();
 	void op_lea_r16_m16();
 	void op_pop_rm16();
-	void op_xchg_ax_r();
+	template<byte OP> void op_xchg_ax_r();
 	void op_cbw();
 	void op_cwd();
 	void op_call_far();
@@ -295,26 +435,26 @@ public:
 	void op_popf();
 	void op_sahf();
 	void op_lahf();
-	void op_mov_a_m();
-	void op_movs();
-	void op_cmps();
-	void op_test_a_imm();
-	void op_stos();
-	void op_lods();
-	void op_scas();
-	void op_mov_reg_imm();
+	template<byte OP> void op_mov_a_m();
+	template<byte OP> void op_movs();
+	template<byte OP> void op_cmps();
+	template<byte OP> void op_test_a_imm();
+	template<byte OP> void op_stos();
+	template<byte OP> void op_lods();
+	template<byte OP> void op_scas();
+	template<byte OP> void op_mov_reg_imm();
 	void op_ret_imm16_intraseg();
 	void op_ret_intraseg();
 	void op_les_r16_m16();
 	void op_lds_r16_m16();
-	void op_mov_m_imm();
+	template<byte OP> void op_mov_m_imm();
 	void op_ret_imm16_interseg();
 	void op_ret_interseg();
 	void op_int_3();
 	void op_int_imm8();
 	void op_into();
 	void op_iret();
-	void op_grp2_rmw();
+	template<byte OP> void op_grp2_rmw();
 	void op_aam();
 	void op_aad();
 	void op_salc();
@@ -341,7 +481,7 @@ public:
 	void op_rep();
 	void op_hlt();
 	void op_cmc();
-	void op_grp3_rmw();
+	template<byte OP> void op_grp3_rmw();
 	void op_clc();
 	void op_stc();
 	void op_cli();
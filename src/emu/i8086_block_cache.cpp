@@ -0,0 +1,245 @@
+#include "emu/i8086_block_cache.h"
+
+#include "emu/bus.h"
+#include "emu/i8086.h"
+#include "emu/i8086_hle.h"
+
+#include <cstring>
+
+enum {
+	F_MODRM  = 0x01, // Has a ModRM byte
+	F_IMM8   = 0x02, // Followed by an 8-bit immediate
+	F_IMM16  = 0x04, // Followed by a 16-bit immediate
+	F_IMM32  = 0x08, // Followed by a 32-bit immediate (far pointer)
+	F_PREFIX = 0x10, // Prefix, part of the following instruction
+	F_END    = 0x20, // Ends the block
+	F_GROUP  = 0x40, // Format depends on the ModRM reg field
+};
+
+#define M  F_MODRM
+#define I8 F_IMM8
+#define IW F_IMM16
+#define IF F_IMM32
+#define P  F_PREFIX
+#define E  F_END
+#define G  F_GROUP
+
+static const byte opcode_format[256] = {
+	/*       0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f  */
+	/* 0 */  M,    M,    M,    M,    I8,   IW,   0,    0,    M,    M,    M,    M,    I8,   IW,   0,    E,
+	/* 1 */  M,    M,    M,    M,    I8,   IW,   0,    0,    M,    M,    M,    M,    I8,   IW,   0,    0,
+	/* 2 */  M,    M,    M,    M,    I8,   IW,   P,    0,    M,    M,    M,    M,    I8,   IW,   P,    0,
+	/* 3 */  M,    M,    M,    M,    I8,   IW,   P,    0,    M,    M,    M,    M,    I8,   IW,   P,    0,
+	/* 4 */  0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+	/* 5 */  0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+	/* 6 */  I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E,
+	/* 7 */  I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E, I8|E,
+	/* 8 */  M|I8, M|IW, M|I8, M|I8, M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M|G,  M,
+	/* 9 */  0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    IF|E, 0,    0,    0,    0,    0,
+	/* a */  IW,   IW,   IW,   IW,   0,    0,    0,    0,    I8,   IW,   0,    0,    0,    0,    0,    0,
+	/* b */  I8,   I8,   I8,   I8,   I8,   I8,   I8,   I8,   IW,   IW,   IW,   IW,   IW,   IW,   IW,   IW,
+	/* c */  IW|E, E,    IW|E, E,    M,    M,    M|I8, M|IW, IW|E, E,    IW|E, E,    E,    I8|E, E,    E,
+	/* d */  M,    M,    M,    M,    I8,   I8,   0,    0,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* e */  I8|E, I8|E, I8|E, I8|E, I8,   I8,   I8,   I8,   IW|E, IW|E, IF|E, I8|E, 0,    0,    0,    0,
+	/* f */  0,    0,    P,    P,    0,    0,    M|G,  M|G,  0,    0,    0,    0,    0,    0,    M|G,  M|G,
+};
+
+#undef G
+#undef E
+#undef P
+#undef IF
+#undef IW
+#undef I8
+#undef M
+
+static inline
+uint32_t block_hash(uint32_t linear) {
+	return (linear ^ (linear >> 12)) & (BLOCK_CACHE_SIZE - 1);
+}
+
+i8086_block_cache_t::i8086_block_cache_t(i8086_t *cpu) :
+	cpu(cpu)
+{
+	blocks = new i8086_block_t[BLOCK_CACHE_SIZE];
+	flush();
+}
+
+i8086_block_cache_t::~i8086_block_cache_t() {
+	delete[] blocks;
+}
+
+bool i8086_block_cache_t::is_prefix(byte op) {
+	return opcode_format[op] & F_PREFIX;
+}
+
+bool i8086_block_cache_t::has_modrm(byte op) {
+	return opcode_format[op] & F_MODRM;
+}
+
+void i8086_block_cache_t::flush() {
+	memset(blocks, 0, BLOCK_CACHE_SIZE * sizeof(i8086_block_t));
+	memset(code_pages, 0, sizeof(code_pages));
+
+	// Start at generation 1 so zeroed blocks never validate.
+	for (uint32_t page = 0; page != CODE_PAGE_COUNT; ++page) {
+		page_gen[page] = 1;
+	}
+}
+
+void i8086_block_cache_t::invalidate_page(uint32_t page) {
+	page_gen[page]++;
+	code_pages[page] = false;
+}
+
+i8086_block_t *i8086_block_cache_t::lookup(uint16_t cs, uint16_t ip) {
+	uint32_t linear = 0x10 * cs + ip;
+	i8086_block_t &block = blocks[block_hash(linear)];
+
+	if (block.linear != linear || block.cs != cs || block.ip != ip || !is_valid(&block)) {
+		decode_block(block, cs, ip);
+	}
+
+	return &block;
+}
+
+void i8086_block_cache_t::decode_block(i8086_block_t &block, uint16_t cs, uint16_t ip) {
+	uint32_t linear = 0x10 * cs + ip;
+
+	block.linear = linear;
+	block.cs     = cs;
+	block.ip     = ip;
+	block.count  = 0;
+
+	block.exec_count = 0;
+	block.code       = nullptr;
+	block.link       = nullptr;
+
+	if (cpu->hle) {
+		cpu->hle->code_decoded(linear);
+	}
+
+	// Hooked routines are entered through step(), blocks end before them.
+	bool ends_block = false;
+	uint32_t end_linear = linear;
+	while (!ends_block && block.count != BLOCK_MAX_INSNS) {
+		if (block.count && cpu->hle && cpu->hle->hooked(0x10 * cs + ip)) {
+			break;
+		}
+		i8086_insn_t &insn = block.insns[block.count];
+		if (!decode_insn(cs, ip, insn, ends_block)) {
+			break;
+		}
+		end_linear = 0x10 * cs + ip + insn.len - 1;
+		block.count++;
+
+		// Don't follow the instruction pointer around the segment.
+		if (ip + insn.len > 0xffff) {
+			break;
+		}
+		ip += insn.len;
+	}
+
+	block.page[0] = (linear & (MEMORY_SIZE - 1)) / DIRTY_PAGE_SIZE;
+	block.page[1] = (end_linear & (MEMORY_SIZE - 1)) / DIRTY_PAGE_SIZE;
+	block.gen[0]  = page_gen[block.page[0]];
+	block.gen[1]  = page_gen[block.page[1]];
+
+	code_pages[block.page[0]] = true;
+	code_pages[block.page[1]] = true;
+}
+
+bool i8086_block_cache_t::decode_insn(uint16_t cs, uint16_t ip, i8086_insn_t &insn, bool &ends_block) {
+	insn.ip       = ip;
+	insn.len      = 0;
+	insn.disp_len = 0;
+	insn.disp     = 0;
+
+	auto next_byte = [&](byte &b) {
+		if (insn.len == INSN_MAX_LEN || 0x10 * cs + ip + insn.len >= MEMORY_SIZE) {
+			return false;
+		}
+		b = cpu->bus->peek8(0x10 * cs + uint16_t(ip + insn.len));
+		insn.bytes[insn.len++] = b;
+		return true;
+	};
+
+	byte op;
+	do {
+		if (!next_byte(op)) {
+			return false;
+		}
+	} while (opcode_format[op] & F_PREFIX);
+
+	byte format = opcode_format[op];
+	ends_block = format & F_END;
+
+	int imm_len = 0;
+	if (format & F_IMM8) {
+		imm_len = 1;
+	} else if (format & F_IMM16) {
+		imm_len = 2;
+	} else if (format & F_IMM32) {
+		imm_len = 4;
+	}
+
+	if (format & F_MODRM) {
+		byte modrm;
+		if (!next_byte(modrm)) {
+			return false;
+		}
+
+		byte mod = (modrm >> 6);
+		byte reg = (modrm >> 3) & 0b111;
+		byte rm  = (modrm >> 0) & 0b111;
+
+		if (mod == 0b01) {
+			insn.disp_len = 1;
+		} else if (mod == 0b10 || (mod == 0b00 && rm == 0b110)) {
+			insn.disp_len = 2;
+		}
+
+		byte disp[2];
+		for (int i = 0; i != insn.disp_len; ++i) {
+			if (!next_byte(disp[i])) {
+				return false;
+			}
+		}
+		if (insn.disp_len == 1) {
+			insn.disp = (disp[0] & 0x80) ? (0xff00 | disp[0]) : disp[0];
+		} else if (insn.disp_len == 2) {
+			insn.disp = readle16(disp);
+		}
+
+		if (format & F_GROUP) {
+			switch (op) {
+				case 0x8e: // mov sreg, r/m16
+					ends_block = reg == i8086_t::SEG_CS;
+					break;
+				case 0xf6: // test r/m8, imm8
+					imm_len = reg < 0b010 ? 1 : 0;
+					break;
+				case 0xf7: // test r/m16, imm16
+					imm_len = reg < 0b010 ? 2 : 0;
+					break;
+				case 0xfe: // Native callback trap
+					if (modrm == 0x38) {
+						imm_len = 2;
+						ends_block = true;
+					}
+					break;
+				case 0xff: // call/jmp r/m16, call/jmp m16:16
+					ends_block = reg >= 0b010 && reg <= 0b101;
+					break;
+			}
+		}
+	}
+
+	for (int i = 0; i != imm_len; ++i) {
+		byte b;
+		if (!next_byte(b)) {
+			return false;
+		}
+	}
+
+	return true;
+}
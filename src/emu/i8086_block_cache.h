@@ -0,0 +1,91 @@
+#ifndef EMU_I8086_BLOCK_CACHE
+#define EMU_I8086_BLOCK_CACHE
+
+#include "emu/ibm5160.h"
+#include "support/types.h"
+
+class i8086_t;
+
+#define BLOCK_CACHE_SIZE      4096
+#define BLOCK_MAX_INSNS       32
+#define INSN_MAX_LEN          10
+#define CODE_PAGE_COUNT       (MEMORY_SIZE / DIRTY_PAGE_SIZE)
+
+/*
+ * A predecoded instruction: its raw bytes (prefixes included), its
+ * length, and the ModRM displacement already extracted and sign-extended.
+ */
+struct i8086_insn_t {
+	uint16_t ip;
+	byte     len;
+	byte     disp_len;
+	uint16_t disp;
+	byte     bytes[INSN_MAX_LEN];
+};
+
+/*
+ * A run of instructions starting at cs:ip and ending at the first control
+ * transfer. The block is valid as long as the generation of the pages it
+ * was decoded from hasn't changed.
+ */
+struct i8086_block_t {
+	uint32_t     linear;
+	uint16_t     cs;
+	uint16_t     ip;
+	byte         count;
+	byte         page[2];
+	uint32_t     gen[2];
+
+	uint32_t       exec_count;
+	void          *code;       // Translated by the JIT
+	i8086_block_t *link;       // Block that last followed this one
+	i8086_insn_t insns[BLOCK_MAX_INSNS];
+};
+
+class i8086_block_cache_t {
+	i8086_t       *cpu;
+	i8086_block_t *blocks;
+
+	uint32_t page_gen[CODE_PAGE_COUNT];
+	bool     code_pages[CODE_PAGE_COUNT];
+
+	bool decode_insn(uint16_t cs, uint16_t ip, i8086_insn_t &insn, bool &ends_block);
+	void decode_block(i8086_block_t &block, uint16_t cs, uint16_t ip);
+
+public:
+	bool enabled = true;
+
+	i8086_block_cache_t(i8086_t *cpu);
+	~i8086_block_cache_t();
+
+	i8086_block_t *lookup(uint16_t cs, uint16_t ip);
+
+	bool is_valid(const i8086_block_t *block) {
+		return block->gen[0] == page_gen[block->page[0]]
+		    && block->gen[1] == page_gen[block->page[1]];
+	}
+
+	void invalidate_page(uint32_t page);
+	void flush();
+
+	static bool is_prefix(byte op);
+	static bool has_modrm(byte op);
+
+	// Called for every write to guest memory.
+	void memory_written(uint32_t addr, uint32_t len) {
+		uint32_t first_page = (addr & (MEMORY_SIZE - 1)) / DIRTY_PAGE_SIZE;
+		uint32_t last_page  = ((addr + len - 1) & (MEMORY_SIZE - 1)) / DIRTY_PAGE_SIZE;
+
+		// Like on the bus, a write past the end of memory wraps to its start.
+		for (uint32_t page = first_page; ; page = (page + 1) % CODE_PAGE_COUNT) {
+			if (code_pages[page]) {
+				invalidate_page(page);
+			}
+			if (page == last_page) {
+				break;
+			}
+		}
+	}
+};
+
+#endif
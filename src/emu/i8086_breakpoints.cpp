@@ -0,0 +1,157 @@
+#include "emu/i8086_breakpoints.h"
+
+#include "emu/i8086.h"
+
+#include <algorithm>
+#include <cstring>
+
+i8086_breakpoints_t::i8086_breakpoints_t(i8086_t *a_cpu) {
+	cpu = a_cpu;
+	memset(exec_map, 0, sizeof(exec_map));
+}
+
+bool i8086_breakpoints_t::add(uint32_t addr, const std::string &condition, bool log) {
+	breakpoint_t bp;
+	if (!bp.condition.compile(condition)) {
+		error = bp.condition.error;
+		return false;
+	}
+	bp.log = log;
+
+	addr &= MEM_ADDR_MASK;
+	if (!has(addr)) {
+		exec_map[addr / 64] |= uint64_t(1) << (addr % 64);
+		exec_count++;
+	}
+	exec_breakpoints[addr] = std::move(bp);
+	return true;
+}
+
+void i8086_breakpoints_t::remove(uint32_t addr) {
+	addr &= MEM_ADDR_MASK;
+	if (has(addr)) {
+		exec_map[addr / 64] &= ~(uint64_t(1) << (addr % 64));
+		exec_count--;
+		exec_breakpoints.erase(addr);
+	}
+}
+
+std::vector<uint32_t> i8086_breakpoints_t::list() {
+	std::vector<uint32_t> addrs;
+	for (uint32_t i = 0; i != MEM_ADDR_SIZE / 64 && addrs.size() != exec_count; ++i) {
+		for (uint64_t bits = exec_map[i]; bits; bits &= bits - 1) {
+			addrs.push_back(64 * i + __builtin_ctzll(bits));
+		}
+	}
+	return addrs;
+}
+
+const i8086_breakpoints_t::breakpoint_t *i8086_breakpoints_t::get(uint32_t addr) {
+	auto it = exec_breakpoints.find(addr & MEM_ADDR_MASK);
+	return it != exec_breakpoints.end() ? &it->second : nullptr;
+}
+
+void i8086_breakpoints_t::add_watch(uint32_t addr, uint32_t len, byte flags) {
+	if (len == 0 || !(flags & (WATCH_READ | WATCH_WRITE))) {
+		return;
+	}
+	uint32_t limit = (flags & WATCH_IO) ? IO_PORT_COUNT : MEM_ADDR_SIZE;
+	addr = std::min(addr, limit - 1);
+	watches.push_back({ addr, std::min(len, limit - addr), flags });
+	update_watches();
+}
+
+void i8086_breakpoints_t::remove_watch(size_t i) {
+	if (i < watches.size()) {
+		watches.erase(watches.begin() + i);
+		update_watches();
+	}
+}
+
+void i8086_breakpoints_t::forget_stop() {
+	skip_addr = UINT32_MAX;
+}
+
+void i8086_breakpoints_t::clear() {
+	memset(exec_map, 0, sizeof(exec_map));
+	exec_count = 0;
+	exec_breakpoints.clear();
+	skip_addr = UINT32_MAX;
+	watches.clear();
+	update_watches();
+}
+
+// Recomputes the page and port flags from the watched ranges.
+void i8086_breakpoints_t::update_watches() {
+	bus_t *bus = cpu->bus;
+
+	bus->watch_handler = [this](uint32_t addr, byte v, byte flags) {
+		watch_hit(addr, v, flags);
+	};
+
+	std::vector<byte> page_flags(MEM_PAGE_COUNT);
+	std::vector<byte> port_flags(IO_PORT_COUNT);
+
+	for (const auto &w : watches) {
+		if (w.flags & WATCH_IO) {
+			for (uint32_t port = w.addr; port != w.addr + w.len; ++port) {
+				port_flags[port] |= w.flags;
+			}
+		} else {
+			for (uint32_t page = w.addr / MEM_PAGE_SIZE; page <= (w.addr + w.len - 1) / MEM_PAGE_SIZE; ++page) {
+				page_flags[page] |= w.flags;
+			}
+		}
+	}
+
+	for (uint32_t page = 0; page != MEM_PAGE_COUNT; ++page) {
+		bus->set_page_watch(page, page_flags[page]);
+	}
+	for (uint32_t port = 0; port != IO_PORT_COUNT; ++port) {
+		bus->set_io_watch(port, port_flags[port]);
+	}
+}
+
+bool i8086_breakpoints_t::exec_hit(uint32_t addr) {
+	if (addr == skip_addr) {
+		skip_addr = UINT32_MAX;
+		return false;
+	}
+
+	breakpoint_t &bp = exec_breakpoints[addr];
+	bp.hits++;
+	if (!bp.condition.eval(cpu, bp.hits)) {
+		return false;
+	}
+	bp.matches++;
+
+	// log_cs and log_ip are saved in snapshots, a log breakpoint leaves them alone.
+	if (bp.log) {
+		cpu->log_state(cpu->cs, cpu->ip);
+		return false;
+	}
+
+	skip_addr  = addr;
+	stop       = true;
+	last_break = { 0, addr, 0, cpu->cs, cpu->ip };
+	break_count++;
+	return true;
+}
+
+// Pages are watched as a whole, only accesses in a watched range stop the CPU.
+void i8086_breakpoints_t::watch_hit(uint32_t addr, byte v, byte flags) {
+	if (stop) {
+		return;
+	}
+
+	for (const auto &w : watches) {
+		if ((w.flags & WATCH_IO) == (flags & WATCH_IO) && (w.flags & flags & (WATCH_READ | WATCH_WRITE))
+		 && addr >= w.addr && addr - w.addr < w.len)
+		{
+			stop       = true;
+			last_break = { flags, addr, v, cpu->cs, cpu->op_ip };
+			break_count++;
+			return;
+		}
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef EMU_I8086_BREAKPOINTS
+#define EMU_I8086_BREAKPOINTS
+
+#include "emu/bus.h"
+#include "emu/i8086_condition.h"
+#include "support/types.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class i8086_t;
+
+// Why the CPU stopped, flags is 0 for a breakpoint or the WATCH_* flags of the access.
+struct i8086_break_t {
+	byte     flags;
+	uint32_t addr;
+	byte     value;
+	uint16_t cs;
+	uint16_t ip;   // Instruction that hit the breakpoint or made the access
+};
+
+/*
+ * Execution breakpoints are a bit per linear address, tested before every
+ * instruction, so their number doesn't matter. Only when the bit is set
+ * is the breakpoint looked up and its condition evaluated, a log
+ * breakpoint then prints the state and lets the CPU go on. Watchpoints set flags on
+ * the bus pages and ports they cover, accesses there take the slow path
+ * and are matched against the watched ranges. A hit sets stop and the
+ * CPU stops between instructions. The JIT isn't used while any are set.
+ */
+class i8086_breakpoints_t {
+public:
+	struct breakpoint_t {
+		i8086_condition_t condition;
+		bool              log = false;   // Print the state instead of stopping
+		uint64_t          hits = 0;      // Times reached
+		uint64_t          matches = 0;   // Times the condition held
+	};
+
+	struct watch_t {
+		uint32_t addr;
+		uint32_t len;
+		byte     flags;   // WATCH_READ and WATCH_WRITE, WATCH_IO for ports
+	};
+
+private:
+	i8086_t *cpu;
+
+	uint64_t exec_map[MEM_ADDR_SIZE / 64];
+	size_t   exec_count = 0;
+	uint32_t skip_addr = UINT32_MAX;   // Breakpoint stopped at, passed once when resuming
+
+	std::unordered_map<uint32_t, breakpoint_t> exec_breakpoints;
+
+	std::vector<watch_t> watches;
+
+	bool exec_hit(uint32_t addr);
+	void watch_hit(uint32_t addr, byte v, byte flags);
+	void update_watches();
+
+public:
+	bool          stop = false;
+	i8086_break_t last_break = {};
+	uint64_t      break_count = 0;
+	std::string   error;   // Why the last add() failed
+
+	i8086_breakpoints_t(i8086_t *cpu);
+
+	bool active() {
+		return exec_count || !watches.empty();
+	}
+
+	// An empty condition always holds, a bad one leaves the breakpoints as they were.
+	bool add(uint32_t addr, const std::string &condition = "", bool log = false);
+	void remove(uint32_t addr);
+	bool has(uint32_t addr) {
+		addr &= MEM_ADDR_MASK;
+		return exec_map[addr / 64] & (uint64_t(1) << (addr % 64));
+	}
+	std::vector<uint32_t> list();
+	const breakpoint_t   *get(uint32_t addr);
+
+	void add_watch(uint32_t addr, uint32_t len, byte flags);
+	void remove_watch(size_t i);
+	const std::vector<watch_t> &get_watches() { return watches; }
+
+	void clear();
+
+	// The CPU moved without passing the breakpoint it stopped at, it isn't skipped on resuming.
+	void forget_stop();
+
+	// Before each instruction, true and stop set if there's a breakpoint at cs:ip.
+	bool check(uint16_t cs, uint16_t ip) {
+		uint32_t addr = (0x10 * cs + ip) & MEM_ADDR_MASK;
+		if (!(exec_map[addr / 64] & (uint64_t(1) << (addr % 64)))) {
+			return false;
+		}
+		return exec_hit(addr);
+	}
+};
+
+#endif
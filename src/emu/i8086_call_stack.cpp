@@ -0,0 +1,16 @@
+#include "emu/i8086_call_stack.h"
+
+#include <cstdio>
+
+void i8086_call_stack_t::dump() const {
+	printf("Callstack:\n");
+	for (uint32_t i = 0; i < size(); i++) {
+		const call_stack_entry_t &e = (*this)[i];
+		printf("\t%3u: %04x:%04x -> %04x:%04x%s\n", i,
+			e.from.seg, e.from.ofs,
+			e.to.seg, e.to.ofs,
+			e.is_int ? " - interrupt" : ""
+		);
+	}
+	printf("\n");
+}
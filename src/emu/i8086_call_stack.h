@@ -0,0 +1,122 @@
+#ifndef EMU_I8086_CALL_STACK
+#define EMU_I8086_CALL_STACK
+
+#include "emu/i8086_addr.h"
+#include "emu/i8086_func_profiler.h"
+#include "support/types.h"
+
+// Track calls and interrupts in a shadow call stack for the debugger.
+#ifndef CALL_STACK_ENABLE
+#define CALL_STACK_ENABLE 1
+#endif
+
+#define CALL_STACK_SIZE 256   // Must be a power of two
+
+struct call_stack_entry_t {
+	i8086_addr_t from;
+	i8086_addr_t to;
+	uint16_t     ss;
+	uint16_t     sp;       // Where the return address was pushed
+	bool         is_int;
+};
+
+/*
+ * Shadow call stack, kept in a ring of the most recent CALL_STACK_SIZE
+ * frames. Frames remember where their return address lives on the guest
+ * stack, so a return pops its own frame along with any frames deeper on
+ * the same stack that were unwound without one, and a return that
+ * doesn't match a frame (a computed jump through ret) leaves the stack
+ * alone.
+ */
+class i8086_call_stack_t {
+#if CALL_STACK_ENABLE
+	call_stack_entry_t entries[CALL_STACK_SIZE];
+	uint32_t           top = 0;    // Index past the innermost frame, wraps around
+	uint32_t           count = 0;
+
+	const call_stack_entry_t &innermost() const {
+		return entries[(top - 1) % CALL_STACK_SIZE];
+	}
+
+	// Drops frames at or below ss:sp, they can't be returned to anymore.
+	void unwind(uint16_t ss, uint16_t sp) {
+		while (count && innermost().ss == ss && innermost().sp <= sp) {
+			--top;
+			--count;
+		}
+	}
+#endif
+
+public:
+	// Told about every call and return while function profiling runs.
+	i8086_func_profiler_t *func_profiler = nullptr;
+
+	// Called after the return address of a call or interrupt was pushed at ss:sp.
+	void call(i8086_addr_t from, i8086_addr_t to, uint16_t ss, uint16_t sp, bool is_int) {
+		if (func_profiler) {
+			func_profiler->call(to, ss, sp, is_int);
+		}
+#if CALL_STACK_ENABLE
+		unwind(ss, sp);
+		entries[top % CALL_STACK_SIZE] = { from, to, ss, sp, is_int };
+		++top;
+		if (count < CALL_STACK_SIZE) {
+			++count;
+		}
+#else
+		(void)from; (void)to; (void)ss; (void)sp; (void)is_int;
+#endif
+	}
+
+	// Called before a return pops its return address from ss:sp.
+	void ret(uint16_t ss, uint16_t sp) {
+		if (func_profiler) {
+			func_profiler->ret(ss, sp);
+		}
+#if CALL_STACK_ENABLE
+		while (count && innermost().ss == ss && innermost().sp < sp) {
+			--top;
+			--count;
+		}
+		if (count && innermost().ss == ss && innermost().sp == sp) {
+			--top;
+			--count;
+		}
+#else
+		(void)ss; (void)sp;
+#endif
+	}
+
+	void clear() {
+		if (func_profiler) {
+			func_profiler->clear_frames();
+		}
+#if CALL_STACK_ENABLE
+		top = 0;
+		count = 0;
+#endif
+	}
+
+	// Frames from the outermost one kept to the innermost.
+	uint32_t size() const {
+#if CALL_STACK_ENABLE
+		return count;
+#else
+		return 0;
+#endif
+	}
+
+	const call_stack_entry_t &operator[](uint32_t i) const {
+#if CALL_STACK_ENABLE
+		return entries[(top - count + i) % CALL_STACK_SIZE];
+#else
+		static const call_stack_entry_t none = {};
+		(void)i;
+		return none;
+#endif
+	}
+
+	void dump() const;
+};
+
+#endif
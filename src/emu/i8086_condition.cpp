@@ -0,0 +1,370 @@
+#include "emu/i8086_condition.h"
+
+#include "emu/bus.h"
+#include "emu/i8086.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+static const struct {
+	const char         *name;
+	uint16_t i8086_t::*reg;
+} reg16_names[] = {
+	{ "ax", &i8086_t::ax }, { "bx", &i8086_t::bx }, { "cx", &i8086_t::cx }, { "dx", &i8086_t::dx },
+	{ "si", &i8086_t::si }, { "di", &i8086_t::di }, { "bp", &i8086_t::bp }, { "sp", &i8086_t::sp },
+	{ "cs", &i8086_t::cs }, { "ds", &i8086_t::ds }, { "es", &i8086_t::es }, { "ss", &i8086_t::ss },
+	{ "ip", &i8086_t::ip },
+};
+
+// Index into reg16_names times two, plus one for the high byte.
+static const struct {
+	const char *name;
+	uint32_t    arg;
+} reg8_names[] = {
+	{ "al", 0 }, { "ah", 1 }, { "bl", 2 }, { "bh", 3 }, { "cl", 4 }, { "ch", 5 }, { "dl", 6 }, { "dh", 7 },
+};
+
+static const struct {
+	const char *name;
+	uint16_t    mask;
+} flag_names[] = {
+	{ "cf", i8086_t::FLAG_CF }, { "pf", i8086_t::FLAG_PF }, { "af", i8086_t::FLAG_AF },
+	{ "zf", i8086_t::FLAG_ZF }, { "sf", i8086_t::FLAG_SF }, { "tf", i8086_t::FLAG_TF },
+	{ "if", i8086_t::FLAG_IF }, { "df", i8086_t::FLAG_DF }, { "of", i8086_t::FLAG_OF },
+};
+
+#define BINARY_LEVELS 10
+
+void i8086_condition_t::emit(opcode_t op, uint32_t arg, int stack_change) {
+	code.push_back({ op, arg });
+	depth += stack_change;
+	max_depth = std::max(max_depth, depth);
+}
+
+// Constant operands are folded right away.
+void i8086_condition_t::emit_binary(opcode_t op) {
+	size_t n = code.size();
+	if (n >= 2 && code[n - 2].op == OP_CONST && code[n - 1].op == OP_CONST) {
+		code[n - 2].arg = apply(op, code[n - 2].arg, code[n - 1].arg);
+		code.pop_back();
+		depth--;
+		return;
+	}
+	emit(op, 0, -1);
+}
+
+bool i8086_condition_t::fail(const char *message) {
+	error = std::string(message) + " at column " + std::to_string(p - text.c_str() + 1);
+	return false;
+}
+
+void i8086_condition_t::skip_space() {
+	while (isspace(byte(*p))) {
+		p++;
+	}
+}
+
+// Single character operators don't match the start of a longer one, & isn't &&.
+bool i8086_condition_t::accept(const char *token) {
+	skip_space();
+	size_t len = strlen(token);
+	if (strncmp(p, token, len)) {
+		return false;
+	}
+	if (len == 1 && strchr("&|<>!", token[0]) && ((p[1] == token[0] && token[0] != '!') || p[1] == '=')) {
+		return false;
+	}
+	p += len;
+	return true;
+}
+
+bool i8086_condition_t::parse_binary(int level) {
+	// By precedence level, lowest first, longer tokens before their prefixes.
+	static const struct {
+		const char *token;
+		int         level;
+		opcode_t    op;
+	} binary_ops[] = {
+		{ "||", 0, OP_JNZ }, { "&&", 1, OP_JZ },
+		{ "|",  2, OP_OR  }, { "^",  3, OP_XOR }, { "&",  4, OP_AND },
+		{ "==", 5, OP_EQ  }, { "!=", 5, OP_NE  },
+		{ "<=", 6, OP_LE  }, { ">=", 6, OP_GE  }, { "<",  6, OP_LT  }, { ">",  6, OP_GT  },
+		{ "<<", 7, OP_SHL }, { ">>", 7, OP_SHR },
+		{ "+",  8, OP_ADD }, { "-",  8, OP_SUB },
+		{ "*",  9, OP_MUL }, { "/",  9, OP_DIV }, { "%",  9, OP_MOD },
+	};
+
+	if (level == BINARY_LEVELS) {
+		return parse_unary();
+	}
+	if (!parse_binary(level + 1)) {
+		return false;
+	}
+
+	for (;;) {
+		size_t i = 0;
+		while (i != std::size(binary_ops) && !(binary_ops[i].level == level && accept(binary_ops[i].token))) {
+			i++;
+		}
+		if (i == std::size(binary_ops)) {
+			return true;
+		}
+		opcode_t op = binary_ops[i].op;
+
+		// && and || skip their right side once the left decides.
+		if (op == OP_JZ || op == OP_JNZ) {
+			size_t jump = code.size();
+			emit(op, 0, -1);
+			if (!parse_binary(level + 1)) {
+				return false;
+			}
+			emit(OP_BOOL, 0, 0);
+			code[jump].arg = code.size();
+			continue;
+		}
+
+		if (!parse_binary(level + 1)) {
+			return false;
+		}
+		emit_binary(op);
+	}
+}
+
+bool i8086_condition_t::parse_unary() {
+	opcode_t op;
+	if (accept("!")) {
+		op = OP_NOT;
+	} else if (accept("~")) {
+		op = OP_CPL;
+	} else if (accept("-")) {
+		op = OP_NEG;
+	} else {
+		return parse_primary();
+	}
+
+	if (!parse_unary()) {
+		return false;
+	}
+	if (code.back().op == OP_CONST) {
+		uint32_t &v = code.back().arg;
+		v = op == OP_NOT ? !v : op == OP_CPL ? ~v : -v;
+	} else {
+		emit(op, 0, 0);
+	}
+	return true;
+}
+
+bool i8086_condition_t::parse_primary() {
+	skip_space();
+
+	if (accept("(")) {
+		if (!parse_binary(0)) {
+			return false;
+		}
+		return accept(")") || fail("Expected ')'");
+	}
+
+	if (isdigit(byte(*p))) {
+		char *end;
+		unsigned long v = strtoul(p, &end, 0);
+		if (isalnum(byte(*end))) {
+			return fail("Bad number");
+		}
+		p = end;
+		emit(OP_CONST, uint32_t(v), 1);
+		return true;
+	}
+
+	if (isalpha(byte(*p))) {
+		const char *start = p;
+		while (isalnum(byte(*p))) {
+			p++;
+		}
+		std::string name(start, p);
+		for (char &c : name) {
+			c = tolower(byte(c));
+		}
+		if (!parse_name(name)) {
+			if (error.empty()) {
+				p = start;
+				return fail("Unknown name");
+			}
+			return false;
+		}
+		return true;
+	}
+
+	return fail(*p ? "Unexpected character" : "Unexpected end");
+}
+
+bool i8086_condition_t::parse_name(const std::string &name) {
+	for (uint32_t i = 0; i != std::size(reg16_names); ++i) {
+		if (name == reg16_names[i].name) {
+			emit(OP_REG16, i, 1);
+			return true;
+		}
+	}
+	for (const auto &r : reg8_names) {
+		if (name == r.name) {
+			emit(OP_REG8, r.arg, 1);
+			return true;
+		}
+	}
+	for (const auto &f : flag_names) {
+		if (name == f.name) {
+			emit(OP_FLAG, f.mask, 1);
+			return true;
+		}
+	}
+	if (name == "flags") {
+		emit(OP_FLAGS, 0, 1);
+		return true;
+	}
+	if (name == "hits") {
+		emit(OP_HITS, 0, 1);
+		return true;
+	}
+
+	if (name == "byte" || name == "word") {
+		if (!accept("[")) {
+			return fail("Expected '['");
+		}
+		// The first expression is the segment if a ':' follows, else the offset in ds.
+		if (!parse_binary(0)) {
+			return false;
+		}
+		bool has_seg = accept(":");
+		if (has_seg && !parse_binary(0)) {
+			return false;
+		}
+		if (!accept("]")) {
+			return fail("Expected ']'");
+		}
+		emit(name == "byte" ? OP_READ8 : OP_READ16, has_seg, has_seg ? -1 : 0);
+		return true;
+	}
+
+	return false;
+}
+
+bool i8086_condition_t::compile(const std::string &a_text) {
+	code.clear();
+	error.clear();
+	text      = a_text;
+	p         = text.c_str();
+	depth     = 0;
+	max_depth = 0;
+
+	skip_space();
+	if (!*p) {
+		text.clear();
+		emit(OP_CONST, 1, 1);
+		return true;
+	}
+
+	bool ok = parse_binary(0);
+	if (ok) {
+		skip_space();
+		if (*p) {
+			ok = fail("Unexpected character");
+		} else if (max_depth > CONDITION_STACK_SIZE) {
+			ok = fail("Expression too complex");
+		}
+	}
+	p = nullptr;
+
+	if (!ok) {
+		code.clear();
+		text.clear();
+		emit(OP_CONST, 0, 1);
+	}
+	return ok;
+}
+
+uint32_t i8086_condition_t::apply(opcode_t op, uint32_t a, uint32_t b) {
+	switch (op) {
+		case OP_MUL: return a * b;
+		case OP_DIV: return b ? a / b : 0;
+		case OP_MOD: return b ? a % b : 0;
+		case OP_ADD: return a + b;
+		case OP_SUB: return a - b;
+		case OP_SHL: return b < 32 ? a << b : 0;
+		case OP_SHR: return b < 32 ? a >> b : 0;
+		case OP_LT:  return a < b;
+		case OP_LE:  return a <= b;
+		case OP_GT:  return a > b;
+		case OP_GE:  return a >= b;
+		case OP_EQ:  return a == b;
+		case OP_NE:  return a != b;
+		case OP_AND: return a & b;
+		case OP_XOR: return a ^ b;
+		case OP_OR:  return a | b;
+		default:     return 0;
+	}
+}
+
+uint32_t i8086_condition_t::eval(i8086_t *cpu, uint64_t hits) const {
+	uint32_t stack[CONDITION_STACK_SIZE];
+	int      sp = -1;
+
+	for (size_t pc = 0; pc != code.size(); ++pc) {
+		const op_t &o = code[pc];
+		switch (o.op) {
+			case OP_CONST:
+				stack[++sp] = o.arg;
+				break;
+			case OP_REG16:
+				stack[++sp] = cpu->*reg16_names[o.arg].reg;
+				break;
+			case OP_REG8:
+				stack[++sp] = byte((cpu->*reg16_names[o.arg / 2].reg) >> (8 * (o.arg & 1)));
+				break;
+			case OP_FLAGS:
+				stack[++sp] = cpu->get_flags();
+				break;
+			case OP_FLAG:
+				stack[++sp] = !!(cpu->get_flags() & o.arg);
+				break;
+			case OP_HITS:
+				stack[++sp] = uint32_t(hits);
+				break;
+			case OP_READ8:
+			case OP_READ16: {
+				uint16_t ofs = stack[sp];
+				uint32_t seg = 0x10 * (o.arg ? uint16_t(stack[--sp]) : cpu->ds);
+				stack[sp] = cpu->bus->peek8(seg + ofs);
+				if (o.op == OP_READ16) {
+					stack[sp] |= cpu->bus->peek8(seg + uint16_t(ofs + 1)) << 8;
+				}
+				break;
+			}
+			case OP_NOT:  stack[sp] = !stack[sp]; break;
+			case OP_NEG:  stack[sp] = -stack[sp]; break;
+			case OP_CPL:  stack[sp] = ~stack[sp]; break;
+			case OP_BOOL: stack[sp] = !!stack[sp]; break;
+			case OP_JZ:
+				if (!stack[sp]) {
+					pc = o.arg - 1;
+				} else {
+					sp--;
+				}
+				break;
+			case OP_JNZ:
+				if (stack[sp]) {
+					stack[sp] = 1;
+					pc = o.arg - 1;
+				} else {
+					sp--;
+				}
+				break;
+			default:
+				sp--;
+				stack[sp] = apply(o.op, stack[sp], stack[sp + 1]);
+				break;
+		}
+	}
+	return stack[sp];
+}
@@ -0,0 +1,94 @@
+#ifndef EMU_I8086_CONDITION
+#define EMU_I8086_CONDITION
+
+#include "support/types.h"
+
+#include <string>
+#include <vector>
+
+class i8086_t;
+
+#define CONDITION_STACK_SIZE 32
+
+/*
+ * A breakpoint condition such as "ax == 0x1234 && byte[ds:si] > 3",
+ * compiled once to bytecode for a small stack machine. Operands are
+ * the registers, al to dh, flags and cf to of, hits (times the
+ * breakpoint was reached, this one included), numbers and byte[] or
+ * word[] memory reads, which take seg:off or just off in ds.
+ * Operators are those of C, with unsigned 32 bit arithmetic.
+ */
+class i8086_condition_t {
+	enum opcode_t : byte {
+		OP_CONST,
+		OP_REG16,
+		OP_REG8,
+		OP_FLAGS,
+		OP_FLAG,
+		OP_HITS,
+		OP_READ8,    // arg is 1 if the segment is on the stack, else it's ds
+		OP_READ16,
+		OP_NOT,
+		OP_NEG,
+		OP_CPL,
+		OP_BOOL,
+		OP_MUL,
+		OP_DIV,
+		OP_MOD,
+		OP_ADD,
+		OP_SUB,
+		OP_SHL,
+		OP_SHR,
+		OP_LT,
+		OP_LE,
+		OP_GT,
+		OP_GE,
+		OP_EQ,
+		OP_NE,
+		OP_AND,
+		OP_XOR,
+		OP_OR,
+		OP_JZ,    // Jump if zero and keep it, else pop, for &&
+		OP_JNZ,   // Jump if not zero and keep 1, else pop, for ||
+	};
+
+	struct op_t {
+		opcode_t op;
+		uint32_t arg;
+	};
+
+	std::vector<op_t> code;
+	std::string       text;
+
+	// Compiler state
+	const char *p = nullptr;
+	int         depth = 0;
+	int         max_depth = 0;
+
+	static uint32_t apply(opcode_t op, uint32_t a, uint32_t b);
+
+	void emit(opcode_t op, uint32_t arg, int stack_change);
+	void emit_binary(opcode_t op);
+
+	bool fail(const char *message);
+	bool accept(const char *token);
+	void skip_space();
+
+	bool parse_binary(int level);
+	bool parse_unary();
+	bool parse_primary();
+	bool parse_name(const std::string &name);
+
+public:
+	std::string error;
+
+	// An empty text is always true, on syntax errors false is returned and error is set.
+	bool compile(const std::string &text);
+
+	const std::string &get_text() const { return text; }
+	bool               empty() const    { return text.empty(); }
+
+	uint32_t eval(i8086_t *cpu, uint64_t hits) const;
+};
+
+#endif
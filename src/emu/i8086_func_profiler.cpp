@@ -0,0 +1,219 @@
+#include "emu/i8086_func_profiler.h"
+
+#include "disasm/names.h"
+#include "emu/bus.h"
+#include "emu/i8086.h"
+
+#include <algorithm>
+#include <set>
+
+static uint64_t edge_key(uint32_t caller, uint32_t callee) {
+	return (uint64_t(caller) << 32) | callee;
+}
+
+i8086_func_profiler_t::i8086_func_profiler_t(i8086_t *a_cpu) {
+	cpu = a_cpu;
+}
+
+void i8086_func_profiler_t::start() {
+	if (enabled) {
+		return;
+	}
+	frames.reserve(FUNC_PROFILER_MAX_DEPTH);
+	push(profile, frames, FUNC_PROFILER_ROOT, 0, 0, cpu->get_cycles());
+	cpu->call_stack.func_profiler = this;
+	enabled = true;
+}
+
+void i8086_func_profiler_t::stop() {
+	if (!enabled) {
+		return;
+	}
+	uint64_t now = cpu->get_cycles();
+	while (!frames.empty()) {
+		pop(profile, frames, now);
+	}
+	cpu->call_stack.func_profiler = nullptr;
+	enabled = false;
+}
+
+void i8086_func_profiler_t::reset() {
+	bool was_enabled = enabled;
+	stop();
+	profile = {};
+	if (was_enabled) {
+		start();
+	}
+}
+
+void i8086_func_profiler_t::push(profile_t &p, std::vector<frame_t> &frames, uint32_t func, uint16_t ss, uint16_t sp, uint64_t now) {
+	func_t &f = p.funcs[func];
+	f.calls++;
+	f.active++;
+	if (!frames.empty()) {
+		edge_t &e = p.edges[edge_key(frames.back().func, func)];
+		e.caller = frames.back().func;
+		e.callee = func;
+		e.calls++;
+	}
+	frames.push_back({ func, ss, sp, now, 0 });
+}
+
+// Cycles can go back when a snapshot is loaded, those frames count as empty.
+void i8086_func_profiler_t::pop(profile_t &p, std::vector<frame_t> &frames, uint64_t now) {
+	frame_t fr = frames.back();
+	frames.pop_back();
+
+	uint64_t incl = now > fr.start ? now - fr.start : 0;
+	uint64_t self = incl > fr.child_cycles ? incl - fr.child_cycles : 0;
+
+	func_t &f = p.funcs[fr.func];
+	f.self_cycles += self;
+	if (!--f.active) {
+		f.incl_cycles += incl;
+	}
+
+	if (!frames.empty()) {
+		frames.back().child_cycles += incl;
+		p.edges[edge_key(frames.back().func, fr.func)].incl_cycles += incl;
+	}
+}
+
+void i8086_func_profiler_t::call(i8086_addr_t to, uint16_t ss, uint16_t sp, bool is_int) {
+	uint64_t now = cpu->get_cycles();
+	while (frames.size() > 1 && frames.back().ss == ss && frames.back().sp <= sp) {
+		pop(profile, frames, now);
+	}
+	if (frames.size() == FUNC_PROFILER_MAX_DEPTH) {
+		return;
+	}
+
+	uint32_t linear = (0x10 * to.seg + to.ofs) & MEM_ADDR_MASK;
+	if (!profile.funcs.count(linear)) {
+		profile.funcs[linear] = { to, is_int, 0, 0, 0, 0 };
+	}
+	push(profile, frames, linear, ss, sp, now);
+}
+
+void i8086_func_profiler_t::ret(uint16_t ss, uint16_t sp) {
+	uint64_t now = cpu->get_cycles();
+	while (frames.size() > 1 && frames.back().ss == ss && frames.back().sp < sp) {
+		pop(profile, frames, now);
+	}
+	if (frames.size() > 1 && frames.back().ss == ss && frames.back().sp == sp) {
+		pop(profile, frames, now);
+	}
+}
+
+void i8086_func_profiler_t::clear_frames() {
+	if (enabled) {
+		stop();
+		start();
+	}
+}
+
+i8086_func_profiler_t::profile_t i8086_func_profiler_t::get_profile() {
+	profile_t p = profile;
+	std::vector<frame_t> open = frames;
+	uint64_t now = cpu->get_cycles();
+	while (!open.empty()) {
+		pop(p, open, now);
+	}
+	return p;
+}
+
+std::string i8086_func_profiler_t::func_name(uint32_t linear, const func_t &f) {
+	if (linear == FUNC_PROFILER_ROOT) {
+		return "(outside calls)";
+	}
+
+	char buf[64];
+	names_t *names = cpu->get_names();
+	if (names) {
+		int offset = 0;
+		std::string name = names->get_name(linear, &offset);
+		if (name != "---") {
+			if (!offset) {
+				return name;
+			}
+			snprintf(buf, sizeof(buf), "+%x", offset);
+			return name + buf;
+		}
+	}
+
+	snprintf(buf, sizeof(buf), "%s%04x:%04x", f.is_int ? "int " : "", f.addr.seg, f.addr.ofs);
+	return buf;
+}
+
+/*
+ * Callgrind's format, with functions compressed to ids after their first
+ * mention. Costs are put at the function's linear address.
+ */
+void i8086_func_profiler_t::write_callgrind(FILE *out) {
+	profile_t p = get_profile();
+
+	uint64_t total = 0;
+	for (const auto &[linear, f] : p.funcs) {
+		total += f.self_cycles;
+	}
+
+	fprintf(out, "# callgrind format\n");
+	fprintf(out, "version: 1\n");
+	fprintf(out, "creator: chani\n");
+	fprintf(out, "positions: instr\n");
+	fprintf(out, "events: Cycles\n");
+	fprintf(out, "summary: %llu\n\n", (unsigned long long)total);
+
+	std::vector<uint32_t> ids;
+	for (const auto &[linear, f] : p.funcs) {
+		ids.push_back(linear);
+	}
+	std::sort(ids.begin(), ids.end());
+
+	std::vector<const edge_t *> edges;
+	for (const auto &[key, e] : p.edges) {
+		edges.push_back(&e);
+	}
+	std::sort(edges.begin(), edges.end(), [](const edge_t *a, const edge_t *b) {
+		return a->caller != b->caller ? a->caller < b->caller : a->callee < b->callee;
+	});
+
+	std::set<uint32_t> named;
+	auto fn_ref = [&](uint32_t linear) {
+		size_t id = std::lower_bound(ids.begin(), ids.end(), linear) - ids.begin() + 1;
+		std::string s = "(" + std::to_string(id) + ")";
+		if (named.insert(linear).second) {
+			s += " " + func_name(linear, p.funcs[linear]);
+		}
+		return s;
+	};
+	auto pos = [](uint32_t linear) {
+		return linear == FUNC_PROFILER_ROOT ? 0 : linear;
+	};
+
+	auto edge = edges.begin();
+	for (uint32_t linear : ids) {
+		const func_t &f = p.funcs[linear];
+		fprintf(out, "fn=%s\n", fn_ref(linear).c_str());
+		fprintf(out, "0x%x %llu\n", pos(linear), (unsigned long long)f.self_cycles);
+
+		for (; edge != edges.end() && (*edge)->caller == linear; ++edge) {
+			const edge_t &e = **edge;
+			fprintf(out, "cfn=%s\n", fn_ref(e.callee).c_str());
+			fprintf(out, "calls=%llu 0x%x\n", (unsigned long long)e.calls, pos(e.callee));
+			fprintf(out, "0x%x %llu\n", pos(linear), (unsigned long long)e.incl_cycles);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+bool i8086_func_profiler_t::write_callgrind(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		printf("func profiler: unable to open '%s'\n", path);
+		return false;
+	}
+	write_callgrind(f);
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,94 @@
+#ifndef EMU_I8086_FUNC_PROFILER
+#define EMU_I8086_FUNC_PROFILER
+
+#include "emu/i8086_addr.h"
+#include "support/types.h"
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class i8086_t;
+
+#define FUNC_PROFILER_MAX_DEPTH 4096
+#define FUNC_PROFILER_ROOT      0xffffffff   // Code run outside of any call seen
+
+/*
+ * Inclusive and exclusive cycles per guest function and per call edge.
+ * Functions are call and interrupt targets, by linear address. The call
+ * stack tells about every call and return while the profiler runs,
+ * frames are matched by where their return address lives on the guest
+ * stack as in i8086_call_stack_t, so abandoned frames end when a
+ * shallower one does. A function's inclusive cycles only count its
+ * outermost activation when it recurses.
+ *
+ * Calls are much rarer than instructions, the lookups they cost don't
+ * slow down the emulation much, with the JIT too.
+ */
+class i8086_func_profiler_t {
+public:
+	struct func_t {
+		i8086_addr_t addr;
+		bool         is_int;
+		uint64_t     calls;
+		uint64_t     self_cycles;
+		uint64_t     incl_cycles;
+		uint32_t     active;   // Activations on the stack
+	};
+
+	struct edge_t {
+		uint32_t caller;
+		uint32_t callee;
+		uint64_t calls;
+		uint64_t incl_cycles;
+	};
+
+	struct profile_t {
+		std::unordered_map<uint32_t, func_t> funcs;
+		std::unordered_map<uint64_t, edge_t> edges;
+	};
+
+private:
+	struct frame_t {
+		uint32_t func;
+		uint16_t ss;
+		uint16_t sp;   // Where the return address was pushed
+		uint64_t start;
+		uint64_t child_cycles;
+	};
+
+	i8086_t *cpu;
+
+	profile_t            profile;
+	std::vector<frame_t> frames;   // frames[0] is the root while running
+
+	static void push(profile_t &p, std::vector<frame_t> &frames, uint32_t func, uint16_t ss, uint16_t sp, uint64_t now);
+	static void pop(profile_t &p, std::vector<frame_t> &frames, uint64_t now);
+
+public:
+	bool enabled = false;
+
+	i8086_func_profiler_t(i8086_t *cpu);
+
+	void start();
+	void stop();
+	void reset();
+
+	// From the call stack, with the same meaning of ss:sp.
+	void call(i8086_addr_t to, uint16_t ss, uint16_t sp, bool is_int);
+	void ret(uint16_t ss, uint16_t sp);
+
+	// The guest stack was replaced, by a reset or a loaded snapshot.
+	void clear_frames();
+
+	// The profile so far, with the frames still running ended now.
+	profile_t get_profile();
+
+	std::string func_name(uint32_t linear, const func_t &f);
+
+	void write_callgrind(FILE *f);
+	bool write_callgrind(const char *path);
+};
+
+#endif
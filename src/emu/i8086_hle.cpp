@@ -0,0 +1,276 @@
+#include "emu/i8086_hle.h"
+
+#include "emu/device.h"
+#include "emu/i8086.h"
+#include "emu/i8086_block_cache.h"
+#include "emu/machine.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+// Guest routines that take longer than this to return aren't verified.
+#define HLE_VERIFY_MAX_STEPS 10000000
+
+static const char *reg_names[HLE_REG_COUNT] = {
+	"ax", "bx", "cx", "dx", "si", "di", "bp", "sp",
+	"ds", "es", "ss", "cs", "ip", "flags",
+};
+
+static void get_regs(i8086_t *cpu, uint16_t regs[HLE_REG_COUNT]) {
+	uint16_t values[HLE_REG_COUNT] = {
+		cpu->ax, cpu->bx, cpu->cx, cpu->dx, cpu->si, cpu->di, cpu->bp, cpu->sp,
+		cpu->ds, cpu->es, cpu->ss, cpu->cs, cpu->ip, cpu->get_flags(),
+	};
+	memcpy(regs, values, sizeof(values));
+}
+
+// The state of every device but the CPU, whose registers are compared on their own.
+static std::vector<std::vector<byte>> get_device_states(machine_t *machine) {
+	std::vector<std::vector<byte>> states;
+	for (const auto &d : machine->devices) {
+		states.emplace_back();
+		if (d.device != machine->cpu) {
+			snapshot_writer_t w(states.back());
+			d.device->save_state(w);
+		}
+	}
+	return states;
+}
+
+i8086_hle_t::i8086_hle_t(machine_t *a_machine, i8086_t *a_cpu) {
+	machine = a_machine;
+	cpu = a_cpu;
+	memset(map, 0, sizeof(map));
+}
+
+size_t i8086_hle_t::add(const hle_hook_t &hook) {
+	size_t index = hooks.size();
+	hooks.push_back(hook);
+	if (hook.at_addr) {
+		bind(0x10 * hook.addr.seg + hook.addr.ofs, index);
+	} else {
+		has_signatures = true;
+	}
+	return index;
+}
+
+bool i8086_hle_t::parse_signature(const char *s, std::vector<int16_t> &signature) {
+	signature.clear();
+	while (*s) {
+		if (isspace((unsigned char)*s)) {
+			++s;
+			continue;
+		}
+		if (s[0] == '?' && s[1] == '?') {
+			signature.push_back(-1);
+			s += 2;
+		} else if (isxdigit((unsigned char)s[0]) && isxdigit((unsigned char)s[1])) {
+			char hex[3] = { s[0], s[1], 0 };
+			signature.push_back(int16_t(strtol(hex, nullptr, 16)));
+			s += 2;
+		} else {
+			printf("hle: bad signature byte '%.2s'\n", s);
+			signature.clear();
+			return false;
+		}
+		if (*s && !isspace((unsigned char)*s)) {
+			printf("hle: signature bytes must be separated by spaces\n");
+			signature.clear();
+			return false;
+		}
+	}
+	return !signature.empty();
+}
+
+// Blocks already decoded through the address are dropped, so they end before it.
+void i8086_hle_t::bind(uint32_t linear, size_t hook) {
+	linear &= MEM_ADDR_MASK;
+	bound[linear] = hook;
+	map[linear / 64] |= uint64_t(1) << (linear % 64);
+	cpu->block_cache->memory_written(linear, 1);
+}
+
+void i8086_hle_t::unbind(uint32_t linear) {
+	linear &= MEM_ADDR_MASK;
+	bound.erase(linear);
+	map[linear / 64] &= ~(uint64_t(1) << (linear % 64));
+}
+
+bool i8086_hle_t::matches(uint32_t linear, const hle_hook_t &hook) {
+	for (size_t i = 0; i != hook.signature.size(); ++i) {
+		if (hook.signature[i] >= 0 && cpu->bus->peek8((linear + i) & MEM_ADDR_MASK) != hook.signature[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void i8086_hle_t::scan(uint32_t linear) {
+	linear &= MEM_ADDR_MASK;
+	if (hooked(linear)) {
+		return;
+	}
+	for (size_t i = 0; i != hooks.size(); ++i) {
+		if (!hooks[i].at_addr && matches(linear, hooks[i])) {
+			bind(linear, i);
+			return;
+		}
+	}
+}
+
+bool i8086_hle_t::hit(uint32_t linear) {
+	if (mode == HLE_MODE_OFF || in_guest) {
+		return false;
+	}
+
+	auto it = bound.find(linear);
+	if (it == bound.end()) {
+		return false;
+	}
+	hle_hook_t &hook = hooks[it->second];
+
+	// The code was replaced since the hook was bound.
+	if (!matches(linear, hook)) {
+		if (!hook.at_addr) {
+			unbind(linear);
+		}
+		return false;
+	}
+
+	hook.calls++;
+	if (mode == HLE_MODE_VERIFY && hook.ret != HLE_RET_NONE) {
+		verify(hook);
+	} else {
+		run_native(hook);
+	}
+	return true;
+}
+
+void i8086_hle_t::run_native(hle_hook_t &hook) {
+	hook.native(cpu);
+
+	switch (hook.ret) {
+	case HLE_RET_NEAR:
+		cpu->call_stack.ret(cpu->ss, cpu->sp);
+		cpu->ip = cpu->pop();
+		break;
+	case HLE_RET_FAR:
+		cpu->call_stack.ret(cpu->ss, cpu->sp);
+		cpu->ip = cpu->pop();
+		cpu->cs = cpu->pop();
+		break;
+	case HLE_IRET:
+		cpu->op_iret();
+		break;
+	case HLE_RET_NONE:
+		break;
+	}
+	cpu->sp += hook.ret_pop;
+	cpu->cycles += hook.cycles;
+	cpu->clock_cycles++;
+}
+
+/*
+ * The guest runs first, until it's back at the return address with its
+ * frame popped. Stack below the caller's frame is scratch space for the
+ * routine and isn't compared.
+ */
+void i8086_hle_t::verify(hle_hook_t &hook) {
+	uint16_t ss = cpu->ss;
+	uint16_t sp = cpu->sp;
+
+	i8086_addr_t ret;
+	ret.ofs = cpu->mem_read16(ss, sp);
+	ret.seg = hook.ret == HLE_RET_NEAR ? cpu->cs : cpu->mem_read16(ss, sp + 2);
+
+	snapshot_t *entry = machine->take_snapshot();
+
+	in_guest = true;
+	uint16_t min_sp = sp;
+	bool returned = false;
+	for (uint32_t steps = 0; steps != HLE_VERIFY_MAX_STEPS; ++steps) {
+		cpu->step();
+		if (cpu->ss == ss && cpu->sp < min_sp) {
+			min_sp = cpu->sp;
+		}
+		if (cpu->cs == ret.seg && cpu->ip == ret.ofs && cpu->ss == ss && cpu->sp > sp) {
+			returned = true;
+			break;
+		}
+	}
+	in_guest = false;
+
+	if (!returned) {
+		printf("hle: %s didn't return to %04x:%04x, not verified\n", hook.name.c_str(), ret.seg, ret.ofs);
+		delete entry;
+		return;
+	}
+
+	uint16_t guest_regs[HLE_REG_COUNT];
+	get_regs(cpu, guest_regs);
+	auto guest_devices = get_device_states(machine);
+	i8086_call_stack_t guest_call_stack = cpu->call_stack;
+	snapshot_t *guest = machine->take_snapshot();
+
+	machine->restore_snapshot(entry);
+	run_native(hook);
+
+	uint16_t native_regs[HLE_REG_COUNT];
+	get_regs(cpu, native_regs);
+	auto native_devices = get_device_states(machine);
+	snapshot_t *native = machine->take_snapshot();
+
+	bool ok = true;
+	for (int i = 0; i != HLE_REG_COUNT; ++i) {
+		if ((hook.compare & (1 << i)) && guest_regs[i] != native_regs[i]) {
+			printf("hle: %s: %s=%04x, guest has %04x\n", hook.name.c_str(), reg_names[i], native_regs[i], guest_regs[i]);
+			ok = false;
+		}
+	}
+
+	uint32_t scratch_begin = 0x10 * ss + min_sp;
+	uint32_t scratch_end   = 0x10 * ss + sp;
+	for (uint32_t page = 0; page != MEM_PAGE_COUNT; ++page) {
+		if (guest->pages[page] == native->pages[page]) {
+			continue;
+		}
+		const byte *g = guest->pages[page]->data;
+		const byte *n = native->pages[page]->data;
+		uint32_t diffs = 0;
+		uint32_t first = 0;
+		for (uint32_t i = 0; i != MEM_PAGE_SIZE; ++i) {
+			uint32_t linear = page * MEM_PAGE_SIZE + i;
+			if (g[i] != n[i] && (linear < scratch_begin || linear >= scratch_end)) {
+				if (!diffs++) {
+					first = i;
+				}
+			}
+		}
+		if (diffs) {
+			printf("hle: %s: %u bytes differ in page %05x, first at %05x is %02x, guest has %02x\n",
+				hook.name.c_str(), diffs, page * MEM_PAGE_SIZE, page * MEM_PAGE_SIZE + first, n[first], g[first]);
+			ok = false;
+		}
+	}
+
+	for (size_t i = 0; i != guest_devices.size(); ++i) {
+		if (guest_devices[i] != native_devices[i]) {
+			printf("hle: %s: %s state differs\n", hook.name.c_str(), machine->devices[i].name.c_str());
+			ok = false;
+		}
+	}
+
+	if (ok) {
+		hook.verified++;
+	} else {
+		hook.mismatches++;
+	}
+
+	machine->restore_snapshot(guest);
+	cpu->call_stack = guest_call_stack;
+
+	delete entry;
+	delete guest;
+	delete native;
+}
@@ -0,0 +1,140 @@
+#ifndef EMU_I8086_HLE
+#define EMU_I8086_HLE
+
+#include "emu/bus.h"
+#include "emu/i8086_addr.h"
+#include "support/types.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class i8086_t;
+class machine_t;
+
+// How a hooked routine returns to its caller once the native code ran.
+enum hle_ret_t : byte {
+	HLE_RET_NEAR,
+	HLE_RET_FAR,
+	HLE_IRET,
+	HLE_RET_NONE,   // The native code sets cs:ip itself, it can't be verified
+};
+
+// Registers compared when verifying a hook.
+enum {
+	HLE_REG_AX    = 1 << 0,
+	HLE_REG_BX    = 1 << 1,
+	HLE_REG_CX    = 1 << 2,
+	HLE_REG_DX    = 1 << 3,
+	HLE_REG_SI    = 1 << 4,
+	HLE_REG_DI    = 1 << 5,
+	HLE_REG_BP    = 1 << 6,
+	HLE_REG_SP    = 1 << 7,
+	HLE_REG_DS    = 1 << 8,
+	HLE_REG_ES    = 1 << 9,
+	HLE_REG_SS    = 1 << 10,
+	HLE_REG_CS    = 1 << 11,
+	HLE_REG_IP    = 1 << 12,
+	HLE_REG_FLAGS = 1 << 13,
+
+	HLE_REG_ALL   = (1 << 14) - 1,
+	HLE_REG_COUNT = 14,
+};
+
+enum hle_mode_t : byte {
+	HLE_MODE_OFF,      // Hooks are ignored, the guest code runs
+	HLE_MODE_ON,
+	HLE_MODE_VERIFY,   // Run both and compare, keep the guest's results
+};
+
+struct hle_hook_t {
+	std::string                   name;
+	std::function<void(i8086_t *)> native;
+	hle_ret_t                     ret = HLE_RET_NEAR;
+	uint16_t                      ret_pop = 0;          // Argument bytes popped by ret n
+	uint32_t                      cycles = 0;           // Charged per call, in place of the guest's
+	uint16_t                      compare = HLE_REG_ALL & ~HLE_REG_FLAGS;
+
+	// Either a fixed address, or code matching the signature wherever it's run.
+	bool                 at_addr = false;
+	i8086_addr_t         addr = {};
+	std::vector<int16_t> signature;   // -1 matches any byte
+
+	uint64_t calls = 0;
+	uint64_t verified = 0;
+	uint64_t mismatches = 0;
+};
+
+/*
+ * Native replacements for guest routines. A hook is entered when the CPU
+ * reaches its address, usually right after the call pushed the return
+ * address: the native code runs in place of the routine and the hook
+ * returns to the caller. Addresses are tested against a bitmap before
+ * every instruction, and by the JIT at block starts.
+ *
+ * Signature hooks are bound to the addresses of blocks the block cache
+ * decodes that start with matching code, and are checked again on every
+ * call in case the code was replaced.
+ *
+ * In verify mode the guest routine runs to its return first, then the
+ * machine is rewound and the native code runs. Memory, device state and
+ * the compared registers of both runs must match. The guest's results
+ * are kept, so a broken hook doesn't change what the program does.
+ */
+class i8086_hle_t {
+	machine_t *machine;
+	i8086_t   *cpu;
+
+	std::vector<hle_hook_t>              hooks;
+	std::unordered_map<uint32_t, size_t> bound;   // Linear address to hook
+	uint64_t                             map[MEM_ADDR_SIZE / 64];
+	bool                                 has_signatures = false;
+	bool                                 in_guest = false;   // Verifying, running the guest version
+
+	void bind(uint32_t linear, size_t hook);
+	void unbind(uint32_t linear);
+	bool matches(uint32_t linear, const hle_hook_t &hook);
+
+	bool hit(uint32_t linear);
+	void run_native(hle_hook_t &hook);
+	void verify(hle_hook_t &hook);
+
+public:
+	hle_mode_t mode = HLE_MODE_ON;
+
+	i8086_hle_t(machine_t *machine, i8086_t *cpu);
+
+	// Returns the hook's index.
+	size_t add(const hle_hook_t &hook);
+
+	std::vector<hle_hook_t> &get_hooks() { return hooks; }
+
+	// Parses hex bytes and ?? wildcards, like "55 8b ec ?? 1e".
+	static bool parse_signature(const char *s, std::vector<int16_t> &signature);
+
+	bool hooked(uint32_t linear) {
+		linear &= MEM_ADDR_MASK;
+		return map[linear / 64] & (uint64_t(1) << (linear % 64));
+	}
+
+	// Before each instruction, true if a hook ran in its place.
+	bool check(uint16_t cs, uint16_t ip) {
+		uint32_t linear = (0x10 * cs + ip) & MEM_ADDR_MASK;
+		if (!(map[linear / 64] & (uint64_t(1) << (linear % 64)))) {
+			return false;
+		}
+		return hit(linear);
+	}
+
+	// From the block cache, for a block decoded at linear.
+	void code_decoded(uint32_t linear) {
+		if (has_signatures) {
+			scan(linear);
+		}
+	}
+
+	void scan(uint32_t linear);
+};
+
+#endif
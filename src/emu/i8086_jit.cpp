@@ -0,0 +1,416 @@
+#include "emu/i8086_jit.h"
+
+#include "emu/i8086.h"
+#include "emu/i8086_block_cache.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Upper bounds on the size of the generated code.
+#define JIT_MAX_INSN_CODE  128
+#define JIT_MAX_BLOCK_CODE (BLOCK_MAX_INSNS * JIT_MAX_INSN_CODE + 64)
+
+/*
+ * x86-64 encoding. The cpu pointer lives in rbx, eax, ecx and edx are scratch.
+ */
+
+enum {
+	EAX = 0,
+	ECX = 1,
+	EDX = 2,
+};
+
+static inline void emit8(byte *&p, byte v) {
+	*p++ = v;
+}
+
+static inline void emit16(byte *&p, uint16_t v) {
+	writele16(p, v);
+	p += 2;
+}
+
+static inline void emit32(byte *&p, uint32_t v) {
+	writele32(p, v);
+	p += 4;
+}
+
+static inline void emit64(byte *&p, uint64_t v) {
+	emit32(p, v);
+	emit32(p, v >> 32);
+}
+
+// ModRM for [rbx + disp32]
+static inline void emit_rbx_disp(byte *&p, byte reg, int32_t disp) {
+	emit8(p, 0x80 | (reg << 3) | 0b011);
+	emit32(p, disp);
+}
+
+// movzx r32, word [rbx + disp]
+static void emit_load16(byte *&p, byte r, int32_t disp) {
+	emit8(p, 0x0f);
+	emit8(p, 0xb7);
+	emit_rbx_disp(p, r, disp);
+}
+
+// mov word [rbx + disp], r16
+static void emit_store16(byte *&p, int32_t disp, byte r) {
+	emit8(p, 0x66);
+	emit8(p, 0x89);
+	emit_rbx_disp(p, r, disp);
+}
+
+// mov word [rbx + disp], imm16
+static void emit_store16_imm(byte *&p, int32_t disp, uint16_t imm) {
+	emit8(p, 0x66);
+	emit8(p, 0xc7);
+	emit_rbx_disp(p, 0, disp);
+	emit16(p, imm);
+}
+
+// mov byte [rbx + disp], imm8
+static void emit_store8_imm(byte *&p, int32_t disp, byte imm) {
+	emit8(p, 0xc6);
+	emit_rbx_disp(p, 0, disp);
+	emit8(p, imm);
+}
+
+// add qword [rbx + disp], imm32
+static void emit_add64_imm(byte *&p, int32_t disp, uint32_t imm) {
+	emit8(p, 0x48);
+	emit8(p, 0x81);
+	emit_rbx_disp(p, 0, disp);
+	emit32(p, imm);
+}
+
+// mov r32, imm32
+static void emit_mov_imm(byte *&p, byte r, uint32_t imm) {
+	emit8(p, 0xb8 + r);
+	emit32(p, imm);
+}
+
+// mov dst, src
+static void emit_mov_rr(byte *&p, byte dst, byte src) {
+	emit8(p, 0x89);
+	emit8(p, 0xc0 | (src << 3) | dst);
+}
+
+// add/or/and/sub/xor dst, src, using the 8086 ALU function encoding
+static void emit_alu_rr(byte *&p, byte func, byte dst, byte src) {
+	emit8(p, (func << 3) | 0x01);
+	emit8(p, 0xc0 | (src << 3) | dst);
+}
+
+/*
+ * Translation
+ */
+
+i8086_jit_t::i8086_jit_t(i8086_t *cpu) :
+	cpu(cpu)
+{
+	auto ofs = [cpu](void *member) {
+		return int32_t((byte *)member - (byte *)cpu);
+	};
+
+	uint16_t *regs16[8] = { &cpu->ax, &cpu->cx, &cpu->dx, &cpu->bx, &cpu->sp, &cpu->bp, &cpu->si, &cpu->di };
+	for (int i = 0; i != 8; ++i) {
+		reg16_ofs[i] = ofs(regs16[i]);
+	}
+	for (int i = 0; i != 4; ++i) {
+		reg8_ofs[i]     = reg16_ofs[i];
+		reg8_ofs[i + 4] = reg16_ofs[i] + 1;
+	}
+
+	cycles_ofs       = ofs(&cpu->cycles);
+	clock_cycles_ofs = ofs(&cpu->clock_cycles);
+	instr_count_ofs  = ofs(&cpu->instr_count);
+	int_delay_ofs   = ofs(&cpu->int_delay);
+	ip_ofs          = ofs(&cpu->ip);
+	lazy_ofs        = ofs(&cpu->lazy);
+}
+
+i8086_jit_t::~i8086_jit_t() {
+#if JIT_SUPPORTED
+	if (arena) {
+		munmap(arena, JIT_ARENA_SIZE);
+	}
+#endif
+}
+
+bool i8086_jit_t::allocate_arena() {
+#if JIT_SUPPORTED
+	void *p = mmap(nullptr, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p != MAP_FAILED) {
+		arena = (byte *)p;
+		return true;
+	}
+	printf("jit: unable to allocate executable memory, using the interpreter\n");
+#else
+	printf("jit: not supported on this host, using the interpreter\n");
+#endif
+	arena_failed = true;
+	enabled = false;
+	return false;
+}
+
+bool i8086_jit_t::exec_insn(i8086_t *cpu, i8086_insn_t *insn) {
+	return cpu->exec_insn(insn);
+}
+
+/*
+ * Emits register-only instructions inline, returns false for anything the
+ * interpreter has to run. The cycle counts match the interpreter's handlers.
+ */
+bool i8086_jit_t::emit_native(byte *&p, const i8086_insn_t &insn, uint32_t &cycles) {
+	const byte *b  = insn.bytes;
+	byte op        = b[0];
+	byte mod       = b[1] >> 6;
+	byte reg       = (b[1] >> 3) & 0b111;
+	byte rm        = b[1] & 0b111;
+
+	auto alu_supported = [](byte func) {
+#if LAZY_FLAGS_CHECK
+		(void)func;
+		return false;
+#else
+		return func != i8086_t::ALU_ADC && func != i8086_t::ALU_SBB;
+#endif
+	};
+
+	// The interpreter charges for a 16-bit immediate fetched from an odd address.
+	auto imm16_cycles = [&](byte pos) -> uint32_t {
+		return ((insn.ip + pos) & 1) ? 4 : 0;
+	};
+
+	// Computes dst = dst <func> src into edx and records the lazy flags.
+	auto emit_alu = [&](byte func, int32_t dst_ofs, bool src_is_imm, int32_t src_ofs, uint16_t imm) {
+		emit_load16(p, EAX, dst_ofs);
+		if (src_is_imm) {
+			emit_mov_imm(p, ECX, imm);
+		} else {
+			emit_load16(p, ECX, src_ofs);
+		}
+		emit_mov_rr(p, EDX, EAX);
+		byte native_func = func == i8086_t::ALU_CMP ? byte(i8086_t::ALU_SUB) : func;
+		emit_alu_rr(p, native_func, EDX, ECX);
+		if (func != i8086_t::ALU_CMP) {
+			emit_store16(p, dst_ofs, EDX);
+		}
+
+		i8086_t::lazy_op_t lazy_op;
+		switch (func) {
+			case i8086_t::ALU_ADD: lazy_op = i8086_t::LAZY_ADD; break;
+			case i8086_t::ALU_SUB:
+			case i8086_t::ALU_CMP: lazy_op = i8086_t::LAZY_SUB; break;
+			default:               lazy_op = i8086_t::LAZY_BIN; break;
+		}
+		emit_store8_imm(p, lazy_ofs + offsetof(i8086_t::lazy_flags_t, op), lazy_op);
+		emit_store8_imm(p, lazy_ofs + offsetof(i8086_t::lazy_flags_t, w),  1);
+		emit_store8_imm(p, lazy_ofs + offsetof(i8086_t::lazy_flags_t, cf), 0);
+		emit_store16(p, lazy_ofs + offsetof(i8086_t::lazy_flags_t, res), EDX);
+		emit_store16(p, lazy_ofs + offsetof(i8086_t::lazy_flags_t, dst), EAX);
+		emit_store16(p, lazy_ofs + offsetof(i8086_t::lazy_flags_t, src), ECX);
+	};
+
+	switch (op) {
+		// alu r/m16, r16 and alu r16, r/m16 with register operands
+		case 0x01: case 0x03: case 0x09: case 0x0b:
+		case 0x21: case 0x23: case 0x29: case 0x2b:
+		case 0x31: case 0x33: case 0x39: case 0x3b: {
+			byte func = (op >> 3) & 0b111;
+			bool d    = op & 0b10;
+			if (mod != 0b11 || !alu_supported(func)) {
+				return false;
+			}
+			byte dst = d ? reg : rm;
+			byte src = d ? rm : reg;
+			emit_alu(func, reg16_ofs[dst], false, reg16_ofs[src], 0);
+			cycles += 3;
+			if (!d && func != i8086_t::ALU_CMP) {
+				cycles += 7;
+			}
+			return true;
+		}
+
+		// alu ax, imm16
+		case 0x05: case 0x0d: case 0x25: case 0x2d: case 0x35: case 0x3d: {
+			byte func = (op >> 3) & 0b111;
+			if (!alu_supported(func)) {
+				return false;
+			}
+			emit_alu(func, reg16_ofs[i8086_t::REG_AX], true, 0, readle16((byte *)&b[1]));
+			cycles += 4;
+			cycles += imm16_cycles(1);
+			return true;
+		}
+
+		// alu r16, imm16 and alu r16, simm8
+		case 0x81: case 0x83: {
+			byte func = reg;
+			if (mod != 0b11 || !alu_supported(func)) {
+				return false;
+			}
+			uint16_t imm = op == 0x81 ? readle16((byte *)&b[2]) : uint16_t(int8_t(b[2]));
+			emit_alu(func, reg16_ofs[rm], true, 0, imm);
+			cycles += 4;
+			if (op == 0x81) {
+				cycles += imm16_cycles(2);
+			}
+			if (func != i8086_t::ALU_CMP) {
+				cycles += 7;
+			}
+			return true;
+		}
+
+		// mov r/m16, r16 and mov r16, r/m16 with register operands
+		case 0x89: case 0x8b: {
+			if (mod != 0b11) {
+				return false;
+			}
+			bool d   = op & 0b10;
+			byte dst = d ? reg : rm;
+			byte src = d ? rm : reg;
+			emit_load16(p, EAX, reg16_ofs[src]);
+			emit_store16(p, reg16_ofs[dst], EAX);
+			cycles += 2;
+			return true;
+		}
+
+		// mov r8, imm8
+		case 0xb0: case 0xb1: case 0xb2: case 0xb3:
+		case 0xb4: case 0xb5: case 0xb6: case 0xb7:
+			emit_store8_imm(p, reg8_ofs[op & 0b111], b[1]);
+			cycles += 4;
+			return true;
+
+		// mov r16, imm16
+		case 0xb8: case 0xb9: case 0xba: case 0xbb:
+		case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+			emit_store16_imm(p, reg16_ofs[op & 0b111], readle16((byte *)&b[1]));
+			cycles += 4;
+			cycles += imm16_cycles(1);
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Accounts for the instructions run so far and returns to the dispatcher.
+ * The helper counts the ones it runs, clock_steps are the inline steps
+ * since the last helper call.
+ */
+void i8086_jit_t::emit_exit(byte *&p, i8086_block_t *block, uint32_t native_insns, uint32_t steps, uint32_t clock_steps, uint32_t cycles, bool clear_int_delay) {
+	if (cycles) {
+		emit_add64_imm(p, cycles_ofs, cycles);
+	}
+	if (clock_steps) {
+		emit_add64_imm(p, clock_cycles_ofs, clock_steps);
+	}
+	if (native_insns && block->cs < 0xf000) {
+		emit_add64_imm(p, instr_count_ofs, native_insns);
+	}
+	if (clear_int_delay) {
+		emit_store8_imm(p, int_delay_ofs, 0);
+	}
+	emit_mov_imm(p, EAX, steps);
+	emit8(p, 0x5b); // pop rbx
+	emit8(p, 0xc3); // ret
+}
+
+jit_code_t i8086_jit_t::translate(i8086_block_t *block) {
+	if (arena_failed || (!arena && !allocate_arena())) {
+		return nullptr;
+	}
+
+	// Start over when the arena is full, all translations are dropped with the blocks.
+	if (arena_used + JIT_MAX_BLOCK_CODE > JIT_ARENA_SIZE) {
+		arena_used = 0;
+		cpu->block_cache->flush();
+		cpu->jit_prev = nullptr;
+		return nullptr;
+	}
+
+	byte *start = arena + arena_used;
+	byte *p = start;
+
+	emit8(p, 0x53);                   // push rbx
+	emit8(p, 0x48); emit8(p, 0x89);   // mov rbx, rdi
+	emit8(p, 0xfb);
+
+	uint32_t steps      = 0;
+	uint32_t clock_steps = 0;   // Inline steps not in clock_cycles yet
+	uint32_t cycles     = 0;    // Inline cycles not in cycles yet
+	uint32_t natives    = 0;
+	bool     has_helper = false;
+	bool     last_native = false;
+
+	for (uint32_t i = 0; i != block->count; ++i) {
+		i8086_insn_t &insn = block->insns[i];
+
+		uint32_t prefixes = 0;
+		while (prefixes < insn.len && (insn.bytes[prefixes] == 0x26 || insn.bytes[prefixes] == 0x2e
+		    || insn.bytes[prefixes] == 0x36 || insn.bytes[prefixes] == 0x3e
+		    || insn.bytes[prefixes] == 0xf2 || insn.bytes[prefixes] == 0xf3)) {
+			prefixes++;
+		}
+		steps += prefixes + 1;
+
+		bool last_native_before = last_native;
+		last_native = prefixes == 0 && emit_native(p, insn, cycles);
+		if (last_native) {
+			natives++;
+			clock_steps += 1;
+			continue;
+		}
+		has_helper = true;
+
+		// Native instructions leave ip behind, the interpreter needs it.
+		if (i == 0 || last_native_before) {
+			emit_store16_imm(p, ip_ofs, insn.ip);
+		}
+
+		// Port accesses sync the devices to clock_cycles and the function profiler
+		// reads cycles, both have to be where the interpreter's would be.
+		if (clock_steps) {
+			emit_add64_imm(p, clock_cycles_ofs, clock_steps);
+			clock_steps = 0;
+		}
+		if (cycles) {
+			emit_add64_imm(p, cycles_ofs, cycles);
+			cycles = 0;
+		}
+
+		emit8(p, 0x48); emit8(p, 0x89); emit8(p, 0xdf);  // mov rdi, rbx
+		emit8(p, 0x48); emit8(p, 0xbe);                  // mov rsi, imm64
+		emit64(p, (uint64_t)&insn);
+		emit8(p, 0x48); emit8(p, 0xb8);                  // mov rax, imm64
+		emit64(p, (uint64_t)&i8086_jit_t::exec_insn);
+		emit8(p, 0xff); emit8(p, 0xd0);                  // call rax
+
+		if (i + 1 != block->count) {
+			// Leave if the instruction jumped away or invalidated the block.
+			emit8(p, 0x84); emit8(p, 0xc0);              // test al, al
+			emit8(p, 0x75);                              // jnz rel8
+			byte *rel = p++;
+			emit_exit(p, block, natives, steps, 0, cycles, false);
+			*rel = p - rel - 1;
+		}
+	}
+
+	if (last_native) {
+		i8086_insn_t &last = block->insns[block->count - 1];
+		emit_store16_imm(p, ip_ofs, last.ip + last.len);
+	}
+	emit_exit(p, block, natives, steps, clock_steps, cycles, last_native && has_helper);
+
+	arena_used += (p - start + 15) & ~15;
+	return (jit_code_t)start;
+}
@@ -0,0 +1,54 @@
+#ifndef EMU_I8086_JIT
+#define EMU_I8086_JIT
+
+#include "support/types.h"
+
+class i8086_t;
+struct i8086_block_t;
+struct i8086_insn_t;
+
+#define JIT_ARENA_SIZE     (16 * 1024 * 1024)
+#define JIT_HOT_THRESHOLD  16
+
+// Runs a translated block, returns the number of steps the interpreter would have taken.
+typedef uint32_t (*jit_code_t)(i8086_t *cpu);
+
+/*
+ * Translates hot blocks from the block cache into x86-64 code.
+ * Register to register moves and ALU operations are emitted inline,
+ * every other instruction calls back into the interpreter, which also
+ * leaves the block early if it jumped away or overwrote the block.
+ */
+class i8086_jit_t {
+	i8086_t *cpu;
+	byte    *arena = nullptr;
+	uint32_t arena_used = 0;
+	bool     arena_failed = false;
+
+	// Offsets of the cpu state the generated code touches.
+	int32_t reg16_ofs[8];
+	int32_t reg8_ofs[8];
+	int32_t cycles_ofs;
+	int32_t clock_cycles_ofs;
+	int32_t instr_count_ofs;
+	int32_t int_delay_ofs;
+	int32_t ip_ofs;
+	int32_t lazy_ofs;
+
+	bool allocate_arena();
+	bool emit_native(byte *&p, const i8086_insn_t &insn, uint32_t &cycles);
+	void emit_exit(byte *&p, i8086_block_t *block, uint32_t native_insns, uint32_t steps, uint32_t clock_steps, uint32_t cycles, bool clear_int_delay);
+
+	static bool exec_insn(i8086_t *cpu, i8086_insn_t *insn);
+
+public:
+	bool enabled = false;
+
+	i8086_jit_t(i8086_t *cpu);
+	~i8086_jit_t();
+
+	// Returns nullptr if the block can't be translated right now.
+	jit_code_t translate(i8086_block_t *block);
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "emu/i8086_profiler.h"
+
+#include "disasm/disasm_i8086.h"
+#include "emu/i8086.h"
+#include "emu/i8086_block_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+i8086_profiler_t::i8086_profiler_t(i8086_t *a_cpu) {
+	cpu = a_cpu;
+	memset(op_count, 0, sizeof(op_count));
+	memset(op_cycles, 0, sizeof(op_cycles));
+}
+
+void i8086_profiler_t::start(uint32_t a_sample_interval) {
+	if (addr_count.empty()) {
+		addr_count.resize(MEM_ADDR_SIZE);
+		addr_cycles.resize(MEM_ADDR_SIZE);
+		addr_cs.resize(MEM_ADDR_SIZE);
+	}
+	sample_interval = a_sample_interval;
+	until_sample = sample_interval;
+	enabled = true;
+}
+
+void i8086_profiler_t::stop() {
+	enabled = false;
+}
+
+void i8086_profiler_t::reset() {
+	std::fill(addr_count.begin(), addr_count.end(), 0);
+	std::fill(addr_cycles.begin(), addr_cycles.end(), 0);
+	std::fill(addr_cs.begin(), addr_cs.end(), 0);
+	memset(op_count, 0, sizeof(op_count));
+	memset(op_cycles, 0, sizeof(op_cycles));
+	total_count = 0;
+	total_cycles = 0;
+	until_sample = sample_interval;
+}
+
+// The opcode and ModRM are read back from memory, past the prefixes.
+void i8086_profiler_t::add(uint32_t linear, uint16_t cs, uint32_t count, uint32_t cycles) {
+	linear &= MEM_ADDR_MASK;
+	addr_count[linear]  += count;
+	addr_cycles[linear] += cycles;
+	addr_cs[linear]      = cs;
+	total_count  += count;
+	total_cycles += cycles;
+
+	uint32_t pos = linear;
+	byte op = cpu->bus->peek8(pos);
+	for (int i = 0; i != INSN_MAX_LEN && i8086_block_cache_t::is_prefix(op); ++i) {
+		op = cpu->bus->peek8(++pos);
+	}
+
+	byte form = PROFILER_NO_MODRM;
+	if (i8086_block_cache_t::has_modrm(op)) {
+		byte modrm = cpu->bus->peek8(pos + 1);
+		form = (modrm >> 6) * 8 + (modrm & 0b111);
+	}
+
+	op_count[op * PROFILER_FORM_COUNT + form]  += count;
+	op_cycles[op * PROFILER_FORM_COUNT + form] += cycles;
+}
+
+template<typename T>
+static void sort_entries(std::vector<T> &entries, size_t n, i8086_profiler_t::sort_t sort) {
+	auto by = [sort](const T &a, const T &b) {
+		if (sort == i8086_profiler_t::SORT_COUNT) {
+			return a.count > b.count;
+		}
+		return a.cycles > b.cycles;
+	};
+	if (sort != i8086_profiler_t::SORT_ADDR) {
+		n = std::min(n, entries.size());
+		std::partial_sort(entries.begin(), entries.begin() + n, entries.end(), by);
+	}
+	if (entries.size() > n) {
+		entries.resize(n);
+	}
+}
+
+std::vector<i8086_profiler_t::addr_entry_t> i8086_profiler_t::top_addrs(size_t n, sort_t sort) {
+	std::vector<addr_entry_t> entries;
+	for (uint32_t linear = 0; linear != addr_count.size(); ++linear) {
+		if (addr_count[linear]) {
+			entries.push_back({ linear, addr_cs[linear], addr_count[linear], addr_cycles[linear] });
+		}
+	}
+	sort_entries(entries, n, sort);
+	return entries;
+}
+
+std::vector<i8086_profiler_t::op_entry_t> i8086_profiler_t::top_ops(size_t n, sort_t sort) {
+	std::vector<op_entry_t> entries;
+	for (uint32_t i = 0; i != 256 * PROFILER_FORM_COUNT; ++i) {
+		if (op_count[i]) {
+			entries.push_back({ byte(i / PROFILER_FORM_COUNT), byte(i % PROFILER_FORM_COUNT), op_count[i], op_cycles[i] });
+		}
+	}
+	sort_entries(entries, n, sort);
+	return entries;
+}
+
+const char *i8086_profiler_t::form_name(byte form) {
+	static const char *names[PROFILER_FORM_COUNT] = {
+		"[bx+si]",     "[bx+di]",     "[bp+si]",     "[bp+di]",     "[si]",     "[di]",     "[disp16]",  "[bx]",
+		"[bx+si+d8]",  "[bx+di+d8]",  "[bp+si+d8]",  "[bp+di+d8]",  "[si+d8]",  "[di+d8]",  "[bp+d8]",   "[bx+d8]",
+		"[bx+si+d16]", "[bx+di+d16]", "[bp+si+d16]", "[bp+di+d16]", "[si+d16]", "[di+d16]", "[bp+d16]",  "[bx+d16]",
+		"reg",         "reg",         "reg",         "reg",         "reg",      "reg",      "reg",       "reg",
+		"",
+	};
+	return form < PROFILER_FORM_COUNT ? names[form] : "";
+}
+
+void i8086_profiler_t::write_report(FILE *f, size_t n) {
+	disasm_i8086_t disassembler;
+	disassembler.read = [this](address_space_t space, uint32_t addr, width_t w) -> uint16_t {
+		if (space != MEM) {
+			return 0;
+		}
+		return w == W8 ? cpu->bus->peek8(addr) : cpu->bus->peek8(addr) | (cpu->bus->peek8(addr + 1) << 8);
+	};
+
+	double total = total_cycles ? double(total_cycles) : 1.0;
+
+	if (sample_interval) {
+		fprintf(f, "# %llu samples, one every %u cycles\n", (unsigned long long)total_count, sample_interval);
+	} else {
+		fprintf(f, "# %llu instructions\n", (unsigned long long)total_count);
+	}
+	fprintf(f, "# %llu cycles\n\n", (unsigned long long)total_cycles);
+
+	fprintf(f, "# address    count        cycles       %%       instruction\n");
+	for (const auto &e : top_addrs(n)) {
+		uint16_t ip = e.linear - 0x10 * e.cs;
+		const char *s = "";
+		disassembler.disassemble(e.cs, &ip, &s);
+		fprintf(f, "%04x:%04x  %-12u %-12llu %6.2f  %s\n", e.cs, uint16_t(e.linear - 0x10 * e.cs),
+			e.count, (unsigned long long)e.cycles, 100.0 * e.cycles / total, s);
+	}
+
+	fprintf(f, "\n# op  form         count        cycles       %%\n");
+	for (const auto &e : top_ops(256 * PROFILER_FORM_COUNT)) {
+		fprintf(f, "%02x    %-12s %-12llu %-12llu %6.2f\n", e.op, form_name(e.form),
+			(unsigned long long)e.count, (unsigned long long)e.cycles, 100.0 * e.cycles / total);
+	}
+}
+
+bool i8086_profiler_t::write_report(const char *path, size_t n) {
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		printf("profiler: unable to open '%s'\n", path);
+		return false;
+	}
+	write_report(f, n);
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,101 @@
+#ifndef EMU_I8086_PROFILER
+#define EMU_I8086_PROFILER
+
+#include "emu/bus.h"
+#include "support/types.h"
+
+#include <cstdio>
+#include <vector>
+
+class i8086_t;
+
+// ModRM forms are mod * 8 + rm, the last one is for opcodes without ModRM.
+#define PROFILER_FORM_COUNT 33
+#define PROFILER_NO_MODRM   32
+
+/*
+ * Where the guest spends its time. Every instruction step() runs is
+ * either counted, or with a sample interval, one in every interval
+ * cycles is and stands for all of them. Counts and cycles are kept in
+ * flat arrays by linear address, and by opcode and ModRM form. The JIT
+ * isn't used while profiling.
+ */
+class i8086_profiler_t {
+public:
+	struct addr_entry_t {
+		uint32_t linear;
+		uint16_t cs;       // Segment the address last ran under
+		uint32_t count;
+		uint64_t cycles;
+	};
+
+	struct op_entry_t {
+		byte     op;
+		byte     form;
+		uint64_t count;
+		uint64_t cycles;
+	};
+
+	enum sort_t {
+		SORT_CYCLES,
+		SORT_COUNT,
+		SORT_ADDR,
+	};
+
+private:
+	i8086_t *cpu;
+
+	std::vector<uint32_t> addr_count;
+	std::vector<uint64_t> addr_cycles;
+	std::vector<uint16_t> addr_cs;
+
+	uint64_t op_count[256 * PROFILER_FORM_COUNT];
+	uint64_t op_cycles[256 * PROFILER_FORM_COUNT];
+
+	uint32_t sample_interval = 0;
+	int64_t  until_sample = 0;
+
+	uint64_t total_count = 0;
+	uint64_t total_cycles = 0;
+
+	void add(uint32_t linear, uint16_t cs, uint32_t count, uint32_t cycles);
+
+public:
+	bool enabled = false;
+
+	i8086_profiler_t(i8086_t *cpu);
+
+	// An interval of 0 counts every instruction. Starting again keeps the counts.
+	void start(uint32_t sample_interval = 0);
+	void stop();
+	void reset();
+
+	uint32_t get_sample_interval() { return sample_interval; }
+	uint64_t get_total_count()     { return total_count; }
+	uint64_t get_total_cycles()    { return total_cycles; }
+
+	// Called by step() after each instruction, with the cycles it took.
+	void record(uint32_t linear, uint16_t cs, uint32_t cycles) {
+		if (!sample_interval) {
+			add(linear, cs, 1, cycles);
+			return;
+		}
+		until_sample -= cycles;
+		// A step longer than the interval, like a whole REP string, takes every sample it spans.
+		if (until_sample <= 0) {
+			uint32_t n = 1 + uint32_t(uint64_t(-until_sample) / sample_interval);
+			until_sample += int64_t(n) * sample_interval;
+			add(linear, cs, n, n * sample_interval);
+		}
+	}
+
+	std::vector<addr_entry_t> top_addrs(size_t n, sort_t sort = SORT_CYCLES);
+	std::vector<op_entry_t>   top_ops(size_t n, sort_t sort = SORT_CYCLES);
+
+	static const char *form_name(byte form);
+
+	void write_report(FILE *f, size_t n = 200);
+	bool write_report(const char *path, size_t n = 200);
+};
+
+#endif
@@ -0,0 +1,333 @@
+#include "emu/i8086_trace.h"
+
+#include "emu/bus.h"
+#include "emu/i8086.h"
+#include "disasm/disasm_i8086.h"
+
+#include <chrono>
+#include <cstring>
+
+static const char trace_magic[8] = { 'C', 'H', 'N', 'T', 'R', 'A', 'C', 'E' };
+
+void trace_print_log_line(FILE *f, const trace_record_t &r) {
+	const uint16_t *v = r.field;
+	uint16_t flags = v[TRACE_FLAGS];
+
+	fprintf(f, "%10d: ", r.instr_count);
+	fprintf(f, "%04X:%04X  ", v[TRACE_CS], v[TRACE_IP]);
+	fprintf(f, " EAX:%08X", v[TRACE_AX]);
+	fprintf(f, " EBX:%08X", v[TRACE_BX]);
+	fprintf(f, " ECX:%08X", v[TRACE_CX]);
+	fprintf(f, " EDX:%08X", v[TRACE_DX]);
+	fprintf(f, " ESI:%08X", v[TRACE_SI]);
+	fprintf(f, " EDI:%08X", v[TRACE_DI]);
+	fprintf(f, " EBP:%08X", v[TRACE_BP]);
+	fprintf(f, " ESP:%08X", v[TRACE_SP]);
+	fprintf(f, " DS:%04X", v[TRACE_DS]);
+	fprintf(f, " ES:%04X", v[TRACE_ES]);
+	fprintf(f, " SS:%04X", v[TRACE_SS]);
+	fprintf(f, " C%d", !!(flags & i8086_t::FLAG_CF));
+	fprintf(f, " Z%d", !!(flags & i8086_t::FLAG_ZF));
+	fprintf(f, " S%d", !!(flags & i8086_t::FLAG_SF));
+	fprintf(f, " O%d", !!(flags & i8086_t::FLAG_OF));
+	fprintf(f, " I%d", !!(flags & i8086_t::FLAG_IF));
+	fprintf(f, " F%04X", flags & (i8086_t::FLAG_CF | i8086_t::FLAG_PF | i8086_t::FLAG_ZF | i8086_t::FLAG_SF |
+	                              i8086_t::FLAG_TF | i8086_t::FLAG_IF | i8086_t::FLAG_DF | i8086_t::FLAG_OF));
+	fprintf(f, "\n");
+}
+
+/*
+ * Record coding: a varint bitmask of what changed since the previous
+ * record, bit 0 for an instruction count that didn't advance by one,
+ * bits 1 to TRACE_FIELD_COUNT for the fields and the next bit for the
+ * memory operand width. Then the instruction count and field deltas as
+ * zigzag varints and the width as a byte.
+ */
+#define TRACE_MASK_WIDTH (1u << (TRACE_FIELD_COUNT + 1))
+
+static void put_varint(std::vector<byte> &out, uint32_t v) {
+	while (v >= 0x80) {
+		out.push_back(byte(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back(byte(v));
+}
+
+static bool get_varint(const std::vector<byte> &in, size_t &pos, uint32_t &v) {
+	v = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (pos >= in.size()) {
+			return false;
+		}
+		byte b = in[pos++];
+		v |= uint32_t(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint32_t zigzag(int32_t v) {
+	return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+	return int32_t(v >> 1) ^ -int32_t(v & 1);
+}
+
+i8086_trace_t::i8086_trace_t(i8086_t *a_cpu) {
+	cpu = a_cpu;
+
+	disassembler = new disasm_i8086_t;
+	disassembler->set_cpu(cpu);
+	disassembler->read = [this](address_space_t space, uint32_t addr, width_t w) -> uint16_t {
+		if (space != MEM) {
+			return 0;
+		}
+		return w == W8 ? cpu->bus->peek8(addr) : cpu->bus->peek8(addr) | (cpu->bus->peek8(addr + 1) << 8);
+	};
+}
+
+i8086_trace_t::~i8086_trace_t() {
+	close();
+	delete disassembler;
+}
+
+bool i8086_trace_t::open(const char *path) {
+	close();
+
+	f = fopen(path, "wb");
+	if (!f) {
+		printf("trace: unable to open '%s'\n", path);
+		return false;
+	}
+	fwrite(trace_magic, 1, sizeof(trace_magic), f);
+
+	ring = new trace_record_t[TRACE_RING_SIZE];
+	head = 0;
+	tail = 0;
+	chunk.clear();
+	chunk_records = 0;
+	prev = {};
+
+	running = true;
+	writer = std::thread(&i8086_trace_t::writer_loop, this);
+	return true;
+}
+
+void i8086_trace_t::close() {
+	if (!f) {
+		return;
+	}
+
+	running = false;
+	writer.join();
+	flush_chunk();
+
+	fclose(f);
+	f = nullptr;
+
+	delete[] ring;
+	ring = nullptr;
+}
+
+void i8086_trace_t::record() {
+	uint32_t h = head.load(std::memory_order_relaxed);
+	while (h - tail.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+		std::this_thread::yield();
+	}
+
+	capture(ring[h % TRACE_RING_SIZE]);
+
+	head.store(h + 1, std::memory_order_release);
+}
+
+void i8086_trace_t::capture(trace_record_t &r) {
+	uint16_t *v = r.field;
+
+	r.instr_count  = cpu->get_instr_count();
+	v[TRACE_CS]    = cpu->cs;
+	v[TRACE_IP]    = cpu->ip;
+	v[TRACE_AX]    = cpu->ax;
+	v[TRACE_BX]    = cpu->bx;
+	v[TRACE_CX]    = cpu->cx;
+	v[TRACE_DX]    = cpu->dx;
+	v[TRACE_SI]    = cpu->si;
+	v[TRACE_DI]    = cpu->di;
+	v[TRACE_BP]    = cpu->bp;
+	v[TRACE_SP]    = cpu->sp;
+	v[TRACE_DS]    = cpu->ds;
+	v[TRACE_ES]    = cpu->es;
+	v[TRACE_SS]    = cpu->ss;
+	v[TRACE_FLAGS] = cpu->get_flags();
+	r.flags_unknown = 0;
+
+	v[TRACE_MEM_SEG]   = 0;
+	v[TRACE_MEM_OFS]   = 0;
+	v[TRACE_MEM_VALUE] = 0;
+	r.mem_width        = 0;
+
+	disassembler->decode(cpu->cs, cpu->ip);
+	if (disassembler->has_mem_arg()) {
+		std::optional<mem_ref_t> mem = disassembler->get_mem_arg();
+		if (mem.has_value() && mem->width) {
+			v[TRACE_MEM_SEG]   = mem->seg;
+			v[TRACE_MEM_OFS]   = mem->ofs;
+			v[TRACE_MEM_VALUE] = mem->value;
+			r.mem_width        = mem->width;
+		}
+	}
+}
+
+void i8086_trace_t::writer_loop() {
+	for (;;) {
+		// Check running first so no record published before close() is missed.
+		bool more = running.load(std::memory_order_acquire);
+
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		uint32_t h = head.load(std::memory_order_acquire);
+		if (t == h) {
+			if (!more) {
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		for (; t != h; ++t) {
+			encode(ring[t % TRACE_RING_SIZE]);
+			if (chunk_records == TRACE_CHUNK_RECORDS) {
+				flush_chunk();
+			}
+		}
+		tail.store(t, std::memory_order_release);
+	}
+}
+
+void i8086_trace_t::encode(const trace_record_t &r) {
+	uint32_t mask = 0;
+	if (r.instr_count != prev.instr_count + 1) {
+		mask |= 1;
+	}
+	for (int i = 0; i != TRACE_FIELD_COUNT; ++i) {
+		if (r.field[i] != prev.field[i]) {
+			mask |= 2u << i;
+		}
+	}
+	if (r.mem_width != prev.mem_width) {
+		mask |= TRACE_MASK_WIDTH;
+	}
+
+	put_varint(chunk, mask);
+	if (mask & 1) {
+		put_varint(chunk, zigzag(int32_t(r.instr_count - prev.instr_count)));
+	}
+	for (int i = 0; i != TRACE_FIELD_COUNT; ++i) {
+		if (mask & (2u << i)) {
+			put_varint(chunk, zigzag(int16_t(r.field[i] - prev.field[i])));
+		}
+	}
+	if (mask & TRACE_MASK_WIDTH) {
+		chunk.push_back(r.mem_width);
+	}
+
+	prev = r;
+	chunk_records++;
+}
+
+void i8086_trace_t::flush_chunk() {
+	if (!chunk_records) {
+		return;
+	}
+
+	byte header[8];
+	writele32(&header[0], chunk_records);
+	writele32(&header[4], chunk.size());
+	fwrite(header, 1, sizeof(header), f);
+	fwrite(chunk.data(), 1, chunk.size(), f);
+
+	chunk.clear();
+	chunk_records = 0;
+	prev = {};
+}
+
+i8086_trace_reader_t::~i8086_trace_reader_t() {
+	if (f) {
+		fclose(f);
+	}
+}
+
+bool i8086_trace_reader_t::open(const char *path) {
+	f = fopen(path, "rb");
+	if (!f) {
+		printf("trace: unable to open '%s'\n", path);
+		return false;
+	}
+
+	char magic[sizeof(trace_magic)];
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, trace_magic, sizeof(magic))) {
+		printf("trace: '%s' is not a trace file\n", path);
+		fclose(f);
+		f = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool i8086_trace_reader_t::read_chunk() {
+	byte header[8];
+	if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+		return false;
+	}
+
+	remaining = readle32(&header[0]);
+	chunk.resize(readle32(&header[4]));
+	pos = 0;
+	prev = {};
+
+	return fread(chunk.data(), 1, chunk.size(), f) == chunk.size();
+}
+
+bool i8086_trace_reader_t::next(trace_record_t &r) {
+	if (!f) {
+		return false;
+	}
+	while (!remaining) {
+		if (!read_chunk()) {
+			return false;
+		}
+	}
+
+	uint32_t mask, v;
+	if (!get_varint(chunk, pos, mask)) {
+		return false;
+	}
+
+	r = prev;
+	r.instr_count = prev.instr_count + 1;
+	if (mask & 1) {
+		if (!get_varint(chunk, pos, v)) {
+			return false;
+		}
+		r.instr_count = prev.instr_count + unzigzag(v);
+	}
+	for (int i = 0; i != TRACE_FIELD_COUNT; ++i) {
+		if (mask & (2u << i)) {
+			if (!get_varint(chunk, pos, v)) {
+				return false;
+			}
+			r.field[i] = prev.field[i] + unzigzag(v);
+		}
+	}
+	if (mask & TRACE_MASK_WIDTH) {
+		if (pos >= chunk.size()) {
+			return false;
+		}
+		r.mem_width = chunk[pos++];
+	}
+
+	prev = r;
+	remaining--;
+	return true;
+}
@@ -0,0 +1,117 @@
+#ifndef EMU_I8086_TRACE
+#define EMU_I8086_TRACE
+
+#include "support/types.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+class i8086_t;
+class disasm_i8086_t;
+
+#define TRACE_RING_SIZE      (1 << 16)   // Records, must be a power of two
+#define TRACE_CHUNK_RECORDS  (1 << 16)
+
+enum {
+	TRACE_CS,
+	TRACE_IP,
+	TRACE_AX,
+	TRACE_BX,
+	TRACE_CX,
+	TRACE_DX,
+	TRACE_SI,
+	TRACE_DI,
+	TRACE_BP,
+	TRACE_SP,
+	TRACE_DS,
+	TRACE_ES,
+	TRACE_SS,
+	TRACE_FLAGS,
+	TRACE_MEM_SEG,
+	TRACE_MEM_OFS,
+	TRACE_MEM_VALUE,
+	TRACE_FIELD_COUNT
+};
+
+// The state before an instruction runs.
+struct trace_record_t {
+	uint32_t instr_count;
+	uint16_t field[TRACE_FIELD_COUNT];
+	byte     mem_width;       // Width of the memory operand in bytes, 0 if it has none
+	uint16_t flags_unknown;   // Flags a reference log line didn't report, they aren't compared
+};
+
+// Prints a record in the DOSBox compatible format of i8086_t::log_state().
+void trace_print_log_line(FILE *f, const trace_record_t &r);
+
+/*
+ * Records every instruction the CPU runs into a ring buffer. A writer
+ * thread drains the ring and stores the records in chunks, each record
+ * coded as the fields that changed since the previous one. Chunks start
+ * over from a zeroed record so they can be decoded on their own.
+ *
+ * File layout: "CHNTRACE", then chunks of
+ *   le32 record count, le32 payload size, payload
+ */
+class i8086_trace_t {
+	i8086_t        *cpu;
+	disasm_i8086_t *disassembler;
+
+	trace_record_t        *ring = nullptr;
+	std::atomic<uint32_t>  head = 0;   // Written by the CPU thread
+	std::atomic<uint32_t>  tail = 0;   // Written by the writer thread
+	std::atomic<bool>      running = false;
+
+	FILE              *f = nullptr;
+	std::thread        writer;
+	std::vector<byte>  chunk;
+	uint32_t           chunk_records = 0;
+	trace_record_t     prev;
+
+	void writer_loop();
+	void encode(const trace_record_t &r);
+	void flush_chunk();
+
+public:
+	i8086_trace_t(i8086_t *cpu);
+	~i8086_trace_t();
+
+	bool open(const char *path);
+	void close();
+
+	bool is_open() {
+		return f != nullptr;
+	}
+
+	// Fills r with the state before the instruction at cs:ip runs.
+	void capture(trace_record_t &r);
+	void record();
+};
+
+// A stream of instruction records.
+class trace_source_t {
+public:
+	virtual ~trace_source_t() {}
+	virtual bool next(trace_record_t &r) = 0;
+};
+
+// Reads back the records of a trace file.
+class i8086_trace_reader_t : public trace_source_t {
+	FILE              *f = nullptr;
+	std::vector<byte>  chunk;
+	size_t             pos = 0;
+	uint32_t           remaining = 0;
+	trace_record_t     prev;
+
+	bool read_chunk();
+
+public:
+	~i8086_trace_reader_t();
+
+	bool open(const char *path);
+	bool next(trace_record_t &r) override;
+};
+
+#endif
@@ -1,11 +1,11 @@
 #include "emu/i8254_pit.h"
 
+#include "emu/bus.h"
 #include "emu/i8086.h"
 #include "emu/ibm5160.h"
+#include "emu/snapshot.h"
 
 #include <cassert>
-#include <algorithm>
-#include <limits>
 
 void i8254_counter_t::write(byte v) {
 	switch (w) {
@@ -37,19 +37,23 @@ void i8254_counter_t::write(byte v) {
 	}
 }
 
+// Reads the latched count, or the live one if none was latched.
 byte i8254_counter_t::read() {
+	uint16_t v = is_latched ? output_latch : uint16_t(counting_element);
 	switch (r) {
 		case 0b00:
 			return 0;
 		case 0b01:
-			r = 0b00;
-			return readlo(output_latch);
+			r = rw;
+			is_latched = false;
+			return readlo(v);
 		case 0b10:
-			r = 0b00;
-			return readhi(output_latch);
+			r = rw;
+			is_latched = false;
+			return readhi(v);
 		case 0b11:
 			r = 0b10;
-			return readlo(output_latch);
+			return readlo(v);
 		default:
 			break;
 	}
@@ -57,9 +61,18 @@ byte i8254_counter_t::read() {
 	return 0;
 }
 
-uint64_t i8254_counter_t::run_cycles(uint64_t cycles) {
-	counting_element -= cycles;
-	return cycles;
+bool i8254_counter_t::run_cycles(uint64_t cycles) {
+	if (!activated) {
+		return false;
+	}
+	if (cycles < counting_element) {
+		counting_element -= cycles;
+		return false;
+	}
+
+	uint32_t reload = count_register ? count_register : 0x10000;
+	counting_element = reload - (cycles - counting_element) % reload;
+	return true;
 }
 
 i8254_pit_t::i8254_pit_t() {
@@ -70,39 +83,39 @@ i8254_pit_t::i8254_pit_t() {
 	counter[0].activated = true;
 }
 
+// Only counter 0 is wired to an interrupt.
 uint64_t i8254_pit_t::next_cycles() {
-	uint32_t min_counter = 0xffffffff;
-	for (int i = 0; i != 3; ++i) {
-		if (counter[i].activated) {
-			min_counter = std::min(min_counter, counter[0].counting_element);
-		}
+	if (!counter[0].activated) {
+		return UINT64_MAX;
 	}
-
-	return min_counter;
+	return counter[0].counting_element;
 }
 
 uint64_t i8254_pit_t::run_cycles(uint64_t cycles) {
-	cycles = std::min(cycles, next_cycles());
-	for (int i = 0; i != 3; ++i) {
-		counter[i].run_cycles(cycles);
-	}
-	if (counter[0].counting_element == 0) {
+	if (counter[0].run_cycles(cycles)) {
 		machine->raise_intr(0x08);
-		counter[0].counting_element = counter[0].count_register;
-		if (counter[0].counting_element == 0) {
-			counter[0].counting_element = 0x10000;
-		}
 	}
+	counter[1].run_cycles(cycles);
+	counter[2].run_cycles(cycles);
 	return cycles;
 }
 
-byte i8254_pit_t::read(byte addr) {
+void i8254_pit_t::map(bus_t *bus) {
+	bus->map_io(0x40, 0x43, this);
+}
+
+byte i8254_pit_t::io_read(uint16_t port) {
+	byte addr = port - 0x40;
 	assert(addr <= 0b11);
 
-	return counter[addr].output_latch;
+	if (addr == 0b11) {
+		return 0;
+	}
+	return counter[addr].read();
 }
 
-void i8254_pit_t::write(byte addr, byte w) {
+void i8254_pit_t::io_write(uint16_t port, byte w) {
+	byte addr = port - 0x40;
 	assert(addr <= 0b11);
 
 	printf("i8254_pit_t::write(%03x, %02x)\n", addr, w);
@@ -117,13 +130,17 @@ void i8254_pit_t::write(byte addr, byte w) {
 			byte mode = (w >> 1) & 0b111;
 			bool bcd  = w & 1;
 
-			if (rw == 0b00) { // Counter latch
-				counter[sc].is_latched = true;
+			if (rw == 0b00) { // Counter latch, the bus synced the counters
+				if (!counter[sc].is_latched) {
+					counter[sc].output_latch = uint16_t(counter[sc].counting_element);
+					counter[sc].is_latched = true;
+				}
 			} else {
 				if (mode & 0b010) {
 					mode |= 0b011;
 				}
 
+				counter[sc].rw = rw;
 				counter[sc].r = rw;
 				counter[sc].w = rw;
 				counter[sc].mode = mode;
@@ -136,3 +153,52 @@ void i8254_pit_t::write(byte addr, byte w) {
 		}
 	}
 }
+
+void i8254_pit_t::save_state(snapshot_writer_t &w) {
+	w.put(selected_counter);
+	w.put(write_state);
+	w.put(read_state);
+
+	for (const auto &c : counter) {
+		w.put(c.activated);
+		w.put(c.counting_element);
+		w.put(c.output_latch);
+		w.put(c.count_register);
+		w.put(byte(c.is_latched));
+		w.put(byte(c.r));
+		w.put(byte(c.w));
+		w.put(byte(c.mode));
+		w.put(byte(c.bcd));
+		w.put(byte(c.out));
+		w.put(byte(c.rw));
+	}
+}
+
+bool i8254_pit_t::load_state(snapshot_reader_t &r) {
+	r.get(selected_counter);
+	r.get(write_state);
+	r.get(read_state);
+
+	for (auto &c : counter) {
+		byte is_latched, read_step, write_step, mode, bcd, out, rw;
+		r.get(c.activated);
+		r.get(c.counting_element);
+		r.get(c.output_latch);
+		r.get(c.count_register);
+		r.get(is_latched);
+		r.get(read_step);
+		r.get(write_step);
+		r.get(mode);
+		r.get(bcd);
+		r.get(out);
+		r.get(rw);
+		c.is_latched = is_latched;
+		c.r          = read_step;
+		c.w          = write_step;
+		c.mode       = mode;
+		c.bcd        = bcd;
+		c.out        = out;
+		c.rw         = rw;
+	}
+	return r.good();
+}
@@ -20,6 +20,7 @@ struct i8254_counter_t {
 	byte     mode:3;
 	byte     bcd:1;
 	byte     out:1;
+	byte     rw:2;             // Access mode, r and w step through it
 
 	i8254_counter_t() :
 		activated(false),
@@ -31,16 +32,22 @@ struct i8254_counter_t {
 		w(0),
 		mode(0),
 		bcd(0),
-		out(0)
+		out(0),
+		rw(0)
 	{}
 
 	byte read();
 	void write(byte v);
 
-	uint64_t next_cycles();
-	uint64_t run_cycles(uint64_t cycles);
+	// Catches up in one step, returns true if the count reached zero and was reloaded.
+	bool run_cycles(uint64_t cycles);
 };
 
+/*
+ * The counters are only brought up to date when the scheduler syncs the
+ * PIT, before a port access or at counter 0's terminal count, the one
+ * event that raises an interrupt. Counters 1 and 2 never end a slice.
+ */
 class i8254_pit_t : public device_t {
 	byte selected_counter = 0;
 	enum {
@@ -61,12 +68,16 @@ class i8254_pit_t : public device_t {
 public:
 	i8254_pit_t();
 
-	byte     read(byte addr);
-	void     write(byte addr, byte cw);
+	void     map(bus_t *bus);
+	byte     io_read(uint16_t port);
+	void     io_write(uint16_t port, byte cw);
 
 	double   frequency_in_mhz() { return 1.1931818181818181; };
 	uint64_t next_cycles();
 	uint64_t run_cycles(uint64_t cycles);
+
+	void     save_state(snapshot_writer_t &w);
+	bool     load_state(snapshot_reader_t &r);
 };
 
 #endif
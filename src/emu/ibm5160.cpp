@@ -2,9 +2,13 @@
 
 #include "bios/bios.h"
 #include "dos/dos.h"
+#include "emu/bus.h"
 #include "emu/i8086.h"
+#include "emu/i8086_block_cache.h"
+#include "emu/i8086_hle.h"
 #include "emu/i8254_pit.h"
 #include "emu/keyboard.h"
+#include "emu/scheduler.h"
 #include "emu/vga.h"
 #include "support/types.h"
 
@@ -12,20 +16,26 @@
 #include <cstdio>
 #include <cstring>
 
-#define DIRTY_PAGE_SIZE     4096
-
 ibm5160_t::ibm5160_t() {
 	memory = (byte *)malloc(MEMORY_SIZE);
 	memset(memory, 0, MEMORY_SIZE);
 
+	bus = new bus_t;
+	bus->map_ram(0, MEMORY_SIZE, memory);
+
 	cpu = add_device("cpu", new i8086_t);
-	((i8086_t *)cpu)->read  = THIS_READ_CB(read);
-	((i8086_t *)cpu)->write = THIS_WRITE_CB(write);
+	((i8086_t *)cpu)->bus = bus;
+
+	hle = new i8086_hle_t(this, (i8086_t *)cpu);
+	((i8086_t *)cpu)->hle = hle;
 
 	pit = add_device("pit", new i8254_pit_t);
 	vga = add_device("vga", new vga_t);
 	keyboard = add_device("kbd", new keyboard_t);
 
+	scheduler = new scheduler_t(this);
+	bus->scheduler = scheduler;
+
 	bios = new bios_t;
 	bios->machine = this;
 
@@ -36,49 +46,58 @@ ibm5160_t::ibm5160_t() {
 	dos->install();
 }
 
-uint16_t ibm5160_t::read(address_space_t address_space, uint32_t addr, width_t w) {
-	if (address_space == MEM) {
-		assert(addr < MEMORY_SIZE);
-		if (w == W8) {
-			return memory[addr];
-		}
-		return readle16(&memory[addr]);
+ibm5160_t::~ibm5160_t() {
+	delete dos;
+	delete bios;
+	delete scheduler;
+	for (auto &d : devices) {
+		delete d.device;
 	}
+	delete hle;
+	delete bus;
+	free(memory);
+}
 
-	if (address_space == IO) {
-		assert(w == W8);
-		byte v = 0;
-		if (addr >= 0x60 && addr <= 0x64) {
-			v = keyboard->read(addr - 0x60);
-		} else if (addr >= 0x3c0 && addr < 0x3e0) {
-			v = vga->read(address_space, addr);
-		}
-		return v;
+uint16_t ibm5160_t::read(address_space_t address_space, uint32_t addr, width_t w) {
+	// Reads for the debugger and DOS, they don't trigger watchpoints.
+	if (address_space == MEM) {
+		return w == W8 ? bus->peek8(addr) : bus->peek8(addr) | (bus->peek8(addr + 1) << 8);
 	}
 
-	return 0;
+	return w == W8 ? bus->io_read8(addr) : bus->io_read16(addr);
 }
 
 void ibm5160_t::write(address_space_t address_space, uint32_t addr, width_t w, uint16_t v) {
 	if (address_space == MEM) {
-		assert(addr < MEMORY_SIZE);
 		if (w == W8) {
-			memory[addr] = v;
+			bus->write8(addr, v);
 		} else {
-			writele16(&memory[addr], v);
+			bus->write16(addr, v);
 		}
+		((i8086_t *)cpu)->block_cache->memory_written(addr, w == W8 ? 1 : 2);
 		return;
 	}
 
-	if (address_space == IO) {
-		assert(w == W8);
+	if (w == W8) {
+		bus->io_write8(addr, v);
+	} else {
+		bus->io_write16(addr, v);
+	}
+}
 
-		if (addr >= 0x040 && addr < 0x060) {
-			pit->write(addr - 0x040, v);
-		} else if (addr >= 0x60 && addr <= 0x64) {
-			keyboard->write(addr - 0x60, v);
-		} else if (addr >= 0x3c0 && addr < 0x3e0) {
-			vga->write(address_space, addr, v);
-		}
+void ibm5160_t::memory_written(uint32_t addr, uint32_t len) {
+	if (len == 0) {
+		return;
 	}
+	bus->mark_dirty(addr, len);
+	((i8086_t *)cpu)->block_cache->memory_written(addr, len);
+}
+
+void ibm5160_t::save_state(snapshot_writer_t &w) {
+	machine_t::save_state(w);
+	dos->save_state(w);
+}
+
+bool ibm5160_t::load_state(snapshot_reader_t &r) {
+	return machine_t::load_state(r) && dos->load_state(r);
 }
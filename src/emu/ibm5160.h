@@ -6,10 +6,12 @@
 #include "support/types.h"
 
 #define MEMORY_SIZE     0x100000
+#define DIRTY_PAGE_SIZE 4096
 
 class bios_t;
 class dos_t;
 class i8086_t;
+class i8086_hle_t;
 class i8254_pit_t;
 class vga_t;
 class keyboard_t;
@@ -21,12 +23,20 @@ public:
 	i8254_pit_t *pit;
 	vga_t       *vga;
 	keyboard_t  *keyboard;
+	i8086_hle_t *hle;
 
 	ibm5160_t();
+	~ibm5160_t();
 
 	uint16_t read(address_space_t, uint32_t, width_t = W8);
 	void     write(address_space_t, uint32_t, width_t, uint16_t);
 
+	// Must be called after writing to memory directly.
+	void     memory_written(uint32_t addr, uint32_t len);
+
+	void     save_state(snapshot_writer_t &w);
+	bool     load_state(snapshot_reader_t &r);
+
 	byte mem_read8(uint16_t seg, uint16_t ofs) {
 		return read(MEM, 0x10 * seg + ofs, W8);
 	}
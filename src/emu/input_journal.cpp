@@ -0,0 +1,196 @@
+#include "emu/input_journal.h"
+
+#include "dos/dos.h"
+#include "emu/i8086.h"
+#include "emu/i8086_jit.h"
+#include "emu/ibm5160.h"
+#include "emu/keyboard.h"
+#include "support/mapped_file.h"
+
+#include <cstring>
+
+#define INPUT_JOURNAL_VERSION  1
+#define INPUT_JOURNAL_FLAG_JIT 0x01
+
+static const char journal_magic[8] = { 'C', 'H', 'N', 'I', 'N', 'P', 'U', 'T' };
+
+static void put_varint(FILE *f, uint64_t v) {
+	while (v >= 0x80) {
+		fputc(byte(v | 0x80), f);
+		v >>= 7;
+	}
+	fputc(byte(v), f);
+}
+
+static bool get_varint(const byte *&p, const byte *end, uint64_t &v) {
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p == end) {
+			return false;
+		}
+		byte b = *p++;
+		v |= uint64_t(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+input_journal_t::input_journal_t(ibm5160_t *a_machine) {
+	machine = a_machine;
+}
+
+input_journal_t::~input_journal_t() {
+	close();
+}
+
+bool input_journal_t::open_record(const char *path) {
+	close();
+
+	f = fopen(path, "wb");
+	if (!f) {
+		printf("input_journal: unable to open '%s'\n", path);
+		return false;
+	}
+
+	i8086_t *cpu = (i8086_t *)machine->cpu;
+	byte header[13];
+	memcpy(header, journal_magic, sizeof(journal_magic));
+	writele32(header + 8, INPUT_JOURNAL_VERSION);
+	header[12] = cpu->jit->enabled ? INPUT_JOURNAL_FLAG_JIT : 0;
+	fwrite(header, 1, sizeof(header), f);
+
+	last_cycle = cpu->get_cycles();
+	return true;
+}
+
+bool input_journal_t::open_replay(const char *path) {
+	close();
+
+	mapped_file_t file;
+	if (!file.open(path)) {
+		printf("input_journal: unable to open '%s'\n", path);
+		return false;
+	}
+
+	const byte *p   = (const byte *)file.data();
+	const byte *end = p + file.size();
+	if (file.size() < 13 || memcmp(p, journal_magic, sizeof(journal_magic))) {
+		printf("input_journal: '%s' is not an input journal\n", path);
+		return false;
+	}
+	if (readle32((byte *)p + 8) != INPUT_JOURNAL_VERSION) {
+		printf("input_journal: '%s' has an unknown version\n", path);
+		return false;
+	}
+
+	i8086_t *cpu = (i8086_t *)machine->cpu;
+	if (bool(p[12] & INPUT_JOURNAL_FLAG_JIT) != cpu->jit->enabled) {
+		printf("input_journal: '%s' was recorded %s the JIT, the replay may diverge\n",
+			path, (p[12] & INPUT_JOURNAL_FLAG_JIT) ? "with" : "without");
+	}
+	p += 13;
+
+	uint64_t cycle = cpu->get_cycles();
+	while (p != end) {
+		event_t  e = {};
+		uint64_t delta, a, b, c;
+
+		if (!get_varint(p, end, delta) || p == end) {
+			break;
+		}
+		cycle += delta;
+		e.cycle = cycle;
+		e.type  = event_type_t(*p++);
+
+		bool ok = false;
+		switch (e.type) {
+			case EVENT_KEY_DOWN:
+			case EVENT_KEY_UP:
+				ok = get_varint(p, end, a);
+				e.key = a;
+				break;
+			case EVENT_MOUSE:
+				ok = get_varint(p, end, a) && get_varint(p, end, b) && get_varint(p, end, c);
+				e.x       = a;
+				e.y       = b;
+				e.buttons = c;
+				break;
+		}
+		if (!ok) {
+			break;
+		}
+		events.push_back(e);
+	}
+
+	if (p != end) {
+		printf("input_journal: '%s' is truncated after %zu events\n", path, events.size());
+	}
+
+	next_event = 0;
+	replaying  = true;
+	return true;
+}
+
+void input_journal_t::close() {
+	if (f) {
+		fclose(f);
+		f = nullptr;
+	}
+	events.clear();
+	next_event = 0;
+	replaying  = false;
+}
+
+void input_journal_t::apply(const event_t &e) {
+	switch (e.type) {
+		case EVENT_KEY_DOWN: machine->keyboard->set_key_down(e.key); break;
+		case EVENT_KEY_UP:   machine->keyboard->set_key_up(e.key); break;
+		case EVENT_MOUSE:    machine->dos->set_mouse(e.x, e.y, e.buttons); break;
+	}
+}
+
+void input_journal_t::record(const event_t &e) {
+	apply(e);
+
+	if (!f) {
+		return;
+	}
+
+	put_varint(f, e.cycle - last_cycle);
+	fputc(e.type, f);
+	if (e.type == EVENT_MOUSE) {
+		put_varint(f, e.x);
+		put_varint(f, e.y);
+		put_varint(f, e.buttons);
+	} else {
+		put_varint(f, e.key);
+	}
+	last_cycle = e.cycle;
+}
+
+void input_journal_t::set_key_down(int key) {
+	if (!is_replaying()) {
+		record({ ((i8086_t *)machine->cpu)->get_cycles(), EVENT_KEY_DOWN, uint32_t(key), 0, 0, 0 });
+	}
+}
+
+void input_journal_t::set_key_up(int key) {
+	if (!is_replaying()) {
+		record({ ((i8086_t *)machine->cpu)->get_cycles(), EVENT_KEY_UP, uint32_t(key), 0, 0, 0 });
+	}
+}
+
+void input_journal_t::set_mouse(uint16_t x, uint16_t y, uint16_t buttons) {
+	if (!is_replaying()) {
+		record({ ((i8086_t *)machine->cpu)->get_cycles(), EVENT_MOUSE, 0, x, y, buttons });
+	}
+}
+
+void input_journal_t::replay() {
+	uint64_t now = ((i8086_t *)machine->cpu)->get_cycles();
+	while (is_replaying() && events[next_event].cycle <= now) {
+		apply(events[next_event++]);
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef EMU_INPUT_JOURNAL
+#define EMU_INPUT_JOURNAL
+
+#include "support/types.h"
+
+#include <cstdio>
+#include <vector>
+
+class ibm5160_t;
+
+/*
+ * Keyboard and mouse input stamped with the CPU cycle count it was
+ * applied at. The runner applies input between slices and slice ends
+ * only depend on emulated time, so replaying a journal applies every
+ * event at the same cycle and the run comes out bit-identical. This
+ * holds as long as the CPU runs the same way, the JIT runs whole blocks
+ * and ends slices at other cycles than the interpreter.
+ *
+ * File layout: "CHNINPUT", le32 version, byte flags, then events of
+ *   varint cycles since the previous event, byte type, varint key or varint x, y, buttons
+ */
+class input_journal_t {
+	enum event_type_t : byte {
+		EVENT_KEY_DOWN,
+		EVENT_KEY_UP,
+		EVENT_MOUSE,
+	};
+
+	struct event_t {
+		uint64_t     cycle;
+		event_type_t type;
+		uint32_t     key;
+		uint16_t     x;
+		uint16_t     y;
+		uint16_t     buttons;
+	};
+
+	ibm5160_t *machine;
+
+	FILE     *f = nullptr;   // Recording
+	uint64_t  last_cycle = 0;
+
+	std::vector<event_t> events;   // Replaying
+	size_t               next_event = 0;
+	bool                 replaying = false;
+
+	void apply(const event_t &e);
+	void record(const event_t &e);
+
+public:
+	input_journal_t(ibm5160_t *machine);
+	~input_journal_t();
+
+	bool open_record(const char *path);
+	bool open_replay(const char *path);
+	void close();
+
+	bool is_recording() { return f != nullptr; }
+
+	// Live input is ignored until the replayed events run out.
+	bool is_replaying() { return replaying && next_event != events.size(); }
+
+	// Apply the input and record it.
+	void set_key_down(int key);
+	void set_key_up(int key);
+	void set_mouse(uint16_t x, uint16_t y, uint16_t buttons);
+
+	// Applies the replayed events due by the current cycle, called between slices.
+	void replay();
+};
+
+#endif
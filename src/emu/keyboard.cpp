@@ -1,11 +1,136 @@
 #include "keyboard.h"
 
+#include "emu/bus.h"
 #include "emu/i8086.h"
 #include "emu/ibm5160.h"
+#include "emu/scheduler.h"
+#include "emu/snapshot.h"
 
-#include <algorithm>
-#include <iostream>
-#include <queue>
+#include <array>
+#include <cstdio>
+
+struct key_scan_codes_t {
+	int             glfw_key;
+	scan_code_seq_t make;    // For key_down
+	scan_code_seq_t brk;     // For key_up
+};
+
+// Taken from http://users.utcluj.ro/~baruch/sie/labor/PS2/Scan_Codes_Set_1.htm
+static constexpr key_scan_codes_t scan_code_set_1_keys[] = {
+	{ GLFW_KEY_SPACE,         { 0x39 }, { 0xB9 } },
+	{ GLFW_KEY_APOSTROPHE,    { 0x28 }, { 0xA8 } },
+	{ GLFW_KEY_COMMA,         { 0x33 }, { 0xB3 } },
+	{ GLFW_KEY_MINUS,         { 0x0C }, { 0x8C } },
+	{ GLFW_KEY_PERIOD,        { 0x34 }, { 0xB4 } },
+	{ GLFW_KEY_SLASH,         { 0x35 }, { 0xB5 } },
+	{ GLFW_KEY_0,             { 0x0B }, { 0x8B } },
+	{ GLFW_KEY_1,             { 0x02 }, { 0x82 } },
+	{ GLFW_KEY_2,             { 0x03 }, { 0x83 } },
+	{ GLFW_KEY_3,             { 0x04 }, { 0x84 } },
+	{ GLFW_KEY_4,             { 0x05 }, { 0x85 } },
+	{ GLFW_KEY_5,             { 0x06 }, { 0x86 } },
+	{ GLFW_KEY_6,             { 0x07 }, { 0x87 } },
+	{ GLFW_KEY_7,             { 0x08 }, { 0x88 } },
+	{ GLFW_KEY_8,             { 0x09 }, { 0x89 } },
+	{ GLFW_KEY_9,             { 0x0A }, { 0x8A } },
+	{ GLFW_KEY_SEMICOLON,     { 0x27 }, { 0xA7 } },
+	{ GLFW_KEY_EQUAL,         { 0x0D }, { 0x8D } },
+	{ GLFW_KEY_A,             { 0x1E }, { 0x9E } },
+	{ GLFW_KEY_B,             { 0x30 }, { 0xB0 } },
+	{ GLFW_KEY_C,             { 0x2E }, { 0xAE } },
+	{ GLFW_KEY_D,             { 0x20 }, { 0xA0 } },
+	{ GLFW_KEY_E,             { 0x12 }, { 0x92 } },
+	{ GLFW_KEY_F,             { 0x21 }, { 0xA1 } },
+	{ GLFW_KEY_G,             { 0x22 }, { 0xA2 } },
+	{ GLFW_KEY_H,             { 0x23 }, { 0xA3 } },
+	{ GLFW_KEY_I,             { 0x17 }, { 0x92 } },
+	{ GLFW_KEY_J,             { 0x24 }, { 0xA4 } },
+	{ GLFW_KEY_K,             { 0x25 }, { 0xA5 } },
+	{ GLFW_KEY_L,             { 0x26 }, { 0xA6 } },
+	{ GLFW_KEY_M,             { 0x32 }, { 0xB2 } },
+	{ GLFW_KEY_N,             { 0x31 }, { 0xB1 } },
+	{ GLFW_KEY_O,             { 0x18 }, { 0x98 } },
+	{ GLFW_KEY_P,             { 0x19 }, { 0x99 } },
+	{ GLFW_KEY_Q,             { 0x10 }, { 0x90 } },
+	{ GLFW_KEY_R,             { 0x13 }, { 0x93 } },
+	{ GLFW_KEY_S,             { 0x1F }, { 0x9F } },
+	{ GLFW_KEY_T,             { 0x14 }, { 0x94 } },
+	{ GLFW_KEY_U,             { 0x16 }, { 0x96 } },
+	{ GLFW_KEY_V,             { 0x2F }, { 0xAF } },
+	{ GLFW_KEY_W,             { 0x11 }, { 0x91 } },
+	{ GLFW_KEY_X,             { 0x2D }, { 0xAD } },
+	{ GLFW_KEY_Y,             { 0x15 }, { 0x95 } },
+	{ GLFW_KEY_Z,             { 0x2C }, { 0xAC } },
+	{ GLFW_KEY_LEFT_BRACKET,  { 0x1A }, { 0x9A } },
+	{ GLFW_KEY_BACKSLASH,     { 0x2B }, { 0xAB } },
+	{ GLFW_KEY_RIGHT_BRACKET, { 0x1B }, { 0x9B } },
+	{ GLFW_KEY_GRAVE_ACCENT,  { 0x29 }, { 0x89 } },
+	{ GLFW_KEY_ESCAPE,        { 0x01 }, { 0x81 } },
+	{ GLFW_KEY_ENTER,         { 0x1C }, { 0x9C } },
+	{ GLFW_KEY_TAB,           { 0x0F }, { 0x8F } },
+	{ GLFW_KEY_BACKSPACE,     { 0x0E }, { 0x8E } },
+	{ GLFW_KEY_INSERT,        { 0xE0, 0x52 }, { 0xE0, 0xD2 } },
+	{ GLFW_KEY_DELETE,        { 0xE0, 0x53 }, { 0xE0, 0xD3 } },
+	{ GLFW_KEY_RIGHT,         { 0xE0, 0x4D }, { 0xE0, 0xCD } },
+	{ GLFW_KEY_LEFT,          { 0xE0, 0x4B }, { 0xE0, 0xCB } },
+	{ GLFW_KEY_DOWN,          { 0xE0, 0x50 }, { 0xE0, 0xD0 } },
+	{ GLFW_KEY_UP,            { 0xE0, 0x48 }, { 0xE0, 0xC8 } },
+	{ GLFW_KEY_PAGE_UP,       { 0xE0, 0x49 }, { 0xE0, 0xC9 } },
+	{ GLFW_KEY_PAGE_DOWN,     { 0xE0, 0x51 }, { 0xE0, 0xD1 } },
+	{ GLFW_KEY_HOME,          { 0x0E, 0x47 }, { 0xE0, 0x97 } },
+	{ GLFW_KEY_END,           { 0xE0, 0x4F }, { 0xE0, 0xCF } },
+	{ GLFW_KEY_CAPS_LOCK,     { 0x3A }, { 0xBA } },
+	{ GLFW_KEY_SCROLL_LOCK,   { 0x46 }, { 0xC6 } },
+	{ GLFW_KEY_NUM_LOCK,      { 0x45 }, { 0xC5 } },
+	{ GLFW_KEY_PRINT_SCREEN,  { 0xE0, 0x2A, 0xE0, 0x37 }, { 0xE0, 0xB7, 0xE0, 0xAA } },
+	{ GLFW_KEY_PAUSE,         { 0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5 }, {} },
+	{ GLFW_KEY_F1,            { 0x3B }, { 0xBB } },
+	{ GLFW_KEY_F2,            { 0x3C }, { 0xBC } },
+	{ GLFW_KEY_F3,            { 0x3D }, { 0xBD } },
+	{ GLFW_KEY_F4,            { 0x3E }, { 0xBE } },
+	{ GLFW_KEY_F5,            { 0x3F }, { 0xBF } },
+	{ GLFW_KEY_F6,            { 0x40 }, { 0xC0 } },
+	{ GLFW_KEY_F7,            { 0x41 }, { 0xC1 } },
+	{ GLFW_KEY_F8,            { 0x42 }, { 0xC2 } },
+	{ GLFW_KEY_F9,            { 0x43 }, { 0xC3 } },
+	{ GLFW_KEY_F10,           { 0x44 }, { 0xC4 } },
+	{ GLFW_KEY_F11,           { 0x57 }, { 0xD7 } },
+	{ GLFW_KEY_F12,           { 0x58 }, { 0xD8 } },
+	{ GLFW_KEY_KP_0,          { 0x52 }, { 0xD2 } },
+	{ GLFW_KEY_KP_1,          { 0x4F }, { 0xCF } },
+	{ GLFW_KEY_KP_2,          { 0x50 }, { 0xD0 } },
+	{ GLFW_KEY_KP_3,          { 0x51 }, { 0xD1 } },
+	{ GLFW_KEY_KP_4,          { 0x4B }, { 0xCB } },
+	{ GLFW_KEY_KP_5,          { 0x4C }, { 0xCC } },
+	{ GLFW_KEY_KP_6,          { 0x4D }, { 0xCD } },
+	{ GLFW_KEY_KP_7,          { 0x47 }, { 0xC7 } },
+	{ GLFW_KEY_KP_8,          { 0x48 }, { 0xC8 } },
+	{ GLFW_KEY_KP_9,          { 0x49 }, { 0xC9 } },
+	{ GLFW_KEY_KP_DECIMAL,    { 0x53 }, { 0xD3 } },
+	{ GLFW_KEY_KP_DIVIDE,     { 0xE0, 0x35 }, { 0xE0, 0xB5 } },
+	{ GLFW_KEY_KP_MULTIPLY,   { 0x37 }, { 0xB7 } },
+	{ GLFW_KEY_KP_SUBTRACT,   { 0x4A }, { 0xCA } },
+	{ GLFW_KEY_KP_ADD,        { 0x4E }, { 0xCE } },
+	{ GLFW_KEY_KP_ENTER,      { 0xE0, 0x1C }, { 0xE0, 0x9C } },
+	{ GLFW_KEY_LEFT_SHIFT,    { 0x2A }, { 0xAA } },
+	{ GLFW_KEY_LEFT_CONTROL,  { 0x1D }, { 0x9D } },
+	{ GLFW_KEY_LEFT_ALT,      { 0x38 }, { 0xB8 } },
+	{ GLFW_KEY_LEFT_SUPER,    { 0xE0, 0x5B }, { 0xE0, 0xDB } },
+	{ GLFW_KEY_RIGHT_SHIFT,   { 0x36 }, { 0xB6 } },
+	{ GLFW_KEY_RIGHT_CONTROL, { 0xE0, 0x1D }, { 0x00 } },
+	{ GLFW_KEY_RIGHT_ALT,     { 0xE0, 0x38 }, { 0xE0, 0xB8 } },
+	{ GLFW_KEY_RIGHT_SUPER,   { 0xE0, 0x5C }, { 0xE0, 0xDC } },
+	{ GLFW_KEY_MENU,          { 0xE0, 0x5D }, { 0xE0, 0xDD } },
+};
+
+// Scan code set 1 indexed by GLFW key, keys without codes have empty sequences.
+static constexpr std::array<key_scan_codes_t, GLFW_KEY_LAST + 1> scan_code_set_1 = [] {
+	std::array<key_scan_codes_t, GLFW_KEY_LAST + 1> table {};
+	for (const auto &key : scan_code_set_1_keys) {
+		table[key.glfw_key] = key;
+	}
+	return table;
+}();
 
 keyboard_t::keyboard_t() :
 	data_output_buffer(0),
@@ -15,8 +140,7 @@ keyboard_t::keyboard_t() :
 	glfw_key_state.reset();
 }
 
-// Returns 0 if empty, or 1ms worth of cycles.
-// Something large enough for run_cycles to run and intr 9 to be raised.
+// Cycles until the next byte is delivered, UINT64_MAX while the buffer is empty.
 uint64_t keyboard_t::next_cycles() {
 	return next_event;
 }
@@ -34,7 +158,7 @@ uint64_t keyboard_t::run_cycles(uint64_t cycles) {
 			buffer.pop_front();
 			status |= I8042_STATUS_OUTPUT_BUFFER_FULL;
 			machine->raise_intr(9);
-			next_event = 1000 * frequency_in_mhz();
+			next_event = buffer.empty() ? UINT64_MAX : uint64_t(1000 * frequency_in_mhz());
 		} else {
 			next_event = UINT64_MAX;
 		}
@@ -43,60 +167,108 @@ uint64_t keyboard_t::run_cycles(uint64_t cycles) {
 	return cycles;
 }
 
-uint8_t keyboard_t::read(uint8_t addr) {
-	switch (addr) {
-		case 0x00:
+void keyboard_t::map(bus_t *bus) {
+	bus->map_io(0x60, 0x64, this);
+}
+
+byte keyboard_t::io_read(uint16_t port) {
+	switch (port) {
+		case 0x60:
 			if (status | I8042_STATUS_OUTPUT_BUFFER_FULL) {
 				status &= ~I8042_STATUS_OUTPUT_BUFFER_FULL;
-				next_event = 1000 * frequency_in_mhz();
+				if (!buffer.empty()) {
+					next_event = 1000 * frequency_in_mhz();
+				}
 			}
 			return data_output_buffer;
-		case 0x04:
+		case 0x64:
 			return status;
 		default:
-			printf("keyboard: unhandled io read @ %02x -> %02x\n", addr, 0);
+			printf("keyboard: unhandled io read @ %02x -> %02x\n", port - 0x60, 0);
 	}
 	return 0;
 }
 
-void keyboard_t::write(uint8_t addr, uint8_t v) {
-	printf("keyboard: unhandled io write @ %02x <- %02x\n", addr, v);
+void keyboard_t::io_write(uint16_t port, byte v) {
+	printf("keyboard: unhandled io write @ %02x <- %02x\n", port - 0x60, v);
+}
+
+// Bytes queued while others are still paced out wait for their turn.
+void keyboard_t::queue_scan_codes(const scan_code_seq_t &seq) {
+	for (int i = 0; i != seq.length; ++i) {
+		buffer.push_back(seq.bytes[i]);
+	}
+	if (seq.length && next_event == UINT64_MAX) {
+		next_event = 0;
+	}
 }
 
 void keyboard_t::set_key_down(int key_id) {
-	if (glfw_key_state.test(key_id)) {
+	if (key_id < 0 || key_id > GLFW_KEY_LAST || glfw_key_state.test(key_id)) {
 		return;
 	}
 
+	// Catch up before the bytes are queued, their interrupt is due now.
+	machine->scheduler->sync(this);
 	glfw_key_state.set(key_id);
-
-	for (int i = 0; i < scan_code_set_1_length; i++) {
-		key_sequence_t element = scan_code_set_1[i];
-		if (element.glfw_index == key_id) {
-			for (byte value : element.make_sequence) {
-				buffer.push_back(value);
-			}
-			next_event = 0;
-			break;
-		}
-	}
+	queue_scan_codes(scan_code_set_1[key_id].make);
+	machine->scheduler->reschedule(this);
 }
 
 void keyboard_t::set_key_up(int key_id) {
-	if (!glfw_key_state.test(key_id)) {
+	if (key_id < 0 || key_id > GLFW_KEY_LAST || !glfw_key_state.test(key_id)) {
 		return;
 	}
 
+	machine->scheduler->sync(this);
 	glfw_key_state.reset(key_id);
+	queue_scan_codes(scan_code_set_1[key_id].brk);
+	machine->scheduler->reschedule(this);
+}
 
-	for (int i = 0; i < scan_code_set_1_length; i++) {
-		key_sequence_t element = scan_code_set_1[i];
-		if (element.glfw_index == key_id) {
-			for (byte value : element.break_sequence) {
-				buffer.push_back(value);
-			}
-			next_event = 0;
-			break;
+void keyboard_t::save_state(snapshot_writer_t &w) {
+	w.put(next_event);
+
+	for (size_t i = 0; i < glfw_key_state.size(); i += 8) {
+		byte b = 0;
+		for (size_t j = 0; j != 8 && i + j < glfw_key_state.size(); ++j) {
+			b |= glfw_key_state.test(i + j) << j;
+		}
+		w.put(b);
+	}
+
+	w.put(uint32_t(buffer.size()));
+	for (byte v : buffer) {
+		w.put(v);
+	}
+
+	w.put(data_output_buffer);
+	w.put(status);
+}
+
+bool keyboard_t::load_state(snapshot_reader_t &r) {
+	r.get(next_event);
+
+	for (size_t i = 0; i < glfw_key_state.size(); i += 8) {
+		byte b;
+		r.get(b);
+		for (size_t j = 0; j != 8 && i + j < glfw_key_state.size(); ++j) {
+			glfw_key_state.set(i + j, (b >> j) & 1);
 		}
 	}
+
+	uint32_t count;
+	if (!r.get(count)) {
+		return false;
+	}
+	buffer.clear();
+	for (uint32_t i = 0; i != count && r.good(); ++i) {
+		byte v;
+		r.get(v);
+		buffer.push_back(v);
+	}
+
+	r.get(data_output_buffer);
+	r.get(status);
+	return r.good();
 }
@@ -1,6 +1,31 @@
 #include "emu/machine.h"
 
+#include "emu/bus.h"
 #include "emu/device.h"
+#include "emu/scheduler.h"
+#include "support/mapped_file.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+/*
+ * Snapshot file layout, in host byte order:
+ *   "CHNSNAP\0", le32 version, le32 state size, le32 memory offset, le32 memory size
+ *   state
+ *   memory, at a page aligned offset so it can be copied straight out of the mapped file
+ */
+#define SNAPSHOT_FILE_ALIGN 4096
+
+static const char snapshot_magic[8] = { 'C', 'H', 'N', 'S', 'N', 'A', 'P', 0 };
+
+struct snapshot_file_header_t {
+	char     magic[8];
+	uint32_t version;
+	uint32_t state_size;
+	uint32_t memory_offset;
+	uint32_t memory_size;
+};
 
 device_t *machine_t::add_plain_device(const char *name, device_t *device) {
 	devices.push_back(named_device_t{
@@ -8,5 +33,184 @@ device_t *machine_t::add_plain_device(const char *name, device_t *device) {
 		device
 	});
 	device->set_machine(this);
+	device->map(bus);
 	return device;
 }
+
+// Devices the scheduler runs lazily are brought up to now first.
+void machine_t::save_state(snapshot_writer_t &w) {
+	if (scheduler) {
+		scheduler->sync_all();
+	}
+
+	w.put(uint32_t(devices.size()));
+	for (const auto &d : devices) {
+		w.put_string(d.name);
+		d.device->save_state(w);
+	}
+
+	if (scheduler) {
+		scheduler->save_state(w);
+	}
+}
+
+bool machine_t::load_state(snapshot_reader_t &r) {
+	uint32_t count;
+	if (!r.get(count) || count != devices.size()) {
+		printf("snapshot: device count doesn't match\n");
+		return false;
+	}
+
+	for (const auto &d : devices) {
+		std::string name;
+		if (!r.get_string(name) || name != d.name) {
+			printf("snapshot: expected device '%s'\n", d.name.c_str());
+			return false;
+		}
+		if (!d.device->load_state(r)) {
+			printf("snapshot: bad state for device '%s'\n", d.name.c_str());
+			return false;
+		}
+	}
+
+	if (scheduler && !scheduler->load_state(r)) {
+		return false;
+	}
+	return r.good();
+}
+
+/*
+ * Devices load their state in place, so one failing halfway would leave
+ * the ones before it restored. The state from before is saved first and
+ * loaded back if the stream doesn't load as a whole.
+ */
+bool machine_t::load_state_or_keep(snapshot_reader_t &r) {
+	std::vector<byte> current;
+	snapshot_writer_t w(current);
+	save_state(w);
+
+	if (load_state(r)) {
+		return true;
+	}
+
+	snapshot_reader_t current_r(current.data(), current.size());
+	bool kept = load_state(current_r);
+	assert(kept);
+	(void)kept;
+	return false;
+}
+
+snapshot_t *machine_t::take_snapshot() {
+	snapshot_t *s = new snapshot_t;
+
+	snapshot_writer_t w(s->state);
+	save_state(w);
+
+	for (uint32_t page = 0; page != MEM_PAGE_COUNT; ++page) {
+		if (!snapshot_base[page] || bus->is_dirty(page)) {
+			snapshot_page_t *copy = new snapshot_page_t;
+			memcpy(copy->data, memory + page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+			snapshot_base[page] = snapshot_page_ref_t(copy);
+			s->pages_copied++;
+		}
+		s->pages[page] = snapshot_base[page];
+	}
+	bus->clear_dirty();
+
+	return s;
+}
+
+bool machine_t::restore_snapshot(const snapshot_t *s) {
+	snapshot_reader_t r(s->state.data(), s->state.size());
+	if (!load_state_or_keep(r)) {
+		return false;
+	}
+
+	// Only pages written since the last snapshot or that differ between the two need copying.
+	for (uint32_t page = 0; page != MEM_PAGE_COUNT; ++page) {
+		if (bus->is_dirty(page) || snapshot_base[page] != s->pages[page]) {
+			memcpy(memory + page * MEM_PAGE_SIZE, s->pages[page]->data, MEM_PAGE_SIZE);
+			memory_written(page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+		}
+		snapshot_base[page] = s->pages[page];
+	}
+	bus->clear_dirty();
+
+	return true;
+}
+
+bool machine_t::save_snapshot(const char *path) {
+	std::vector<byte> state;
+	snapshot_writer_t w(state);
+	save_state(w);
+
+	snapshot_file_header_t header;
+	memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+	header.version       = SNAPSHOT_VERSION;
+	header.state_size    = state.size();
+	header.memory_offset = (sizeof(header) + state.size() + SNAPSHOT_FILE_ALIGN - 1) & ~(SNAPSHOT_FILE_ALIGN - 1);
+	header.memory_size   = MEM_ADDR_SIZE;
+
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		printf("snapshot: unable to open '%s'\n", path);
+		return false;
+	}
+
+	static const byte zeros[SNAPSHOT_FILE_ALIGN] = {};
+	size_t padding = header.memory_offset - sizeof(header) - state.size();
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+	       && fwrite(state.data(), 1, state.size(), f) == state.size()
+	       && fwrite(zeros, 1, padding, f) == padding
+	       && fwrite(memory, 1, MEM_ADDR_SIZE, f) == MEM_ADDR_SIZE;
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		printf("snapshot: unable to write '%s'\n", path);
+	}
+	return ok;
+}
+
+bool machine_t::load_snapshot(const char *path) {
+	mapped_file_t file;
+	if (!file.open(path)) {
+		printf("snapshot: unable to open '%s'\n", path);
+		return false;
+	}
+
+	snapshot_file_header_t header;
+	if (file.size() < sizeof(header)) {
+		printf("snapshot: '%s' is not a snapshot\n", path);
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (memcmp(header.magic, snapshot_magic, sizeof(header.magic))) {
+		printf("snapshot: '%s' is not a snapshot\n", path);
+		return false;
+	}
+	if (header.version != SNAPSHOT_VERSION || header.memory_size != MEM_ADDR_SIZE
+	 || header.state_size > file.size() - sizeof(header)
+	 || header.memory_offset < sizeof(header) + header.state_size
+	 || header.memory_offset > file.size() || file.size() - header.memory_offset < MEM_ADDR_SIZE)
+	{
+		printf("snapshot: '%s' doesn't fit this machine\n", path);
+		return false;
+	}
+
+	snapshot_reader_t r((const byte *)file.data() + sizeof(header), header.state_size);
+	if (!load_state_or_keep(r)) {
+		return false;
+	}
+
+	memcpy(memory, file.data() + header.memory_offset, MEM_ADDR_SIZE);
+	memory_written(0, MEM_ADDR_SIZE);
+
+	// Memory matches none of the kept pages, the next snapshot copies it all.
+	for (auto &page : snapshot_base) {
+		page.reset();
+	}
+	bus->clear_dirty();
+
+	return true;
+}
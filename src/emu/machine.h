@@ -2,12 +2,15 @@
 #define EMU_MACHINE
 
 #include "emu/cpu_device.h"
+#include "emu/snapshot.h"
 #include "support/types.h"
 
 #include <string>
 #include <vector>
 
+class bus_t;
 class device_t;
+class scheduler_t;
 
 struct named_device_t {
 	std::string  name;
@@ -25,11 +28,35 @@ protected:
 		return device;
 	}
 
+	// The device state, machines add the state kept outside devices.
+	virtual void save_state(snapshot_writer_t &w);
+	virtual bool load_state(snapshot_reader_t &r);
+
+	// Loads state or leaves the machine as it was.
+	bool load_state_or_keep(snapshot_reader_t &r);
+
 public:
 	devices_t devices;
 
 	cpu_device_t *cpu;
-	byte         *memory;
+	byte         *memory;   // RAM backing the whole 1 MiB address space
+	bus_t        *bus;
+	scheduler_t  *scheduler = nullptr;
+
+	// Memory as of the last snapshot taken or restored, the next snapshot shares its clean pages.
+	snapshot_page_ref_t snapshot_base[MEM_PAGE_COUNT];
+
+	virtual ~machine_t() {}
+
+	// Must be called after writing to memory directly.
+	virtual void memory_written(uint32_t addr, uint32_t len) { (void)addr; (void)len; }
+
+	// The caller owns the snapshot. Restoring fails if the snapshot doesn't fit the machine.
+	snapshot_t *take_snapshot();
+	bool        restore_snapshot(const snapshot_t *s);
+
+	bool save_snapshot(const char *path);
+	bool load_snapshot(const char *path);
 
 	void raise_nmi() {
 		cpu->raise_nmi();
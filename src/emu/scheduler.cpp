@@ -0,0 +1,203 @@
+#include "emu/scheduler.h"
+
+#include "emu/cpu_device.h"
+#include "emu/machine.h"
+#include "emu/snapshot.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+
+scheduler_t::scheduler_t(machine_t *a_machine) {
+	machine = a_machine;
+	cpu = machine->cpu;
+	cpu_ticks_per_cycle = ticks_per_cycle(cpu->frequency_in_mhz());
+
+	uint64_t t = now();
+	for (const auto &d : machine->devices) {
+		if (d.device != cpu) {
+			clocks.push_back({ d.device, ticks_per_cycle(d.device->frequency_in_mhz()), t, SCHEDULER_NEVER, 0, false });
+		}
+	}
+	for (uint32_t i = 0; i != clocks.size(); ++i) {
+		schedule(i);
+	}
+}
+
+uint64_t scheduler_t::ticks_per_cycle(double frequency_in_mhz) {
+	double   ticks   = SCHEDULER_TICKS_PER_SECOND / (frequency_in_mhz * 1e6);
+	uint64_t rounded = std::llround(ticks);
+	if (std::fabs(ticks - rounded) > 1e-6 * ticks) {
+		printf("scheduler: a %g MHz clock isn't a whole number of ticks, it will drift\n", frequency_in_mhz);
+	}
+	return std::max<uint64_t>(rounded, 1);
+}
+
+// Time starts one second in, so the lags loaded from snapshots fit behind it.
+uint64_t scheduler_t::now() {
+	return SCHEDULER_TICKS_PER_SECOND + cpu->get_clock_cycles() * cpu_ticks_per_cycle;
+}
+
+scheduler_t::device_clock_t *scheduler_t::find(device_t *device) {
+	for (auto &c : clocks) {
+		if (c.device == device) {
+			return &c;
+		}
+	}
+	return nullptr;
+}
+
+void scheduler_t::schedule(uint32_t index) {
+	device_clock_t &c = clocks[index];
+
+	uint64_t next = c.device->next_cycles();
+	uint64_t deadline = SCHEDULER_NEVER;
+	if (next < (SCHEDULER_NEVER - c.synced) / c.ticks_per_cycle) {
+		deadline = c.synced + next * c.ticks_per_cycle;
+	}
+
+	// Port accesses mostly leave the next event where it was.
+	if (c.queued && deadline == c.deadline) {
+		return;
+	}
+
+	c.gen++;
+	c.deadline = deadline;
+	c.queued = deadline != SCHEDULER_NEVER;
+	if (!c.queued) {
+		return;
+	}
+
+	// Stale entries only leave from the top, rebuild before they pile up.
+	if (heap.size() >= 4 * clocks.size() + 16) {
+		heap.clear();
+		for (uint32_t i = 0; i != clocks.size(); ++i) {
+			if (clocks[i].queued && i != index) {
+				heap.push_back({ clocks[i].deadline, i, clocks[i].gen });
+			}
+		}
+		std::make_heap(heap.begin(), heap.end(), std::greater<heap_entry_t>());
+	}
+
+	heap.push_back({ c.deadline, index, c.gen });
+	std::push_heap(heap.begin(), heap.end(), std::greater<heap_entry_t>());
+}
+
+/*
+ * Runs up to each event in turn, so devices see the same cycle counts
+ * however they are synced. An event due now runs for 0 cycles.
+ */
+void scheduler_t::run_device(device_clock_t &c, uint64_t until) {
+	uint64_t cycles = until > c.synced ? (until - c.synced) / c.ticks_per_cycle : 0;
+	for (;;) {
+		uint64_t next = c.device->next_cycles();
+		if (next > cycles) {
+			if (cycles) {
+				c.device->run_cycles(cycles);
+				c.synced += cycles * c.ticks_per_cycle;
+			}
+			return;
+		}
+		c.device->run_cycles(next);
+		c.synced += next * c.ticks_per_cycle;
+		cycles -= next;
+
+		// Nothing happened, don't spin on it.
+		if (!next && !c.device->next_cycles()) {
+			return;
+		}
+	}
+}
+
+uint64_t scheduler_t::next_deadline() {
+	while (!heap.empty() && heap.front().gen != clocks[heap.front().index].gen) {
+		std::pop_heap(heap.begin(), heap.end(), std::greater<heap_entry_t>());
+		heap.pop_back();
+	}
+	return heap.empty() ? SCHEDULER_NEVER : heap.front().deadline;
+}
+
+uint64_t scheduler_t::cpu_cycles_until_next(uint64_t max_ticks) {
+	uint64_t t = now();
+	uint64_t end = std::min(next_deadline(), t + max_ticks);
+	if (end <= t) {
+		return 1;
+	}
+	return (end - t + cpu_ticks_per_cycle - 1) / cpu_ticks_per_cycle;
+}
+
+// Each device runs at most once, one with another event due now waits for the next call.
+void scheduler_t::run_due() {
+	uint64_t t = now();
+
+	uint32_t due[16];
+	uint32_t count = 0;
+	while (count != 16 && next_deadline() <= t) {
+		due[count++] = heap.front().index;
+		clocks[heap.front().index].queued = false;
+		std::pop_heap(heap.begin(), heap.end(), std::greater<heap_entry_t>());
+		heap.pop_back();
+	}
+
+	for (uint32_t i = 0; i != count; ++i) {
+		run_device(clocks[due[i]], t);
+		schedule(due[i]);
+	}
+}
+
+uint64_t scheduler_t::run(uint64_t max_ticks) {
+	uint64_t start = now();
+	cpu->run_cycles(cpu_cycles_until_next(max_ticks));
+	run_due();
+	return now() - start;
+}
+
+void scheduler_t::sync(device_t *device) {
+	device_clock_t *c = find(device);
+	if (c) {
+		run_device(*c, now());
+	}
+}
+
+void scheduler_t::reschedule(device_t *device) {
+	device_clock_t *c = find(device);
+	if (c) {
+		schedule(c - clocks.data());
+	}
+}
+
+void scheduler_t::sync_all() {
+	uint64_t t = now();
+	for (uint32_t i = 0; i != clocks.size(); ++i) {
+		run_device(clocks[i], t);
+		schedule(i);
+	}
+}
+
+void scheduler_t::save_state(snapshot_writer_t &w) {
+	uint64_t t = now();
+	w.put(uint32_t(clocks.size()));
+	for (const auto &c : clocks) {
+		w.put(uint64_t(t - c.synced));
+	}
+}
+
+bool scheduler_t::load_state(snapshot_reader_t &r) {
+	uint32_t count;
+	if (!r.get(count) || count != clocks.size()) {
+		printf("snapshot: scheduler doesn't match the devices\n");
+		return false;
+	}
+
+	uint64_t t = now();
+	heap.clear();
+	for (uint32_t i = 0; i != clocks.size(); ++i) {
+		uint64_t lag;
+		r.get(lag);
+		clocks[i].synced = t - std::min(lag, t);
+		clocks[i].queued = false;
+		schedule(i);
+	}
+	return r.good();
+}
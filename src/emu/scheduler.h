@@ -0,0 +1,91 @@
+#ifndef EMU_SCHEDULER
+#define EMU_SCHEDULER
+
+#include "support/types.h"
+
+#include <vector>
+
+class cpu_device_t;
+class device_t;
+class machine_t;
+class snapshot_reader_t;
+class snapshot_writer_t;
+
+// Master clock ticks per second, the LCM of the device clocks: the 5 MHz
+// CPU, the 13.125/11 MHz PIT, the 25.175 MHz VGA and the 20 MHz keyboard
+// are all a whole number of ticks per cycle.
+#define SCHEDULER_TICKS_PER_SECOND 422940000000ull
+#define SCHEDULER_NEVER            UINT64_MAX
+
+// Slices end at least this often, so input and the front ends get a turn.
+#define SCHEDULER_MAX_SLICE (SCHEDULER_TICKS_PER_SECOND / 1000)
+
+/*
+ * Runs the machine against a master clock kept in integer ticks. The CPU
+ * drives time, its cycles advance the clock. Every other device has a
+ * deadline, the time of its next event, kept in a min-heap: the CPU runs
+ * uninterrupted until the nearest one, then the devices that are due run
+ * up to now. The others only run when the CPU touches their ports, the
+ * bus brings them up to date first.
+ *
+ * Devices remember the time they ran up to, the part of a cycle that
+ * didn't fit is carried to their next run, so nothing drifts.
+ */
+class scheduler_t {
+	struct device_clock_t {
+		device_t *device;
+		uint64_t  ticks_per_cycle;
+		uint64_t  synced;     // Time the device ran up to
+		uint64_t  deadline;
+		uint32_t  gen;        // Heap entries from older generations are stale
+		bool      queued;     // The heap holds an entry of this generation
+	};
+
+	struct heap_entry_t {
+		uint64_t deadline;
+		uint32_t index;
+		uint32_t gen;
+
+		bool operator>(const heap_entry_t &o) const { return deadline > o.deadline; }
+	};
+
+	machine_t    *machine;
+	cpu_device_t *cpu;
+	uint64_t      cpu_ticks_per_cycle;
+
+	std::vector<device_clock_t> clocks;
+	std::vector<heap_entry_t>   heap;
+
+	device_clock_t *find(device_t *device);
+	void schedule(uint32_t index);
+	void run_device(device_clock_t &c, uint64_t until);
+	uint64_t next_deadline();
+
+public:
+	scheduler_t(machine_t *machine);
+
+	static uint64_t ticks_per_cycle(double frequency_in_mhz);
+
+	uint64_t now();
+
+	// CPU cycles until the next deadline, at most max_ticks away and at least one.
+	uint64_t cpu_cycles_until_next(uint64_t max_ticks = SCHEDULER_MAX_SLICE);
+
+	// Runs the devices whose deadline passed.
+	void run_due();
+
+	// Runs the CPU up to the next deadline and the devices then due, returns the ticks run.
+	uint64_t run(uint64_t max_ticks = SCHEDULER_MAX_SLICE);
+
+	// Brings a device up to now before its state is looked at, and picks up
+	// its next event after its state changed.
+	void sync(device_t *device);
+	void reschedule(device_t *device);
+	void sync_all();
+
+	// What part of a cycle each device is behind, snapshots are taken synced.
+	void save_state(snapshot_writer_t &w);
+	bool load_state(snapshot_reader_t &r);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef EMU_SNAPSHOT
+#define EMU_SNAPSHOT
+
+#include "emu/bus.h"
+#include "support/types.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#define SNAPSHOT_VERSION 4
+
+// Appends state in host byte order, snapshots don't move between hosts.
+class snapshot_writer_t {
+	std::vector<byte> &out;
+
+public:
+	snapshot_writer_t(std::vector<byte> &out) : out(out) {}
+
+	void put_bytes(const void *p, size_t n) {
+		const byte *b = (const byte *)p;
+		out.insert(out.end(), b, b + n);
+	}
+
+	template<typename T> void put(const T &v) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		put_bytes(&v, sizeof(v));
+	}
+
+	void put_string(const std::string &s) {
+		put(uint32_t(s.size()));
+		put_bytes(s.data(), s.size());
+	}
+};
+
+// Reads state back, reads past the end fail and leave good() false.
+class snapshot_reader_t {
+	const byte *p;
+	const byte *end;
+	bool        ok = true;
+
+public:
+	snapshot_reader_t(const byte *p, size_t n) : p(p), end(p + n) {}
+
+	bool good() const {
+		return ok;
+	}
+
+	bool get_bytes(void *dst, size_t n) {
+		if (!ok || size_t(end - p) < n) {
+			ok = false;
+			memset(dst, 0, n);
+			return false;
+		}
+		memcpy(dst, p, n);
+		p += n;
+		return true;
+	}
+
+	template<typename T> bool get(T &v) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		return get_bytes(&v, sizeof(v));
+	}
+
+	bool get_string(std::string &s) {
+		uint32_t n;
+		if (!get(n) || size_t(end - p) < n) {
+			ok = false;
+			return false;
+		}
+		s.assign((const char *)p, n);
+		p += n;
+		return true;
+	}
+};
+
+struct snapshot_page_t {
+	byte data[MEM_PAGE_SIZE];
+};
+
+typedef std::shared_ptr<const snapshot_page_t> snapshot_page_ref_t;
+
+/*
+ * The machine at one point in time: the CPU, device and DOS state, and
+ * memory as pages shared with the snapshots taken before it. Taking a
+ * snapshot only copies the pages written since the previous one.
+ */
+struct snapshot_t {
+	std::vector<byte>   state;
+	snapshot_page_ref_t pages[MEM_PAGE_COUNT];
+	uint32_t            pages_copied = 0;   // Pages this snapshot didn't share
+};
+
+#endif
@@ -0,0 +1,410 @@
+#include "emu/time_travel.h"
+
+#include "dos/dos.h"
+#include "emu/bus.h"
+#include "emu/device.h"
+#include "emu/i8086.h"
+#include "emu/i8086_breakpoints.h"
+#include "emu/ibm5160.h"
+#include "emu/keyboard.h"
+#include "emu/scheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+
+// Stands in for a RAM page while searching for writes and notes writes to one byte of it.
+class write_watch_t : public device_t {
+public:
+	uint32_t addr = 0;
+	bool     hit = false;
+
+	double   frequency_in_mhz()          { return 1.0; }
+	uint64_t next_cycles()               { return UINT64_MAX; }
+	uint64_t run_cycles(uint64_t cycles) { return cycles; }
+
+	void save_state(snapshot_writer_t &w) { (void)w; }
+	bool load_state(snapshot_reader_t &r) { (void)r; return true; }
+
+	byte mmio_read(uint32_t a) {
+		return machine->memory[a];
+	}
+
+	void mmio_write(uint32_t a, byte v) {
+		machine->memory[a] = v;
+		machine->bus->mark_dirty(a, 1);
+		if (a == addr) {
+			hit = true;
+		}
+	}
+};
+
+time_travel_t::time_travel_t(ibm5160_t *a_machine) {
+	machine = a_machine;
+	cpu = (i8086_t *)machine->cpu;
+	reset();
+}
+
+time_travel_t::~time_travel_t() {
+	for (auto &c : checkpoints) {
+		delete c.snapshot;
+	}
+}
+
+void time_travel_t::reset() {
+	for (auto &c : checkpoints) {
+		delete c.snapshot;
+	}
+	checkpoints.clear();
+	events.clear();
+	next_event = 0;
+
+	position = 0;
+	history_end = 0;
+	slice = 0;
+	bytes_used = 0;
+	in_slice = false;
+
+	add_checkpoint();
+}
+
+void time_travel_t::advance() {
+	position++;
+	history_end = std::max(history_end, position);
+}
+
+void time_travel_t::apply_events() {
+	while (next_event != events.size() && events[next_event].position <= position) {
+		const event_t &e = events[next_event++];
+		switch (e.type) {
+			case EVENT_KEY_DOWN: machine->keyboard->set_key_down(e.key); break;
+			case EVENT_KEY_UP:   machine->keyboard->set_key_up(e.key); break;
+			case EVENT_MOUSE:    machine->dos->set_mouse(e.x, e.y, e.buttons); break;
+		}
+	}
+}
+
+void time_travel_t::add_event(const event_t &e) {
+	// Input in the past replaces the history after it.
+	if (position < history_end) {
+		while (checkpoints.back().position > position) {
+			drop_checkpoint(checkpoints.size() - 1);
+		}
+		events.resize(next_event);
+		history_end = position;
+	}
+
+	events.push_back(e);
+	events.back().position = position;
+	apply_events();
+}
+
+void time_travel_t::set_key_down(int key) {
+	add_event({ 0, EVENT_KEY_DOWN, key, 0, 0, 0 });
+}
+
+void time_travel_t::set_key_up(int key) {
+	add_event({ 0, EVENT_KEY_UP, key, 0, 0, 0 });
+}
+
+void time_travel_t::set_mouse(uint16_t x, uint16_t y, uint16_t buttons) {
+	add_event({ 0, EVENT_MOUSE, 0, x, y, buttons });
+}
+
+/*
+ * ##     ## ##     ## ##    ##
+ * ##     ## ##     ## ###   ##
+ * ##     ## ##     ## ####  ##
+ * ########  ##     ## ## ## ##
+ * ##   ##   ##     ## ##  ####
+ * ##    ##  ##     ## ##   ###
+ * ##     ##  #######  ##    ##
+ */
+
+// Slices end where the scheduler's do in machine_runner_t::run_until_next_event().
+void time_travel_t::start_slice() {
+	cpu_budget = machine->scheduler->cpu_cycles_until_next();
+	cpu_done   = 0;
+	in_slice   = true;
+}
+
+// Steps the CPU through the rest of the slice, returns false if it stopped early.
+bool time_travel_t::run_cpu(uint64_t target, const predicate_t &stop) {
+	while (cpu_done < cpu_budget) {
+		apply_events();
+		if (position >= target || (stop && stop(cpu))) {
+			return false;
+		}
+		cpu_done += cpu->step();
+		advance();
+	}
+	return true;
+}
+
+void time_travel_t::end_slice() {
+	machine->scheduler->run_due();
+	in_slice = false;
+	slice++;
+	advance();
+
+	if (slice >= checkpoints.back().slice + checkpoint_interval) {
+		add_checkpoint();
+	}
+}
+
+// Runs until position reaches target or stop returns true before an instruction.
+void time_travel_t::run_to(uint64_t target, const predicate_t &stop) {
+	for (;;) {
+		if (!in_slice) {
+			apply_events();
+			if (position >= target) {
+				break;
+			}
+			start_slice();
+		}
+		if (!run_cpu(target, stop)) {
+			break;
+		}
+		end_slice();
+	}
+
+	// Watchpoints hit while re-executing aren't stops, and the breakpoint stopped at was left behind.
+	cpu->breakpoints->stop = false;
+	cpu->breakpoints->forget_stop();
+}
+
+// A breakpoint or watchpoint ends it early, the rest of the slice runs on the next call.
+void time_travel_t::run_slice() {
+	if (!in_slice) {
+		apply_events();
+		start_slice();
+	}
+
+	predicate_t stop = nullptr;
+	if (cpu->breakpoints->active()) {
+		stop = [](i8086_t *cpu) {
+			return cpu->breakpoints->stop || cpu->breakpoints->check(cpu->cs, cpu->ip);
+		};
+	}
+
+	if (run_cpu(UINT64_MAX, stop)) {
+		end_slice();
+	}
+}
+
+/*
+ *  ######  ##     ## ########  ######  ##    ## ########   #######  #### ##    ## ########  ######
+ * ##    ## ##     ## ##       ##    ## ##   ##  ##     ## ##     ##  ##  ###   ##    ##    ##    ##
+ * ##       ##     ## ##       ##       ##  ##   ##     ## ##     ##  ##  ####  ##    ##    ##
+ * ##       ######### ######   ##       #####    ########  ##     ##  ##  ## ## ##    ##     ######
+ * ##       ##     ## ##       ##       ##  ##   ##        ##     ##  ##  ##  ####    ##          ##
+ * ##    ## ##     ## ##       ##    ## ##   ##  ##        ##     ##  ##  ##   ###    ##    ##    ##
+ *  ######  ##     ## ########  ######  ##    ## ##         #######  #### ##    ##    ##     ######
+ */
+
+void time_travel_t::add_checkpoint() {
+	snapshot_t *s = machine->take_snapshot();
+	bytes_used += s->state.size() + size_t(s->pages_copied) * MEM_PAGE_SIZE;
+	checkpoints.push_back({ position, slice, cpu->get_instr_count(), s });
+
+	// Keep the first and the last checkpoint, drop the one whose loss leaves the shortest gap for its age.
+	while (bytes_used > ram_budget && checkpoints.size() > 2) {
+		size_t best = 1;
+		double best_score = DBL_MAX;
+		for (size_t i = 1; i + 1 < checkpoints.size(); ++i) {
+			double gap   = checkpoints[i + 1].position - checkpoints[i - 1].position;
+			double age   = position - checkpoints[i].position + 1;
+			double score = gap / age;
+			if (score < best_score) {
+				best = i;
+				best_score = score;
+			}
+		}
+		drop_checkpoint(best);
+	}
+}
+
+void time_travel_t::drop_checkpoint(size_t i) {
+	snapshot_t *s = checkpoints[i].snapshot;
+
+	// Pages no other checkpoint holds are freed, the machine holds the pages of the last snapshot too.
+	bytes_used -= s->state.size();
+	for (uint32_t page = 0; page != MEM_PAGE_COUNT; ++page) {
+		long holders = s->pages[page].use_count() - (machine->snapshot_base[page] == s->pages[page]);
+		if (holders == 1) {
+			bytes_used -= MEM_PAGE_SIZE;
+		}
+	}
+
+	delete s;
+	checkpoints.erase(checkpoints.begin() + i);
+}
+
+// The last checkpoint at or before target.
+size_t time_travel_t::checkpoint_before(uint64_t target) {
+	auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), target,
+		[](uint64_t t, const checkpoint_t &c) { return t < c.position; });
+	assert(it != checkpoints.begin());
+	return it - checkpoints.begin() - 1;
+}
+
+void time_travel_t::restore(size_t i) {
+	const checkpoint_t &c = checkpoints[i];
+
+	machine->restore_snapshot(c.snapshot);
+	position = c.position;
+	slice    = c.slice;
+	in_slice = false;
+
+	next_event = std::lower_bound(events.begin(), events.end(), c.position,
+		[](const event_t &e, uint64_t p) { return e.position < p; }) - events.begin();
+}
+
+/*
+ * ##    ##    ###    ##     ## ####  ######      ###    ######## ####  #######  ##    ##
+ * ###   ##   ## ##   ##     ##  ##  ##    ##    ## ##      ##     ##  ##     ## ###   ##
+ * ####  ##  ##   ##  ##     ##  ##  ##         ##   ##     ##     ##  ##     ## ####  ##
+ * ## ## ## ##     ## ##     ##  ##  ##   #### ##     ##    ##     ##  ##     ## ## ## ##
+ * ##  #### #########  ##   ##   ##  ##    ##  #########    ##     ##  ##     ## ##  ####
+ * ##   ### ##     ##   ## ##    ##  ##    ##  ##     ##    ##     ##  ##     ## ##   ###
+ * ##    ## ##     ##    ###    ####  ######   ##     ##    ##    ####  #######  ##    ##
+ */
+
+void time_travel_t::seek(uint64_t target) {
+	// Restore when going back or when a checkpoint is closer than the current position.
+	size_t i = checkpoint_before(target);
+	if (target < position || checkpoints[i].position > position) {
+		restore(i);
+	}
+	run_to(target, nullptr);
+}
+
+void time_travel_t::step_forward() {
+	uint64_t n = cpu->get_instr_count();
+	run_to(UINT64_MAX, [n](i8086_t *cpu) {
+		return cpu->get_instr_count() > n;
+	});
+}
+
+bool time_travel_t::step_back() {
+	uint64_t n = cpu->get_instr_count();
+	if (n == 0 || checkpoints.front().instr_count >= n) {
+		return false;
+	}
+
+	// The last position before the instruction that made the count n.
+	size_t i = checkpoints.size() - 1;
+	while (checkpoints[i].instr_count >= n || checkpoints[i].position >= position) {
+		--i;
+	}
+
+	uint64_t end = position;
+	restore(i);
+
+	uint64_t last = position;
+	run_to(end, [this, n, &last](i8086_t *cpu) {
+		if (cpu->get_instr_count() < n) {
+			last = position;
+			return false;
+		}
+		return true;
+	});
+
+	seek(last);
+	return true;
+}
+
+bool time_travel_t::reverse_continue(const predicate_t &hit) {
+	uint64_t start = position;
+	uint64_t end = position;
+
+	// Search the stretches between checkpoints from the newest back.
+	for (size_t i = checkpoint_before(end); ; --i) {
+		if (checkpoints[i].position == end) {
+			if (i == 0) {
+				break;
+			}
+			continue;
+		}
+
+		restore(i);
+
+		uint64_t found = UINT64_MAX;
+		run_to(end, [this, &hit, &found](i8086_t *cpu) {
+			if (hit(cpu)) {
+				found = position;
+			}
+			return false;
+		});
+
+		if (found != UINT64_MAX) {
+			seek(found);
+			return true;
+		}
+
+		end = checkpoints[i].position;
+		if (i == 0) {
+			break;
+		}
+	}
+
+	seek(start);
+	return false;
+}
+
+bool time_travel_t::find_last_write(uint32_t addr, uint64_t &write_position) {
+	addr &= MEM_ADDR_MASK;
+	uint32_t page = addr / MEM_PAGE_SIZE;
+	uint32_t page_addr = page * MEM_PAGE_SIZE;
+
+	write_watch_t watch;
+	watch.set_machine(machine);
+	watch.addr = addr;
+
+	uint64_t start = position;
+	uint64_t end = position;
+	bool     found = false;
+
+	for (size_t i = checkpoint_before(end); ; --i) {
+		// Checkpoints sharing the page have no write to it between them.
+		bool skip = checkpoints[i].position == end
+		         || (end != start && checkpoints[i].snapshot->pages[page] == checkpoints[i + 1].snapshot->pages[page]);
+
+		if (!skip) {
+			restore(i);
+			machine->bus->map_mmio(page_addr, MEM_PAGE_SIZE, &watch);
+
+			// DOS writes memory directly, those are caught when they change the byte.
+			byte     value = machine->memory[addr];
+			uint64_t last_step = position;
+			auto written = [&]() {
+				if (watch.hit || machine->memory[addr] != value) {
+					write_position = last_step;
+					found = true;
+					watch.hit = false;
+					value = machine->memory[addr];
+				}
+			};
+
+			run_to(end, [this, &written, &last_step](i8086_t *) {
+				written();
+				last_step = position;
+				return false;
+			});
+			written();
+
+			machine->bus->map_ram(page_addr, MEM_PAGE_SIZE, machine->memory + page_addr);
+			if (found) {
+				break;
+			}
+		}
+
+		end = checkpoints[i].position;
+		if (i == 0) {
+			break;
+		}
+	}
+
+	seek(start);
+	return found;
+}
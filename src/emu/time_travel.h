@@ -0,0 +1,123 @@
+#ifndef EMU_TIME_TRAVEL
+#define EMU_TIME_TRAVEL
+
+#include "emu/snapshot.h"
+#include "support/types.h"
+
+#include <functional>
+#include <vector>
+
+class i8086_t;
+class ibm5160_t;
+
+#define TIME_TRAVEL_DEFAULT_BUDGET       (size_t(256) << 20)
+#define TIME_TRAVEL_CHECKPOINT_INTERVAL  100   // Slices, a slice is at most 1 ms
+
+/*
+ * Reverse execution by checkpoints and re-execution. The engine runs the
+ * machine in the same slices as the machine runner and counts every CPU
+ * step and every slice end as a position. Input is logged at the
+ * position it arrived, so restoring the checkpoint before a position and
+ * running forward always lands in the same state. Input arriving while
+ * in the past starts a new history from there.
+ *
+ * Checkpoints are snapshots sharing unchanged pages. Once they take more
+ * than ram_budget, the checkpoints closest to their neighbours relative
+ * to their age are dropped, so older history gets sparser.
+ *
+ * The CPU is stepped one instruction at a time, the JIT isn't used.
+ */
+class time_travel_t {
+public:
+	typedef std::function<bool(i8086_t *cpu)> predicate_t;
+
+private:
+	enum event_type_t : byte {
+		EVENT_KEY_DOWN,
+		EVENT_KEY_UP,
+		EVENT_MOUSE,
+	};
+
+	struct event_t {
+		uint64_t     position;
+		event_type_t type;
+		int          key;
+		uint16_t     x;
+		uint16_t     y;
+		uint16_t     buttons;
+	};
+
+	struct checkpoint_t {
+		uint64_t    position;
+		uint64_t    slice;
+		uint64_t    instr_count;
+		snapshot_t *snapshot;
+	};
+
+	ibm5160_t *machine;
+	i8086_t   *cpu;
+
+	std::vector<checkpoint_t> checkpoints;
+	std::vector<event_t>      events;
+	size_t                    next_event = 0;   // First event not applied yet
+
+	uint64_t position = 0;
+	uint64_t history_end = 0;   // Furthest position reached
+	uint64_t slice = 0;
+	size_t   bytes_used = 0;
+
+	// The slice in progress, the CPU runs first and the devices due at its end.
+	bool     in_slice = false;
+	uint64_t cpu_budget = 0;
+	uint64_t cpu_done = 0;
+
+	void advance();
+	void apply_events();
+	void add_event(const event_t &e);
+
+	void start_slice();
+	bool run_cpu(uint64_t target, const predicate_t &stop);
+	void end_slice();
+	void run_to(uint64_t target, const predicate_t &stop);
+
+	void   add_checkpoint();
+	void   drop_checkpoint(size_t i);
+	size_t checkpoint_before(uint64_t target);
+	void   restore(size_t i);
+
+public:
+	size_t   ram_budget = TIME_TRAVEL_DEFAULT_BUDGET;
+	uint32_t checkpoint_interval = TIME_TRAVEL_CHECKPOINT_INTERVAL;
+
+	time_travel_t(ibm5160_t *machine);
+	~time_travel_t();
+
+	// Forgets the history, for when the machine state was replaced.
+	void reset();
+
+	uint64_t get_position()         { return position; }
+	uint64_t get_history_end()      { return history_end; }
+	size_t   get_bytes_used()       { return bytes_used; }
+	size_t   get_checkpoint_count() { return checkpoints.size(); }
+
+	// Runs the machine forward by one slice, or until a breakpoint or watchpoint stops it.
+	void run_slice();
+
+	void set_key_down(int key);
+	void set_key_up(int key);
+	void set_mouse(uint16_t x, uint16_t y, uint16_t buttons);
+
+	void seek(uint64_t target);
+
+	// Stop right after the next or before the previous guest instruction.
+	void step_forward();
+	bool step_back();
+
+	// Goes back to the last position before this one where hit is true, before the instruction runs.
+	bool reverse_continue(const predicate_t &hit);
+
+	// Finds the position of the last instruction before this one that wrote the byte at addr.
+	bool find_last_write(uint32_t addr, uint64_t &write_position);
+};
+
+#endif
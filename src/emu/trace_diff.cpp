@@ -0,0 +1,360 @@
+#include "emu/trace_diff.h"
+
+#include "emu/i8086.h"
+
+#include <cstdio>
+#include <cstring>
+
+#define TRACE_LOG_FLAGS (i8086_t::FLAG_CF | i8086_t::FLAG_PF | i8086_t::FLAG_ZF | i8086_t::FLAG_SF | \
+                         i8086_t::FLAG_TF | i8086_t::FLAG_IF | i8086_t::FLAG_DF | i8086_t::FLAG_OF)
+
+// Fields compared between the traces, the memory operand isn't in the logs.
+#define TRACE_DIFF_FIELDS ((1u << (TRACE_FLAGS + 1)) - 1)
+
+static const char *field_names[TRACE_FIELD_COUNT] = {
+	"CS", "IP", "AX", "BX", "CX", "DX", "SI", "DI", "BP", "SP", "DS", "ES", "SS", "FLAGS",
+	"MEM_SEG", "MEM_OFS", "MEM_VALUE",
+};
+
+/*
+ * ##        #######   ######      ########  ########    ###    ########  ######## ########
+ * ##       ##     ## ##    ##     ##     ## ##         ## ##   ##     ## ##       ##     ##
+ * ##       ##     ## ##           ##     ## ##        ##   ##  ##     ## ##       ##     ##
+ * ##       ##     ## ##   ####    ########  ######   ##     ## ##     ## ######   ########
+ * ##       ##     ## ##    ##     ##   ##   ##       ######### ##     ## ##       ##   ##
+ * ##       ##     ## ##    ##     ##    ##  ##       ##     ## ##     ## ##       ##    ##
+ * ########  #######   ######      ##     ## ######## ##     ## ########  ######## ##     ##
+ */
+
+static inline int hex_digit(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+// Parses [s, e) as hex, false unless it's all hex digits.
+static bool parse_hex(const char *s, const char *e, uint32_t &v) {
+	if (s == e) {
+		return false;
+	}
+	v = 0;
+	for (; s != e; ++s) {
+		int d = hex_digit(*s);
+		if (d < 0) {
+			return false;
+		}
+		v = (v << 4) | d;
+	}
+	return true;
+}
+
+static bool token_is(const char *s, size_t n, const char *name) {
+	return strlen(name) == n && !memcmp(s, name, n);
+}
+
+// Field of a register named in a log line, or -1.
+static int register_field(const char *s, size_t n) {
+	static const struct {
+		const char *name;
+		int         field;
+	} registers[] = {
+		{ "EAX", TRACE_AX }, { "EBX", TRACE_BX }, { "ECX", TRACE_CX }, { "EDX", TRACE_DX },
+		{ "ESI", TRACE_SI }, { "EDI", TRACE_DI }, { "EBP", TRACE_BP }, { "ESP", TRACE_SP },
+		{ "DS",  TRACE_DS }, { "ES",  TRACE_ES }, { "SS",  TRACE_SS },
+	};
+	for (const auto &reg : registers) {
+		if (token_is(s, n, reg.name)) {
+			return reg.field;
+		}
+	}
+	return -1;
+}
+
+// Flag named by a single letter in log_state() lines or by two in DOSBox lines, or 0.
+static uint16_t flag_bit(const char *s, size_t n) {
+	static const struct {
+		char     letter;
+		uint16_t flag;
+	} flag_letters[] = {
+		{ 'C', i8086_t::FLAG_CF }, { 'P', i8086_t::FLAG_PF }, { 'Z', i8086_t::FLAG_ZF },
+		{ 'S', i8086_t::FLAG_SF }, { 'T', i8086_t::FLAG_TF }, { 'I', i8086_t::FLAG_IF },
+		{ 'D', i8086_t::FLAG_DF }, { 'O', i8086_t::FLAG_OF },
+	};
+	if (n != 1 && !(n == 2 && s[1] == 'F')) {
+		return 0;
+	}
+	for (const auto &f : flag_letters) {
+		if (s[0] == f.letter) {
+			return f.flag;
+		}
+	}
+	return 0;
+}
+
+static bool parse_line(const char *s, const char *e, trace_record_t &r) {
+	constexpr uint32_t all_registers = (1u << TRACE_AX) | (1u << TRACE_BX) | (1u << TRACE_CX) | (1u << TRACE_DX)
+	                                 | (1u << TRACE_SI) | (1u << TRACE_DI) | (1u << TRACE_BP) | (1u << TRACE_SP)
+	                                 | (1u << TRACE_DS) | (1u << TRACE_ES) | (1u << TRACE_SS);
+	uint32_t seen = 0;
+	bool     have_csip = false;
+	bool     have_flags = false;
+	uint16_t flag_bits = 0;
+	uint16_t flags_seen = 0;
+	uint32_t v, w;
+
+	r = {};
+	while (s < e) {
+		while (s < e && (*s == ' ' || *s == '\t' || *s == '\r')) {
+			++s;
+		}
+		const char *t = s;
+		while (s < e && *s != ' ' && *s != '\t' && *s != '\r') {
+			++s;
+		}
+		size_t n = s - t;
+		if (!n) {
+			break;
+		}
+
+		const char *colon = (const char *)memchr(t, ':', n);
+		if (colon) {
+			size_t key_len = colon - t;
+
+			// The first seg:ofs in the line is cs:ip, later ones are operands.
+			if (!have_csip && key_len == 4 && parse_hex(t, colon, v) && parse_hex(colon + 1, s, w)) {
+				r.field[TRACE_CS] = v;
+				r.field[TRACE_IP] = w;
+				have_csip = true;
+				continue;
+			}
+			if (!parse_hex(colon + 1, s, v)) {
+				continue;
+			}
+
+			int field = register_field(t, key_len);
+			if (field >= 0) {
+				r.field[field] = v;
+				seen |= 1u << field;
+			} else if (token_is(t, key_len, "FLG")) {
+				r.field[TRACE_FLAGS] = v;
+				have_flags = true;
+			} else if (uint16_t flag = flag_bit(t, key_len)) {
+				flags_seen |= flag;
+				if (v) {
+					flag_bits |= flag;
+				}
+			}
+		} else if (n == 5 && t[0] == 'F' && parse_hex(t + 1, s, v)) {
+			r.field[TRACE_FLAGS] = v;
+			have_flags = true;
+		} else if (n == 2 && (t[1] == '0' || t[1] == '1')) {
+			flags_seen |= flag_bit(t, 1);
+			if (t[1] == '1') {
+				flag_bits |= flag_bit(t, 1);
+			}
+		}
+	}
+
+	if (!have_csip || (seen & all_registers) != all_registers) {
+		return false;
+	}
+	// DOSBox lines name each flag, they don't all have DF and TF.
+	if (!have_flags) {
+		r.field[TRACE_FLAGS] = flag_bits;
+		r.flags_unknown = TRACE_LOG_FLAGS & ~flags_seen;
+	}
+	r.field[TRACE_FLAGS] &= TRACE_LOG_FLAGS;
+	return true;
+}
+
+bool trace_log_reader_t::open(const char *path) {
+	if (!file.open(path)) {
+		printf("trace_diff: unable to open '%s'\n", path);
+		return false;
+	}
+	pos = file.data();
+	end = pos + file.size();
+	line_number = 0;
+	return true;
+}
+
+bool trace_log_reader_t::next(trace_record_t &r) {
+	while (pos < end) {
+		const char *eol = (const char *)memchr(pos, '\n', end - pos);
+		if (!eol) {
+			eol = end;
+		}
+
+		line     = pos;
+		line_len = eol - pos;
+		pos      = eol < end ? eol + 1 : end;
+		line_number++;
+
+		if (parse_line(line, eol, r)) {
+			r.instr_count = line_number;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool i8086_live_trace_t::next(trace_record_t &r) {
+	for (;;) {
+		uint64_t instr_count = cpu->get_instr_count();
+		cpu->trace->capture(r);
+		cpu->step();
+
+		// Steps that take an interrupt or run BIOS code don't count as instructions.
+		if (cpu->get_instr_count() != instr_count) {
+			return true;
+		}
+	}
+}
+
+/*
+ * ########  #### ######## ########
+ * ##     ##  ##  ##       ##
+ * ##     ##  ##  ##       ##
+ * ##     ##  ##  ######   ######
+ * ##     ##  ##  ##       ##
+ * ##     ##  ##  ##       ##
+ * ########  #### ##       ##
+ */
+
+// Flags both records hold.
+static uint16_t compared_flags(const trace_record_t &a, const trace_record_t &b) {
+	return TRACE_LOG_FLAGS & ~(a.flags_unknown | b.flags_unknown);
+}
+
+uint32_t trace_diff_t::differing_fields(const trace_record_t &a, const trace_record_t &b) {
+	uint32_t mask = 0;
+	for (int i = 0; i <= TRACE_FLAGS; ++i) {
+		uint16_t va = a.field[i];
+		uint16_t vb = b.field[i];
+		if (i == TRACE_FLAGS) {
+			va &= compared_flags(a, b);
+			vb &= compared_flags(a, b);
+		}
+		if (va != vb) {
+			mask |= 1u << i;
+		}
+	}
+	return mask & TRACE_DIFF_FIELDS;
+}
+
+bool trace_diff_t::skipped(const trace_record_t &r) {
+	uint16_t cs = r.field[TRACE_CS];
+	for (const auto &range : skip_ranges) {
+		if (cs >= range.cs_lo && cs <= range.cs_hi) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool trace_diff_t::next_ref(trace_log_reader_t &ref, trace_record_t &r) {
+	while (ref.next(r)) {
+		if (!skipped(r)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool trace_diff_t::next_own(trace_source_t &own, trace_record_t &r) {
+	while (own.next(r)) {
+		if (!skipped(r)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Searches the next window reference lines for own, leaves the reference where it was if it isn't found.
+bool trace_diff_t::find_in_ref(trace_log_reader_t &ref, trace_record_t &r, const trace_record_t &own, uint64_t window) {
+	trace_log_reader_t::position_t start = ref.tell();
+	trace_record_t start_r = r;
+
+	for (uint64_t i = 0; i != window; ++i) {
+		if (!next_ref(ref, r)) {
+			break;
+		}
+		if (!differing_fields(r, own)) {
+			return true;
+		}
+	}
+
+	ref.seek(start);
+	r = start_r;
+	return false;
+}
+
+void trace_diff_t::report(trace_log_reader_t &ref, const trace_record_t &r, const trace_record_t &own) {
+	printf("trace_diff: difference after %llu matching instructions, at reference line %llu\n",
+		(unsigned long long)compared, (unsigned long long)ref.line_number);
+
+	for (uint32_t i = 0; i != context_count; ++i) {
+		const context_t &c = context[(compared - context_count + i) % TRACE_DIFF_CONTEXT];
+		printf("  ref:   %.*s\n", int(c.line_len), c.line);
+		printf("  chani: ");
+		trace_print_log_line(stdout, c.record);
+	}
+
+	printf("> ref:   %.*s\n", int(ref.line_len), ref.line);
+	printf("> chani: ");
+	trace_print_log_line(stdout, own);
+
+	printf("  differs in:");
+	uint32_t mask = differing_fields(r, own);
+	for (int i = 0; i != TRACE_FIELD_COUNT; ++i) {
+		if (mask & (1u << i)) {
+			uint16_t field_mask = i == TRACE_FLAGS ? compared_flags(r, own) : 0xffff;
+			printf(" %s (%04X vs %04X)", field_names[i], r.field[i] & field_mask, own.field[i] & field_mask);
+		}
+	}
+	printf("\n");
+}
+
+bool trace_diff_t::run(trace_log_reader_t &ref, trace_source_t &own) {
+	trace_record_t r = {};
+	trace_record_t o;
+
+	compared = 0;
+	resyncs = 0;
+	context_count = 0;
+
+	if (!next_own(own, o)) {
+		return true;
+	}
+
+	// The reference usually starts long before the program does.
+	if (!find_in_ref(ref, r, o, UINT64_MAX)) {
+		printf("trace_diff: the first instruction (%04X:%04X) isn't in the reference\n",
+			o.field[TRACE_CS], o.field[TRACE_IP]);
+		return false;
+	}
+
+	for (;;) {
+		if (differing_fields(r, o)) {
+			if (!resync_window || !find_in_ref(ref, r, o, resync_window)) {
+				report(ref, r, o);
+				return false;
+			}
+			resyncs++;
+		}
+
+		context_t &c = context[compared % TRACE_DIFF_CONTEXT];
+		c.line     = ref.line;
+		c.line_len = ref.line_len;
+		c.record   = o;
+		if (context_count < TRACE_DIFF_CONTEXT) {
+			context_count++;
+		}
+		compared++;
+
+		if (!next_own(own, o) || !next_ref(ref, r)) {
+			return true;
+		}
+	}
+}
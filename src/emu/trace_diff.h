@@ -0,0 +1,108 @@
+#ifndef EMU_TRACE_DIFF
+#define EMU_TRACE_DIFF
+
+#include "emu/i8086_trace.h"
+#include "support/mapped_file.h"
+
+#include <vector>
+
+class i8086_t;
+
+#define TRACE_DIFF_CONTEXT 8
+
+/*
+ * Reads the instruction lines of a reference emulator log in the format
+ * of i8086_t::log_state() or DOSBox's heavy debug log. Lines are parsed
+ * in place in the mapped file, registers are found by name so the
+ * disassembly and extra registers in DOSBox lines are skipped. Lines
+ * without cs:ip and the general registers are ignored.
+ */
+class trace_log_reader_t {
+	mapped_file_t file;
+	const char   *pos = nullptr;
+	const char   *end = nullptr;
+
+public:
+	struct position_t {
+		const char *pos;
+		const char *line;
+		size_t      line_len;
+		uint64_t    line_number;
+	};
+
+	const char *line = nullptr;   // Text of the last record read
+	size_t      line_len = 0;
+	uint64_t    line_number = 0;
+
+	bool open(const char *path);
+	bool next(trace_record_t &r);
+
+	position_t tell() const {
+		return { pos, line, line_len, line_number };
+	}
+
+	void seek(const position_t &p) {
+		pos         = p.pos;
+		line        = p.line;
+		line_len    = p.line_len;
+		line_number = p.line_number;
+	}
+};
+
+// Steps the CPU and yields a record for every guest instruction it runs.
+class i8086_live_trace_t : public trace_source_t {
+	i8086_t *cpu;
+
+public:
+	i8086_live_trace_t(i8086_t *cpu) : cpu(cpu) {}
+
+	bool next(trace_record_t &r) override;
+};
+
+/*
+ * Walks a reference log and Chani's execution in lockstep and stops at
+ * the first instruction where cs:ip, the registers or the flags differ.
+ * Instructions in code segments known to differ, like the BIOS which
+ * Chani emulates at a high level, are skipped on both sides.
+ */
+class trace_diff_t {
+	struct skip_range_t {
+		uint16_t cs_lo;
+		uint16_t cs_hi;
+	};
+
+	struct context_t {
+		const char    *line;
+		size_t         line_len;
+		trace_record_t record;
+	};
+
+	std::vector<skip_range_t> skip_ranges = { { 0xf000, 0xffff } };
+
+	context_t context[TRACE_DIFF_CONTEXT];
+	uint32_t  context_count = 0;
+
+	bool skipped(const trace_record_t &r);
+	bool next_ref(trace_log_reader_t &ref, trace_record_t &r);
+	bool next_own(trace_source_t &own, trace_record_t &r);
+	bool find_in_ref(trace_log_reader_t &ref, trace_record_t &r, const trace_record_t &own, uint64_t window);
+	void report(trace_log_reader_t &ref, const trace_record_t &r, const trace_record_t &own);
+
+public:
+	// Reference lines searched for the current instruction after a divergence, 0 to stop at once.
+	uint64_t resync_window = 0;
+
+	uint64_t compared = 0;
+	uint64_t resyncs = 0;
+
+	void add_skip_range(uint16_t cs_lo, uint16_t cs_hi) {
+		skip_ranges.push_back({ cs_lo, cs_hi });
+	}
+
+	// Returns true if the streams matched until one of them ended.
+	bool run(trace_log_reader_t &ref, trace_source_t &own);
+
+	static uint32_t differing_fields(const trace_record_t &a, const trace_record_t &b);
+};
+
+#endif
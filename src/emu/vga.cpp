@@ -1,9 +1,13 @@
 #include "emu/vga.h"
 
+#include "emu/bus.h"
 #include "emu/ibm5160.h"
+#include "emu/snapshot.h"
+#include "emu/vga_palette.h"
 
 #include <cstdio>
 #include <cstring>
+#include <vector>
 
 vga_t::vga_t() {
 	h_total = h_visible_area + h_front_porch + h_sync_pulse + h_back_porch;
@@ -13,72 +17,45 @@ vga_t::vga_t() {
 	v_sync_pels = h_total * v_sync_pulse;
 
 	memset(dac_ram, 0, sizeof(dac_ram));
+	update_palette();
 }
 
-uint64_t vga_t::next_cycles() {
-	int total_pels  = h_total * v_total;
-	int v_sync_pels = h_total * v_sync_pulse;
-
-	while (current_pel >= total_pels) {
-		current_pel -= total_pels;
+void vga_t::update_palette() {
+	for (int c = 0; c != 256; ++c) {
+		palette[c] = vga_dac_to_rgba(&dac_ram[3 * c]);
 	}
+}
 
+// The end of the retrace is the only event, the beam position is worked out when 0x3da is read.
+uint64_t vga_t::next_cycles() {
 	if (current_pel < v_sync_pels) {
 		return v_sync_pels - current_pel;
 	}
-
-	return total_pels - current_pel;
+	return total_pels - current_pel + v_sync_pels;
 }
 
 uint64_t vga_t::run_cycles(uint64_t cycles) {
-	current_pel += cycles;
-	while (current_pel >= total_pels) {
-		current_pel -= total_pels;
+	if (cycles >= next_cycles()) {
+		frame_pending = true;
 	}
-
-	if (current_pel < v_sync_pels) {
-		return v_sync_pels - current_pel;
-	}
-
-	if (current_pel == v_sync_pels) {
-		// write_ppm(0xa0000, 320, 200);
-	}
-
-	return total_pels - current_pel;
+	current_pel = (current_pel + cycles) % total_pels;
+	return cycles;
 }
 
 bool vga_t::frame_ready() {
-	return current_pel == v_sync_pels;
+	bool ready = frame_pending;
+	frame_pending = false;
+	return ready;
 }
 
 void vga_t::read_rgba(byte *p, uint32_t addr, int w, int h) {
-	static int frame_number;
-	static int next_frame_number = 0;
-	char filename[32];
-
-	frame_number = next_frame_number++;
-
-	for (int y = 0; y != h; ++y) {
-		for (int x = 0; x != w; ++x) {
-			int offset = w * y + x;
-			byte c = machine->memory[addr + offset];
-			byte r = dac_ram[3*c+0];
-			byte g = dac_ram[3*c+1];
-			byte b = dac_ram[3*c+2];
-			p[4 * offset + 0] = (r << 2) | (r >> 4);
-			p[4 * offset + 1] = (g << 2) | (g >> 4);
-			p[4 * offset + 2] = (b << 2) | (b >> 4);
-			p[4 * offset + 3] = 255;
-		}
-	}
+	vga_indexed_to_rgba(p, &machine->memory[addr], size_t(w) * h, palette);
 }
 
 void vga_t::read_dac_ram(byte *p) {
 	memcpy(p, dac_ram, 0x300);
 }
 
-byte frame[320*200*3];
-
 void vga_t::write_ppm(uint32_t addr, int w, int h) {
 	static int frame_number;
 	static int next_frame_number = 0;
@@ -86,17 +63,13 @@ void vga_t::write_ppm(uint32_t addr, int w, int h) {
 
 	frame_number = next_frame_number++;
 
-	for (int y = 0; y != h; ++y) {
-		for (int x = 0; x != w; ++x) {
-			int offset = w * y + x;
-			byte c = machine->memory[addr + offset];
-			byte r = dac_ram[3*c+0];
-			byte g = dac_ram[3*c+1];
-			byte b = dac_ram[3*c+2];
-			frame[3 * offset + 0] = (r << 2) | (r >> 4);
-			frame[3 * offset + 1] = (g << 2) | (g >> 4);
-			frame[3 * offset + 2] = (b << 2) | (b >> 4);
-		}
+	static std::vector<byte> rgba;
+	static std::vector<byte> rgb;
+	rgba.resize(4 * w * h);
+	rgb.resize(3 * w * h);
+	read_rgba(rgba.data(), addr, w, h);
+	for (int i = 0; i != w * h; ++i) {
+		memcpy(&rgb[3 * i], &rgba[4 * i], 3);
 	}
 
 	sprintf(filename, "ppm/frame-%05d.ppm", frame_number);
@@ -114,54 +87,71 @@ void vga_t::write_ppm(uint32_t addr, int w, int h) {
 	}
 	fprintf(f, "P6\n");
 	fprintf(f, "%d %d\n%d\n", w, h, 255);
-	fwrite(frame, 320*200*3, 1, f);
+	fwrite(rgb.data(), rgb.size(), 1, f);
 	fclose(f);
 }
 
-uint8_t vga_t::read(address_space_t address_space, uint32_t addr) {
-	uint8_t v = 0;
-
-	if (address_space == IO) {
-		switch (addr) {
-			case 0x3c7: // DAC State Register
-				v = dac_state;
-				break;
-			case 0x3c8: // DAC Address Write Mode Register
-				v = dac_address;
-				break;
-			case 0x3c9: // DAC Data Register
-				v = dac_ram[dac_address++];
-				dac_address %= 0x300;
-				break;
-			case 0x3da: // Input Status #1 Register
-				v = 0;
-				if (current_pel < v_sync_pels) {
-					v |= 0b00001000;
-				}
-				break;
-		}
-		// printf("VGA: read  0x%3x -> %02x\n", addr, v);
+void vga_t::map(bus_t *bus) {
+	bus->map_io(0x3c0, 0x3df, this);
+}
+
+byte vga_t::io_read(uint16_t port) {
+	byte v = 0;
+
+	switch (port) {
+		case 0x3c7: // DAC State Register
+			v = dac_state;
+			break;
+		case 0x3c8: // DAC Address Write Mode Register
+			v = dac_address;
+			break;
+		case 0x3c9: // DAC Data Register
+			v = dac_ram[dac_address++];
+			dac_address %= 0x300;
+			break;
+		case 0x3da: // Input Status #1 Register
+			v = 0;
+			if (current_pel < v_sync_pels) {
+				v |= 0b00001000;
+			}
+			break;
 	}
+	// printf("VGA: read  0x%3x -> %02x\n", port, v);
 
 	return v;
 }
 
-void vga_t::write(address_space_t address_space, uint32_t addr, uint8_t v) {
-	if (address_space == IO) {
-		// printf("VGA: write %02x -> 0x%3x\n", v, addr);
-		switch (addr) {
-			case 0x3c7: // DAC Address Read Mode Register
-				dac_address = 3 * v;
-				dac_state = 0b00;
-				break;
-			case 0x3c8: // DAC Address Write Mode Register
-				dac_address = 3 * v;
-				dac_state = 0b11;
-				break;
-			case 0x3c9: // DAC Data Register
-				dac_ram[dac_address++] = v & 0b111111;
-				dac_address %= 0x300;
-				break;
-		}
+void vga_t::io_write(uint16_t port, byte v) {
+	// printf("VGA: write %02x -> 0x%3x\n", v, port);
+	switch (port) {
+		case 0x3c7: // DAC Address Read Mode Register
+			dac_address = 3 * v;
+			dac_state = 0b00;
+			break;
+		case 0x3c8: // DAC Address Write Mode Register
+			dac_address = 3 * v;
+			dac_state = 0b11;
+			break;
+		case 0x3c9: // DAC Data Register
+			dac_ram[dac_address] = v & 0b111111;
+			palette[dac_address / 3] = vga_dac_to_rgba(&dac_ram[dac_address - dac_address % 3]);
+			dac_address = (dac_address + 1) % 0x300;
+			break;
 	}
 }
+
+void vga_t::save_state(snapshot_writer_t &w) {
+	w.put(current_pel);
+	w.put(dac_state);
+	w.put(dac_address);
+	w.put(dac_ram);
+}
+
+bool vga_t::load_state(snapshot_reader_t &r) {
+	r.get(current_pel);
+	r.get(dac_state);
+	r.get(dac_address);
+	r.get(dac_ram);
+	update_palette();
+	return r.good();
+}
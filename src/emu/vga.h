@@ -21,12 +21,18 @@ class vga_t : public device_t {
 	int total_pels;
 	int v_sync_pels;
 
-	int current_pel = 0;
+	int  current_pel = 0;
+	bool frame_pending = false;
 
 	uint8_t  dac_state = 0;
 	uint16_t dac_address = 0;
 	uint8_t  dac_ram[0x300];
 
+	// dac_ram as RGBA words, updated on every DAC write.
+	alignas(64) uint32_t palette[256];
+
+	void update_palette();
+
 public:
 	vga_t();
 
@@ -36,14 +42,20 @@ public:
 	uint64_t next_cycles();
 	uint64_t run_cycles(uint64_t cycles);
 
+	// Once per frame, true on the first call after the vertical retrace.
 	bool frame_ready();
 
+	// Converts the w*h indexed pixels at addr through the DAC.
 	void read_rgba(byte *p, uint32_t addr, int w, int h);
 	void read_dac_ram(byte *p);
 	void write_ppm(uint32_t addr, int w, int h);
 
-	uint8_t read(address_space_t, uint32_t);
-	void    write(address_space_t, uint32_t, uint8_t);
+	void map(bus_t *bus);
+	byte io_read(uint16_t port);
+	void io_write(uint16_t port, byte v);
+
+	void save_state(snapshot_writer_t &w);
+	bool load_state(snapshot_reader_t &r);
 };
 
 #endif
@@ -0,0 +1,105 @@
+#include "emu/vga_palette.h"
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VGA_SIMD_SUPPORTED 1
+#include <immintrin.h>
+#else
+#define VGA_SIMD_SUPPORTED 0
+#endif
+
+const char *vga_kernel_name(vga_kernel_t kernel) {
+	switch (kernel) {
+		case VGA_KERNEL_SCALAR: return "scalar";
+		case VGA_KERNEL_SSE2:   return "sse2";
+		case VGA_KERNEL_AVX2:   return "avx2";
+		default:                return "?";
+	}
+}
+
+bool vga_kernel_supported(vga_kernel_t kernel) {
+	switch (kernel) {
+		case VGA_KERNEL_SCALAR:
+			return true;
+#if VGA_SIMD_SUPPORTED
+		case VGA_KERNEL_SSE2:
+			return __builtin_cpu_supports("sse2");
+		case VGA_KERNEL_AVX2:
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+vga_kernel_t vga_best_kernel() {
+	static const vga_kernel_t best = [] {
+		vga_kernel_t kernel = VGA_KERNEL_SCALAR;
+		for (int k = VGA_KERNEL_SCALAR; k != VGA_KERNEL_COUNT; ++k) {
+			if (vga_kernel_supported(vga_kernel_t(k))) {
+				kernel = vga_kernel_t(k);
+			}
+		}
+		return kernel;
+	}();
+	return best;
+}
+
+uint32_t vga_dac_to_rgba(const byte *rgb) {
+	byte rgba[4] = {
+		byte((rgb[0] << 2) | (rgb[0] >> 4)),
+		byte((rgb[1] << 2) | (rgb[1] >> 4)),
+		byte((rgb[2] << 2) | (rgb[2] >> 4)),
+		255,
+	};
+	uint32_t v;
+	memcpy(&v, rgba, 4);
+	return v;
+}
+
+static void indexed_to_rgba_scalar(byte *dst, const byte *src, size_t count, const uint32_t *palette) {
+	for (size_t i = 0; i != count; ++i) {
+		memcpy(dst + 4 * i, &palette[src[i]], 4);
+	}
+}
+
+#if VGA_SIMD_SUPPORTED
+// No gather before AVX2, the lookups are scalar and the stores 16 bytes wide.
+__attribute__((target("sse2")))
+static void indexed_to_rgba_sse2(byte *dst, const byte *src, size_t count, const uint32_t *palette) {
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_setr_epi32(palette[src[i + 0]], palette[src[i + 1]], palette[src[i + 2]], palette[src[i + 3]]);
+		_mm_storeu_si128((__m128i *)(dst + 4 * i), v);
+	}
+	indexed_to_rgba_scalar(dst + 4 * i, src + i, count - i, palette);
+}
+
+__attribute__((target("avx2")))
+static void indexed_to_rgba_avx2(byte *dst, const byte *src, size_t count, const uint32_t *palette) {
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		__m256i v     = _mm256_i32gather_epi32((const int *)palette, index, 4);
+		_mm256_storeu_si256((__m256i *)(dst + 4 * i), v);
+	}
+	indexed_to_rgba_scalar(dst + 4 * i, src + i, count - i, palette);
+}
+#endif
+
+void vga_indexed_to_rgba(vga_kernel_t kernel, byte *dst, const byte *src, size_t count, const uint32_t palette[256]) {
+	switch (kernel) {
+#if VGA_SIMD_SUPPORTED
+		case VGA_KERNEL_SSE2:
+			indexed_to_rgba_sse2(dst, src, count, palette);
+			break;
+		case VGA_KERNEL_AVX2:
+			indexed_to_rgba_avx2(dst, src, count, palette);
+			break;
+#endif
+		default:
+			indexed_to_rgba_scalar(dst, src, count, palette);
+			break;
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef EMU_VGA_PALETTE_H
+#define EMU_VGA_PALETTE_H
+
+#include "support/types.h"
+
+#include <cstddef>
+
+// Kernels converting indexed pixels, from slowest to fastest.
+enum vga_kernel_t : byte {
+	VGA_KERNEL_SCALAR,
+	VGA_KERNEL_SSE2,
+	VGA_KERNEL_AVX2,   // Gathers 8 palette entries at once
+
+	VGA_KERNEL_COUNT,
+};
+
+const char  *vga_kernel_name(vga_kernel_t kernel);
+bool         vga_kernel_supported(vga_kernel_t kernel);
+
+// The fastest kernel the host runs, checked once.
+vga_kernel_t vga_best_kernel();
+
+// The RGBA word of a 6 bit per channel DAC entry, as bytes in memory.
+uint32_t vga_dac_to_rgba(const byte *rgb);
+
+// Writes count RGBA pixels to dst from the palette indexes in src.
+void vga_indexed_to_rgba(vga_kernel_t kernel, byte *dst, const byte *src, size_t count, const uint32_t palette[256]);
+
+inline void vga_indexed_to_rgba(byte *dst, const byte *src, size_t count, const uint32_t palette[256]) {
+	vga_indexed_to_rgba(vga_best_kernel(), dst, src, count, palette);
+}
+
+#endif
@@ -3,27 +3,41 @@
 #include "dos/dos.h"
 #include "emu/device.h"
 #include "emu/i8086.h"
+#include "emu/i8086_breakpoints.h"
 #include "emu/i8254_pit.h"
 #include "emu/ibm5160.h"
+#include "emu/input_journal.h"
+#include "emu/time_travel.h"
 #include "emu/vga.h"
 #include "emu/keyboard.h"
+#include "emu/scheduler.h"
 
+#include <cstring>
 #include <thread>
 #include <vector>
 
-machine_runner_t::machine_runner_t(ibm5160_t *machine) :
-	machine(machine)
+machine_view_t::machine_view_t() :
+	frame(4 * MACHINE_VIEW_WIDTH * MACHINE_VIEW_HEIGHT),
+	memory(MEMORY_SIZE)
 {
-	for (const auto &registered_device : machine->devices) {
-		devices.push_back({
-			device_next_event_t {
-				registered_device.name,
-				registered_device.device,
-				0.0
-			}
-		});
+}
+
+uint16_t machine_view_t::read(address_space_t address_space, uint32_t addr, width_t w) const {
+	if (address_space != MEM) {
+		return 0;
 	}
+	addr %= MEMORY_SIZE;
+	return w == W8 ? memory[addr] : memory[addr] | (memory[(addr + 1) % MEMORY_SIZE] << 8);
+}
+
+machine_runner_t::machine_runner_t(ibm5160_t *machine, time_travel_t *time_travel, input_journal_t *input_journal) :
+	machine(machine),
+	time_travel(time_travel),
+	input_journal(input_journal)
+{
+}
 
+void machine_runner_t::start() {
 	thread = new std::thread(&machine_runner_t::loop, this);
 }
 
@@ -33,12 +47,17 @@ void machine_runner_t::debug_run(int cycles) {
 }
 
 void machine_runner_t::stop() {
+	if (!thread) {
+		return;
+	}
 	{
 		std::lock_guard<std::mutex> lock(state_mutex);
 		state = MACHINE_RUNNER_STATE_STOP;
 	}
 	state_cv.notify_one();
 	thread->join();
+	delete thread;
+	thread = nullptr;
 }
 
 void machine_runner_t::pause() {
@@ -53,68 +72,162 @@ void machine_runner_t::resume() {
 	state_cv.notify_one();
 }
 
+// A paused machine only changes through here, so the view follows right away.
 void machine_runner_t::with_machine(const std::function<void(ibm5160_t *)> &f) {
 	std::lock_guard<std::mutex> lock(machine_mutex);
 	f(machine);
+	if (is_paused()) {
+		publish_view();
+	}
 }
 
-void machine_runner_t::set_mouse(uint16_t x, uint16_t y, uint16_t buttons) {
+void machine_runner_t::publish_view() {
+	machine_view_t &view = views.write_buffer();
+	i8086_t        *cpu  = (i8086_t *)machine->cpu;
+
+	view.cpu.ax          = cpu->ax;
+	view.cpu.bx          = cpu->bx;
+	view.cpu.cx          = cpu->cx;
+	view.cpu.dx          = cpu->dx;
+	view.cpu.si          = cpu->si;
+	view.cpu.di          = cpu->di;
+	view.cpu.bp          = cpu->bp;
+	view.cpu.sp          = cpu->sp;
+	view.cpu.cs          = cpu->cs;
+	view.cpu.ds          = cpu->ds;
+	view.cpu.es          = cpu->es;
+	view.cpu.ss          = cpu->ss;
+	view.cpu.ip          = cpu->ip;
+	view.cpu.flags       = cpu->get_flags();
+	view.cpu.op          = cpu->op;
+	view.cpu.is_prefix   = cpu->is_prefix;
+	view.cpu.int_delay   = cpu->int_delay;
+	view.cpu.int_nmi     = cpu->int_nmi;
+	view.cpu.int_intr    = cpu->int_intr;
+	view.cpu.int_number  = cpu->int_number;
+	view.cpu.instr_count = cpu->get_instr_count();
+
+	machine->vga->read_dac_ram(view.dac_ram);
+	machine->vga->read_rgba(view.frame.data(), 0xA0000, MACHINE_VIEW_WIDTH, MACHINE_VIEW_HEIGHT);
+	if (publish_memory) {
+		memcpy(view.memory.data(), machine->memory, MEMORY_SIZE);
+	}
+
+	views.publish();
+}
+
+bool machine_runner_t::set_mouse(uint16_t x, uint16_t y, uint16_t buttons) {
 	if (old_mouse_x == x && old_mouse_y == y && old_mouse_buttons == buttons) {
-		return;
+		return true;
 	}
 
+	if (!input_queue.push({ INPUT_MOUSE, 0, x, y, buttons, std::chrono::steady_clock::now() })) {
+		return false;
+	}
 	old_mouse_x = x;
 	old_mouse_y = y;
 	old_mouse_buttons = buttons;
-
-	std::lock_guard<std::mutex> lock(machine_mutex);
-	machine->dos->set_mouse(x, y, buttons);
+	return true;
 }
 
-void machine_runner_t::set_key_down(int down_key_id) {
-	std::lock_guard<std::mutex> lock(machine_mutex);
-	machine->keyboard->set_key_down(down_key_id);
+bool machine_runner_t::set_key_down(int down_key_id) {
+	return input_queue.push({ INPUT_KEY_DOWN, down_key_id, 0, 0, 0, std::chrono::steady_clock::now() });
 }
 
-void machine_runner_t::set_key_up(int up_key_id) {
-	std::lock_guard<std::mutex> lock(machine_mutex);
-	machine->keyboard->set_key_up(up_key_id);
+bool machine_runner_t::set_key_up(int up_key_id) {
+	return input_queue.push({ INPUT_KEY_UP, up_key_id, 0, 0, 0, std::chrono::steady_clock::now() });
 }
 
-void machine_runner_t::run_until_next_event() {
-	// Find next event for each devices (in microseconds)
-	for (auto &d : devices) {
-		uint64_t device_cycles = d.device->next_cycles();
-		d.next_event = device_cycles / d.device->frequency_in_mhz();
-	}
-
-	auto next_event_device = std::min_element(devices.begin(), devices.end(), [](auto a, auto b) {
-		return a.next_event < b.next_event;
-	});
-	double next_event = next_event_device->next_event;
+void machine_runner_t::apply_input() {
+	input_event_t e;
+	bool          applied = false;
+	while (input_queue.pop(e)) {
+		if (!applied) {
+			auto waited = std::chrono::steady_clock::now() - e.host_time;
+			input_latency_us = std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
+			applied = true;
+		}
 
-	// Simulate at most 1ms (1000 microseconds) at a time
-	next_event = std::min(next_event, 1000.0);
+		if (time_travel) {
+			switch (e.type) {
+				case INPUT_KEY_DOWN: time_travel->set_key_down(e.key); break;
+				case INPUT_KEY_UP:   time_travel->set_key_up(e.key); break;
+				case INPUT_MOUSE:    time_travel->set_mouse(e.x, e.y, e.buttons); break;
+			}
+		} else if (input_journal) {
+			switch (e.type) {
+				case INPUT_KEY_DOWN: input_journal->set_key_down(e.key); break;
+				case INPUT_KEY_UP:   input_journal->set_key_up(e.key); break;
+				case INPUT_MOUSE:    input_journal->set_mouse(e.x, e.y, e.buttons); break;
+			}
+		} else {
+			switch (e.type) {
+				case INPUT_KEY_DOWN: machine->keyboard->set_key_down(e.key); break;
+				case INPUT_KEY_UP:   machine->keyboard->set_key_up(e.key); break;
+				case INPUT_MOUSE:    machine->dos->set_mouse(e.x, e.y, e.buttons); break;
+			}
+		}
+	}
+}
 
-	// Run all devices until next event
-	std::lock_guard<std::mutex> lock(machine_mutex);
-	for (auto &d : devices) {
-		double   device_frequency = d.device->frequency_in_mhz();
-		uint64_t device_cycles = next_event * device_frequency;
+void machine_runner_t::run_until_next_event() {
+	if (time_travel) {
+		std::lock_guard<std::mutex> lock(machine_mutex);
+		apply_input();
 		if (debug_cycles > 0) {
-			d.device->run_cycles(debug_cycles);
 			debug_cycles = 0;
+			time_travel->step_forward();
 			pause();
+		} else {
+			time_travel->run_slice();
 		}
-		else {
-			d.device->run_cycles(device_cycles);
-		}
+		stop_at_break();
+		return;
+	}
+
+	// Input only lands between slices, so a replay applies it before the same slice.
+	std::lock_guard<std::mutex> lock(machine_mutex);
+	apply_input();
+	if (input_journal) {
+		input_journal->replay();
+	}
+
+	scheduler_t *scheduler = machine->scheduler;
+	if (debug_cycles > 0) {
+		uint64_t start = scheduler->now();
+		machine->cpu->run_cycles(debug_cycles);
+		scheduler->run_due();
+		emulated_ticks += scheduler->now() - start;
+		debug_cycles = 0;
+		pause();
+	} else {
+		emulated_ticks += scheduler->run();
+	}
+
+	stop_at_break();
+}
+
+void machine_runner_t::stop_at_break() {
+	i8086_breakpoints_t *breakpoints = ((i8086_t *)machine->cpu)->breakpoints;
+	if (breakpoints->stop) {
+		breakpoints->stop = false;
+		pause();
 	}
 }
 
 void machine_runner_t::state_run() {
 	run_until_next_event();
-	if (machine->vga->frame_ready()) {
+
+	bool frame_ready;
+	{
+		std::lock_guard<std::mutex> lock(machine_mutex);
+		frame_ready = machine->vga->frame_ready();
+		if (frame_ready) {
+			publish_view();
+		}
+	}
+
+	if (throttle && frame_ready) {
 		// Limit frame rate to 70 fps
 		const auto frame_end = frame_start + std::chrono::nanoseconds(1000000000 / 70);
 		std::this_thread::sleep_until(frame_end);
@@ -125,6 +238,11 @@ void machine_runner_t::state_run() {
 void machine_runner_t::state_pause() {
 	const auto pause_start = std::chrono::steady_clock::now();
 
+	{
+		std::lock_guard<std::mutex> lock(machine_mutex);
+		publish_view();
+	}
+
 	{
 		auto ul = std::unique_lock<std::mutex>(state_mutex);
 		state_cv.wait(ul, [this](){ return state != MACHINE_RUNNER_STATE_PAUSE; });
@@ -1,16 +1,23 @@
 #ifndef EMU_MACHINE_RUNNER_H
 #define EMU_MACHINE_RUNNER_H
 
-#include "emu/device.h"
+#include "emu/emu.h"
+#include "emu/scheduler.h"
+#include "support/spsc_queue.h"
+#include "support/triple_buffer.h"
+#include "support/types.h"
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <mutex>
-#include <string>
 #include <thread>
 #include <vector>
 
 class ibm5160_t;
+class input_journal_t;
+class time_travel_t;
 
 enum {
 	MACHINE_RUNNER_STATE_RUN,
@@ -18,52 +25,135 @@ enum {
 	MACHINE_RUNNER_STATE_PAUSE,
 };
 
-class machine_runner_t {
-	struct device_next_event_t {
-		std::string name;
-		device_t   *device;
-		double      next_event;
-	};
+#define MACHINE_VIEW_WIDTH  320
+#define MACHINE_VIEW_HEIGHT 200
+
+// What the GUI shows of the machine, copied at the end of a frame or when it pauses.
+struct machine_view_t {
+	struct cpu_t {
+		uint16_t ax, bx, cx, dx;
+		uint16_t si, di, bp, sp;
+		uint16_t cs, ds, es, ss;
+		uint16_t ip;
+		uint16_t flags;
+		byte     op;
+		bool     is_prefix;
+		bool     int_delay;
+		bool     int_nmi;
+		bool     int_intr;
+		byte     int_number;
+		uint64_t instr_count;
+	} cpu = {};
+
+	byte              dac_ram[0x300] = {};
+	std::vector<byte> frame;    // RGBA, of the VRAM window at 0xA0000
+	std::vector<byte> memory;   // Only kept up to date while the GUI asks for it
+
+	machine_view_t();
+
+	// Like ibm5160_t::read() for memory, ports read as 0.
+	uint16_t read(address_space_t address_space, uint32_t addr, width_t w) const;
+};
+
+enum input_event_type_t : byte {
+	INPUT_KEY_DOWN,
+	INPUT_KEY_UP,
+	INPUT_MOUSE,
+};
+
+// Input from the GUI thread, stamped with the host time it was sent at.
+struct input_event_t {
+	input_event_type_t type;
+	int                key;
+	uint16_t           x;
+	uint16_t           y;
+	uint16_t           buttons;
 
+	std::chrono::time_point<std::chrono::steady_clock> host_time;
+};
+
+class machine_runner_t {
 	int16_t  debug_cycles = 0;
+	bool     throttle = true;
+	uint64_t emulated_ticks = 0;   // Scheduler ticks run
 
+	// Owned by the GUI thread.
 	uint16_t old_mouse_x = -1;
 	uint16_t old_mouse_y = -1;
 	uint16_t old_mouse_buttons = -1;
 
-	std::chrono::time_point<std::chrono::steady_clock> frame_start;
+	spsc_queue_t<input_event_t, 1024> input_queue;
+	std::atomic<int64_t>              input_latency_us = 0;
 
-	std::vector<device_next_event_t> devices;
+	std::chrono::time_point<std::chrono::steady_clock> frame_start;
 
-	std::mutex  machine_mutex;
-	ibm5160_t  *machine;
+	std::mutex       machine_mutex;
+	ibm5160_t       *machine;
+	time_travel_t   *time_travel;
+	input_journal_t *input_journal;
 
-	std::thread      *thread;
+	std::thread      *thread = nullptr;
 
 	std::condition_variable state_cv;
 	std::mutex              state_mutex;
 	std::atomic_int         state = MACHINE_RUNNER_STATE_RUN;
 
+	triple_buffer_t<machine_view_t> views;
+	std::atomic_bool                publish_memory = false;
+
+	// With machine_mutex held.
+	void publish_view();
+	void apply_input();
+
 	void loop();
-	void run_until_next_event();
+	void stop_at_break();
 
 	void state_run();
 	void state_pause();
 
 public:
-	machine_runner_t(ibm5160_t *machine);
+	// With time travel the machine is run through it so it can be rewound.
+	// Input goes through the journal when there is one, to record or replay it.
+	machine_runner_t(ibm5160_t *machine, time_travel_t *time_travel = nullptr, input_journal_t *input_journal = nullptr);
 
+	// Runs the machine on its own thread, front ends can also call run_until_next_event() instead.
+	void start();
 	void stop();
 	void pause();
 	bool is_paused() { return state == MACHINE_RUNNER_STATE_PAUSE; }
 	void resume();
 	void debug_run(int cycles);
 
+	// Runs the CPU up to the next device event, at most 1 ms of emulated time.
+	void run_until_next_event();
+
+	// Without throttling frames aren't held to 70 per second.
+	void set_throttle(bool on) { throttle = on; }
+
+	// In microseconds.
+	double get_emulated_time() { return emulated_ticks / (SCHEDULER_TICKS_PER_SECOND / 1e6); }
+
+	// Locks the machine for the debugger, the GUI otherwise only looks at the view.
 	void with_machine(const std::function<void(ibm5160_t *)> &f);
 
-	void set_mouse(uint16_t x, uint16_t y, uint16_t buttons);
-	void set_key_down(int down_key_id);
-	void set_key_up(int up_key_id);
+	// GUI thread only. Picks up the latest view, true if there was a newer one.
+	bool update_view() { return views.update(); }
+	const machine_view_t &get_view() { return views.read_buffer(); }
+
+	// Copying all of memory into the view is only worth it while something shows it.
+	void set_publish_memory(bool on) { publish_memory = on; }
+
+	// Only to be used inside with_machine().
+	time_travel_t *get_time_travel() { return time_travel; }
+
+	// GUI thread only. Queued without locking and applied before the next
+	// slice, false if the queue is full and the event should be sent again.
+	bool set_mouse(uint16_t x, uint16_t y, uint16_t buttons);
+	bool set_key_down(int down_key_id);
+	bool set_key_up(int up_key_id);
+
+	// How long the oldest of the last input applied waited for its slice, in microseconds.
+	int64_t get_input_latency() { return input_latency_us; }
 };
 
 #endif
@@ -1,8 +1,12 @@
 #include "gui/main_window.h"
 
 #include "emu/i8086.h"
+#include "emu/i8086_breakpoints.h"
+#include "emu/i8086_func_profiler.h"
+#include "emu/i8086_profiler.h"
 #include "emu/ibm5160.h"
-#include "emu/vga.h"
+#include "emu/time_travel.h"
+#include "emu/vga_palette.h"
 #include "disasm/disasm_i8086.h"
 #include "gui/disassembler_view.h"
 #include "gui/machine_runner.h"
@@ -17,7 +21,10 @@
 #include <imgui_demo.cpp>
 
 #include <cstdio>
+#include <cstring>
+#include <string>
 #include <thread>
+#include <vector>
 #include <imgui_memory_editor.h>
 
 void main_window_t::initialize_glfw() {
@@ -64,8 +71,7 @@ void main_window_t::initialize_imgui() {
 }
 
 void main_window_t::loop() {
-	texture_t frame_texture(320, 200);
-	byte dac_ram[0x300];
+	texture_t frame_texture(MACHINE_VIEW_WIDTH, MACHINE_VIEW_HEIGHT);
 	bool show_disassembler = true;
 
 	auto disassembler_view = new disassembler_view_t;
@@ -89,11 +95,12 @@ void main_window_t::loop() {
 			machine_runner->debug_run(1);
 		}
 
-		machine_runner->with_machine([&](ibm5160_t *machine) {
-			disassembler_view->draw("Disassembler", &show_disassembler, [&machine](address_space_t s, uint32_t addr, width_t w) { return machine->read(s, addr, w); });
-			machine->vga->read_rgba(frame_texture.data(), 0xA0000, frame_texture.width(), frame_texture.height());
-			machine->vga->read_dac_ram(dac_ram);
-			});
+		// Stays valid until the next update_view(), the runner publishes into the other buffers.
+		machine_runner->update_view();
+		const machine_view_t &view = machine_runner->get_view();
+
+		disassembler_view->draw("Disassembler", &show_disassembler, [&view](address_space_t s, uint32_t addr, width_t w) { return view.read(s, addr, w); });
+		memcpy(frame_texture.data(), view.frame.data(), view.frame.size());
 
 		int frame_x = 0;
 		int frame_y = 0;
@@ -101,9 +108,12 @@ void main_window_t::loop() {
 
 		create_window_framebuffer(frame_texture, frame_x, frame_y, mouse_btn);
 		capture_keyboard();
-		create_window_palette_state(dac_ram);
-		create_window_debug(frame_x, frame_y, mouse_btn);
-		create_window_hexview();
+		create_window_palette_state(view.dac_ram);
+		create_window_debug(view, frame_x, frame_y, mouse_btn);
+		bool show_hexview = create_window_hexview(view);
+		machine_runner->set_publish_memory(show_disassembler || show_hexview);
+		create_window_profiler();
+		create_window_func_profiler();
 
 		glfw_render_frame();
 	}
@@ -111,15 +121,316 @@ void main_window_t::loop() {
 	machine_runner->stop();
 }
 
-void main_window_t::create_window_hexview() {
-	static MemoryEditor mem_editor;
+// Shows the view's copy of memory, edits go to both.
+bool main_window_t::create_window_hexview(const machine_view_t &view) {
+	static MemoryEditor      mem_editor;
+	static machine_runner_t *hexview_machine_runner;
 	if (ImGui::Begin("Memory View"))
 	{
+		hexview_machine_runner = machine_runner;
+		mem_editor.WriteFn = [](ImU8 *data, size_t off, ImU8 d) {
+			data[off] = d;
+			hexview_machine_runner->with_machine([&](ibm5160_t *machine) {
+				machine->memory[off] = d;
+				machine->memory_written(off, 1);
+			});
+		};
+		mem_editor.DrawContents((void *)view.memory.data(), view.memory.size());
+		ImGui::End();
+		return true;
+	}
+	return false;
+}
+
+// Sorts the rows by the table's sort column, columns are in the order of the row fields.
+template<typename T, typename F>
+static void sort_table_rows(std::vector<T> &rows, ImGuiTableSortSpecs *specs, F key) {
+	if (!specs || !specs->SpecsCount) {
+		return;
+	}
+	int  column = specs->Specs[0].ColumnIndex;
+	bool ascending = specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+	std::stable_sort(rows.begin(), rows.end(), [&](const T &a, const T &b) {
+		return ascending ? key(a, column) < key(b, column) : key(b, column) < key(a, column);
+	});
+}
+
+void main_window_t::create_window_profiler() {
+	struct addr_row_t {
+		i8086_profiler_t::addr_entry_t e;
+		std::string                    insn;
+	};
+
+	static std::vector<addr_row_t>                     addr_rows;
+	static std::vector<i8086_profiler_t::op_entry_t> op_rows;
+	static int    sample_interval = 0;
+	static char   export_path[256] = "profile.txt";
+	static double last_refresh = 0;
+	static bool   sort_addrs = false;
+	static bool   sort_ops = false;
+
+	if (!ImGui::Begin("Profiler")) {
+		ImGui::End();
+		return;
+	}
+
+	static bool     enabled = false;
+	static uint64_t total_count = 0;
+	static uint64_t total_cycles = 0;
+	static bool     sampled = false;
+
+	bool start_stop = ImGui::Button(enabled ? "Stop" : "Start");
+	ImGui::SameLine();
+	bool reset = ImGui::Button("Reset");
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(80);
+	ImGui::InputInt("Sample every N cycles, 0 counts all", &sample_interval, 0);
+
+	ImGui::SetNextItemWidth(200);
+	ImGui::InputText("##export", export_path, sizeof(export_path));
+	ImGui::SameLine();
+	bool write_report = ImGui::Button("Export");
+
+	// Scanning the counts takes a while, so they are refreshed once a second.
+	bool refresh = ImGui::GetTime() - last_refresh >= 1.0;
+
+	if (start_stop || reset || write_report || refresh) {
 		machine_runner->with_machine([&](ibm5160_t *machine) {
-			mem_editor.DrawContents(machine->memory, MEMORY_SIZE);
+			i8086_profiler_t *profiler = ((i8086_t *)machine->cpu)->profiler;
+
+			if (start_stop) {
+				if (profiler->enabled) {
+					profiler->stop();
+				} else {
+					profiler->start(std::max(sample_interval, 0));
+				}
+			}
+			if (reset) {
+				profiler->reset();
+			}
+			if (write_report) {
+				profiler->write_report(export_path);
+			}
+
+			enabled      = profiler->enabled;
+			total_count  = profiler->get_total_count();
+			total_cycles = profiler->get_total_cycles();
+			sampled      = profiler->get_sample_interval() != 0;
+
+			if (refresh) {
+				last_refresh = ImGui::GetTime();
+
+				disasm_i8086_t disassembler;
+				disassembler.read = [&machine](address_space_t s, uint32_t addr, width_t w) { return machine->read(s, addr, w); };
+
+				addr_rows.clear();
+				for (const auto &e : profiler->top_addrs(500)) {
+					uint16_t ip = e.linear - 0x10 * e.cs;
+					const char *s = "";
+					disassembler.disassemble(e.cs, &ip, &s);
+					addr_rows.push_back({ e, s });
+				}
+				op_rows = profiler->top_ops(256 * PROFILER_FORM_COUNT);
+				sort_addrs = true;
+				sort_ops = true;
+			}
+		});
+	}
+
+	ImGui::Text("%llu %s, %llu cycles", (unsigned long long)total_count,
+		sampled ? "samples" : "instructions", (unsigned long long)total_cycles);
+
+	double total = total_cycles ? double(total_cycles) : 1.0;
+	const ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg
+		| ImGuiTableFlags_BordersInner | ImGuiTableFlags_Resizable;
+
+	if (ImGui::BeginTable("Hot spots", 5, flags, ImVec2(0, ImGui::GetContentRegionAvail().y * 0.6f))) {
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Address");
+		ImGui::TableSetupColumn("Count", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Cycles", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("%", ImGuiTableColumnFlags_NoSort);
+		ImGui::TableSetupColumn("Instruction", ImGuiTableColumnFlags_NoSort);
+		ImGui::TableHeadersRow();
+
+		ImGuiTableSortSpecs *specs = ImGui::TableGetSortSpecs();
+		if (specs && (specs->SpecsDirty || sort_addrs)) {
+			sort_table_rows(addr_rows, specs, [](const addr_row_t &r, int column) -> uint64_t {
+				return column == 0 ? r.e.linear : column == 1 ? r.e.count : r.e.cycles;
+			});
+			specs->SpecsDirty = false;
+			sort_addrs = false;
+		}
+
+		for (const auto &r : addr_rows) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%04x:%04x", r.e.cs, uint16_t(r.e.linear - 0x10 * r.e.cs));
+			ImGui::TableNextColumn();
+			ImGui::Text("%u", r.e.count);
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)r.e.cycles);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", 100.0 * r.e.cycles / total);
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(r.insn.c_str());
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::BeginTable("Opcodes", 5, flags)) {
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Opcode");
+		ImGui::TableSetupColumn("ModRM");
+		ImGui::TableSetupColumn("Count", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Cycles", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("%", ImGuiTableColumnFlags_NoSort);
+		ImGui::TableHeadersRow();
+
+		ImGuiTableSortSpecs *specs = ImGui::TableGetSortSpecs();
+		if (specs && (specs->SpecsDirty || sort_ops)) {
+			sort_table_rows(op_rows, specs, [](const i8086_profiler_t::op_entry_t &e, int column) -> uint64_t {
+				return column == 0 ? e.op : column == 1 ? e.form : column == 2 ? e.count : e.cycles;
 			});
+			specs->SpecsDirty = false;
+			sort_ops = false;
+		}
+
+		for (const auto &e : op_rows) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%02x", e.op);
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(i8086_profiler_t::form_name(e.form));
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)e.count);
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)e.cycles);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", 100.0 * e.cycles / total);
+		}
+		ImGui::EndTable();
+	}
+
+	ImGui::End();
+}
+
+void main_window_t::create_window_func_profiler() {
+	struct func_row_t {
+		std::string name;
+		uint64_t    calls;
+		uint64_t    self_cycles;
+		uint64_t    incl_cycles;
+	};
+
+	static std::vector<func_row_t> rows;
+	static char   export_path[256] = "callgrind.out";
+	static double last_refresh = 0;
+	static bool   sort_rows = false;
+
+	if (!ImGui::Begin("Function Profiler")) {
 		ImGui::End();
+		return;
+	}
+
+	static bool enabled = false;
+
+	bool start_stop = ImGui::Button(enabled ? "Stop" : "Start");
+	ImGui::SameLine();
+	bool reset = ImGui::Button("Reset");
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(200);
+	ImGui::InputText("##export", export_path, sizeof(export_path));
+	ImGui::SameLine();
+	bool write_callgrind = ImGui::Button("Export callgrind");
+
+	bool refresh = ImGui::GetTime() - last_refresh >= 1.0;
+
+	if (start_stop || reset || write_callgrind || refresh) {
+		machine_runner->with_machine([&](ibm5160_t *machine) {
+			i8086_func_profiler_t *func_profiler = ((i8086_t *)machine->cpu)->func_profiler;
+
+			if (start_stop) {
+				if (func_profiler->enabled) {
+					func_profiler->stop();
+				} else {
+					func_profiler->start();
+				}
+			}
+			if (reset) {
+				func_profiler->reset();
+			}
+			if (write_callgrind) {
+				func_profiler->write_callgrind(export_path);
+			}
+			enabled = func_profiler->enabled;
+
+			if (refresh) {
+				last_refresh = ImGui::GetTime();
+
+				rows.clear();
+				for (const auto &[linear, f] : func_profiler->get_profile().funcs) {
+					rows.push_back({ func_profiler->func_name(linear, f), f.calls, f.self_cycles, f.incl_cycles });
+				}
+				sort_rows = true;
+			}
+		});
+	}
+
+	uint64_t total_cycles = 0;
+	for (const auto &r : rows) {
+		total_cycles += r.self_cycles;
 	}
+	double total = total_cycles ? double(total_cycles) : 1.0;
+
+	const ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg
+		| ImGuiTableFlags_BordersInner | ImGuiTableFlags_Resizable;
+
+	if (ImGui::BeginTable("Functions", 6, flags)) {
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Function");
+		ImGui::TableSetupColumn("Calls", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Self", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Inclusive", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Self %", ImGuiTableColumnFlags_NoSort);
+		ImGui::TableSetupColumn("Incl %", ImGuiTableColumnFlags_NoSort);
+		ImGui::TableHeadersRow();
+
+		ImGuiTableSortSpecs *specs = ImGui::TableGetSortSpecs();
+		if (specs && specs->SpecsCount && (specs->SpecsDirty || sort_rows)) {
+			if (specs->Specs[0].ColumnIndex == 0) {
+				bool ascending = specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+				std::stable_sort(rows.begin(), rows.end(), [ascending](const func_row_t &a, const func_row_t &b) {
+					return ascending ? a.name < b.name : b.name < a.name;
+				});
+			} else {
+				sort_table_rows(rows, specs, [](const func_row_t &r, int column) -> uint64_t {
+					return column == 1 ? r.calls : column == 2 ? r.self_cycles : r.incl_cycles;
+				});
+			}
+			specs->SpecsDirty = false;
+			sort_rows = false;
+		}
+
+		for (const auto &r : rows) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(r.name.c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)r.calls);
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)r.self_cycles);
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)r.incl_cycles);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", 100.0 * r.self_cycles / total);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", 100.0 * r.incl_cycles / total);
+		}
+		ImGui::EndTable();
+	}
+
+	ImGui::End();
 }
 
 void main_window_t::glfw_render_frame() {
@@ -170,29 +481,27 @@ void main_window_t::create_window_framebuffer(texture_t &frame_texture, int &fra
 void main_window_t::capture_keyboard() {
 	ImGui::CaptureKeyboardFromApp(false);
 	ImGuiIO& io = ImGui::GetIO();
+
+	// Only changes are sent, one that didn't fit in the queue is sent again next frame.
+	static_assert(IM_ARRAYSIZE(io.KeysDown) == IM_ARRAYSIZE(keys_down));
 	for (int key_index = 0; key_index < IM_ARRAYSIZE(io.KeysDown); key_index++) {
-		if (ImGui::IsKeyDown(key_index)) {
-			machine_runner->set_key_down(key_index);
+		bool down = io.KeysDown[key_index];
+		if (down == keys_down[key_index]) {
+			continue;
 		}
-		if (ImGui::IsKeyReleased(key_index)) {
-			machine_runner->set_key_up(key_index);
+		if (down ? machine_runner->set_key_down(key_index) : machine_runner->set_key_up(key_index)) {
+			keys_down[key_index] = down;
 		}
 	}
 }
 
-void main_window_t::create_window_palette_state(byte dac_ram[768]) {
+void main_window_t::create_window_palette_state(const byte dac_ram[768]) {
 	if (ImGui::Begin("Palette")) {
 		texture_t palette_texture(16, 16);
 		byte *palette_image_data = palette_texture.data();
 		for (int c = 0; c != 256; ++c) {
-			byte r = dac_ram[3 * c + 0];
-			byte g = dac_ram[3 * c + 1];
-			byte b = dac_ram[3 * c + 2];
-
-			palette_image_data[4 * c + 0] = (r << 2) | (r >> 4);
-			palette_image_data[4 * c + 1] = (g << 2) | (g >> 4);
-			palette_image_data[4 * c + 2] = (b << 2) | (b >> 4);
-			palette_image_data[4 * c + 3] = 255;
+			uint32_t rgba = vga_dac_to_rgba(&dac_ram[3 * c]);
+			memcpy(&palette_image_data[4 * c], &rgba, 4);
 		}
 		palette_texture.apply();
 
@@ -202,163 +511,294 @@ void main_window_t::create_window_palette_state(byte dac_ram[768]) {
 	}
 }
 
-void main_window_t::create_window_debug(int frame_x, int frame_y, const uint16_t &mouse_btn) {
+void main_window_t::create_window_debug(const machine_view_t &view, int frame_x, int frame_y, const uint16_t &mouse_btn) {
 	if (ImGui::Begin("Debug")) {
 		ImGui::Text("Pointer X: %d", frame_x);
 		ImGui::Text("Pointer Y: %d", frame_y);
+		ImGui::Text("Input latency: %lld us", (long long)machine_runner->get_input_latency());
 		if (ImGui::BeginChild("Control")) {
-			machine_runner->with_machine([&](ibm5160_t *machine) {
-				if (ImGui::Button("Pause")) {
-					machine_runner->pause();
-				}
+			if (ImGui::Button("Pause")) {
+				machine_runner->pause();
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Resume")) {
+				machine_runner->resume();
+			}
+			if (machine_runner->is_paused()) {
 				ImGui::SameLine();
-				if (ImGui::Button("Resume")) {
-					machine_runner->resume();
+				if (ImGui::Button("Step over")) {
+					machine_runner->debug_run(1);
 				}
-				if (machine_runner->is_paused()) {
+			}
+			if (ImGui::Button("Save snapshot")) {
+				machine_runner->with_machine([](ibm5160_t *machine) {
+					machine->save_snapshot("chani.snap");
+				});
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Load snapshot")) {
+				machine_runner->with_machine([&](ibm5160_t *machine) {
+					if (machine->load_snapshot("chani.snap") && machine_runner->get_time_travel()) {
+						machine_runner->get_time_travel()->reset();
+					}
+				});
+			}
+			// While paused the runner doesn't hold the lock, and the view follows every change.
+			if (machine_runner->is_paused() && machine_runner->get_time_travel()) {
+				machine_runner->with_machine([&](ibm5160_t *) {
+					time_travel_t *time_travel = machine_runner->get_time_travel();
+					static char     watch_addr[6] = "";
+					static uint64_t write_position;
+					static int      write_found = -1;
+
+					if (ImGui::Button("Step back")) {
+						time_travel->step_back();
+					}
 					ImGui::SameLine();
-					if (ImGui::Button("Step over")) {
-						machine_runner->debug_run(1);
+					if (ImGui::Button("Present")) {
+						time_travel->seek(time_travel->get_history_end());
 					}
-				}
-				if (ImGui::BeginTable("Registers", 2,
-					ImGuiTableFlags_ScrollX | ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInner
-					| ImGuiTableBgTarget_CellBg | ImGuiTableFlags_SizingStretchSame | ImGuiTableFlags_Reorderable))
-				{
-					i8086_t* cpu = (i8086_t*)machine->cpu;
-
-					ImGui::TableNextRow(ImGuiTableRowFlags_Headers);
-					ImGui::TableNextColumn();
-					ImGui::Text("CPU Field");
-					ImGui::TableNextColumn();
-					ImGui::Text("Value");
-					ImGui::TableNextColumn();
-					ImGui::Text("AX");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->ax);
-					ImGui::TableNextColumn();
-					ImGui::Text("ES");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->es);
-					ImGui::TableNextColumn();
-					ImGui::Text("SP");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->sp);
-					ImGui::TableNextColumn();
-					ImGui::Text("IP");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->ip);
-					ImGui::TableNextColumn();
-					ImGui::Text("CX");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->cx);
-					ImGui::TableNextColumn();
-					ImGui::Text("CS");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->cs);
-					ImGui::TableNextColumn();
-					ImGui::Text("BP");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->bp);
-					ImGui::TableNextColumn();
-					ImGui::Text("OP");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->op);
-					ImGui::TableNextColumn();
-					ImGui::Text("DX");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->dx);
-					ImGui::TableNextColumn();
-					ImGui::Text("SS");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->ss);
-					ImGui::TableNextColumn();
-					ImGui::Text("DI");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->di);
-					ImGui::TableNextColumn();
-					ImGui::Text("BX");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->bx);
-					ImGui::TableNextColumn();
-					ImGui::Text("DS");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->ds);
-					ImGui::TableNextColumn();
-					ImGui::Text("SI");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04x", cpu->si);
-					ImGui::TableNextColumn();
-					ImGui::Text("OF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_of());
-					ImGui::TableNextColumn();
-					ImGui::Text("DF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_df());
-					ImGui::TableNextColumn();
-					ImGui::Text("IF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_if());
-					ImGui::TableNextColumn();
-					ImGui::Text("TF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_tf());
-					ImGui::TableNextColumn();
-					ImGui::Text("SF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_sf());
-					ImGui::TableNextColumn();
-					ImGui::Text("ZF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_zf());
-					ImGui::TableNextColumn();
-					ImGui::Text("AF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_af());
-					ImGui::TableNextColumn();
-					ImGui::Text("PF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_pf());
-					ImGui::TableNextColumn();
-					ImGui::Text("CF");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_cf());
-					ImGui::TableNextColumn();
-					ImGui::Text("Combined Flags");
-					ImGui::TableNextColumn();
-					ImGui::Text("%04X", cpu->get_log_flags());
-					ImGui::TableNextColumn();
-					ImGui::Text("Instruction count");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->get_instr_count());
-					ImGui::TableNextColumn();
-					ImGui::Text("OP");
-					ImGui::TableNextColumn();
-					ImGui::Text("%02X", cpu->op);
-					ImGui::TableNextColumn();
-					ImGui::Text("Is Prefix");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->is_prefix);
-					ImGui::TableNextColumn();
-					ImGui::Text("Int delay");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->int_delay);
-					ImGui::TableNextColumn();
-					ImGui::Text("Int nmi");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->int_nmi);
-					ImGui::TableNextColumn();
-					ImGui::Text("Int intr");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->int_intr);
-					ImGui::TableNextColumn();
-					ImGui::Text("Int Number");
-					ImGui::TableNextColumn();
-					ImGui::Text("%d", cpu->int_number);
-					ImGui::EndTable();
-				}
-			});
+					ImGui::Text("Position %llu of %llu, %zu checkpoints in %zu KiB",
+						(unsigned long long)time_travel->get_position(), (unsigned long long)time_travel->get_history_end(),
+						time_travel->get_checkpoint_count(), time_travel->get_bytes_used() / 1024);
+
+					ImGui::SetNextItemWidth(64);
+					ImGui::InputText("##watch", watch_addr, sizeof(watch_addr), ImGuiInputTextFlags_CharsHexadecimal);
+					ImGui::SameLine();
+					if (ImGui::Button("Go to last write")) {
+						write_found = time_travel->find_last_write(strtoul(watch_addr, nullptr, 16), write_position);
+						if (write_found) {
+							time_travel->seek(write_position);
+						}
+					}
+					if (write_found == 0) {
+						ImGui::SameLine();
+						ImGui::Text("Not written");
+					}
+				});
+			}
+			if (ImGui::CollapsingHeader("Breakpoints")) {
+				machine_runner->with_machine([&](ibm5160_t *machine) {
+					i8086_breakpoints_t *breakpoints = ((i8086_t *)machine->cpu)->breakpoints;
+					static char bp_addr[6] = "";
+					static char bp_condition[128] = "";
+					static bool bp_log = false;
+					static char wp_addr[6] = "";
+					static int  wp_len = 1;
+					static bool wp_read = false;
+					static bool wp_write = true;
+					static bool wp_io = false;
+
+					ImGui::SetNextItemWidth(64);
+					ImGui::InputText("##bp", bp_addr, sizeof(bp_addr), ImGuiInputTextFlags_CharsHexadecimal);
+					ImGui::SameLine();
+					ImGui::SetNextItemWidth(200);
+					ImGui::InputTextWithHint("##bpcond", "condition", bp_condition, sizeof(bp_condition));
+					ImGui::SameLine();
+					ImGui::Checkbox("Log", &bp_log);
+					ImGui::SameLine();
+					if (ImGui::Button("Add breakpoint")) {
+						if (breakpoints->add(strtoul(bp_addr, nullptr, 16), bp_condition, bp_log)) {
+							breakpoints->error.clear();
+						}
+					}
+					if (!breakpoints->error.empty()) {
+						ImGui::Text("%s", breakpoints->error.c_str());
+					}
+
+					ImGui::SetNextItemWidth(64);
+					ImGui::InputText("##wp", wp_addr, sizeof(wp_addr), ImGuiInputTextFlags_CharsHexadecimal);
+					ImGui::SameLine();
+					ImGui::SetNextItemWidth(64);
+					ImGui::InputInt("##wplen", &wp_len, 0);
+					ImGui::SameLine();
+					ImGui::Checkbox("R", &wp_read);
+					ImGui::SameLine();
+					ImGui::Checkbox("W", &wp_write);
+					ImGui::SameLine();
+					ImGui::Checkbox("Port", &wp_io);
+					ImGui::SameLine();
+					if (ImGui::Button("Add watch")) {
+						byte flags = (wp_read ? WATCH_READ : 0) | (wp_write ? WATCH_WRITE : 0) | (wp_io ? WATCH_IO : 0);
+						breakpoints->add_watch(strtoul(wp_addr, nullptr, 16), std::max(wp_len, 1), flags);
+					}
+
+					for (uint32_t addr : breakpoints->list()) {
+						ImGui::PushID(addr);
+						if (ImGui::SmallButton("x")) {
+							breakpoints->remove(addr);
+						}
+						ImGui::SameLine();
+						const auto *bp = breakpoints->get(addr);
+						ImGui::Text("%s at %05x%s%s, %llu hits, %llu matched", bp->log ? "Log" : "Break", addr,
+							bp->condition.empty() ? "" : " if ", bp->condition.get_text().c_str(),
+							(unsigned long long)bp->hits, (unsigned long long)bp->matches);
+						ImGui::PopID();
+					}
+
+					const auto &watches = breakpoints->get_watches();
+					for (size_t i = 0; i != watches.size(); ++i) {
+						const auto &w = watches[i];
+						ImGui::PushID(int(MEM_ADDR_SIZE + i));
+						bool removed = ImGui::SmallButton("x");
+						ImGui::SameLine();
+						ImGui::Text("Watch %s %05x+%u %s%s", (w.flags & WATCH_IO) ? "port" : "mem", w.addr, w.len,
+							(w.flags & WATCH_READ) ? "R" : "", (w.flags & WATCH_WRITE) ? "W" : "");
+						ImGui::PopID();
+						if (removed) {
+							breakpoints->remove_watch(i);
+							break;
+						}
+					}
+
+					if (breakpoints->break_count) {
+						const i8086_break_t &b = breakpoints->last_break;
+						if (!b.flags) {
+							ImGui::Text("Last stop: breakpoint at %04x:%04x", b.cs, b.ip);
+						} else {
+							ImGui::Text("Last stop: %s %s %05x value %02x by %04x:%04x",
+								(b.flags & WATCH_IO) ? "port" : "memory", (b.flags & WATCH_WRITE) ? "write" : "read",
+								b.addr, b.value, b.cs, b.ip);
+						}
+					}
+				});
+			}
+			if (ImGui::BeginTable("Registers", 2,
+				ImGuiTableFlags_ScrollX | ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInner
+				| ImGuiTableBgTarget_CellBg | ImGuiTableFlags_SizingStretchSame | ImGuiTableFlags_Reorderable))
+			{
+				ImGui::TableNextRow(ImGuiTableRowFlags_Headers);
+				ImGui::TableNextColumn();
+				ImGui::Text("CPU Field");
+				ImGui::TableNextColumn();
+				ImGui::Text("Value");
+				ImGui::TableNextColumn();
+				ImGui::Text("AX");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.ax);
+				ImGui::TableNextColumn();
+				ImGui::Text("ES");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.es);
+				ImGui::TableNextColumn();
+				ImGui::Text("SP");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.sp);
+				ImGui::TableNextColumn();
+				ImGui::Text("IP");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.ip);
+				ImGui::TableNextColumn();
+				ImGui::Text("CX");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.cx);
+				ImGui::TableNextColumn();
+				ImGui::Text("CS");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.cs);
+				ImGui::TableNextColumn();
+				ImGui::Text("BP");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.bp);
+				ImGui::TableNextColumn();
+				ImGui::Text("OP");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.op);
+				ImGui::TableNextColumn();
+				ImGui::Text("DX");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.dx);
+				ImGui::TableNextColumn();
+				ImGui::Text("SS");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.ss);
+				ImGui::TableNextColumn();
+				ImGui::Text("DI");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.di);
+				ImGui::TableNextColumn();
+				ImGui::Text("BX");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.bx);
+				ImGui::TableNextColumn();
+				ImGui::Text("DS");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.ds);
+				ImGui::TableNextColumn();
+				ImGui::Text("SI");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04x", view.cpu.si);
+				ImGui::TableNextColumn();
+				ImGui::Text("OF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_OF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("DF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_DF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("IF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_IF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("TF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_TF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("SF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_SF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("ZF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_ZF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("AF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_AF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("PF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_PF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("CF");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", (view.cpu.flags & i8086_t::FLAG_CF) != 0);
+				ImGui::TableNextColumn();
+				ImGui::Text("Combined Flags");
+				ImGui::TableNextColumn();
+				ImGui::Text("%04X", view.cpu.flags & (i8086_t::FLAG_CF | i8086_t::FLAG_PF | i8086_t::FLAG_ZF | i8086_t::FLAG_SF
+					| i8086_t::FLAG_TF | i8086_t::FLAG_IF | i8086_t::FLAG_DF | i8086_t::FLAG_OF));
+				ImGui::TableNextColumn();
+				ImGui::Text("Instruction count");
+				ImGui::TableNextColumn();
+				ImGui::Text("%llu", (unsigned long long)view.cpu.instr_count);
+				ImGui::TableNextColumn();
+				ImGui::Text("OP");
+				ImGui::TableNextColumn();
+				ImGui::Text("%02X", view.cpu.op);
+				ImGui::TableNextColumn();
+				ImGui::Text("Is Prefix");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", view.cpu.is_prefix);
+				ImGui::TableNextColumn();
+				ImGui::Text("Int delay");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", view.cpu.int_delay);
+				ImGui::TableNextColumn();
+				ImGui::Text("Int nmi");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", view.cpu.int_nmi);
+				ImGui::TableNextColumn();
+				ImGui::Text("Int intr");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", view.cpu.int_intr);
+				ImGui::TableNextColumn();
+				ImGui::Text("Int Number");
+				ImGui::TableNextColumn();
+				ImGui::Text("%d", view.cpu.int_number);
+				ImGui::EndTable();
+			}
 			ImGui::EndChild();
 		}
 		ImGui::End();
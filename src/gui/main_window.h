@@ -6,17 +6,21 @@
 struct GLFWwindow;
 
 class machine_runner_t;
+struct machine_view_t;
 
 class main_window_t {
 	GLFWwindow *window;
 	machine_runner_t *machine_runner;
+	bool keys_down[512] = {};   // As last sent to the runner, by ImGui key index
 private:
 	void glfw_render_frame();
 	void capture_keyboard();
 	void create_window_framebuffer(texture_t &frame_texture, int &frame_x, int  &frame_y, uint16_t &mouse_btn);
-	void create_window_palette_state(byte dac_ram[768]);
-	void create_window_debug(int frame_x, int frame_y, const uint16_t& mouse_btn);
-	void create_window_hexview();
+	void create_window_palette_state(const byte dac_ram[768]);
+	void create_window_debug(const machine_view_t &view, int frame_x, int frame_y, const uint16_t& mouse_btn);
+	bool create_window_hexview(const machine_view_t &view);
+	void create_window_profiler();
+	void create_window_func_profiler();
 
 public:
 	main_window_t(machine_runner_t *machine_runner) :
@@ -0,0 +1,205 @@
+#include "dos/dos.h"
+#include "emu/i8086.h"
+#include "emu/i8086_func_profiler.h"
+#include "emu/i8086_hle.h"
+#include "emu/i8086_jit.h"
+#include "emu/i8086_profiler.h"
+#include "emu/i8086_trace.h"
+#include "emu/ibm5160.h"
+#include "emu/input_journal.h"
+#include "emu/vga.h"
+#include "gui/machine_runner.h"
+#include "support/file_reader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+/*
+ * Runs the machine without a window, as fast as it goes, until one of
+ * the limits is reached or the program exits. Limits are checked at
+ * slice ends, so runs stop at most 1 ms of emulated time past them.
+ */
+
+struct headless_stats_t {
+	i8086_t          *cpu = nullptr;
+	i8086_hle_t      *hle = nullptr;
+	machine_runner_t *machine_runner = nullptr;
+	uint64_t          frames = 0;
+	uint64_t          start_cycles = 0;
+	uint64_t          start_instr_count = 0;
+	const char       *profile_path = nullptr;
+	const char       *callgrind_path = nullptr;
+
+	std::chrono::time_point<std::chrono::steady_clock> start;
+};
+
+static headless_stats_t stats;
+
+// Also runs from exit(), which DOS calls when the program terminates.
+static void print_stats() {
+	static bool printed = false;
+	if (printed || !stats.cpu) {
+		return;
+	}
+	printed = true;
+
+	stats.cpu->trace->close();
+	if (stats.profile_path) {
+		stats.cpu->profiler->write_report(stats.profile_path);
+	}
+	if (stats.callgrind_path) {
+		stats.cpu->func_profiler->write_callgrind(stats.callgrind_path);
+	}
+
+	for (const auto &hook : stats.hle->get_hooks()) {
+		if (hook.calls) {
+			printf("headless: hle %s: %llu calls, %llu verified, %llu mismatches\n", hook.name.c_str(),
+				(unsigned long long)hook.calls, (unsigned long long)hook.verified, (unsigned long long)hook.mismatches);
+		}
+	}
+
+	double   wall   = std::chrono::duration<double>(std::chrono::steady_clock::now() - stats.start).count();
+	uint64_t cycles = stats.cpu->get_cycles() - stats.start_cycles;
+	uint64_t instrs = stats.cpu->get_instr_count() - stats.start_instr_count;
+	double   emulated = stats.machine_runner->get_emulated_time() / 1e6;
+
+	printf("headless: %llu instructions, %llu cycles, %llu frames\n",
+		(unsigned long long)instrs, (unsigned long long)cycles, (unsigned long long)stats.frames);
+	printf("headless: %.3f s emulated in %.3f s, %.2fx real time, %.2f MIPS\n",
+		emulated, wall, wall > 0 ? emulated / wall : 0.0, wall > 0 ? instrs / wall / 1e6 : 0.0);
+}
+
+int main(int argc, char **argv) {
+	bool        use_jit = false;
+	bool        dump_frames = false;
+	const char *trace_path = nullptr;
+	const char *snapshot_path = nullptr;
+	const char *replay_path = nullptr;
+	const char *profile_path = nullptr;
+	uint32_t    profile_interval = 0;
+	hle_mode_t  hle_mode = HLE_MODE_ON;
+	const char *callgrind_path = nullptr;
+	uint64_t    max_cycles = 0;
+	uint64_t    max_frames = 0;
+	uint64_t    max_instrs = 0;
+
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "--jit")) {
+			use_jit = true;
+		} else if (!strcmp(argv[arg], "--dump-frames")) {
+			dump_frames = true;
+		} else if (!strcmp(argv[arg], "--cycles") && arg + 1 < argc) {
+			max_cycles = strtoull(argv[++arg], nullptr, 0);
+		} else if (!strcmp(argv[arg], "--frames") && arg + 1 < argc) {
+			max_frames = strtoull(argv[++arg], nullptr, 0);
+		} else if (!strcmp(argv[arg], "--instructions") && arg + 1 < argc) {
+			max_instrs = strtoull(argv[++arg], nullptr, 0);
+		} else if (!strcmp(argv[arg], "--snapshot") && arg + 1 < argc) {
+			snapshot_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--replay") && arg + 1 < argc) {
+			replay_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--trace") && arg + 1 < argc) {
+			trace_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--profile") && arg + 1 < argc) {
+			profile_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--profile-interval") && arg + 1 < argc) {
+			profile_interval = strtoul(argv[++arg], nullptr, 0);
+		} else if (!strcmp(argv[arg], "--callgrind") && arg + 1 < argc) {
+			callgrind_path = argv[++arg];
+		} else if (!strcmp(argv[arg], "--hle") && arg + 1 < argc) {
+			const char *mode = argv[++arg];
+			if (!strcmp(mode, "off")) {
+				hle_mode = HLE_MODE_OFF;
+			} else if (!strcmp(mode, "verify")) {
+				hle_mode = HLE_MODE_VERIFY;
+			} else {
+				hle_mode = HLE_MODE_ON;
+			}
+		} else {
+			break;
+		}
+	}
+
+	if (arg >= argc) {
+		printf("Usage: %s [--jit] [--cycles N] [--frames N] [--instructions N] [--snapshot in.snap]\n", argv[0]);
+		printf("       %*s [--replay in.input] [--trace out.trace] [--dump-frames]\n", int(strlen(argv[0])), "");
+		printf("       %*s [--profile out.txt] [--profile-interval cycles]\n", int(strlen(argv[0])), "");
+		printf("       %*s [--callgrind callgrind.out] [--hle on|off|verify] file\n", int(strlen(argv[0])), "");
+		exit(1);
+	}
+
+	auto machine = std::make_unique<ibm5160_t>();
+	i8086_t *cpu = (i8086_t *)machine->cpu;
+	cpu->jit->enabled = use_jit;
+	machine->hle->mode = hle_mode;
+
+	const char *filename = argv[arg];
+	file_reader_t exe(filename);
+	if (exe.eof()) {
+		printf("Unable to open file '%s'\n", filename);
+		return -1;
+	}
+	machine->dos->exec(exe);
+
+	if (snapshot_path && !machine->load_snapshot(snapshot_path)) {
+		return -1;
+	}
+
+	if (trace_path && !cpu->trace->open(trace_path)) {
+		return -1;
+	}
+
+	if (profile_path) {
+		cpu->profiler->start(profile_interval);
+	}
+	if (callgrind_path) {
+		cpu->func_profiler->start();
+	}
+
+	input_journal_t *input_journal = nullptr;
+	if (replay_path) {
+		input_journal = new input_journal_t(&*machine);
+		if (!input_journal->open_replay(replay_path)) {
+			return -1;
+		}
+	}
+
+	// The runner thread isn't started, slices are run from here.
+	machine_runner_t *machine_runner = new machine_runner_t(&*machine, nullptr, input_journal);
+	machine_runner->set_throttle(false);
+
+	stats.cpu               = cpu;
+	stats.hle               = machine->hle;
+	stats.machine_runner    = machine_runner;
+	stats.profile_path      = profile_path;
+	stats.callgrind_path    = callgrind_path;
+	stats.start_cycles      = cpu->get_cycles();
+	stats.start_instr_count = cpu->get_instr_count();
+	stats.start             = std::chrono::steady_clock::now();
+	atexit(print_stats);
+
+	for (;;) {
+		machine_runner->run_until_next_event();
+
+		if (machine->vga->frame_ready()) {
+			stats.frames++;
+			if (dump_frames) {
+				machine->vga->write_ppm(0xA0000, 320, 200);
+			}
+		}
+
+		if ((max_cycles && cpu->get_cycles() - stats.start_cycles >= max_cycles)
+		 || (max_frames && stats.frames >= max_frames)
+		 || (max_instrs && cpu->get_instr_count() - stats.start_instr_count >= max_instrs))
+		{
+			break;
+		}
+	}
+
+	print_stats();
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include "support/mapped_file.h"
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file_t::~mapped_file_t() {
+	close();
+}
+
+bool mapped_file_t::open(const char *path) {
+	close();
+
+#ifndef _WIN32
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	len = st.st_size;
+
+	if (len) {
+		void *m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m != MAP_FAILED) {
+			madvise(m, len, MADV_SEQUENTIAL);
+			p = (const char *)m;
+			mapped = true;
+		}
+	}
+	::close(fd);
+
+	if (mapped || !len) {
+		return true;
+	}
+#endif
+
+	// No mmap, read the whole file instead.
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = new char[len ? len : 1];
+	if (fread(buf, 1, len, f) != len) {
+		delete[] buf;
+		fclose(f);
+		len = 0;
+		return false;
+	}
+	fclose(f);
+
+	p = buf;
+	return true;
+}
+
+void mapped_file_t::close() {
+#ifndef _WIN32
+	if (mapped) {
+		munmap((void *)p, len);
+	} else
+#endif
+	{
+		delete[] p;
+	}
+
+	p = nullptr;
+	len = 0;
+	mapped = false;
+}
@@ -0,0 +1,31 @@
+#ifndef SUPPORT_MAPPED_FILE_H
+#define SUPPORT_MAPPED_FILE_H
+
+#include <cstddef>
+
+// A whole file mapped read-only into memory.
+class mapped_file_t {
+	const char *p = nullptr;
+	size_t      len = 0;
+	bool        mapped = false;   // Otherwise read into a heap buffer
+
+public:
+	mapped_file_t() {}
+	~mapped_file_t();
+
+	mapped_file_t(const mapped_file_t &) = delete;
+	mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+	bool open(const char *path);
+	void close();
+
+	const char *data() const {
+		return p;
+	}
+
+	size_t size() const {
+		return len;
+	}
+};
+
+#endif
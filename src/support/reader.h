@@ -25,7 +25,7 @@ public:
 		return ::readbe16(b);
 	}
 
-	uint16_t readle32() {
+	uint32_t readle32() {
 		byte b[4];
 		read(b, 4);
 		return ::readle32(b);
@@ -0,0 +1,46 @@
+#ifndef SUPPORT_SPSC_QUEUE_H
+#define SUPPORT_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * A fixed size ring between one producer thread and one consumer thread.
+ * Both sides finish in a bounded number of steps: push() fails when the
+ * ring is full instead of waiting. Each index is only written by its own
+ * side and lives on its own cache line.
+ */
+template<typename T, size_t N>
+class spsc_queue_t {
+	static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+	T buffer[N];
+
+	alignas(64) std::atomic<size_t> head { 0 };   // Next to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tail { 0 };   // Next to push, written by the producer
+
+public:
+	// Producer side, false if the queue is full.
+	bool push(const T &v) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == N) {
+			return false;
+		}
+		buffer[t % N] = v;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false if the queue is empty.
+	bool pop(T &v) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		v = buffer[h % N];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SUPPORT_TRIPLE_BUFFER_H
+#define SUPPORT_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+/*
+ * Hands values from one writer thread to one reader thread without
+ * locks. The writer fills its buffer and publishes it, the reader picks
+ * up the latest published one. Neither ever waits for the other, and a
+ * value is never torn: the third buffer is swapped in and out between
+ * them through a single atomic index.
+ */
+template<typename T>
+class triple_buffer_t {
+	enum {
+		INDEX_MASK = 0b011,
+		FRESH      = 0b100,   // Published since the reader last took one
+	};
+
+	T buffers[3];
+
+	std::atomic<int> shared { 1 };
+	int              back  = 0;   // Owned by the writer
+	int              front = 2;   // Owned by the reader
+
+public:
+	// Writer side: fill every field, the buffer holds a value from two publishes ago.
+	T &write_buffer() { return buffers[back]; }
+
+	void publish() {
+		back = shared.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// Reader side: returns true if a newer value was taken.
+	bool update() {
+		if (!(shared.load(std::memory_order_relaxed) & FRESH)) {
+			return false;
+		}
+		front = shared.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	const T &read_buffer() { return buffers[front]; }
+};
+
+#endif
@@ -20,7 +20,7 @@ uint16_t readbe16(byte *p) {
 }
 
 inline
-uint16_t readle32(byte *p) {
+uint32_t readle32(byte *p) {
 	return (uint32_t(p[0]) <<  0u)
 	     + (uint32_t(p[1]) <<  8u)
 	     + (uint32_t(p[2]) << 16u)
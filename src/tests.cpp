@@ -0,0 +1,419 @@
+#include "emu/i8086.h"
+#include "emu/i8086_breakpoints.h"
+#include "emu/i8086_func_profiler.h"
+#include "emu/i8086_jit.h"
+#include "emu/i8086_profiler.h"
+#include "emu/ibm5160.h"
+#include "emu/scheduler.h"
+#include "emu/snapshot.h"
+#include "emu/time_travel.h"
+#include "emu/trace_diff.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+/*
+ * Checks run by ctest. Each test prints what went wrong and returns
+ * false, files they need are written to the working directory.
+ */
+
+// Writes text to path and reads its first record back.
+static bool read_log_line(const char *path, const char *text, trace_record_t &r) {
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		printf("unable to write '%s'\n", path);
+		return false;
+	}
+	fputs(text, f);
+	fclose(f);
+
+	trace_log_reader_t reader;
+	if (!reader.open(path) || !reader.next(r)) {
+		printf("no record in '%s'\n", text);
+		return false;
+	}
+	return true;
+}
+
+// DOSBox lines leave out DF and TF, they only differ where a line has them.
+static bool test_trace_diff_missing_flags() {
+	static const char *without_df =
+		"1000:0105  stosb                                                        "
+		"EAX:00000000 EBX:00000000 ECX:00000000 EDX:00000000 ESI:00000000 EDI:00000000 "
+		"EBP:00000000 ESP:0000FFFE DS:1000 ES:1000 FS:0000 GS:0000 SS:1000 "
+		"CF:0 ZF:0 SF:0 OF:0 AF:0 PF:0 IF:1\n";
+	static const char *with_df =
+		"1000:0105  stosb                                                        "
+		"EAX:00000000 EBX:00000000 ECX:00000000 EDX:00000000 ESI:00000000 EDI:00000000 "
+		"EBP:00000000 ESP:0000FFFE DS:1000 ES:1000 FS:0000 GS:0000 SS:1000 "
+		"CF:0 ZF:0 SF:0 OF:0 AF:0 PF:0 IF:1 DF:0\n";
+
+	trace_record_t own = {};
+	own.field[TRACE_CS]    = 0x1000;
+	own.field[TRACE_IP]    = 0x0105;
+	own.field[TRACE_DS]    = 0x1000;
+	own.field[TRACE_ES]    = 0x1000;
+	own.field[TRACE_SS]    = 0x1000;
+	own.field[TRACE_SP]    = 0xfffe;
+	own.field[TRACE_FLAGS] = 0xf002 | i8086_t::FLAG_IF | i8086_t::FLAG_DF;
+
+	trace_record_t ref;
+	if (!read_log_line("chani-tests.log", without_df, ref)) {
+		return false;
+	}
+	if (uint32_t fields = trace_diff_t::differing_fields(ref, own)) {
+		printf("after STD, a line without DF differs in fields %04X\n", fields);
+		return false;
+	}
+
+	if (!read_log_line("chani-tests.log", with_df, ref)) {
+		return false;
+	}
+	if (trace_diff_t::differing_fields(ref, own) != (1u << TRACE_FLAGS)) {
+		printf("after STD, a line with DF:0 doesn't differ in FLAGS\n");
+		return false;
+	}
+
+	own.field[TRACE_FLAGS] &= ~i8086_t::FLAG_DF;
+	if (uint32_t fields = trace_diff_t::differing_fields(ref, own)) {
+		printf("a line with DF:0 differs in fields %04X\n", fields);
+		return false;
+	}
+	return true;
+}
+
+// A snapshot whose state ends in the middle of the devices leaves the machine as it was.
+static bool test_snapshot_restore_failure() {
+	ibm5160_t *machine = new ibm5160_t;
+	i8086_t   *cpu = (i8086_t *)machine->cpu;
+
+	snapshot_t *s = machine->take_snapshot();
+	s->state.resize(s->state.size() / 2);
+
+	cpu->ax = 0x1234;
+	cpu->cs = 0x2000;
+
+	std::vector<byte> before;
+	snapshot_writer_t w(before);
+	machine->save_state(w);
+
+	bool restored = machine->restore_snapshot(s);
+
+	std::vector<byte> after;
+	snapshot_writer_t w2(after);
+	machine->save_state(w2);
+
+	bool ok = true;
+	if (restored) {
+		printf("a truncated snapshot was restored\n");
+		ok = false;
+	} else if (before != after || cpu->ax != 0x1234 || cpu->cs != 0x2000) {
+		printf("a failed restore changed the machine\n");
+		ok = false;
+	}
+
+	delete s;
+	delete machine;
+	return ok;
+}
+
+// A machine running "inc ax; inc bx; jmp" at 0000:0500, where the CPU doesn't note the last guest cs:ip.
+static ibm5160_t *make_loop_machine() {
+	static const byte loop[] = { 0x40, 0x43, 0xeb, 0xfc };
+
+	ibm5160_t *machine = new ibm5160_t;
+	i8086_t   *cpu = (i8086_t *)machine->cpu;
+	memcpy(&machine->memory[0x500], loop, sizeof(loop));
+	machine->memory_written(0x500, sizeof(loop));
+	cpu->cs = 0x0000;
+	cpu->ip = 0x0500;
+	return machine;
+}
+
+static std::vector<byte> machine_state(ibm5160_t *machine) {
+	std::vector<byte> state;
+	snapshot_writer_t w(state);
+	machine->save_state(w);
+	return state;
+}
+
+// Logging the state is all a log breakpoint does, snapshots don't see it.
+static bool test_log_breakpoint_state() {
+	ibm5160_t *plain = make_loop_machine();
+	ibm5160_t *logged = make_loop_machine();
+	((i8086_t *)logged->cpu)->breakpoints->add(0x500, "hits == 1", true);
+
+	plain->cpu->run_cycles(100);
+	logged->cpu->run_cycles(100);
+
+	bool ok = machine_state(plain) == machine_state(logged);
+	if (!ok) {
+		printf("a log breakpoint changed the machine state\n");
+	}
+
+	delete logged;
+	delete plain;
+	return ok;
+}
+
+// After seeking back, the breakpoint stopped at stops the CPU again.
+static bool test_time_travel_breakpoint_after_seek() {
+	ibm5160_t     *machine = make_loop_machine();
+	i8086_t       *cpu = (i8086_t *)machine->cpu;
+	time_travel_t *time_travel = new time_travel_t(machine);
+	cpu->breakpoints->add(0x501);
+
+	time_travel->run_slice();
+	uint64_t hit = time_travel->get_position();
+	bool     ok = cpu->breakpoints->stop && cpu->ip == 0x501;
+
+	cpu->breakpoints->stop = false;
+	time_travel->seek(0);
+	time_travel->run_slice();
+	ok = ok && cpu->breakpoints->stop && time_travel->get_position() == hit;
+	if (!ok) {
+		printf("the breakpoint at 0000:0501 didn't stop at position %llu again\n", (unsigned long long)hit);
+	}
+
+	delete time_travel;
+	delete machine;
+	return ok;
+}
+
+// The io workload from chani-bench, storing what it reads at 2000:0000. PIT counter 0 is
+// started with a count of 0x100, its interrupt returns right away from 0000:0600.
+static ibm5160_t *make_io_machine(bool use_jit) {
+	static const byte io[] = {
+		0xb0, 0x34,                     // 0100: mov al,0x34
+		0xe6, 0x43,                     // 0102: out 0x43,al
+		0x30, 0xc0,                     // 0104: xor al,al
+		0xe6, 0x40,                     // 0106: out 0x40,al
+		0xb0, 0x01,                     // 0108: mov al,0x01
+		0xe6, 0x40,                     // 010a: out 0x40,al
+		0x31, 0xff,                     // 010c: xor di,di
+		0xba, 0xc8, 0x03,               // 010e: mov dx,0x3c8
+		0x89, 0xf8,                     // 0111: mov ax,di
+		0xee,                           // 0113: out dx,al
+		0x42,                           // 0114: inc dx
+		0xee,                           // 0115: out dx,al
+		0xee,                           // 0116: out dx,al
+		0xee,                           // 0117: out dx,al
+		0xe4, 0x40,                     // 0118: in al,0x40
+		0xaa,                           // 011a: stosb
+		0xba, 0xc7, 0x03,               // 011b: mov dx,0x3c7
+		0xee,                           // 011e: out dx,al
+		0xba, 0xc9, 0x03,               // 011f: mov dx,0x3c9
+		0xec,                           // 0122: in al,dx
+		0xaa,                           // 0123: stosb
+		0xeb, 0xe8,                     // 0124: jmp 0x10e
+	};
+	static const byte vector_8[] = { 0x00, 0x06, 0x00, 0x00 };
+
+	ibm5160_t *machine = new ibm5160_t;
+	i8086_t   *cpu = (i8086_t *)machine->cpu;
+	cpu->jit->enabled = use_jit;
+	memcpy(&machine->memory[0x10100], io, sizeof(io));
+	machine->memory_written(0x10100, sizeof(io));
+	memcpy(&machine->memory[0x20], vector_8, sizeof(vector_8));
+	machine->memory[0x600] = 0xcf;  // iret
+	machine->memory_written(0x600, 1);
+	cpu->cs = 0x1000;
+	cpu->ip = 0x0100;
+	cpu->ds = 0x2000;
+	cpu->es = 0x2000;
+	cpu->ss = 0x3000;
+	cpu->sp = 0xfffe;
+	return machine;
+}
+
+// Devices synced to now, without the CPU: it only notes the last guest cs:ip when interpreting.
+static std::vector<byte> device_state(ibm5160_t *machine) {
+	machine->scheduler->sync_all();
+
+	std::vector<byte> state;
+	snapshot_writer_t w(state);
+	for (const auto &d : machine->devices) {
+		if (d.device != machine->cpu) {
+			d.device->save_state(w);
+		}
+	}
+	return state;
+}
+
+// Translated code reads the ports and takes the interrupts they raise when the interpreter does.
+static bool test_jit_io_matches_interpreter() {
+	ibm5160_t *interpreted = make_io_machine(false);
+	ibm5160_t *translated = make_io_machine(true);
+	i8086_t   *interpreter_cpu = (i8086_t *)interpreted->cpu;
+	i8086_t   *jit_cpu = (i8086_t *)translated->cpu;
+
+	interpreter_cpu->run_cycles(20000);
+	jit_cpu->run_cycles(20000);
+
+	// Blocks stop the JIT later, the interpreter catches up.
+	while (interpreter_cpu->get_instr_count() < jit_cpu->get_instr_count()) {
+		interpreter_cpu->step();
+	}
+	while (jit_cpu->get_instr_count() < interpreter_cpu->get_instr_count()) {
+		jit_cpu->step();
+	}
+
+	bool ok = true;
+	if (interpreter_cpu->get_clock_cycles() != jit_cpu->get_clock_cycles()) {
+		printf("after %llu instructions, the clock is at %llu interpreted and %llu translated\n",
+			(unsigned long long)jit_cpu->get_instr_count(),
+			(unsigned long long)interpreter_cpu->get_clock_cycles(), (unsigned long long)jit_cpu->get_clock_cycles());
+		ok = false;
+	} else if (memcmp(&interpreted->memory[0x20000], &translated->memory[0x20000], 0x10000)) {
+		printf("translated code read other values from the ports\n");
+		ok = false;
+	} else if (memcmp(&interpreted->memory[0x30000], &translated->memory[0x30000], 0x10000)) {
+		printf("translated code took the timer interrupt elsewhere\n");
+		ok = false;
+	} else if (device_state(interpreted) != device_state(translated)) {
+		printf("translated code left the devices in another state\n");
+		ok = false;
+	}
+
+	delete translated;
+	delete interpreted;
+	return ok;
+}
+
+// Cycles per address, as a share of the total.
+static std::vector<double> profile_shares(i8086_profiler_t *profiler, uint32_t first, uint32_t count) {
+	std::vector<double> shares(count);
+	for (const auto &e : profiler->top_addrs(SIZE_MAX)) {
+		if (e.linear >= first && e.linear < first + count) {
+			shares[e.linear - first] = double(e.cycles) / profiler->get_total_cycles();
+		}
+	}
+	return shares;
+}
+
+// A REP string longer than the sample interval gets the samples it spans, as in an exact profile.
+static bool test_profiler_sampled_rep() {
+	static const byte rep_loop[] = {
+		0xb9, 0x00, 0x01,               // 0500: mov cx,0x100
+		0xf3, 0xa5,                     // 0503: rep movsw
+		0x40,                           // 0505: inc ax
+		0x40,                           // 0506: inc ax
+		0x40,                           // 0507: inc ax
+		0x40,                           // 0508: inc ax
+		0xeb, 0xf5,                     // 0509: jmp 0x500
+	};
+
+	std::vector<double> shares[2];
+	for (int sampled = 0; sampled != 2; ++sampled) {
+		ibm5160_t *machine = new ibm5160_t;
+		i8086_t   *cpu = (i8086_t *)machine->cpu;
+		memcpy(&machine->memory[0x500], rep_loop, sizeof(rep_loop));
+		machine->memory_written(0x500, sizeof(rep_loop));
+		cpu->cs = 0x0000;
+		cpu->ip = 0x0500;
+		cpu->ds = 0x2000;
+		cpu->es = 0x3000;
+
+		cpu->profiler->start(sampled ? 100 : 0);
+		cpu->run_cycles(1000000);
+		shares[sampled] = profile_shares(cpu->profiler, 0x500, sizeof(rep_loop));
+		delete machine;
+	}
+
+	for (uint32_t i = 0; i != sizeof(rep_loop); ++i) {
+		if (fabs(shares[0][i] - shares[1][i]) > 0.01) {
+			printf("0000:%04x has %.2f%% of the cycles exactly and %.2f%% sampled\n",
+				0x500 + i, 100 * shares[0][i], 100 * shares[1][i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Translated code bills cycles to the function they ran in, as the interpreter does.
+static bool test_jit_func_profile_matches_interpreter() {
+	static const byte caller[] = {
+		0x40,                           // 0100: inc ax
+		0x40,                           // 0101: inc ax
+		0x05, 0x34, 0x12,               // 0102: add ax,0x1234
+		0xe8, 0xf8, 0x00,               // 0105: call 0x200
+		0x43,                           // 0108: inc bx
+		0x43,                           // 0109: inc bx
+		0xeb, 0xf4,                     // 010a: jmp 0x100
+	};
+	static const byte callee[] = {
+		0x41,                           // 0200: inc cx
+		0xc3,                           // 0201: ret
+	};
+
+	i8086_func_profiler_t::profile_t profiles[2];
+	for (int use_jit = 0; use_jit != 2; ++use_jit) {
+		ibm5160_t *machine = new ibm5160_t;
+		i8086_t   *cpu = (i8086_t *)machine->cpu;
+		cpu->jit->enabled = use_jit;
+		memcpy(&machine->memory[0x10100], caller, sizeof(caller));
+		memcpy(&machine->memory[0x10200], callee, sizeof(callee));
+		machine->memory_written(0x10100, 0x200);
+		cpu->cs = 0x1000;
+		cpu->ip = 0x0100;
+		cpu->ss = 0x3000;
+		cpu->sp = 0xfffe;
+
+		// Both stop at the top of the loop after the same number of calls.
+		cpu->func_profiler->start();
+		cpu->run_cycles(400000);
+		while (cpu->ip != 0x100) {
+			cpu->step();
+		}
+		profiles[use_jit] = cpu->func_profiler->get_profile();
+		delete machine;
+	}
+
+	if (profiles[0].funcs.size() != profiles[1].funcs.size()) {
+		printf("%zu functions interpreted and %zu translated\n", profiles[0].funcs.size(), profiles[1].funcs.size());
+		return false;
+	}
+	for (const auto &f : profiles[0].funcs) {
+		auto it = profiles[1].funcs.find(f.first);
+		if (it == profiles[1].funcs.end() || it->second.calls != f.second.calls
+		    || it->second.self_cycles != f.second.self_cycles || it->second.incl_cycles != f.second.incl_cycles) {
+			printf("%05x has other calls or cycles translated\n", f.first);
+			return false;
+		}
+	}
+	return true;
+}
+
+static const struct {
+	const char *name;
+	bool      (*run)();
+} tests[] = {
+	{ "trace_diff_missing_flags",             test_trace_diff_missing_flags },
+	{ "snapshot_restore_failure",             test_snapshot_restore_failure },
+	{ "log_breakpoint_state",                 test_log_breakpoint_state },
+	{ "time_travel_breakpoint_after_seek",    test_time_travel_breakpoint_after_seek },
+	{ "jit_io_matches_interpreter",           test_jit_io_matches_interpreter },
+	{ "profiler_sampled_rep",                 test_profiler_sampled_rep },
+	{ "jit_func_profile_matches_interpreter", test_jit_func_profile_matches_interpreter },
+};
+
+int main(int argc, char **argv) {
+	int failed = 0;
+	for (const auto &t : tests) {
+		bool selected = argc == 1;
+		for (int i = 1; i < argc; ++i) {
+			selected |= !strcmp(argv[i], t.name);
+		}
+		if (!selected) {
+			continue;
+		}
+
+		bool ok = t.run();
+		printf("%-4s %s\n", ok ? "ok" : "FAIL", t.name);
+		fflush(stdout);
+		failed += !ok;
+	}
+	return failed ? 1 : 0;
+}